@@ -8,3 +8,28 @@ void Adapter::setSpecificRequest(Event (*specificRequestFunc)(Event timeEvent))
 Event Adapter::request(Event timeEvent) {
     return specificRequestFunc(timeEvent);
 }
+
+void Adapter::startSampling(const Event& timeEvent, unsigned long now) {
+    (void)now;
+    timeEvent_ = timeEvent;
+    result_ = Event();
+}
+
+long Adapter::pollSampling(unsigned long now) {
+    (void)now;
+    result_ = request(timeEvent_);
+    return SAMPLING_DONE;
+}
+
+Event Adapter::collectSampling() {
+    return result_;
+}
+
+Event Adapter::sampleBlocking(const Event& timeEvent) {
+    startSampling(timeEvent, millis());
+    long wait;
+    while ((wait = pollSampling(millis())) != SAMPLING_DONE) {
+        delay(wait);
+    }
+    return collectSampling();
+}
@@ -6,11 +6,34 @@
 #include "Adaptee.h"
 #include "Event.h"
 
+#define SAMPLING_DONE -1 // returned by pollSampling once the result can be collected
+
 class Adapter : public Target, public Adaptee {
 public:
     void setSpecificRequest(Event (*specificRequestFunc)(Event timeEvent));
     Event request(Event timeEvent);
 
+    /*
+    * Sampling without blocking: startSampling begins a round, pollSampling takes the
+    * readings that are due and collectSampling returns the resulting event. Several
+    * adapters can be sampled at the same time by polling them in turn.
+    * The default implementation runs the blocking request on the first poll.
+    */
+    virtual void startSampling(const Event& timeEvent, unsigned long now);
+
+    /*
+    * @return ms until the adapter needs to be polled again, or SAMPLING_DONE
+    */
+    virtual long pollSampling(unsigned long now);
+    virtual Event collectSampling();
+
+    // Runs a whole sampling round, waiting between the polls
+    Event sampleBlocking(const Event& timeEvent);
+
+protected:
+    Event timeEvent_;
+    Event result_;
+
 private:
     Event (*specificRequestFunc)(Event timeEvent);
 };
@@ -6,14 +6,50 @@
 #include <ArduinoHttpClient.h>
 #include "secrets.h"
 #include "Event.h"
+#include "JsonEncoder.h"
+#include "MeasurementCatalog.h"
+#include "BatchResultScanner.h"
+#include "GzipEncoder.h"
+#include "Uplink.h"
+#include "Instrumentation.h"
+#include "Log.h"
 
 
-#define MAX_MEASUREMENTS 30
-class ApiClient {
+#define API_BATCH_MAX_BYTES 2048 // largest body sent in a single batch request
+#define API_BATCH_MIN_BYTES 256 // a 413 shrinks the batch budget down to this, then batching is paused
+#define API_BATCH_RETRY_MS (60 * 60000UL) // batches are tried again this long after the server rejected one
+#define PAYLOAD_TOO_LARGE_STATUS 413
+#define API_KEEP_ALIVE_IDLE_MS 20000 // a kept connection idle for longer is closed before the next request
+#define API_GZIP_MIN_BYTES 512 // smaller bodies are sent uncompressed, the gzip framing would eat the gain
+#define API_CONTENT_TYPE "application/json" // of the body, gzip only adds a Content-Encoding
+
+// Send large bodies with Content-Encoding: gzip, the server has to accept it
+// (e.g. a proxy that inflates request bodies), define it in secrets.h to override this
+#ifndef API_GZIP_REQUESTS
+#define API_GZIP_REQUESTS 0
+#endif
+
+class ApiClient : public Uplink {
 
     private:
         HttpClient http_;
-        int last_results[MAX_MEASUREMENTS];
+        int last_results[UPLINK_MAX_EVENTS];
+
+        bool batchingEnabled_;
+        bool batchingPaused_;
+        unsigned long batchingPausedAt_;
+        size_t batchBudget_;
+        unsigned long requestCount_;
+        unsigned long deliveredEventCount_;
+        unsigned long newConnections_;
+        unsigned long reusedConnections_;
+        unsigned long lastActivityMillis_;
+
+        GzipEncoder gzip_;
+        bool compressionEnabled_;
+        bool lastRequestCompressed_;
+        unsigned long rawBodyBytes_;
+        unsigned long sentBodyBytes_;
 
     public:
 
@@ -21,6 +57,21 @@ class ApiClient {
             reset_last_results();
             http_.connectionKeepAlive();
             //http_.setHttpResponseTimeout(HTTP_TIMEOUT);
+
+            batchingEnabled_ = true;
+            batchingPaused_ = false;
+            batchingPausedAt_ = 0;
+            batchBudget_ = API_BATCH_MAX_BYTES;
+            requestCount_ = 0;
+            deliveredEventCount_ = 0;
+            newConnections_ = 0;
+            reusedConnections_ = 0;
+            lastActivityMillis_ = 0;
+
+            compressionEnabled_ = API_GZIP_REQUESTS;
+            lastRequestCompressed_ = false;
+            rawBodyBytes_ = 0;
+            sentBodyBytes_ = 0;
         }
 
         int sendEvent(const Event& event) {
@@ -30,61 +81,37 @@ class ApiClient {
                 return OK_STATUS;
             }
 
-            String contentType = "application/json";
-            String postData = event.getData();
-            int dataLength = postData.length() + 1;
-
-            // Send event to server
-            Serial.println("Sending event to server...");
-            Serial.println("Length: " + String(dataLength));
-
-            int connStatus = http_.connect(API_URL.c_str(), API_PORT);
-            Serial.println("Connect result: " + String(connStatus));
-            http_.connectionKeepAlive();
-
-            http_.beginRequest();
-            http_.post(API_ENDPOINT);
-            http_.sendHeader("Authorization", API_TOKEN);
-            http_.sendHeader("Content-Type", contentType);
-            http_.sendHeader("Content-Length", dataLength);
-            http_.beginBody();
-            http_.print(postData);
-            http_.endRequest();
-
-            int statusCode = http_.responseStatusCode();
-            //String response = http_.responseBody();
-
-            if (statusCode == HTTP_SUCCESS){
-                Serial.println("Success Sending event");
-                statusCode = http_.responseStatusCode();
-                
-                if (statusCode >= 0) {
-                    String response = http_.responseBody();
-                    Serial.println("Status code: " + String(statusCode));
-                    Serial.println("Body length: " + http_.contentLength());
-                }
-            }
-
-            Serial.println("Status code: " + String(statusCode));
-            //Serial.println("Response: " + response);
+            const int index = 0;
+            int statusCode = post(&event, &index, 1, nullptr);
 
             if (statusCode == OK_STATUS || statusCode == CREATED_STATUS) {
-                Serial.println("Event sent successfully");
+                LOG_DEBUG(API, "Event sent successfully");
             } else if (statusCode == HTTP_ERROR_INVALID_RESPONSE) {
-                Serial.println("Seems like server got the event, but it didn't respond properly");
+                LOG_WARN(API, "Seems like server got the event, but it didn't respond properly");
             }else{
-                Serial.println("Failed to send event");
+                LOG_WARN(API, "Failed to send event, status %d", statusCode);
             }
 
-            http_.stop(); 
             return statusCode;
         }
 
-
-        int* sendEvents(const Event* events, int n) {
+        /*
+        * Sends the measurement events packing as many as fit in the batch budget in
+        * each request. The result of each event is stored at the same index in the
+        * returned array.
+        */
+        int* sendEvents(const Event* events, int n) override {
             // Send events to server
-            Serial.println("Sending events to server...");
+            LOG_DEBUG(API, "Sending %d events to server", n);
             reset_last_results();
+            n = min(n, UPLINK_MAX_EVENTS);
+            resumeBatchingIfDue();
+
+            const MeasurementDictionary& dictionary = measurementDictionary();
+            int batch[UPLINK_MAX_EVENTS];
+            int batchSize = 0;
+            int batchRecords = 0;
+            size_t batchBytes = 0;
 
             for (int i = 0; i < n; i++){
                 //if event is different from measurement, omit it
@@ -92,27 +119,418 @@ class ApiClient {
                     last_results[i] = OK_STATUS;
                     continue;
                 }
-                last_results[i] = sendEvent(events[i]);
 
-                //if the result was HTTP_ERROR_INVALID_RESPONSE,
-                //it means that the server got the event, but it didn't respond properly
-                if (last_results[i] == HTTP_ERROR_INVALID_RESPONSE) {
-                    last_results[i] = OK_STATUS;
+                // payloads written by older firmware cannot be merged, they go on their own
+                if (!batchingEnabled_ || events[i].getRecordCount() == 0) {
+                    last_results[i] = sendSingle(events[i]);
+                    continue;
+                }
+
+                size_t eventBytes = measurementsJsonLength(events[i].getRecords(), events[i].getRecordCount(), dictionary);
+                bool full = batchBytes + eventBytes > batchBudget_ ||
+                            batchRecords + events[i].getRecordCount() > BATCH_RESULT_MAX_ITEMS;
+                if (batchSize > 0 && full) {
+                    sendBatch(events, batch, batchSize);
+                    batchSize = 0;
+                    batchRecords = 0;
+                    batchBytes = 0;
                 }
+
+                batch[batchSize++] = i;
+                batchRecords += events[i].getRecordCount();
+                batchBytes += eventBytes;
             }
 
+            if (batchSize > 0) {
+                sendBatch(events, batch, batchSize);
+            }
+
+            LOG_DEBUG(API, "Requests so far: %lu for %lu delivered events, %lu new connections, %lu reused",
+                      requestCount_, deliveredEventCount_, newConnections_, reusedConnections_);
+            if (rawBodyBytes_ > sentBodyBytes_) {
+                LOG_DEBUG(API, "Bodies sent as %lu bytes instead of %lu", sentBodyBytes_, rawBodyBytes_);
+            }
             return last_results;
         }
 
-        int* getLastResults() {
+        int* getLastResults() override {
             return last_results;
         }
 
         void reset_last_results() {
-            for (int i = 0; i < MAX_MEASUREMENTS; i++) {
+            for (int i = 0; i < UPLINK_MAX_EVENTS; i++) {
                 last_results[i] = -1;
             }
         }
+
+        /*
+        * Largest body, in bytes, sent in a single batch request. Events are never
+        * split, so a single event larger than the budget is still sent.
+        */
+        void setBatchBudget(size_t bytes) {
+            batchBudget_ = bytes;
+        }
+
+        // a 413 from the server shrinks it
+        size_t getBatchBudget() const {
+            return batchBudget_;
+        }
+
+        /*
+        * Batching is paused for API_BATCH_RETRY_MS when the server rejects a batch,
+        * this turns it back on at once. Turned off here it stays off.
+        */
+        void setBatchingEnabled(bool enabled) {
+            batchingEnabled_ = enabled;
+            batchingPaused_ = false;
+        }
+
+        bool isBatchingEnabled() const {
+            return batchingEnabled_;
+        }
+
+        /*
+        * Bodies of at least API_GZIP_MIN_BYTES are sent gzip compressed. It is turned
+        * off when the server answers 415 to a compressed body.
+        */
+        void setCompressionEnabled(bool enabled) {
+            compressionEnabled_ = enabled;
+        }
+
+        bool isCompressionEnabled() const {
+            return compressionEnabled_;
+        }
+
+        // Body bytes before and after compression, over all requests
+        unsigned long getRawBodyBytes() const {
+            return rawBodyBytes_;
+        }
+
+        unsigned long getSentBodyBytes() const {
+            return sentBodyBytes_;
+        }
+
+        unsigned long getRequestCount() const {
+            return requestCount_;
+        }
+
+        unsigned long getDeliveredEventCount() const {
+            return deliveredEventCount_;
+        }
+
+        unsigned long getNewConnectionCount() const {
+            return newConnections_;
+        }
+
+        unsigned long getReusedConnectionCount() const {
+            return reusedConnections_;
+        }
+
+        // Closes the kept connection, e.g. when the WiFi link is restarted
+        void disconnect() override {
+            http_.stop();
+        }
+
+    private:
+
+        static bool isSuccess(int statusCode) {
+            return statusCode == OK_STATUS || statusCode == CREATED_STATUS;
+        }
+
+        /*
+        * Sends a single event and counts it as delivered if the server got it.
+        */
+        int sendSingle(const Event& event) {
+            int statusCode = sendEvent(event);
+
+            //if the result was HTTP_ERROR_INVALID_RESPONSE,
+            //it means that the server got the event, but it didn't respond properly
+            if (statusCode == HTTP_ERROR_INVALID_RESPONSE) {
+                statusCode = OK_STATUS;
+            }
+            if (isSuccess(statusCode)) {
+                deliveredEventCount_++;
+            }
+            return statusCode;
+        }
+
+        // Batches go again once the pause after a rejected one is over
+        void resumeBatchingIfDue() {
+            if (batchingPaused_ && millis() - batchingPausedAt_ >= API_BATCH_RETRY_MS) {
+                LOG_INFO(API, "Trying batches again");
+                batchingEnabled_ = true;
+                batchingPaused_ = false;
+            }
+        }
+
+        /*
+        * Sends the events at the given indexes in one request and stores the result of
+        * each of them in last_results. When the server rejects the batch with a result
+        * per item, the events whose items were all valid are retried one by one. A
+        * body too large shrinks the batch budget and the events go again in two halves;
+        * when the server rejects batches altogether, batching is paused for
+        * API_BATCH_RETRY_MS and every event is sent on its own.
+        */
+        void sendBatch(const Event* events, const int* indexes, int count) {
+            if (count == 1) {
+                last_results[indexes[0]] = sendSingle(events[indexes[0]]);
+                return;
+            }
+
+            LOG_DEBUG(API, "Sending a batch of %d events", count);
+            BatchResultScanner scanner;
+            int statusCode = post(events, indexes, count, &scanner);
+
+            if (isSuccess(statusCode) || statusCode == HTTP_ERROR_INVALID_RESPONSE) {
+                for (int i = 0; i < count; i++) {
+                    last_results[indexes[i]] = OK_STATUS;
+                }
+                deliveredEventCount_ += count;
+                return;
+            }
+
+            int totalRecords = 0;
+            for (int i = 0; i < count; i++) {
+                totalRecords += events[indexes[i]].getRecordCount();
+            }
+
+            if (statusCode == BAD_REQUEST_STATUS && scanner.valid() && scanner.items() == totalRecords) {
+                LOG_WARN(API, "Batch rejected, retrying the valid events one by one");
+                int item = 0;
+                for (int i = 0; i < count; i++) {
+                    const Event& event = events[indexes[i]];
+                    bool eventOk = true;
+                    for (int r = 0; r < event.getRecordCount(); r++) {
+                        eventOk = eventOk && scanner.itemOk(item++);
+                    }
+                    last_results[indexes[i]] = eventOk ? sendSingle(event) : BAD_REQUEST_STATUS;
+                }
+                return;
+            }
+
+            if (statusCode == PAYLOAD_TOO_LARGE_STATUS && batchBudget_ > API_BATCH_MIN_BYTES) {
+                // just below the rejected body, the next batches take one event less
+                size_t rejectedBytes = 0;
+                for (int i = 0; i < count; i++) {
+                    const Event& event = events[indexes[i]];
+                    rejectedBytes += measurementsJsonLength(event.getRecords(), event.getRecordCount(), measurementDictionary());
+                }
+                batchBudget_ = max(min(batchBudget_, rejectedBytes) - 1, (size_t)API_BATCH_MIN_BYTES);
+                LOG_WARN(API, "Batch of %d events too large, budget now %d bytes", count, (int)batchBudget_);
+                sendBatch(events, indexes, count / 2);
+                sendBatch(events, indexes + count / 2, count - count / 2);
+                return;
+            }
+
+            if (statusCode == BAD_REQUEST_STATUS || statusCode == NOT_FOUND_STATUS || statusCode == 405 ||
+                statusCode == PAYLOAD_TOO_LARGE_STATUS || statusCode == 415) {
+                LOG_WARN(API, "Server rejected the batch (%d), one event per request for %lu min",
+                         statusCode, API_BATCH_RETRY_MS / 60000UL);
+                batchingEnabled_ = false;
+                batchingPaused_ = true;
+                batchingPausedAt_ = millis();
+                for (int i = 0; i < count; i++) {
+                    last_results[indexes[i]] = sendSingle(events[indexes[i]]);
+                }
+                return;
+            }
+
+            // the server or the connection failed, every event keeps the error
+            for (int i = 0; i < count; i++) {
+                last_results[indexes[i]] = statusCode;
+            }
+        }
+
+        /*
+        * Writes the records of all the listed events as one JSON array, an event
+        * without records (payload from older firmware) is written as it is.
+        */
+        template <typename Sink>
+        void writeBody(Sink& sink, const Event* events, const int* indexes, int count, const MeasurementDictionary& dictionary) {
+            if (count == 1 && events[indexes[0]].getRecordCount() == 0) {
+                const String& data = events[indexes[0]].getData();
+                sink.write(data.c_str(), data.length());
+                return;
+            }
+
+            bool first = true;
+            sink.write("[", 1);
+            for (int i = 0; i < count; i++) {
+                const Event& event = events[indexes[i]];
+                for (int r = 0; r < event.getRecordCount(); r++) {
+                    if (!first) {
+                        sink.write(", ", 2);
+                    }
+                    encodeMeasurement(sink, event.getRecords()[r], dictionary);
+                    first = false;
+                }
+            }
+            sink.write("]", 1);
+        }
+
+        /*
+        * Writes the body, through the gzip encoder when compressed is set, so the
+        * compressed body is streamed as the JSON is encoded.
+        */
+        template <typename Sink>
+        void writeRequestBody(Sink& sink, bool compressed, const Event* events, const int* indexes, int count,
+                              const MeasurementDictionary& dictionary) {
+            if (!compressed) {
+                writeBody(sink, events, indexes, count, dictionary);
+                return;
+            }
+            gzip_.begin(sink);
+            GzipSink<Sink> gzipSink(gzip_, sink);
+            writeBody(gzipSink, events, indexes, count, dictionary);
+            gzip_.finish(sink);
+        }
+
+        /*
+        * Whether the kept connection can carry the next request. A connection closed
+        * by the server is noticed by connected(), one that sat idle for too long is
+        * closed here because a NAT or the server may have dropped it without notice.
+        */
+        bool reuseConnection() {
+            if (!http_.connected()) {
+                return false;
+            }
+            if (millis() - lastActivityMillis_ > API_KEEP_ALIVE_IDLE_MS) {
+                LOG_DEBUG(API, "Kept connection idle for too long, closing it");
+                http_.stop();
+                return false;
+            }
+            return true;
+        }
+
+        /*
+        * Posts the listed events in one request and returns the status code.
+        * If a scanner is passed, the body of a 400 response is fed to it.
+        */
+        int post(const Event* events, const int* indexes, int count, BatchResultScanner* scanner) {
+            bool reused = reuseConnection();
+            int statusCode = request(events, indexes, count, reused, scanner);
+
+            // a kept connection closed by the server before it answered never got the
+            // request, so it is sent again on a new connection
+            if (reused && statusCode < 0 && statusCode != HTTP_ERROR_INVALID_RESPONSE && !http_.connected()) {
+                LOG_INFO(API, "Kept connection was closed by the server, retrying on a new one");
+                http_.stop();
+                statusCode = request(events, indexes, count, false, scanner);
+            }
+
+            if (statusCode == 415 && lastRequestCompressed_) {
+                LOG_WARN(API, "Server does not take gzip bodies, sending them uncompressed");
+                compressionEnabled_ = false;
+                statusCode = post(events, indexes, count, scanner);
+            }
+            return statusCode;
+        }
+
+        int request(const Event* events, const int* indexes, int count, bool reused, BatchResultScanner* scanner) {
+            const MeasurementDictionary& dictionary = measurementDictionary();
+
+            // the length is computed by running the encoder without output, so the
+            // body never needs to be built in memory
+            size_t dataLength;
+            size_t bodyLength;
+            bool compressed;
+            {
+                INSTRUMENT_STAGE(STAGE_JSON_BUILD);
+                CountingSink counter;
+                writeBody(counter, events, indexes, count, dictionary);
+                dataLength = counter.count;
+                bodyLength = dataLength;
+
+                // the compressed length takes a second pass, the encoder is deterministic
+                compressed = compressionEnabled_ && dataLength >= API_GZIP_MIN_BYTES;
+                if (compressed) {
+                    unsigned long start = micros();
+                    CountingSink compressedCounter;
+                    writeRequestBody(compressedCounter, true, events, indexes, count, dictionary);
+                    bodyLength = compressedCounter.count;
+                    LOG_DEBUG(API, "Compressed %u bytes to %u in %lu us",
+                              (unsigned)dataLength, (unsigned)bodyLength, micros() - start);
+                }
+            }
+            lastRequestCompressed_ = compressed;
+
+            // Send event to server
+            LOG_DEBUG(API, "Sending %u bytes to server", (unsigned)bodyLength);
+
+            // from here on the body is encoded again as it goes out, timed with the request
+            INSTRUMENT_STAGE(STAGE_HTTP_SEND);
+
+            // post() opens the connection only when the kept one is closed
+            http_.beginRequest();
+            int connStatus = http_.post(API_ENDPOINT);
+            if (connStatus != HTTP_SUCCESS) {
+                LOG_WARN(API, "Connect result: %d", connStatus);
+                http_.stop();
+                return connStatus;
+            }
+            if (reused) {
+                reusedConnections_++;
+            } else {
+                newConnections_++;
+            }
+
+            http_.sendHeader("Authorization", API_TOKEN);
+            http_.sendHeader("Content-Type", API_CONTENT_TYPE);
+            if (compressed) {
+                http_.sendHeader("Content-Encoding", "gzip");
+            }
+            http_.sendHeader("Content-Length", (int)bodyLength);
+            http_.beginBody();
+            {
+                PrintSink<HttpClient> sink(http_);
+                writeRequestBody(sink, compressed, events, indexes, count, dictionary);
+            }
+            http_.endRequest();
+            requestCount_++;
+            rawBodyBytes_ += dataLength;
+            sentBodyBytes_ += bodyLength;
+
+            int statusCode = http_.responseStatusCode();
+            LOG_DEBUG(API, "Status code: %d", statusCode);
+
+            finishResponse(statusCode, (statusCode == BAD_REQUEST_STATUS) ? scanner : nullptr);
+            return statusCode;
+        }
+
+        /*
+        * Reads the rest of the response so the connection is ready for the next
+        * request, feeding the body to the scanner if one is passed. The connection is
+        * closed when the response failed or its end cannot be told.
+        */
+        void finishResponse(int statusCode, BatchResultScanner* scanner) {
+            lastActivityMillis_ = millis();
+            if (statusCode < 0 || http_.skipResponseHeaders() != HTTP_SUCCESS) {
+                http_.stop();
+                return;
+            }
+
+            bool delimited = http_.isResponseChunked() ||
+                             http_.contentLength() != HttpClient::kNoContentLengthHeader;
+
+            unsigned long start = millis();
+            while (!http_.endOfBodyReached() && millis() - start < HTTP_TIMEOUT) {
+                int c = http_.read();
+                if (c >= 0) {
+                    if (scanner != nullptr) {
+                        scanner->feed((char)c);
+                    }
+                } else if (!http_.connected()) {
+                    break;
+                } else {
+                    delay(1);
+                }
+            }
+
+            if (!delimited || !http_.endOfBodyReached()) {
+                http_.stop();
+            }
+            lastActivityMillis_ = millis();
+        }
 };
 
 #endif // API_CLIENT_H
\ No newline at end of file
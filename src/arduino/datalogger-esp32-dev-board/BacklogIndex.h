@@ -0,0 +1,153 @@
+#ifndef BACKLOG_INDEX_H
+#define BACKLOG_INDEX_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Maximum number of backlog files kept in RAM, 4 bytes each
+#define BACKLOG_INDEX_CAPACITY 256
+
+/*
+* Sorted index of the timestamps that name the backlog files (/<timestamp>.txt).
+* It is filled by one directory scan and then kept up to date as files are written
+* and deleted, so the oldest or newest file is found in O(1) instead of walking the
+* directory. When the card holds more files than BACKLOG_INDEX_CAPACITY only the
+* ones closest to the drained end are kept, and the index asks for a new scan once
+* they run out. This header does not depend on Arduino.
+*/
+class BacklogIndex {
+public:
+    BacklogIndex() : count_(0), built_(false), truncated_(false), keepNewest_(true), boundary_(0) {}
+
+    /*
+    * Starts a rebuild, feed every timestamp found in the directory with add.
+    * @param keepNewest: which end is kept when there are more files than the capacity
+    */
+    void beginRebuild(bool keepNewest) {
+        count_ = 0;
+        truncated_ = false;
+        keepNewest_ = keepNewest;
+        built_ = true;
+    }
+
+    /*
+    * A rebuild is needed before the index can answer for the given end.
+    */
+    bool needsRebuild(bool newest) const {
+        if (!built_) {
+            return true;
+        }
+        if (!truncated_) {
+            return false;
+        }
+        // the entries left on the card are outside of the kept window
+        return count_ == 0 || keepNewest_ != newest;
+    }
+
+    void invalidate() {
+        built_ = false;
+    }
+
+    void add(uint32_t timestamp) {
+        if (!built_) {
+            return;
+        }
+        int position = lowerBound(timestamp);
+        if (position < count_ && entries_[position] == timestamp) {
+            return;
+        }
+
+        // files beyond a dropped one must wait for the next scan, or they would be
+        // offered before it
+        if (truncated_ && (keepNewest_ ? timestamp <= boundary_ : timestamp >= boundary_)) {
+            return;
+        }
+
+        if (count_ == BACKLOG_INDEX_CAPACITY) {
+            if (keepNewest_) {
+                // drop the oldest entry unless the new one is older still
+                if (position == 0) {
+                    drop(timestamp);
+                    return;
+                }
+                drop(entries_[0]);
+                memmove(entries_, entries_ + 1, (position - 1) * sizeof(uint32_t));
+                entries_[position - 1] = timestamp;
+                return;
+            }
+            if (position == count_) {
+                drop(timestamp);
+                return;
+            }
+            drop(entries_[count_ - 1]);
+            count_--;
+        }
+
+        memmove(entries_ + position + 1, entries_ + position, (count_ - position) * sizeof(uint32_t));
+        entries_[position] = timestamp;
+        count_++;
+    }
+
+    void remove(uint32_t timestamp) {
+        int position = lowerBound(timestamp);
+        if (position == count_ || entries_[position] != timestamp) {
+            return;
+        }
+        memmove(entries_ + position, entries_ + position + 1, (count_ - position - 1) * sizeof(uint32_t));
+        count_--;
+    }
+
+    /*
+    * @return false when the index has no files
+    */
+    bool oldest(uint32_t &timestamp) const {
+        if (count_ == 0) {
+            return false;
+        }
+        timestamp = entries_[0];
+        return true;
+    }
+
+    bool newest(uint32_t &timestamp) const {
+        if (count_ == 0) {
+            return false;
+        }
+        timestamp = entries_[count_ - 1];
+        return true;
+    }
+
+    int size() const { return count_; }
+    bool truncated() const { return truncated_; }
+    bool built() const { return built_; }
+
+private:
+    uint32_t entries_[BACKLOG_INDEX_CAPACITY];
+    int count_;
+    bool built_;
+    bool truncated_;
+    bool keepNewest_;
+    uint32_t boundary_;     // closest dropped timestamp to the kept window
+
+    void drop(uint32_t timestamp) {
+        if (!truncated_ || (keepNewest_ ? timestamp > boundary_ : timestamp < boundary_)) {
+            boundary_ = timestamp;
+        }
+        truncated_ = true;
+    }
+
+    int lowerBound(uint32_t timestamp) const {
+        int low = 0;
+        int high = count_;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (entries_[middle] < timestamp) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+};
+
+#endif // BACKLOG_INDEX_H
@@ -0,0 +1,149 @@
+#ifndef BATCH_RESULT_SCANNER_H
+#define BATCH_RESULT_SCANNER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Maximum number of items whose result can be tracked
+#define BATCH_RESULT_MAX_ITEMS 64
+
+/*
+* Reads the body the API returns when a batch is rejected, one character at a time
+* so it can be fed straight from the socket. The body is expected to be an array
+* with one entry per posted item, where an empty object means that item was valid:
+*   [{}, {"value": ["A valid number is required."]}, {}]
+* This header does not depend on Arduino.
+*/
+class BatchResultScanner {
+public:
+    BatchResultScanner() {
+        reset();
+    }
+
+    void reset() {
+        depth_ = 0;
+        items_ = 0;
+        inString_ = false;
+        escaped_ = false;
+        itemEmpty_ = true;
+        started_ = false;
+        finished_ = false;
+        invalid_ = false;
+    }
+
+    void feed(char c) {
+        if (invalid_ || finished_) {
+            if (finished_ && !isSpace(c)) {
+                invalid_ = true;
+            }
+            return;
+        }
+
+        if (inString_) {
+            itemEmpty_ = false;
+            if (escaped_) {
+                escaped_ = false;
+            } else if (c == '\\') {
+                escaped_ = true;
+            } else if (c == '"') {
+                inString_ = false;
+            }
+            return;
+        }
+
+        if (isSpace(c)) {
+            return;
+        }
+
+        if (!started_) {
+            started_ = true;
+            if (c != '[') {
+                invalid_ = true;
+                return;
+            }
+            depth_ = 1;
+            return;
+        }
+
+        switch (c) {
+            case '[':
+            case '{':
+                if (depth_ == 1) {
+                    itemEmpty_ = true;
+                } else {
+                    itemEmpty_ = false;
+                }
+                depth_++;
+                break;
+            case ']':
+            case '}':
+                depth_--;
+                if (depth_ == 1) {
+                    endItem();
+                } else if (depth_ == 0) {
+                    finished_ = true;
+                }
+                break;
+            case ',':
+                break;
+            case '"':
+                inString_ = true;
+                itemEmpty_ = false;
+                break;
+            default:
+                // scalar items mean this is not a per item result
+                if (depth_ == 1) {
+                    invalid_ = true;
+                } else {
+                    itemEmpty_ = false;
+                }
+                break;
+        }
+    }
+
+    void feed(const char* data, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            feed(data[i]);
+        }
+    }
+
+    // the whole body was a well formed array of objects
+    bool valid() const { return started_ && finished_ && !invalid_; }
+    int items() const { return items_; }
+
+    // whether the item at index was accepted by the server
+    bool itemOk(int index) const {
+        if (index < 0 || index >= items_ || index >= BATCH_RESULT_MAX_ITEMS) {
+            return false;
+        }
+        return (ok_[index / 8] >> (index % 8)) & 1;
+    }
+
+private:
+    uint8_t ok_[(BATCH_RESULT_MAX_ITEMS + 7) / 8];
+    int depth_;
+    int items_;
+    bool inString_;
+    bool escaped_;
+    bool itemEmpty_;
+    bool started_;
+    bool finished_;
+    bool invalid_;
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    void endItem() {
+        if (items_ < BATCH_RESULT_MAX_ITEMS) {
+            if (itemEmpty_) {
+                ok_[items_ / 8] |= (1 << (items_ % 8));
+            } else {
+                ok_[items_ / 8] &= ~(1 << (items_ % 8));
+            }
+        }
+        items_++;
+    }
+};
+
+#endif // BATCH_RESULT_SCANNER_H
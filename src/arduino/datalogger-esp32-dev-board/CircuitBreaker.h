@@ -0,0 +1,146 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <stdint.h>
+
+#define BREAKER_FAILURE_THRESHOLD 3     // consecutive failed sends that open the breaker
+#define BREAKER_BASE_BACKOFF 5000       // ms, first wait after the breaker opens
+#define BREAKER_MAX_BACKOFF 600000      // ms, the wait doubles every time a probe fails up to this
+
+typedef unsigned long (*BreakerClock)();
+
+enum BreakerState {
+    BREAKER_CLOSED,     // sends go through
+    BREAKER_OPEN,       // sends are refused until the backoff is over
+    BREAKER_HALF_OPEN   // one probe is let through, its result closes or reopens the breaker
+};
+
+/*
+* Circuit breaker for one destination. After BREAKER_FAILURE_THRESHOLD failed
+* sends in a row it opens and refuses sends for a backoff that doubles with every
+* failed probe, with equal jitter (half fixed, half random) so devices that lost the
+* server together do not come back in lockstep. Once the backoff is over a single
+* probe is allowed; a success closes the breaker and resets the backoff. The clock
+* and the random seed are injected so it can run on a simulated clock.
+* This header does not depend on Arduino.
+*/
+class CircuitBreaker {
+public:
+    CircuitBreaker(BreakerClock clock, uint32_t seed,
+                   unsigned int failureThreshold = BREAKER_FAILURE_THRESHOLD,
+                   unsigned long baseBackoff = BREAKER_BASE_BACKOFF,
+                   unsigned long maxBackoff = BREAKER_MAX_BACKOFF)
+        : clock_(clock), random_(seed != 0 ? seed : 1), threshold_(failureThreshold),
+          baseBackoff_(baseBackoff), maxBackoff_(maxBackoff) {
+        reset();
+    }
+
+    void reset() {
+        state_ = BREAKER_CLOSED;
+        failures_ = 0;
+        openings_ = 0;
+        backoff_ = 0;
+        retryAt_ = 0;
+        probing_ = false;
+    }
+
+    /*
+    * Asks to send. In the half open state only the first caller gets through, as
+    * the probe, until its result is recorded.
+    * @return false if the send must not be attempted
+    */
+    bool allowRequest() {
+        if (state_ == BREAKER_OPEN && (long)(clock_() - retryAt_) >= 0) {
+            state_ = BREAKER_HALF_OPEN;
+            probing_ = false;
+        }
+        if (state_ == BREAKER_OPEN || (state_ == BREAKER_HALF_OPEN && probing_)) {
+            return false;
+        }
+        probing_ = (state_ == BREAKER_HALF_OPEN);
+        return true;
+    }
+
+    // Same as allowRequest but without taking the probe
+    bool wouldAllow() const {
+        if (state_ == BREAKER_OPEN) {
+            return (long)(clock_() - retryAt_) >= 0;
+        }
+        return !(state_ == BREAKER_HALF_OPEN && probing_);
+    }
+
+    // The destination answered, even if it rejected what was sent
+    void recordSuccess() {
+        state_ = BREAKER_CLOSED;
+        failures_ = 0;
+        openings_ = 0;
+        probing_ = false;
+    }
+
+    // The destination could not be reached or failed to answer
+    void recordFailure() {
+        failures_++;
+        probing_ = false;
+        if (state_ == BREAKER_HALF_OPEN || failures_ >= threshold_) {
+            open();
+        }
+    }
+
+    // The probe did not reach the destination for another reason, let the next caller probe
+    void releaseProbe() {
+        probing_ = false;
+    }
+
+    BreakerState state() const { return state_; }
+    bool isProbing() const { return state_ == BREAKER_HALF_OPEN && probing_; }
+    unsigned long getBackoff() const { return backoff_; }
+
+    // ms until a probe is allowed, 0 unless the breaker is open
+    unsigned long retryIn() const {
+        if (state_ != BREAKER_OPEN) {
+            return 0;
+        }
+        long left = (long)(retryAt_ - clock_());
+        return left > 0 ? (unsigned long)left : 0;
+    }
+
+private:
+    BreakerClock clock_;
+    uint32_t random_;
+    unsigned int threshold_;
+    unsigned long baseBackoff_;
+    unsigned long maxBackoff_;
+
+    BreakerState state_;
+    unsigned int failures_;
+    unsigned int openings_;
+    unsigned long backoff_;
+    unsigned long retryAt_;
+    bool probing_;
+
+    void open() {
+        unsigned long backoff = baseBackoff_;
+        for (unsigned int i = 0; i < openings_ && backoff < maxBackoff_; i++) {
+            backoff *= 2;
+        }
+        if (backoff > maxBackoff_) {
+            backoff = maxBackoff_;
+        }
+        openings_++;
+
+        unsigned long half = backoff / 2;
+        backoff_ = half + nextRandom() % (backoff - half + 1);
+        retryAt_ = clock_() + backoff_;
+        state_ = BREAKER_OPEN;
+    }
+
+    // xorshift32, good enough to spread retries
+    uint32_t nextRandom() {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 17;
+        random_ ^= random_ << 5;
+        return random_;
+    }
+};
+
+#endif // CIRCUIT_BREAKER_H
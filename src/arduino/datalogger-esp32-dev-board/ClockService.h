@@ -0,0 +1,245 @@
+#ifndef CLOCK_SERVICE_H
+#define CLOCK_SERVICE_H
+
+#include <stdint.h>
+#include "Scheduler.h"
+
+#define CLOCK_SYNC_INTERVAL 3600000UL       // ms between RTC reads once the clock is running
+#define CLOCK_EDGE_POLL 20                  // ms between RTC reads while waiting for its second to tick
+#define CLOCK_EDGE_TIMEOUT 1500             // ms, a second that does not tick means the RTC is stuck
+#define CLOCK_REFERENCE_INTERVAL 60000UL    // ms between checks for a reference (NTP) time
+#define CLOCK_MAX_DRIFT_PPM 1000            // larger drift estimates are taken as glitches
+#define CLOCK_DRIFT_WEIGHT 0.5f             // weight of the newest drift estimate
+#define CLOCK_RTC_TOLERANCE 2               // s, the RTC is set from the reference when it is off by more
+
+typedef unsigned long (*MillisClock)();
+
+/*
+* A source of wall clock time in epoch seconds, e.g. the DS3231 or NTP.
+*/
+class ClockSource {
+public:
+    virtual ~ClockSource() {}
+
+    /*
+    * @return false if there is no time to give, for a reference source: no new
+    * time since the last call
+    */
+    virtual bool read(uint32_t& epoch) = 0;
+
+    // @return false if the source cannot be set
+    virtual bool write(uint32_t epoch) {
+        (void)epoch;
+        return false;
+    }
+};
+
+/*
+* Serves the wall clock from millis() instead of the RTC bus. The RTC is read at
+* begin and then every CLOCK_SYNC_INTERVAL; each sync polls it until its second
+* ticks, so the epoch is anchored to a known millis() with CLOCK_EDGE_POLL
+* precision, and the rate of millis() against the RTC over the interval gives the
+* drift that now() corrects for. now() is O(1), never touches the bus and does not
+* go backwards, unless the RTC is stepped back: when a reference source (NTP) has a
+* new time the RTC is set from it if it is off by more than CLOCK_RTC_TOLERANCE,
+* and the served time follows. Syncing runs as a ResumableTask
+* on the task that owns the I2C bus, now() must be called from that task too.
+* This header does not depend on Arduino.
+*/
+class ClockService : public ResumableTask {
+public:
+    ClockService(ClockSource& rtc, MillisClock millis)
+        : rtc_(rtc), reference_(nullptr), millis_(millis), valid_(false), anchorEpoch_(0), anchorMs_(0),
+          driftPpm_(0), lastServed_(0), edgeValid_(false), edgeEpoch_(0), edgeMs_(0), syncing_(false),
+          syncStartEpoch_(0), syncStartMs_(0), lastSyncMs_(0), lastReferenceMs_(0), lastOffsetMs_(0),
+          syncs_(0), failures_(0) {}
+
+    /*
+    * Reads the RTC once, the clock is usable from here on with second precision
+    * and gets aligned to the RTC second at the first resume.
+    * @return false if the RTC could not be read
+    */
+    bool begin() {
+        uint32_t epoch;
+        unsigned long ms = millis_();
+        lastSyncMs_ = ms;
+        lastReferenceMs_ = ms;
+        if (!rtc_.read(epoch)) {
+            failures_++;
+            return false;
+        }
+        anchor(epoch, ms);
+        valid_ = true;
+        startSync(ms);
+        return true;
+    }
+
+    // Optional source the RTC is corrected from, e.g. NTP
+    void setReference(ClockSource* reference) {
+        reference_ = reference;
+    }
+
+    // Epoch seconds of the wall clock, 0 until the RTC was read once
+    uint32_t now() {
+        if (!valid_) {
+            return 0;
+        }
+        int64_t ms = (int64_t)anchorEpoch_ * 1000 + elapsed(millis_());
+        uint32_t epoch = (uint32_t)(ms / 1000);
+        // a sync may move the anchor back a little, time stands still until it catches up
+        if (epoch < lastServed_) {
+            return lastServed_;
+        }
+        lastServed_ = epoch;
+        return epoch;
+    }
+
+    long resume(unsigned long now) override {
+        if (syncing_) {
+            return pollEdge(now);
+        }
+        if (reference_ != nullptr && now - lastReferenceMs_ >= CLOCK_REFERENCE_INTERVAL) {
+            lastReferenceMs_ = now;
+            checkReference(now);
+            if (syncing_) {
+                return CLOCK_EDGE_POLL;
+            }
+        }
+        if (now - lastSyncMs_ >= CLOCK_SYNC_INTERVAL) {
+            startSync(now);
+            return pollEdge(now);
+        }
+        unsigned long untilSync = CLOCK_SYNC_INTERVAL - (now - lastSyncMs_);
+        return (long)(untilSync < SCHEDULER_MAX_WAIT ? untilSync : SCHEDULER_MAX_WAIT);
+    }
+
+    bool isValid() const { return valid_; }
+    float getDriftPpm() const { return driftPpm_; }
+    // RTC minus served time at the last sync, in ms
+    long getLastOffsetMs() const { return lastOffsetMs_; }
+    unsigned long getSyncCount() const { return syncs_; }
+    unsigned long getFailureCount() const { return failures_; }
+
+private:
+    ClockSource& rtc_;
+    ClockSource* reference_;
+    MillisClock millis_;
+    bool valid_;
+
+    // the served time is anchorEpoch_ at anchorMs_ plus the drift corrected elapsed time
+    uint32_t anchorEpoch_;
+    unsigned long anchorMs_;
+    float driftPpm_;            // how much faster millis() runs than the RTC
+    uint32_t lastServed_;
+
+    // last RTC second edge, the drift is measured between two of them
+    bool edgeValid_;
+    uint32_t edgeEpoch_;
+    unsigned long edgeMs_;
+
+    bool syncing_;
+    uint32_t syncStartEpoch_;
+    unsigned long syncStartMs_;
+    unsigned long lastSyncMs_;
+    unsigned long lastReferenceMs_;
+    long lastOffsetMs_;
+    unsigned long syncs_;
+    unsigned long failures_;
+
+    // ms of RTC time since the anchor
+    int64_t elapsed(unsigned long ms) const {
+        int64_t raw = (int64_t)(unsigned long)(ms - anchorMs_);
+        return raw - (int64_t)(raw * (double)driftPpm_ / 1e6);
+    }
+
+    void anchor(uint32_t epoch, unsigned long ms) {
+        anchorEpoch_ = epoch;
+        anchorMs_ = ms;
+    }
+
+    void startSync(unsigned long now) {
+        uint32_t epoch;
+        if (!rtc_.read(epoch)) {
+            failures_++;
+            lastSyncMs_ = now;
+            return;
+        }
+        syncing_ = true;
+        syncStartEpoch_ = epoch;
+        syncStartMs_ = now;
+    }
+
+    /*
+    * Reads the RTC until its second changes, the new second started between the
+    * previous read and this one.
+    */
+    long pollEdge(unsigned long now) {
+        uint32_t epoch;
+        if (!rtc_.read(epoch)) {
+            failures_++;
+            syncing_ = false;
+            lastSyncMs_ = now;
+            return SCHEDULER_MAX_WAIT;
+        }
+        if (epoch == syncStartEpoch_) {
+            if (now - syncStartMs_ > CLOCK_EDGE_TIMEOUT) {
+                failures_++;
+                syncing_ = false;
+                lastSyncMs_ = now;
+                return SCHEDULER_MAX_WAIT;
+            }
+            return CLOCK_EDGE_POLL;
+        }
+        syncing_ = false;
+        lastSyncMs_ = now;
+        onEdge(epoch, now);
+        return SCHEDULER_MAX_WAIT;
+    }
+
+    void onEdge(uint32_t epoch, unsigned long now) {
+        syncs_++;
+        if (valid_) {
+            lastOffsetMs_ = (long)((int64_t)epoch * 1000 - ((int64_t)anchorEpoch_ * 1000 + elapsed(now)));
+        }
+
+        if (edgeValid_ && epoch > edgeEpoch_) {
+            double rtcMs = (double)(epoch - edgeEpoch_) * 1000.0;
+            double localMs = (double)(unsigned long)(now - edgeMs_);
+            float sample = (float)((localMs - rtcMs) / rtcMs * 1e6);
+            if (sample > -CLOCK_MAX_DRIFT_PPM && sample < CLOCK_MAX_DRIFT_PPM) {
+                driftPpm_ = (syncs_ <= 2) ? sample : driftPpm_ + CLOCK_DRIFT_WEIGHT * (sample - driftPpm_);
+            }
+        }
+        edgeValid_ = true;
+        edgeEpoch_ = epoch;
+        edgeMs_ = now;
+
+        anchor(epoch, now);
+        valid_ = true;
+    }
+
+    void checkReference(unsigned long now) {
+        uint32_t reference;
+        if (!reference_->read(reference)) {
+            return;
+        }
+        uint32_t served = this->now();
+        // signed 32 bit difference, a reference behind the served time is negative
+        int32_t offset = (int32_t)(reference - served);
+        if (offset >= -CLOCK_RTC_TOLERANCE && offset <= CLOCK_RTC_TOLERANCE) {
+            return;
+        }
+        if (!rtc_.write(reference)) {
+            failures_++;
+            return;
+        }
+        // the RTC was stepped, the drift is measured again from the next edge
+        edgeValid_ = false;
+        if (reference < lastServed_) {
+            lastServed_ = reference;
+        }
+        startSync(now);
+    }
+};
+
+#endif // CLOCK_SERVICE_H
@@ -16,181 +16,266 @@
 
 #include "CustomUtils.h"
 #include "Event.h"
-#include "Subscriber.h"
-#include "EventManager.h"
+#include "EventBus.h"
 #include "ApiClient.h"
+#include "MqttUplink.h"
+#include "EventLog.h"
+#include "RingBuffer.h"
+#include "CircuitBreaker.h"
+#include "ConnectionStateMachine.h"
+#include "WifiRadio.h"
+#include "Instrumentation.h"
+#include "Log.h"
 
 #define MAX_MEASUREMENTS 3
 #define MAX_EXCESS_EVENTS 3
+#define EVENT_RETRY_BUDGET 10   // sends an event the server rejects gets before it is given up
+#define LINK_SUBSCRIBERS 2
 
-class ConnectionEventManager : public EventManager, public Subscriber{
+// transport used unless setUplink picks another one, UPLINK_HTTP or UPLINK_MQTT
+#ifndef DEFAULT_UPLINK
+#define DEFAULT_UPLINK UPLINK_HTTP
+#endif
+
+class ConnectionEventManager : public ResumableTask{
 private:
-    Event firstConnectionEvent;
-    Event lastConnectionEvent;
     WiFiClient client;
     ApiClient apiClient = ApiClient(client);
-
+    WiFiClient mqttSocket;
+    MqttUplink mqttUplink = MqttUplink(mqttSocket);
+    Uplink* uplink = nullptr;
+    EventLog* spillLog = nullptr;
+
+    // one breaker per destination, so an unreachable broker does not hold back http
+    CircuitBreaker httpBreaker = CircuitBreaker(millis, esp_random());
+    CircuitBreaker mqttBreaker = CircuitBreaker(millis, esp_random());
+    CircuitBreaker* breaker = nullptr;
+    int breakerResults[UPLINK_MAX_EVENTS];
+    size_t lastAttempted = 0;
+    size_t lastSent = 0;
+    unsigned long givenUpCount = 0;
+
+    // the WiFi link, driven one step at a time by resume
+    WifiRadio radio = WifiRadio(apiClient, mqttUplink);
+    ConnectionStateMachine<WifiRadio> connection{radio, millis, esp_random()};
+    LinkState linkState = LINK_DOWN;
 
 public:
-    int measurementEventsCount = 0;
-    Event measurementEvents[MAX_MEASUREMENTS + MAX_EXCESS_EVENTS];
-
-    ConnectionEventManager() {
-        firstConnectionEvent = Event(CONNECTION_EVENT, SERVICE_UNAVAILABLE_STATUS, "", "{\"error\":\"No connection events yet\"}");
-        lastConnectionEvent = firstConnectionEvent;
-        for (int i = 0; i < MAX_MEASUREMENTS + MAX_EXCESS_EVENTS; i++){
-            measurementEvents[i] = Event();
-        }
+    // unsent measurement events, oldest first
+    RingBuffer<Event, MAX_MEASUREMENTS + MAX_EXCESS_EVENTS> measurementEvents;
+
+    // LINK_UP when the link comes up and LINK_DOWN when it is lost
+    Channel<LinkState, LINK_SUBSCRIBERS> linkChannel;
+
+    ConnectionEventManager() : measurementEvents(OVERFLOW_SPILL) {
+        setUplink(DEFAULT_UPLINK);
+
+        // the WiFi task reports a lost link right away instead of waiting for a status check
+        WiFi.onEvent([this](arduino_event_id_t, arduino_event_info_t) {
+            connection.notifyLinkLost();
+        }, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
     }
 
-    Event getFirstEvent() {
-        return firstConnectionEvent;
+    /*
+    * Selects the transport the events are sent through.
+    * @param transport: UPLINK_HTTP or UPLINK_MQTT
+    */
+    void setUplink(int transport) {
+        uplink = (transport == UPLINK_MQTT) ? static_cast<Uplink*>(&mqttUplink) : static_cast<Uplink*>(&apiClient);
+        breaker = (transport == UPLINK_MQTT) ? &mqttBreaker : &httpBreaker;
+        LOG_INFO(CONNECTION, "Sending events through %s", (transport == UPLINK_MQTT) ? "MQTT" : "HTTP");
     }
 
-    //------------------------ Event Manager Interface ------------------------
-    void notify() override {
-        // Run business logic
-        main();
-        Serial.println("ConnectionEventManager notifying subscribers...");
+    /*
+    * Where the oldest unsent events go when the buffer is full. Without a log, or if
+    * the log cannot be written, the oldest event is dropped.
+    */
+    void setSpillLog(EventLog* log) {
+        spillLog = log;
+    }
 
-        // Notify subscribers
-        for (int i = 0; i < number_of_subs; i++){
-            subscribers_[i]->update(lastConnectionEvent);
-        }
+    void setOverflowPolicy(OverflowPolicy policy) {
+        measurementEvents.setPolicy(policy);
     }
 
-    void main() override {
-        Serial.println("\nConnectionEventManager running business logic...");
-
-        if (lastConnectionEvent.getStatusCode() >= 500){
-            Serial.println("Connection status code is 500 or greater ");
-            connect();
-        } else if (lastConnectionEvent.getStatusCode() == SERVICE_UNAVAILABLE_STATUS) {
-            Serial.println("Connection status code is " + String(SERVICE_UNAVAILABLE_STATUS));
-            connect(true);
-        } else if (lastConnectionEvent.getStatusCode() == OK_STATUS) {
-            Serial.println("Connection status code is " + String(OK_STATUS));
-            lastConnectionEvent = check_connection();
-        } else {
-            String message = "Unhandled connection status code: " + String(lastConnectionEvent.getStatusCode());
-            Serial.println(message);
-            throw std::runtime_error(message.c_str());
-        }
+    unsigned long getDroppedCount() const {
+        return measurementEvents.dropped();
+    }
+
+    // events dropped because the server kept rejecting them
+    unsigned long getGivenUpCount() const {
+        return givenUpCount;
     }
 
+    // false while the link is down or the breaker of the uplink holds sends back
+    bool uplinkReady() const {
+        return connection.isUp() && breaker->wouldAllow();
+    }
+
+    // how often the WiFi link was lost and how long it took to come back
+    const LinkStats& getLinkStats() const {
+        return connection.stats();
+    }
+
+    // events handed to the uplink and events delivered by the last send call
+    size_t getLastAttemptedCount() const {
+        return lastAttempted;
+    }
 
+    size_t getLastSentCount() const {
+        return lastSent;
+    }
+
+    //------------------------ Resumable Task Interface ------------------------
     /*
-    * Sends the pending data to the server
+    * Runs the connection state machine and, when the link goes up or down, tells the
+    * subscribers of the link channel.
     */
-    void sendMemAllocatedData(){
-        Serial.println("There are " + String(measurementEventsCount) + " pending.");
-        Serial.println("Sending pending [allocated in mem] data...");
-        int* statusCodes = apiClient.sendEvents(measurementEvents, measurementEventsCount % (MAX_MEASUREMENTS + MAX_EXCESS_EVENTS));
-
-        int currentCount = measurementEventsCount % (MAX_MEASUREMENTS + MAX_EXCESS_EVENTS);  // This ensures we loop correctly if the count exceeds the buffer size
-        int readIndex = 0, writeIndex = 0;
-
-        // Iterate through all events that have been attempted to send
-        while (readIndex < currentCount) {
-            if (statusCodes[readIndex] == OK_STATUS || statusCodes[readIndex] == CREATED_STATUS) {
-                // Event was sent successfully, do not copy it to the write index
-                measurementEvents[readIndex] = Event();  // Optional: Reset the event to clear data
-            } else {
-                // Event was not sent successfully, needs to be retained
-                if (writeIndex != readIndex) {
-                    // Only copy if readIndex has surpassed writeIndex
-                    measurementEvents[writeIndex] = measurementEvents[readIndex];
-                }
-                writeIndex++;
-            }
-            readIndex++;
+    long resume(unsigned long now) override {
+        long wait = connection.resume(now);
+        if (connection.state() == linkState) {
+            return wait;
         }
 
-        // Update the count of events in the buffer
-        measurementEventsCount = writeIndex;
-
-        // Clear any old events that are beyond the new count
-        while (writeIndex < currentCount) {
-            measurementEvents[writeIndex++] = Event();  // Reset the event to clear data
+        bool wasUp = (linkState == LINK_UP);
+        linkState = connection.state();
+        if (connection.isUp()) {
+            const LinkStats& stats = connection.stats();
+            IPAddress ip = WiFi.localIP();
+            LOG_INFO(CONNECTION, "Connected to WiFi, IP Address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+            LOG_INFO(CONNECTION, "Link back after %lu ms (%lu attempts, %lu reconnects, longest %lu ms)",
+                     stats.lastReconnectMs, stats.attempts, stats.reconnects, stats.maxReconnectMs);
+            // the breakers keep their backoff, the server may still be down
+            linkChannel.publish(LINK_UP);
+        } else if (wasUp) {
+            LOG_WARN(CONNECTION, "WiFi link lost");
+            linkChannel.publish(LINK_DOWN);
         }
+        return wait;
     }
 
+    bool isConnected() const {
+        return connection.isUp();
+    }
+
+
     /*
-    * This function takes the passed events array, which should be an empty array,
-    * and fills it with the excess events, this is usually used for avoiding filling the
-    * excessEvents array. And is used later for the SD card to store the events.
+    * Sends the pending events and keeps the ones that failed.
+    * @return number of events the server acknowledged, given up events are not counted
     */
-    bool returnExcessEvents(Event* events, int size) {
-        if (measurementEventsCount < (MAX_MEASUREMENTS + MAX_EVENTS_PER_FILE - 1)) {
-            Serial.println("Seeking excess events...");
-            Serial.printf("Not enough events to return. Current count: %d\n", measurementEventsCount);
-            return false;
+    size_t sendMemAllocatedData(){
+        const size_t pending = measurementEvents.size();
+        LOG_DEBUG(CONNECTION, "Sending %d pending events", (int)pending);
+
+        // the events are sent from where they are stored, in two runs when the
+        // buffer wrapped around
+        int statusCodes[MAX_MEASUREMENTS + MAX_EXCESS_EVENTS];
+        bool attempted[MAX_MEASUREMENTS + MAX_EXCESS_EVENTS];
+        size_t done = 0;
+        startSending();
+        while (done < pending) {
+            Event* run;
+            size_t count = measurementEvents.peek(run, pending - done, done);
+            int runAttempted;
+            int* runStatusCodes = sendThroughBreaker(run, count, runAttempted);
+            for (size_t i = 0; i < count; i++) {
+                statusCodes[done + i] = runStatusCodes[i];
+                attempted[done + i] = (int)i < runAttempted;
+            }
+            done += count;
         }
 
-        // Calculate the actual number of events to return, should not exceed the available count or the size of the passed array
-        int eventsToReturn = min(size, measurementEventsCount);
-
-        // Calculate the start index for the oldest events in the circular buffer
-        int startIdx = measurementEventsCount % (MAX_MEASUREMENTS + MAX_EXCESS_EVENTS);
+        // keep the events that were not sent successfully, in order
+        size_t sent = 0;
+        measurementEvents.retain([this, &statusCodes, &attempted, &sent](Event& event, size_t position) {
+            if (wasSent(statusCodes[position])) {
+                sent++;
+                return false;
+            }
+            return keepAfterFailure(event, statusCodes[position], attempted[position]);
+        });
+        return sent;
+    }
 
-        for (int i = 0; i < eventsToReturn; i++) {
-            int index = (startIdx + i) % (MAX_MEASUREMENTS + MAX_EXCESS_EVENTS);
-            events[i] = measurementEvents[index];
-            measurementEvents[index] = Event(); // Reset the spot in the circular buffer
+    /*
+    * Appends the oldest pending events to the spill log, straight from where they
+    * are stored. They leave RAM only once the append succeeded, so a failed one,
+    * e.g. on a full card, loses nothing. How many is up to the caller, see
+    * FlowController.
+    * @return number of events spilled, at most count
+    */
+    size_t spillExcessEvents(size_t count) {
+        if (spillLog == nullptr) {
+            return 0;
         }
-
-        // Decrement the measurementEventsCount by the number of events returned
-        measurementEventsCount -= eventsToReturn;
-
-        // Compact the array to remove gaps if necessary
-        int remainingEvents = measurementEventsCount;
-        for (int i = 0; i < remainingEvents; i++) {
-            int fromIndex = (startIdx + eventsToReturn + i) % (MAX_MEASUREMENTS + MAX_EXCESS_EVENTS);
-            int toIndex = (startIdx + i) % (MAX_MEASUREMENTS + MAX_EXCESS_EVENTS);
-            measurementEvents[toIndex] = measurementEvents[fromIndex];
-            if (toIndex != fromIndex) {
-                measurementEvents[fromIndex] = Event(); // Clear the vacated spot
+        size_t spilled = 0;
+        while (spilled < count) {
+            Event* oldest;
+            // one run, or two when the buffer wrapped around
+            size_t run = measurementEvents.peek(oldest, count - spilled);
+            if (run == 0) {
+                break;
+            }
+            if (!spillLog->append(oldest, run)) {
+                LOG_ERROR(CONNECTION, "Could not spill %d events, they stay pending", (int)run);
+                break;
             }
+            measurementEvents.discard(run);
+            spilled += run;
         }
-
-        return true;
+        INSTRUMENT_COUNT(COUNTER_SPILLS, spilled);
+        LOG_DEBUG(CONNECTION, "Spilled %d excess events, %d left pending", (int)spilled, (int)measurementEvents.size());
+        return spilled;
     }
 
 
-    //------------------------ Subscriber Interface ------------------------
-    void update(const Event* events, int size) override {
+    /*
+    * Sends freshly sampled events, the ones that fail are kept pending.
+    * @return number of events sent
+    */
+    size_t sendNewEvents(const Event* events, int size) {
+        startSending();
 
         // make sure size is not greater than MAX_MEASUREMENTS
         if (size > MAX_MEASUREMENTS){
-            Serial.printf("WARNING: Size of events array is greater (%d) than MAX_MEASUREMENTS. Truncating to %d\n", size, MAX_MEASUREMENTS);
+            LOG_WARN(CONNECTION, "Size of events array is greater (%d) than MAX_MEASUREMENTS. Truncating to %d", size, MAX_MEASUREMENTS);
             size = MAX_MEASUREMENTS;
         }
 
         // if the first event is not a measurement event then 
         // can be assumed that the incoming array is an error
         if (events[0].getType() != MEASUREMENT_EVENT){
-            Serial.println("First event is not a measurement event. Ignoring incoming events...");
-            return;
+            LOG_WARN(CONNECTION, "First event is not a measurement event. Ignoring incoming events...");
+            return 0;
         }
 
-        Serial.printf("ConnectionEventManager received an array of %d events...\n", size);
-        int* statusCodes = apiClient.sendEvents(events, size);
+        LOG_DEBUG(CONNECTION, "Received an array of %d events", size);
+        int attempted;
+        int* statusCodes = sendThroughBreaker(events, size, attempted);
 
         
         // add the remainig events to the measurementEvents array (the ones that were not sent successfully)
-        // if the measurementEvents array is full overwrite like in a circular buffer
+        // if the measurementEvents array is full the oldest ones are spilled
 
+        size_t sent = 0;
         for (int i = 0; i < size; i++){
             
             // if the data was sent successfully, do not add it to the measurementEvents array
-            if (statusCodes[i] == OK_STATUS || statusCodes[i] == CREATED_STATUS){
+            if (wasSent(statusCodes[i])){
+                sent++;
                 continue;
             }
-            measurementEvents[measurementEventsCount % (MAX_MEASUREMENTS + MAX_EXCESS_EVENTS)] = events[i];
-            measurementEventsCount++;
+            Event unsent = events[i];
+            if (keepAfterFailure(unsent, statusCodes[i], i < attempted)) {
+                storeUnsent(unsent);
+            }
         }
 
-        logMemoryUsage();
+        // the stats task shows the heap every minute, after every send only when debugging
+        if (LOG_LEVEL_CONNECTION >= LOG_LEVEL_DEBUG) {
+            logMemoryUsage();
+        }
+        return sent;
     }
 
     /*
@@ -200,22 +285,24 @@ public:
     *  are ommited because they are EMPTY events.
     */
     bool updateFromLoadedEvents(Event events[], int size) {
-        Serial.printf("ConnectionEventManager received an array from SD of %d events...\n", size);
+        startSending();
+        LOG_DEBUG(CONNECTION, "Received an array from SD of %d events", size);
 
         // if the first event is not a measurement event then
         // can be assumed that the incoming array is an error
         if (events[0].getType() != MEASUREMENT_EVENT){
-            Serial.println("First event is not a measurement event. Ignoring incoming events...");
+            LOG_WARN(CONNECTION, "First event is not a measurement event. Ignoring incoming events...");
             return true;
         }
 
         // try to send the events
-        int* statusCodes = apiClient.sendEvents(events, size);
+        int attempted;
+        int* statusCodes = sendThroughBreaker(events, size, attempted);
         bool allSent = true;
 
-        // replace the events that were sent successfully with empty events
+        // replace the events that were sent successfully, or given up, with empty events
         for (int i = 0; i < size; i++){
-            if (statusCodes[i] == OK_STATUS || statusCodes[i] == CREATED_STATUS){
+            if (wasSent(statusCodes[i]) || !keepAfterFailure(events[i], statusCodes[i], i < attempted)){
                 events[i] = Event();
             }else{
                 allSent = false;
@@ -226,57 +313,103 @@ public:
     }
 
     //------------------------ Business Logic ------------------------
-    void connect(bool doReconnect = false) {
-
-        // Disconnect if already connected
-        WiFi.disconnect();
-
-        // Connect to WiFi hotspot if not already connected
-        if (!WiFi.isConnected() || lastConnectionEvent.getType() == -1) {
-            Serial.println("Connecting to hotspot...");
-            WiFi.begin(MY_SSID, MY_PASSWORD);
-
-            // Wait up to 600 seconds (10 minutes) for connection to succeed
-            for (int count = 0; count < 600; count++) {
-                if (WiFi.status() == WL_CONNECTED) {
-                    Serial.println("Connected to WiFi");
-                    Serial.print("IP Address: ");
-                    Serial.println(WiFi.localIP());
-                    lastConnectionEvent = Event(CONNECTION_EVENT, OK_STATUS, "", "{\"error\":\"Succesfully connected to WiFi\"}"); 
-                    return;
-                }
-                Serial.print(".");
-                delay(1000);
-            }
+    static bool wasSent(int statusCode) {
+        return statusCode == OK_STATUS || statusCode == CREATED_STATUS;
+    }
+
+    // the server answered, whether it took the event or not
+    static bool reachedServer(int statusCode) {
+        return statusCode >= OK_STATUS && statusCode < INTERNAL_SERVER_ERROR;
+    }
 
-            // If connection fails, set the event accordingly
-            lastConnectionEvent = Event(CONNECTION_EVENT, SERVICE_UNAVAILABLE_STATUS, "", "{\"error\":\"Connection failed\"}");
+    void startSending() {
+        lastAttempted = 0;
+        lastSent = 0;
+    }
+
+    /*
+    * Sends the events unless the breaker of the uplink is open, while it is half
+    * open only the first event is sent as the probe. Events that are not sent get
+    * SERVICE_UNAVAILABLE_STATUS. The outcome is fed back to the breaker: it opens
+    * when nothing reaches the server and closes as soon as anything does.
+    * @param attempted: number of events, from the first, handed to the uplink
+    */
+    int* sendThroughBreaker(const Event* events, int n, int& attempted) {
+        n = min(n, UPLINK_MAX_EVENTS);
+        attempted = 0;
+        if (!connection.isUp()) {
+            LOG_DEBUG(CONNECTION, "No WiFi link, keeping the events");
+        } else if (breaker->allowRequest()) {
+            attempted = breaker->isProbing() ? min(n, 1) : n;
         } else {
-            // Already connected
-            Serial.println("Already connected");
-            if (doReconnect) {
-                Serial.println("Reconnecting...");
-                reconnect();
+            LOG_DEBUG(CONNECTION, "Uplink paused after repeated failures, next try in %lu ms", breaker->retryIn());
+        }
+
+        int* results = (attempted > 0) ? uplink->sendEvents(events, attempted) : nullptr;
+        bool reached = false;
+        bool failed = false;
+        for (int i = 0; i < n; i++) {
+            breakerResults[i] = (i < attempted) ? results[i] : SERVICE_UNAVAILABLE_STATUS;
+            if (i >= attempted || events[i].getType() != MEASUREMENT_EVENT) {
+                continue;
+            }
+            reached = reached || reachedServer(results[i]);
+            failed = failed || !reachedServer(results[i]);
+            lastSent += wasSent(results[i]) ? 1 : 0;
+        }
+        lastAttempted += attempted;
+
+        if (reached) {
+            breaker->recordSuccess();
+            connection.noteAlive();
+        } else if (failed) {
+            breaker->recordFailure();
+            if (breaker->state() == BREAKER_OPEN) {
+                LOG_WARN(CONNECTION, "Uplink failing, pausing it for %lu ms", breaker->getBackoff());
             }
+        } else if (breaker->isProbing()) {
+            breaker->releaseProbe();
         }
+        return breakerResults;
     }
 
-    void reconnect() {
-        // Disconnect and reconnect to WiFi
-        WiFi.disconnect();
-        delay(1000);
-        return connect(false);
+    /*
+    * Counts a failed send of the event. Only a rejection by the server counts in
+    * timesSent: events held back by the breaker or lost on the way are kept as
+    * they are, however long the outage. An event the server kept rejecting is
+    * given up once it used its retry budget, so one bad event cannot hold the
+    * backlog forever.
+    * @return false if the event is given up
+    */
+    bool keepAfterFailure(Event& event, int statusCode, bool attempted) {
+        if (!attempted) {
+            return true;
+        }
+        INSTRUMENT_COUNT(COUNTER_SEND_RETRIES, 1);
+        if (!reachedServer(statusCode)) {
+            return true;
+        }
+        if (++event.timesSent < EVENT_RETRY_BUDGET) {
+            return true;
+        }
+        LOG_WARN(CONNECTION, "Giving up an event rejected %d times, last status %d", event.timesSent, statusCode);
+        givenUpCount++;
+        INSTRUMENT_COUNT(COUNTER_GIVEN_UP, 1);
+        return false;
     }
 
-    Event check_connection(){
-        // Check connection
-        if (!client.connect("www.google.com", 80)) {
-            Serial.println("Connection failed");
-            return Event(CONNECTION_EVENT, SERVICE_UNAVAILABLE_STATUS, "", "{\"error\":\"Connection failed\"}");
-        } else {
-            Serial.println("Connection successful");
-            return Event(CONNECTION_EVENT, OK_STATUS, "", "{\"error\":\"Connection successful\"}");
+    void storeUnsent(const Event& event) {
+        unsigned long dropped = measurementEvents.dropped();
+        if (measurementEvents.push(event) || measurementEvents.policy() != OVERFLOW_SPILL) {
+            INSTRUMENT_COUNT(COUNTER_DROPS, measurementEvents.dropped() - dropped);
+            return;
+        }
+        if (spillExcessEvents(MAX_EVENTS_PER_FILE) == 0) {
+            LOG_ERROR(CONNECTION, "Could not spill unsent events, dropping the oldest one");
+            measurementEvents.dropOldest();
+            INSTRUMENT_COUNT(COUNTER_DROPS, 1);
         }
+        measurementEvents.push(event);
     }
 
 };
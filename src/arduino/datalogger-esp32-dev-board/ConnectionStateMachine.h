@@ -0,0 +1,159 @@
+#ifndef CONNECTION_STATE_MACHINE_H
+#define CONNECTION_STATE_MACHINE_H
+
+#include <atomic>
+#include "Scheduler.h"
+#include "CircuitBreaker.h"
+
+#define CONNECT_TIMEOUT 20000           // ms an attempt may take before the radio is reset
+#define CONNECT_POLL_INTERVAL 250       // ms between status checks while connecting
+#define LINK_CHECK_INTERVAL 1000        // ms between status checks while connected
+#define LIVENESS_TIMEOUT 600000         // ms without a sign of life before the link is probed
+#define RECONNECT_BASE_BACKOFF 2000     // ms, first wait after a failed attempt
+#define RECONNECT_MAX_BACKOFF 300000    // ms, the wait doubles with every failed attempt up to this
+
+enum LinkState {
+    LINK_DOWN,          // waiting for the backoff to end before the next attempt
+    LINK_CONNECTING,    // an attempt is running
+    LINK_UP
+};
+
+/*
+* Time to get the link back and how often it was lost.
+*/
+struct LinkStats {
+    unsigned long attempts;
+    unsigned long reconnects;
+    unsigned long lastReconnectMs;      // from losing the link to having it back
+    unsigned long maxReconnectMs;
+};
+
+/*
+* Keeps the WiFi link up without ever blocking: every resume does one status check
+* and returns, so it runs from a Scheduler next to the other tasks. Attempts that
+* time out, or a link that is lost, wait for a backoff with jitter before the next
+* attempt, see CircuitBreaker. The link is taken as alive while the uplink gets
+* answers (noteAlive); only after LIVENESS_TIMEOUT without one is it probed, and a
+* failed probe resets it. A lost link reported by the radio's event handler
+* (notifyLinkLost) is acted on at the next resume.
+* The Radio does the work and is mocked on the host, it needs
+*   void begin()            start connecting
+*   bool isConnected()
+*   void disconnect()
+*   bool probe()            cheap check that the link carries traffic
+* This header does not depend on Arduino.
+*/
+template <typename Radio>
+class ConnectionStateMachine : public ResumableTask {
+public:
+    ConnectionStateMachine(Radio& radio, BreakerClock clock, uint32_t seed)
+        : radio_(radio), backoff_(clock, seed, 1, RECONNECT_BASE_BACKOFF, RECONNECT_MAX_BACKOFF),
+          state_(LINK_DOWN), attemptStart_(0), lostAt_(0), lastAlive_(0), lostSinceStart_(false),
+          aliveSeen_(false), linkLost_(false) {
+        stats_ = LinkStats();
+    }
+
+    long resume(unsigned long now) override {
+        if (linkLost_.exchange(false) && state_ == LINK_UP) {
+            lose(now);
+        }
+
+        switch (state_) {
+            case LINK_DOWN:
+                if (!backoff_.allowRequest()) {
+                    return waitFor(backoff_.retryIn());
+                }
+                radio_.begin();
+                state_ = LINK_CONNECTING;
+                attemptStart_ = now;
+                stats_.attempts++;
+                return CONNECT_POLL_INTERVAL;
+
+            case LINK_CONNECTING:
+                if (radio_.isConnected()) {
+                    up(now);
+                    return LINK_CHECK_INTERVAL;
+                }
+                if (now - attemptStart_ >= CONNECT_TIMEOUT) {
+                    radio_.disconnect();
+                    backoff_.recordFailure();
+                    state_ = LINK_DOWN;
+                    return waitFor(backoff_.retryIn());
+                }
+                return CONNECT_POLL_INTERVAL;
+
+            case LINK_UP:
+            default:
+                if (!radio_.isConnected()) {
+                    lose(now);
+                    return 0;
+                }
+                if (aliveSeen_.exchange(false)) {
+                    lastAlive_ = now;
+                }
+                if (now - lastAlive_ >= LIVENESS_TIMEOUT) {
+                    if (!radio_.probe()) {
+                        lose(now);
+                        return 0;
+                    }
+                    lastAlive_ = now;
+                }
+                return LINK_CHECK_INTERVAL;
+        }
+    }
+
+    // The uplink got an answer, so the link works; callable from any task
+    void noteAlive() {
+        aliveSeen_ = true;
+    }
+
+    // Called from the radio's event handler, which may run on another task
+    void notifyLinkLost() {
+        linkLost_ = true;
+    }
+
+    bool isUp() const { return state_ == LINK_UP; }
+    LinkState state() const { return state_; }
+    const LinkStats& stats() const { return stats_; }
+
+private:
+    Radio& radio_;
+    CircuitBreaker backoff_;
+    LinkState state_;
+    unsigned long attemptStart_;
+    unsigned long lostAt_;
+    unsigned long lastAlive_;
+    bool lostSinceStart_;
+    std::atomic<bool> aliveSeen_;
+    std::atomic<bool> linkLost_;
+    LinkStats stats_;
+
+    void up(unsigned long now) {
+        state_ = LINK_UP;
+        backoff_.recordSuccess();
+        lastAlive_ = now;
+        aliveSeen_ = false;
+        if (lostSinceStart_) {
+            stats_.reconnects++;
+            stats_.lastReconnectMs = now - lostAt_;
+            if (stats_.lastReconnectMs > stats_.maxReconnectMs) {
+                stats_.maxReconnectMs = stats_.lastReconnectMs;
+            }
+        }
+    }
+
+    void lose(unsigned long now) {
+        radio_.disconnect();
+        state_ = LINK_DOWN;
+        lostAt_ = now;
+        lostSinceStart_ = true;
+        // the first attempt after losing the link is immediate, retries back off
+        backoff_.reset();
+    }
+
+    static long waitFor(unsigned long ms) {
+        return (long)((ms < LINK_CHECK_INTERVAL) ? ms : LINK_CHECK_INTERVAL);
+    }
+};
+
+#endif // CONNECTION_STATE_MACHINE_H
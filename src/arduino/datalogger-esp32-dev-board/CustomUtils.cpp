@@ -1,4 +1,12 @@
 #include "CustomUtils.h"
+#include "Instrumentation.h"
+#include "Log.h"
+
+// Index of the backlog files in the root directory, see findFileByDate
+static BacklogIndex backlogIndex;
+static const char* backlogDir = "/";
+
+static bool isBacklogFile(const char* path, uint32_t &timestamp);
 
 void logMemoryUsage() {
   long int free_hmem = ESP.getFreeHeap();
@@ -6,58 +14,62 @@ void logMemoryUsage() {
   long int free_mem = ESP.getFreePsram();
   long int total_mem = ESP.getPsramSize();
 
+  long int min_free_hmem = ESP.getMinFreeHeap();
+  long int largest_block = ESP.getMaxAllocHeap();
+
   float usedPercentage = ((float)(total_hmem - free_hmem) * 100.0f) / (float)total_hmem;
+  // share of the free heap that cannot be had in one block
+  float fragmentation = (free_hmem > 0) ? 100.0f - ((float)largest_block * 100.0f) / (float)free_hmem : 0.0f;
+
+  LOG_INFO(SYSTEM, "Free H. memory: %ld B, Total H. memory: %ld B, used H. percentage: %.2f", free_hmem, total_hmem, usedPercentage);
+  LOG_INFO(SYSTEM, "Lowest free H. memory: %ld B, largest free block: %ld B, fragmentation: %.2f", min_free_hmem, largest_block, fragmentation);
+  LOG_INFO(SYSTEM, "Free memory: %ld B, Total memory: %ld B", free_mem, total_mem);
+}
 
-  Serial.printf("\tFree H. memory: %d B, Total H. memory: %d B, used H. percentage: %.2f\n", free_hmem, total_hmem, usedPercentage);
-  Serial.printf("\tFree memory: %d B, Total memory: %d B\n", free_mem, total_mem);
+uint32_t freeHeapBytes() {
+  return ESP.getFreeHeap();
 }
 
 void listDir(fs::FS &fs, const char * dirname, uint8_t levels){
-    Serial.printf("Listing directory: %s\n", dirname);
+    LOG_INFO(STORAGE, "Listing directory: %s", dirname);
 
     File root = fs.open(dirname);
     if(!root){
-        Serial.println("Failed to open directory");
+        LOG_ERROR(STORAGE, "Failed to open directory %s", dirname);
         return;
     }
     if(!root.isDirectory()){
-        Serial.println("Not a directory");
+        LOG_ERROR(STORAGE, "%s is not a directory", dirname);
         return;
     }
 
     File file = root.openNextFile();
     while(file){
         if(file.isDirectory()){
-            Serial.print("  DIR : ");
-            Serial.println(file.name());
+            LOG_INFO(STORAGE, "  DIR : %s", file.name());
             if(levels){
                 listDir(fs, file.path(), levels -1);
             }
         } else {
-            Serial.print("  FILE: ");
-            Serial.print(file.name());
-            Serial.print("  SIZE: ");
-            Serial.println(file.size());
+            LOG_INFO(STORAGE, "  FILE: %s  SIZE: %lu", file.name(), (unsigned long)file.size());
         }
         file = root.openNextFile();
     }
 }
 
 void createDir(fs::FS &fs, const char * path){
-    Serial.printf("Creating Dir: %s\n", path);
     if(fs.mkdir(path)){
-        Serial.println("Dir created");
+        LOG_INFO(STORAGE, "Created dir %s", path);
     } else {
-        Serial.println("mkdir failed");
+        LOG_ERROR(STORAGE, "mkdir %s failed", path);
     }
 }
 
 void removeDir(fs::FS &fs, const char * path){
-    Serial.printf("Removing Dir: %s\n", path);
     if(fs.rmdir(path)){
-        Serial.println("Dir removed");
+        LOG_INFO(STORAGE, "Removed dir %s", path);
     } else {
-        Serial.println("rmdir failed");
+        LOG_ERROR(STORAGE, "rmdir %s failed", path);
     }
 }
 
@@ -78,52 +90,50 @@ void readFile(fs::FS &fs, const char * path){
 }
 
 void writeFile(fs::FS &fs, const char * path, const char * message){
-    Serial.printf("Writing file: %s\n", path);
-
     File file = fs.open(path, FILE_WRITE);
     if(!file){
-        Serial.println("Failed to open file for writing");
+        LOG_ERROR(STORAGE, "Failed to open %s for writing", path);
         return;
     }
     if(file.print(message)){
-        Serial.println("File written");
+        LOG_DEBUG(STORAGE, "Wrote %s", path);
     } else {
-        Serial.println("Write failed");
+        LOG_ERROR(STORAGE, "Write to %s failed", path);
     }
     file.close();
 }
 
 void appendFile(fs::FS &fs, const char * path, const char * message){
-    Serial.printf("Appending to file: %s\n", path);
-
     File file = fs.open(path, FILE_APPEND);
     if(!file){
-        Serial.println("Failed to open file for appending");
+        LOG_ERROR(STORAGE, "Failed to open %s for appending", path);
         return;
     }
     if(file.print(message)){
-        Serial.println("Message appended");
+        LOG_DEBUG(STORAGE, "Appended to %s", path);
     } else {
-        Serial.println("Append failed");
+        LOG_ERROR(STORAGE, "Append to %s failed", path);
     }
     file.close();
 }
 
 void renameFile(fs::FS &fs, const char * path1, const char * path2){
-    Serial.printf("Renaming file %s to %s\n", path1, path2);
     if (fs.rename(path1, path2)) {
-        Serial.println("File renamed");
+        LOG_DEBUG(STORAGE, "Renamed %s to %s", path1, path2);
     } else {
-        Serial.println("Rename failed");
+        LOG_ERROR(STORAGE, "Renaming %s to %s failed", path1, path2);
     }
 }
 
 void deleteFile(fs::FS &fs, const char * path){
-    Serial.printf("Deleting file: %s\n", path);
     if(fs.remove(path)){
-        Serial.println("File deleted");
+        uint32_t timestamp;
+        if (isBacklogFile(path, timestamp)) {
+            backlogIndex.remove(timestamp);
+        }
+        LOG_DEBUG(STORAGE, "Deleted %s", path);
     } else {
-        Serial.println("Delete failed");
+        LOG_ERROR(STORAGE, "Deleting %s failed", path);
     }
 }
 
@@ -131,23 +141,21 @@ void showAditionalSDCardInfo(fs::SDFS &fs) {
   uint8_t cardType = fs.cardType();
 
   if(cardType == CARD_NONE){
-      Serial.println("No SD card attached");
+      LOG_WARN(STORAGE, "No SD card attached");
       return;
   }
 
-    Serial.print("SD Card Type: ");
+    const char* typeName = "UNKNOWN";
     if(cardType == CARD_MMC){
-        Serial.println("MMC");
+        typeName = "MMC";
     } else if(cardType == CARD_SD){
-        Serial.println("SDSC");
+        typeName = "SDSC";
     } else if(cardType == CARD_SDHC){
-        Serial.println("SDHC");
-    } else {
-        Serial.println("UNKNOWN");
+        typeName = "SDHC";
     }
 
     uint64_t cardSize = fs.cardSize() / (1024 * 1024);
-    Serial.printf("SD Card Size: %lluMB\n", cardSize);
+    LOG_INFO(STORAGE, "SD Card Type: %s, Size: %lluMB", typeName, (unsigned long long)cardSize);
 }
 
 
@@ -160,30 +168,40 @@ void showAditionalSDCardInfo(fs::SDFS &fs) {
 * @return true if the events were stored successfully, false otherwise
 */
 bool storeEvents(fs::FS &fs, Event* events, int numEvents, const char * path){
-    Serial.printf("Storing %d events in file: %s\n", numEvents, path);
+    INSTRUMENT_STAGE(STAGE_SD_STORE);
+    LOG_DEBUG(STORAGE, "Storing %d events in file: %s", numEvents, path);
     File file = fs.open(path, FILE_WRITE, true);
 
     if(!file){
-        Serial.println("Failed to open file for writing");
+        LOG_ERROR(STORAGE, "Failed to open %s for writing", path);
         return false;
     }
 
     const Event emptyEvent = Event();
 
+    // every line ends with its own newline
+    PrintSink<File> sink(file);
     for (int i = 0; i < numEvents; i++) {
         if (events[i] == emptyEvent) {
             continue;
         }
-        file.print(events[i].toString());
-        file.print("\n");
+        events[i].writeTo(sink);
     }
+    sink.flush();
 
     file.close();
+
+    uint32_t timestamp;
+    if (isBacklogFile(path, timestamp)) {
+        backlogIndex.add(timestamp);
+    }
     return true;
 }
 
 /*
-* load events from a file
+* load events from a file, lines are read into a fixed buffer and parsed in place.
+* Blank lines are skipped, malformed lines are reported and skipped. Slots that
+* could not be filled are set to the empty event.
 * @param fs: file system object
 * @param events: array of events
 * @param numevents: number of events to load
@@ -191,17 +209,49 @@ bool storeEvents(fs::FS &fs, Event* events, int numEvents, const char * path){
 * @return true if the events were loaded successfully, false otherwise
 */
 bool loadEvents(fs::FS &fs, Event* events, int numEvents, const char * path){
-    Serial.printf("Loading %d events from file: %s\n", numEvents, path);
+    INSTRUMENT_STAGE(STAGE_SD_LOAD);
+    LOG_DEBUG(STORAGE, "Loading %d events from file: %s", numEvents, path);
     File file = fs.open(path, FILE_READ);
 
     if(!file){
-        Serial.println("Failed to open file for reading");
+        LOG_ERROR(STORAGE, "Failed to open %s for reading", path);
+        // do not offer it again if it was a backlog file
+        uint32_t timestamp;
+        if (isBacklogFile(path, timestamp)) {
+            backlogIndex.remove(timestamp);
+        }
         return false;
     }
 
-    for (int i = 0; i < numEvents; i++) {
-        String line = file.readStringUntil('\n');
-        events[i] = Event(line);
+    char line[EVENT_LINE_MAX_LENGTH];
+    EventLine parsed;
+    int loaded = 0;
+    int lineNumber = 0;
+
+    while (loaded < numEvents && file.available()) {
+        size_t length = file.readBytesUntil('\n', line, sizeof(line));
+        lineNumber++;
+
+        // the line did not fit in the buffer, drop the rest of it
+        if (length == sizeof(line)) {
+            while (file.available() && file.read() != '\n') {}
+            LOG_WARN(STORAGE, "Line %d of %s is too long, skipping it", lineNumber, path);
+            continue;
+        }
+
+        int status = parseEventLine(line, length, parsed);
+        if (status == EVENT_LINE_EMPTY) {
+            continue;
+        }
+        if (status == EVENT_LINE_MALFORMED) {
+            LOG_WARN(STORAGE, "Line %d of %s is malformed, skipping it", lineNumber, path);
+            continue;
+        }
+        events[loaded++] = Event(parsed);
+    }
+
+    for (int i = loaded; i < numEvents; i++) {
+        events[i] = Event();
     }
 
     file.close();
@@ -209,102 +259,110 @@ bool loadEvents(fs::FS &fs, Event* events, int numEvents, const char * path){
 }
 
 
-// Helper function to extract the timestamp from a filename
-unsigned long getTimestampFromFilename(const char* filename) {
-    String fname(filename);
-    int dotIndex = fname.lastIndexOf('.');
-    if(dotIndex != -1) {
-        return fname.substring(0, dotIndex).toInt();
+/*
+* Whether the path names a backlog file, '/<timestamp>.txt' in the backlog directory.
+* @param timestamp: the timestamp in the name, if it is a backlog file
+*/
+static bool isBacklogFile(const char* path, uint32_t &timestamp) {
+    const char* name = strrchr(path, '/');
+    size_t dirLength = (name == nullptr) ? 0 : name - path + 1;
+    name = (name == nullptr) ? path : name + 1;
+
+    // the backlog lives in the root directory
+    if (dirLength != strlen(backlogDir) || strncmp(path, backlogDir, dirLength) != 0) {
+        return false;
     }
-    return 0;
+
+    char* end;
+    timestamp = strtoul(name, &end, 10);
+    return end != name && strcmp(end, ".txt") == 0;
 }
 
-// Function to find the most recent or oldest file
-String findFileByDate(fs::FS &fs, const char *dirname, bool findNewest) {
+/*
+* Scans the directory once and fills the backlog index with the files found.
+* @param keepNewest: which end to keep when there are more files than the index holds
+*/
+void rebuildBacklogIndex(fs::FS &fs, const char *dirname, bool keepNewest) {
+    INSTRUMENT_STAGE(STAGE_DIR_SCAN);
     File root = fs.open(dirname);
     if (!root || !root.isDirectory()) {
-        Serial.println("Failed to open directory or not a directory");
-        return String(""); // Return an empty string if there are issues
+        LOG_ERROR(STORAGE, "Failed to open %s or not a directory", dirname);
+        backlogIndex.invalidate();
+        return;
     }
 
-    Serial.println("Looking files in SD card ...");
-    File file = root.openNextFile();
-    unsigned long oldestTimestamp = ULONG_MAX;
-    unsigned long newestTimestamp = 0;
-    String oldestFile;
-    String newestFile;
+    LOG_DEBUG(STORAGE, "Indexing files in SD card");
+    backlogIndex.beginRebuild(keepNewest);
 
+    File file = root.openNextFile();
     while (file) {
         if (!file.isDirectory()) {
-            String filename = file.name();
-            if (filename.endsWith(".txt")) {
-                unsigned long timestamp = getTimestampFromFilename(filename.c_str());
-                if (timestamp < oldestTimestamp) {
-                    oldestTimestamp = timestamp;
-                    oldestFile = filename; 
-                    Serial.println("Oldest file:" + oldestFile);
-                }
-                if (timestamp > newestTimestamp) {
-                    newestTimestamp = timestamp;
-                    newestFile = filename;
-                    Serial.println("Newest file:" + newestFile);
-                }
+            // older cores return the full path as the name
+            const char* name = strrchr(file.name(), '/');
+            name = (name == nullptr) ? file.name() : name + 1;
+
+            char* end;
+            uint32_t timestamp = strtoul(name, &end, 10);
+            if (end != name && strcmp(end, ".txt") == 0) {
+                backlogIndex.add(timestamp);
             }
         }
         file = root.openNextFile();
     }
-
     root.close();
 
-    // Return the file name based on whether the newest or oldest is requested
-    return findNewest ? newestFile : oldestFile;
+    LOG_INFO(STORAGE, "Indexed %d backlog files%s", backlogIndex.size(), backlogIndex.truncated() ? " (more left on the card)" : "");
 }
 
-
 /*
-* format of the string is: 
-    'YYYY-MM-DDThh:mm:ss +/-xx:xx'
+* Whether backlog files may be left on the card. Until the directory was scanned
+* once the answer is yes, so findFileByDate gets to build the index.
 */
-DateTime fromTimestampStringToDatetime(const String &dtString){
-    int year = dtString.substring(0, 4).toInt();
-    int month = dtString.substring(5, 7).toInt();
-    int day = dtString.substring(8, 10).toInt();
-    int hour = dtString.substring(11, 13).toInt();
-    int minute = dtString.substring(14, 16).toInt();
-    int second = dtString.substring(17, 19).toInt();
-    return DateTime(year, month, day, hour, minute, second);
-}
-
-// Function to check if a given year is a leap year
-bool isLeapYear(int year) {
-    return (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+bool hasBacklogFiles() {
+    return !backlogIndex.built() || backlogIndex.size() > 0 || backlogIndex.truncated();
 }
 
+/*
+* Function to find the most recent or oldest file, its path is written into path. The directory is only scanned when
+* the index is first used or when the indexed window runs out, storeEvents and deleteFile
+* keep it up to date otherwise.
+*/
+bool findFileByDate(fs::FS &fs, const char *dirname, char *path, size_t size, bool findNewest) {
+    if (strcmp(dirname, backlogDir) != 0) {
+        LOG_WARN(STORAGE, "Only %s is indexed", backlogDir);
+        return false;
+    }
 
-// Get the Unix timestamp for this DateTime object
-long long fromDatetimeToUnix(const DateTime &dt) {
-    // Months days count from January to December, ignoring leap years
-    static int monthDays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    long long days = 0;
-
-    // Count all days from years between 1970 and the given year exclusive
-    for (int y = 1970; y < dt.year; y++) {
-        days += 365 + isLeapYear(y);
+    if (backlogIndex.needsRebuild(findNewest)) {
+        rebuildBacklogIndex(fs, dirname, findNewest);
     }
 
-    // Count all days from months in the given year
-    for (int m = 0; m < dt.month - 1; m++) {
-        days += monthDays[m];
-        if (m == 1 && isLeapYear(dt.year)) // February in leap year
-            days += 1;
+    uint32_t timestamp;
+    bool found = findNewest ? backlogIndex.newest(timestamp) : backlogIndex.oldest(timestamp);
+    if (!found) {
+        return false;
     }
 
-    // Add days in the current month
-    days += dt.day - 1;
+    int length = snprintf(path, size, "%s%lu.txt", backlogDir, (unsigned long)timestamp);
+    return length > 0 && (size_t)length < size;
+}
 
-    // Convert all days to seconds
-    long long totalSeconds = days * 86400LL;
-    totalSeconds += (dt.hours * 3600 + dt.minutes * 60 + dt.seconds);
 
-    return totalSeconds;
-}
\ No newline at end of file
+/*
+* format of the string is: 
+    'YYYY-MM-DDThh:mm:ss +/-xx:xx'
+*/
+DateTime fromTimestampStringToDatetime(const String &dtString){
+    uint32_t epoch;
+    if (!parseIsoTimestamp(dtString.c_str(), dtString.length(), epoch)) {
+        return DateTime(0, 0, 0, 0, 0, 0);
+    }
+    CivilTime civil = civilFromEpoch(epoch);
+    return DateTime(civil.year, civil.month, civil.day, civil.hour, civil.minute, civil.second);
+}
+
+// Get the Unix timestamp for this DateTime object, see daysFromCivil
+long long fromDatetimeToUnix(const DateTime &dt) {
+    long long days = daysFromCivil(dt.year, dt.month, dt.day);
+    return days * 86400LL + (dt.hours * 3600 + dt.minutes * 60 + dt.seconds);
+}
@@ -13,6 +13,7 @@
 #endif
 
 #include "Event.h"
+#include "BacklogIndex.h"
 
 
 
@@ -22,6 +23,7 @@ long long fromDatetimeToUnix(const DateTime &dt);
 
 // Memory related functions
 void logMemoryUsage();
+uint32_t freeHeapBytes();
 
 // File system related functions
 void createDir(fs::FS &fs, const char * path);
@@ -35,6 +37,8 @@ void deleteFile(fs::FS &fs, const char * path);
 void showAditionalSDCardInfo(fs::SDFS &fs);
 bool storeEvents(fs::FS &fs, Event* events, int numEvents, const char * path);
 bool loadEvents(fs::FS &fs, Event* events, int numEvents, const char * path);
-String findFileByDate(fs::FS &fs, const char *dirname, bool findNewest = true);
+bool findFileByDate(fs::FS &fs, const char *dirname, char *path, size_t size, bool findNewest = true);
+void rebuildBacklogIndex(fs::FS &fs, const char *dirname, bool keepNewest);
+bool hasBacklogFiles();
 
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef DS3231_CLOCK_H
+#define DS3231_CLOCK_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "ClockService.h"
+#include "TimeUtils.h"
+#include "Instrumentation.h"
+
+#define DS3231_ADDRESS 0x68
+#define DS3231_TIME_REGISTER 0x00
+#define DS3231_TIME_LENGTH 7        // seconds, minutes, hours, weekday, date, month/century, year
+
+/*
+* The DS3231 as a ClockSource. The seven time registers are read in one burst,
+* the chip latches them at the start of the transfer so the fields always belong
+* to the same second, unlike one bus transaction per field.
+*/
+class Ds3231Clock : public ClockSource {
+public:
+    explicit Ds3231Clock(TwoWire& wire = Wire) : wire_(wire) {}
+
+    bool read(uint32_t& epoch) override {
+        INSTRUMENT_STAGE(STAGE_RTC_READ);
+        wire_.beginTransmission(DS3231_ADDRESS);
+        wire_.write(DS3231_TIME_REGISTER);
+        if (wire_.endTransmission(false) != 0) {
+            return false;
+        }
+        if (wire_.requestFrom((uint8_t)DS3231_ADDRESS, (uint8_t)DS3231_TIME_LENGTH) != DS3231_TIME_LENGTH) {
+            return false;
+        }
+        uint8_t registers[DS3231_TIME_LENGTH];
+        for (int i = 0; i < DS3231_TIME_LENGTH; i++) {
+            registers[i] = (uint8_t)wire_.read();
+        }
+
+        CivilTime civil;
+        civil.second = fromBcd(registers[0] & 0x7F);
+        civil.minute = fromBcd(registers[1] & 0x7F);
+        if (registers[2] & 0x40) {
+            // 12 hour mode, bit 5 is PM
+            uint8_t hour = fromBcd(registers[2] & 0x1F) % 12;
+            civil.hour = (registers[2] & 0x20) ? hour + 12 : hour;
+        } else {
+            civil.hour = fromBcd(registers[2] & 0x3F);
+        }
+        civil.day = fromBcd(registers[4] & 0x3F);
+        civil.month = fromBcd(registers[5] & 0x1F);
+        civil.year = 2000 + fromBcd(registers[6]) + ((registers[5] & 0x80) ? 100 : 0);
+
+        // a chip that lost power or a garbled transfer gives fields out of range
+        if (civil.second > 59 || civil.minute > 59 || civil.hour > 23 || civil.day < 1 || civil.day > 31 ||
+            civil.month < 1 || civil.month > 12) {
+            return false;
+        }
+        epoch = epochFromCivil(civil);
+        return true;
+    }
+
+    // Sets the time in 24 hour mode, also in one burst
+    bool write(uint32_t epoch) override {
+        CivilTime civil = civilFromEpoch(epoch);
+        if (civil.year < 2000 || civil.year > 2199) {
+            return false;
+        }
+        uint8_t year = civil.year - 2000;
+        // weekday 1..7 with 1970-01-01, a Thursday, as 5
+        uint8_t weekday = (uint8_t)((dayNumber(epoch) + 4) % 7 + 1);
+
+        wire_.beginTransmission(DS3231_ADDRESS);
+        wire_.write(DS3231_TIME_REGISTER);
+        wire_.write(toBcd(civil.second));
+        wire_.write(toBcd(civil.minute));
+        wire_.write(toBcd(civil.hour));
+        wire_.write(weekday);
+        wire_.write(toBcd(civil.day));
+        wire_.write(toBcd(civil.month) | (year >= 100 ? 0x80 : 0));
+        wire_.write(toBcd(year % 100));
+        return wire_.endTransmission() == 0;
+    }
+
+private:
+    TwoWire& wire_;
+
+    static uint8_t fromBcd(uint8_t value) {
+        return (value >> 4) * 10 + (value & 0x0F);
+    }
+
+    static uint8_t toBcd(uint8_t value) {
+        return ((value / 10) << 4) | (value % 10);
+    }
+};
+
+#endif // DS3231_CLOCK_H
@@ -1,10 +1,13 @@
 #include "Event.h"
+#include "Log.h"
 
 Event::Event() {
     type_ = UNKNOWN_EVENT; // Initialize with an unknown type
     statusCode_ = -1;
     timestamp_ = "";
     data_ = "{}";
+    numRecords_ = 0;
+    epoch_ = 0;
 }
 
 Event::Event(int type,
@@ -15,21 +18,59 @@ Event::Event(int type,
     statusCode_ = statusCode;
     timestamp_ = timestamp;
     data_ = data;
+    numRecords_ = 0;
+    epoch_ = 0;
 }
 
-Event::Event(String eventString){
+/*
+* Builds a measurement event, the records are copied into the event so the
+* caller can reuse its array.
+*/
+Event::Event(int statusCode,
+             const MeasurementRecord* records,
+             int numRecords) {
+    type_ = MEASUREMENT_EVENT;
+    statusCode_ = statusCode;
+    timestamp_ = "";
+    data_ = "";
+    numRecords_ = 0;
+    epoch_ = 0;
+
+    if (numRecords > MAX_RECORDS_PER_EVENT) {
+        LOG_WARN(SYSTEM, "%d records do not fit in an event. Truncating to %d", numRecords, MAX_RECORDS_PER_EVENT);
+        numRecords = MAX_RECORDS_PER_EVENT;
+    }
+    for (int i = 0; i < numRecords; i++) {
+        records_[numRecords_++] = records[i];
+    }
+}
+
+/*
+* Parses a line written by toString, malformed lines give the empty event.
+*/
+Event::Event(String eventString) : Event() {
+    EventLine line;
+    if (parseEventLine(eventString.begin(), eventString.length(), line) == EVENT_LINE_OK) {
+        *this = Event(line);
+    }
+}
 
-    //parse the string to get the event attributes
-    int typeIndex = eventString.indexOf("\"type\":") + 7;
-    int statusCodeIndex = eventString.indexOf("\"statusCode\":") + 14;
-    int timestampIndex = eventString.indexOf("\"datetime\":\"") + 12;
-    int dataIndex = eventString.indexOf("\"data\":") + 7;
+Event::Event(const EventLine& line) {
+    type_ = line.type;
+    statusCode_ = line.statusCode;
+    data_ = line.data;
+    timesSent = line.timesSent;
+    numRecords_ = 0;
+    epoch_ = 0;
+
+    // a datetime written from an epoch goes back to the epoch, anything else is kept as text
+    if (line.datetimeLength != ISO_TIMESTAMP_LENGTH || !parseIsoTimestamp(line.datetime, line.datetimeLength, epoch_)) {
+        timestamp_ = line.datetime;
+    }
 
-    type_ = eventString.substring(typeIndex, eventString.indexOf(",", typeIndex)).toInt();
-    statusCode_ = eventString.substring(statusCodeIndex, eventString.indexOf(",", statusCodeIndex)).toInt();
-    timestamp_ = eventString.substring(timestampIndex, eventString.indexOf("\",", timestampIndex));
-    data_ = eventString.substring(dataIndex, eventString.indexOf("timesSent") - 2);
-    timesSent = eventString.substring(eventString.indexOf("timesSent") + 11, eventString.indexOf("}", eventString.indexOf("timesSent"))).toInt();
+    for (int i = 0; i < line.numRecords && i < MAX_RECORDS_PER_EVENT; i++) {
+        records_[numRecords_++] = line.records[i];
+    }
 }
 
 int Event::getType() const {
@@ -40,11 +81,33 @@ int Event::getStatusCode() const {
     return statusCode_;
 }
 
+/*
+* The text timestamp, events that carry an epoch have it formatted here.
+*/
 String Event::getTimestamp() const {
+    if (timestamp_.length() == 0 && epoch_ != 0) {
+        char datetime[ISO_TIMESTAMP_BUFFER];
+        formatIsoTimestamp(epoch_, datetime);
+        return String(datetime);
+    }
     return timestamp_;
 }
 
-String Event::getData() const {
+/*
+* The text timestamp without allocating: formatted into buffer, which must hold
+* ISO_TIMESTAMP_BUFFER characters, for events that carry an epoch, otherwise the
+* stored text.
+*/
+const char* Event::getTimestamp(char* buffer, size_t& length) const {
+    if (timestamp_.length() == 0 && epoch_ != 0) {
+        length = formatIsoTimestamp(epoch_, buffer);
+        return buffer;
+    }
+    length = timestamp_.length();
+    return timestamp_.c_str();
+}
+
+const String& Event::getData() const {
     return data_;
 }
 
@@ -52,37 +115,61 @@ void Event::setTimestamp(const String& timestamp) {
     timestamp_ = timestamp;
 }
 
+uint32_t Event::getEpoch() const {
+    return epoch_;
+}
 
-String Event::toString() const {
+void Event::setEpoch(uint32_t epoch) {
+    epoch_ = epoch;
+}
 
-    //json like string representation
-    String eventString = "{";
-    eventString += "\"type\":";
-    eventString += type_;
-    eventString += ",\"statusCode\":";
-    eventString += statusCode_;
-    eventString += ",\"datetime\":\"";
-    eventString += timestamp_;
-    eventString += "\",\"data\":";
-    
-    //if data is empty write ""
-    if (data_ == ""){
-        eventString += "\"\"";
-    }else{
-        eventString += data_;
-    }
+const MeasurementRecord* Event::getRecords() const {
+    return records_;
+}
 
-    //add the timesSent attribute
-    eventString += ",\"timesSent\":";
-    eventString += timesSent;
-    eventString += "}";
-    eventString += "\n";
+int Event::getRecordCount() const {
+    return numRecords_;
+}
 
+
+/*
+* Same line as writeTo, built on the heap. Kept for code that needs a String,
+* the cyclic paths print with printTo instead.
+*/
+String Event::toString() const {
+    CountingSink counter;
+    writeTo(counter);
+
+    struct StringSink {
+        String& text;
+        void write(const char* data, size_t length) {
+            text.concat(data, length);
+        }
+    };
+    String eventString;
+    eventString.reserve(counter.count);
+    StringSink sink = {eventString};
+    writeTo(sink);
     return eventString;
 }
 
+size_t Event::printTo(Print& output) const {
+    PrintSink<Print> sink(output);
+    writeTo(sink);
+    sink.flush();
+    return sink.written();
+}
+
 bool Event::operator==(const Event& other) const {
-    return (type_ == other.type_ && statusCode_ == other.statusCode_ && timestamp_ == other.timestamp_ && data_ == other.data_);
+    if (type_ != other.type_ || statusCode_ != other.statusCode_ || numRecords_ != other.numRecords_) {
+        return false;
+    }
+    for (int i = 0; i < numRecords_; i++) {
+        if (records_[i] != other.records_[i]) {
+            return false;
+        }
+    }
+    return (epoch_ == other.epoch_ && timestamp_ == other.timestamp_ && data_ == other.data_);
 }
 
 bool Event::operator!=(const Event& other) const {
@@ -2,6 +2,10 @@
 #define EVENT_H
 
 #include <Arduino.h>
+#include "MeasurementRecord.h"
+#include "EventLineParser.h"
+#include "TimeUtils.h"
+#include "JsonEncoder.h"
 
 // Define event types
 #define TIME_EVENT 0
@@ -30,14 +34,24 @@ public:
 
     Event();
     Event(int type, int statusCode, const String& timestamp, const String& data);
+    Event(int statusCode, const MeasurementRecord* records, int numRecords);
     Event(String eventString);
+    explicit Event(const EventLine& line);
     
     int getType() const;
     int getStatusCode() const;
     String getTimestamp() const;
-    String getData() const;
+    const char* getTimestamp(char* buffer, size_t& length) const;
+    const String& getData() const;
     void setTimestamp(const String& timestamp);
+    uint32_t getEpoch() const;
+    void setEpoch(uint32_t epoch);
+    const MeasurementRecord* getRecords() const;
+    int getRecordCount() const;
     String toString() const;
+    template <typename Sink>
+    void writeTo(Sink& sink) const;
+    size_t printTo(Print& output) const;
 
     // Comparison operators
     bool operator==(const Event& other) const;
@@ -46,10 +60,66 @@ public:
 private:
     int type_;
     int statusCode_;
-    String timestamp_;
+    String timestamp_;              // legacy text timestamp, events carry epoch_ instead
     String data_;
+    uint32_t epoch_;                // seconds of the RTC wall clock, 0 if unknown
+
+    // Measurement payload, kept out of data_ so copying an event does not touch the heap
+    MeasurementRecord records_[MAX_RECORDS_PER_EVENT];
+    uint8_t numRecords_;
 };
 
+/*
+* Writes the line toString returns, including the newline, without building it on
+* the heap. Use this or printTo on the paths that run every cycle.
+*/
+template <typename Sink>
+void Event::writeTo(Sink& sink) const {
+    using namespace json_encoder;
+
+    writeText(sink, "{\"type\":");
+    writeSigned(sink, type_);
+    writeText(sink, ",\"statusCode\":");
+    writeSigned(sink, statusCode_);
+    writeText(sink, ",\"datetime\":\"");
+    char datetime[ISO_TIMESTAMP_BUFFER];
+    size_t datetimeLength;
+    const char* text = getTimestamp(datetime, datetimeLength);
+    sink.write(text, datetimeLength);
+    writeText(sink, "\",\"data\":");
+
+    //if the event carries records write them as an array of arrays,
+    //if data is empty write ""
+    if (numRecords_ > 0) {
+        sink.write("[", 1);
+        for (int i = 0; i < numRecords_; i++) {
+            const MeasurementRecord& record = records_[i];
+            writeText(sink, i > 0 ? ",[" : "[");
+            writeUnsigned(sink, record.variableId);
+            sink.write(",", 1);
+            writeUnsigned(sink, record.cropId);
+            sink.write(",", 1);
+            writeValue(sink, record.value);
+            sink.write(",", 1);
+            writeUnsigned(sink, record.epoch);
+            sink.write(",", 1);
+            writeSigned(sink, record.status);
+            sink.write(",", 1);
+            writeUnsigned(sink, record.timesSent);
+            sink.write("]", 1);
+        }
+        sink.write("]", 1);
+    } else if (data_.length() == 0) {
+        sink.write("\"\"", 2);
+    } else {
+        sink.write(data_.c_str(), data_.length());
+    }
+
+    writeText(sink, ",\"timesSent\":");
+    writeSigned(sink, timesSent);
+    writeText(sink, "}\n");
+}
+
 struct EventArray {
     Event* events;
     int size;
@@ -88,7 +158,7 @@ struct EventArray {
 
     // Overload the [] operator
     Event& operator[](size_t index) {
-        if (index >= size) {
+        if (index >= (size_t)size) {
             // Handle the error, for example, throw an exception
             // For Arduino, you might just halt or reset since exceptions aren't generally used
             Serial.println("Index out of bounds");
@@ -0,0 +1,190 @@
+#include "EventBlockCodec.h"
+#include <string.h>
+#include <math.h>
+
+// Values that do not fit in hundredths, NaN included, are stored as this
+#define EVENT_BLOCK_INVALID_VALUE INT32_MIN
+
+// Room left for the payload length varint in front of the payload
+#define EVENT_BLOCK_LENGTH_BYTES 2
+
+static uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+size_t writeVarint(uint32_t value, uint8_t* out, size_t capacity) {
+    size_t n = 0;
+    do {
+        if (n == capacity) {
+            return 0;
+        }
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[n++] = (value != 0) ? (byte | 0x80) : byte;
+    } while (value != 0);
+    return n;
+}
+
+size_t readVarint(const uint8_t* in, size_t length, uint32_t& value) {
+    value = 0;
+    for (size_t n = 0; n < length && n < 5; n++) {
+        value |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+        if ((in[n] & 0x80) == 0) {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+uint8_t eventBlockCrc(const uint8_t* data, size_t length) {
+    // CRC-8 with polynomial x^8 + x^2 + x + 1
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/*
+* Cursor over the block being written, writes past the end are remembered
+* instead of checked at every call.
+*/
+struct BlockWriter {
+    uint8_t* p;
+    uint8_t* end;
+    bool overflow;
+
+    void varint(uint32_t value) {
+        size_t n = overflow ? 0 : writeVarint(value, p, end - p);
+        overflow = overflow || n == 0;
+        p += n;
+    }
+
+    void string(const char* text, size_t length) {
+        varint(length);
+        if (overflow || (size_t)(end - p) < length + 1) {
+            overflow = true;
+            return;
+        }
+        memcpy(p, text, length);
+        p[length] = '\0';
+        p += length + 1;
+    }
+};
+
+struct BlockReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool malformed;
+
+    uint32_t varint() {
+        uint32_t value = 0;
+        size_t n = malformed ? 0 : readVarint(p, end - p, value);
+        malformed = malformed || n == 0;
+        p += n;
+        return value;
+    }
+
+    const char* string(size_t& length) {
+        length = varint();
+        if (malformed || (size_t)(end - p) < length + 1 || p[length] != '\0') {
+            malformed = true;
+            length = 0;
+            return "";
+        }
+        const char* text = (const char*)p;
+        p += length + 1;
+        return text;
+    }
+};
+
+static int32_t toHundredths(float value) {
+    if (!(fabsf(value) < 21474836.0f)) {
+        return EVENT_BLOCK_INVALID_VALUE;
+    }
+    return (int32_t)lroundf(value * 100.0f);
+}
+
+size_t encodeEventBlock(const EventLine& event, uint8_t* out, size_t capacity) {
+    const size_t header = 1 + EVENT_BLOCK_LENGTH_BYTES;
+    if (capacity < EVENT_BLOCK_OVERHEAD) {
+        return 0;
+    }
+
+    BlockWriter w = {out + header, out + capacity - 1, false};
+    w.varint(zigzag(event.type));
+    w.varint(zigzag(event.statusCode));
+    w.varint(event.timesSent);
+    w.varint(event.numRecords);
+
+    uint32_t firstEpoch = (event.numRecords > 0) ? event.records[0].epoch : 0;
+    for (int i = 0; i < event.numRecords; i++) {
+        const MeasurementRecord& record = event.records[i];
+        w.varint(record.variableId);
+        w.varint(record.cropId);
+        w.varint(zigzag(toHundredths(record.value)));
+        w.varint(i == 0 ? record.epoch : zigzag((int32_t)(record.epoch - firstEpoch)));
+        w.varint(zigzag(record.status - event.statusCode));
+        w.varint(record.timesSent);
+    }
+    w.string(event.datetime, event.datetimeLength);
+    w.string(event.data, event.dataLength);
+
+    size_t length = w.p - (out + header);
+    if (w.overflow || length > EVENT_BLOCK_MAX_PAYLOAD) {
+        return 0;
+    }
+
+    // the payload was written after room for the longest length, move it next to the actual one
+    out[0] = EVENT_BLOCK_MAGIC;
+    size_t lengthBytes = writeVarint(length, out + 1, EVENT_BLOCK_LENGTH_BYTES);
+    if (lengthBytes < EVENT_BLOCK_LENGTH_BYTES) {
+        memmove(out + 1 + lengthBytes, out + header, length);
+    }
+    size_t crcAt = 1 + lengthBytes + length;
+    out[crcAt] = eventBlockCrc(out + 1 + lengthBytes, length);
+    return crcAt + 1;
+}
+
+int decodeEventBlock(const uint8_t* payload, size_t length, EventLine& out) {
+    BlockReader r = {payload, payload + length, false};
+    out.type = unzigzag(r.varint());
+    out.statusCode = unzigzag(r.varint());
+    out.timesSent = r.varint();
+    uint32_t numRecords = r.varint();
+    if (numRecords > MAX_RECORDS_PER_EVENT) {
+        return EVENT_LINE_MALFORMED;
+    }
+    out.numRecords = numRecords;
+
+    uint32_t firstEpoch = 0;
+    for (uint32_t i = 0; i < numRecords; i++) {
+        MeasurementRecord& record = out.records[i];
+        record = MeasurementRecord();
+        record.variableId = r.varint();
+        record.cropId = r.varint();
+        int32_t hundredths = unzigzag(r.varint());
+        record.value = (hundredths == EVENT_BLOCK_INVALID_VALUE) ? NAN : hundredths / 100.0f;
+        uint32_t epoch = r.varint();
+        if (i == 0) {
+            firstEpoch = epoch;
+        }
+        record.epoch = (i == 0) ? epoch : firstEpoch + unzigzag(epoch);
+        record.status = out.statusCode + unzigzag(r.varint());
+        record.timesSent = r.varint();
+    }
+    out.datetime = r.string(out.datetimeLength);
+    out.data = r.string(out.dataLength);
+
+    if (r.malformed || r.p != r.end) {
+        return EVENT_LINE_MALFORMED;
+    }
+    return EVENT_LINE_OK;
+}
@@ -0,0 +1,57 @@
+#ifndef EVENT_BLOCK_CODEC_H
+#define EVENT_BLOCK_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "EventLineParser.h"
+
+// First byte of a binary block, never the first character of a text line
+#define EVENT_BLOCK_MAGIC 0xE7
+
+// Header (magic + length) and trailer (crc) around the payload
+#define EVENT_BLOCK_OVERHEAD 4
+
+// Payloads are read into the same buffer as text lines, crc included
+#define EVENT_BLOCK_MAX_PAYLOAD (EVENT_LINE_MAX_LENGTH - 1)
+
+/*
+* Compact binary form of an event for the SD backlog, about a fifth of the size
+* of the line written by Event::toString. A block is
+*   magic, payload length (varint), payload, crc8 of the payload
+* and a block with an empty payload (no crc) is a commit marker. The payload holds
+* varints: type, status code and times sent, the number of records and, for each
+* record, the variable and crop ids, the value in hundredths, the epoch as a delta
+* from the first record (the first one is absolute), the status as a delta from the
+* event status and the times sent. Zigzag encoding keeps small negative numbers
+* short. The datetime and raw data follow, each one length prefixed and null
+* terminated so they can be used in place.
+* Values keep two decimals, like the text lines. This header does not depend on Arduino.
+*/
+
+/*
+* @param out: buffer for the whole block
+* @return block length, or 0 if it does not fit in capacity or EVENT_BLOCK_MAX_PAYLOAD
+*/
+size_t encodeEventBlock(const EventLine& event, uint8_t* out, size_t capacity);
+
+/*
+* Decodes a payload whose crc was checked. The datetime and data spans of out point
+* into the payload.
+* @return EVENT_LINE_OK or EVENT_LINE_MALFORMED
+*/
+int decodeEventBlock(const uint8_t* payload, size_t length, EventLine& out);
+
+uint8_t eventBlockCrc(const uint8_t* data, size_t length);
+
+/*
+* Writes value as a base-128 varint.
+* @return bytes written, 0 if out is too small
+*/
+size_t writeVarint(uint32_t value, uint8_t* out, size_t capacity);
+
+/*
+* @return bytes read, 0 if the varint is truncated or longer than 5 bytes
+*/
+size_t readVarint(const uint8_t* in, size_t length, uint32_t& value);
+
+#endif // EVENT_BLOCK_CODEC_H
@@ -0,0 +1,134 @@
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <stddef.h>
+#include "Span.h"
+
+/*
+* Typed publish/subscribe channel for one topic. Subscribers are a function and
+* a context, kept in a table sized at compile time, so nothing is allocated and
+* publishing is an indirect call per subscriber. Bind a method with
+*
+*   channel.subscribe<NtpClock, &NtpClock::onLink>(&ntpClock);
+*
+* Subscribing and unsubscribing from a handler, even while the channel is
+* publishing further up the stack, is safe: a subscriber removed during a
+* dispatch is not called again by it, one added during a dispatch gets the next
+* message. A channel is used from one task, subscribe from setup or from that
+* task. This header does not depend on Arduino.
+*/
+template <typename Message, size_t MaxSubscribers>
+class Channel {
+public:
+    typedef void (*Handler)(void* context, const Message& message);
+
+    Channel() : count_(0), depth_(0), removed_(false) {}
+
+    // @return false if the table is full or the subscriber is already there
+    bool subscribe(Handler handler, void* context) {
+        if (handler == nullptr || find(handler, context) >= 0 || count_ >= MaxSubscribers) {
+            return false;
+        }
+        subscribers_[count_].handler = handler;
+        subscribers_[count_].context = context;
+        count_++;
+        return true;
+    }
+
+    template <typename T, void (T::*Method)(const Message&)>
+    bool subscribe(T* object) {
+        return subscribe(&call<T, Method>, object);
+    }
+
+    // @return false if the subscriber was not there
+    bool unsubscribe(Handler handler, void* context) {
+        int i = find(handler, context);
+        if (i < 0) {
+            return false;
+        }
+        if (depth_ > 0) {
+            // a dispatch may be walking the table, the slot is cleared and removed after it
+            subscribers_[i].handler = nullptr;
+            removed_ = true;
+        } else {
+            removeAt(i);
+        }
+        return true;
+    }
+
+    template <typename T, void (T::*Method)(const Message&)>
+    bool unsubscribe(T* object) {
+        return unsubscribe(&call<T, Method>, object);
+    }
+
+    // Calls every subscriber with the message, in the order they subscribed
+    void publish(const Message& message) {
+        size_t count = count_;
+        depth_++;
+        for (size_t i = 0; i < count; i++) {
+            Handler handler = subscribers_[i].handler;
+            if (handler != nullptr) {
+                handler(subscribers_[i].context, message);
+            }
+        }
+        depth_--;
+        if (depth_ == 0 && removed_) {
+            compact();
+        }
+    }
+
+    size_t subscriberCount() const {
+        size_t n = 0;
+        for (size_t i = 0; i < count_; i++) {
+            n += (subscribers_[i].handler != nullptr) ? 1 : 0;
+        }
+        return n;
+    }
+
+    static size_t capacity() { return MaxSubscribers; }
+
+private:
+    struct Subscription {
+        Handler handler;
+        void* context;
+    };
+
+    Subscription subscribers_[MaxSubscribers];
+    size_t count_;
+    int depth_;         // publish calls running, a handler may publish again
+    bool removed_;      // cleared slots wait for the dispatch to end
+
+    template <typename T, void (T::*Method)(const Message&)>
+    static void call(void* context, const Message& message) {
+        (static_cast<T*>(context)->*Method)(message);
+    }
+
+    int find(Handler handler, void* context) const {
+        for (size_t i = 0; i < count_; i++) {
+            if (subscribers_[i].handler == handler && subscribers_[i].context == context) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    void removeAt(size_t i) {
+        for (size_t j = i; j + 1 < count_; j++) {
+            subscribers_[j] = subscribers_[j + 1];
+        }
+        count_--;
+    }
+
+    void compact() {
+        size_t kept = 0;
+        for (size_t i = 0; i < count_; i++) {
+            if (subscribers_[i].handler != nullptr) {
+                subscribers_[kept++] = subscribers_[i];
+            }
+        }
+        count_ = kept;
+        removed_ = false;
+    }
+};
+
+#endif // EVENT_BUS_H
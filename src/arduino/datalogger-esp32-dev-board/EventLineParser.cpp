@@ -0,0 +1,425 @@
+#include "EventLineParser.h"
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <float.h>
+
+// Exponents past this overflow or underflow a double anyway, reading stops growing them
+#define NUMBER_MAX_EXPONENT 1000
+
+/*
+* Cursor over the line being parsed, every helper moves it forward so
+* the whole line is visited once.
+*/
+struct LineCursor {
+    char* p;
+    char* end;
+};
+
+static void skipSpaces(LineCursor& c) {
+    while (c.p < c.end && (*c.p == ' ' || *c.p == '\t' || *c.p == '\r' || *c.p == '\n')) {
+        c.p++;
+    }
+}
+
+static bool expect(LineCursor& c, char expected) {
+    skipSpaces(c);
+    if (c.p >= c.end || *c.p != expected) {
+        return false;
+    }
+    c.p++;
+    return true;
+}
+
+static int hexValue(char h) {
+    if (h >= '0' && h <= '9') return h - '0';
+    if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+    if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+    return -1;
+}
+
+/*
+* Reads a string starting at the opening quote and unescapes it in place.
+* On success start/length describe the unescaped text and the cursor is past the closing quote.
+*/
+static bool readString(LineCursor& c, char*& start, size_t& length) {
+    if (c.p >= c.end || *c.p != '"') {
+        return false;
+    }
+    c.p++;
+    start = c.p;
+    char* write = c.p;
+
+    while (c.p < c.end) {
+        char ch = *c.p++;
+        if (ch == '"') {
+            length = write - start;
+            return true;
+        }
+        if (ch != '\\') {
+            *write++ = ch;
+            continue;
+        }
+        if (c.p >= c.end) {
+            return false;
+        }
+        char escaped = *c.p++;
+        switch (escaped) {
+            case '"': *write++ = '"'; break;
+            case '\\': *write++ = '\\'; break;
+            case '/': *write++ = '/'; break;
+            case 'b': *write++ = '\b'; break;
+            case 'f': *write++ = '\f'; break;
+            case 'n': *write++ = '\n'; break;
+            case 'r': *write++ = '\r'; break;
+            case 't': *write++ = '\t'; break;
+            case 'u': {
+                if (c.end - c.p < 4) {
+                    return false;
+                }
+                int code = 0;
+                for (int i = 0; i < 4; i++) {
+                    int digit = hexValue(*c.p++);
+                    if (digit < 0) {
+                        return false;
+                    }
+                    code = (code << 4) | digit;
+                }
+                // only ascii is expected in the log, anything else is replaced
+                *write++ = (code < 0x80) ? (char)code : '?';
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+// Skips a string without modifying it, the cursor is on the opening quote
+static bool skipString(LineCursor& c) {
+    c.p++;
+    while (c.p < c.end) {
+        char ch = *c.p++;
+        if (ch == '"') {
+            return true;
+        }
+        if (ch == '\\') {
+            if (c.p >= c.end) {
+                return false;
+            }
+            c.p++;
+        }
+    }
+    return false;
+}
+
+static bool readNumber(LineCursor& c, double& value) {
+    skipSpaces(c);
+    bool negative = false;
+    if (c.p < c.end && (*c.p == '-' || *c.p == '+')) {
+        negative = (*c.p == '-');
+        c.p++;
+    }
+
+    bool digits = false;
+    double result = 0;
+    while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+        result = result * 10 + (*c.p++ - '0');
+        digits = true;
+    }
+    if (c.p < c.end && *c.p == '.') {
+        c.p++;
+        double scale = 0.1;
+        while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+            result += (*c.p++ - '0') * scale;
+            scale *= 0.1;
+            digits = true;
+        }
+    }
+    if (!digits) {
+        return false;
+    }
+    if (c.p < c.end && (*c.p == 'e' || *c.p == 'E')) {
+        c.p++;
+        bool negativeExponent = false;
+        if (c.p < c.end && (*c.p == '-' || *c.p == '+')) {
+            negativeExponent = (*c.p == '-');
+            c.p++;
+        }
+        int exponent = 0;
+        if (c.p >= c.end || *c.p < '0' || *c.p > '9') {
+            return false;
+        }
+        while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+            int digit = *c.p++ - '0';
+            if (exponent < NUMBER_MAX_EXPONENT) {
+                exponent = exponent * 10 + digit;
+            }
+        }
+        while (exponent-- > 0) {
+            result = negativeExponent ? result / 10 : result * 10;
+        }
+    }
+
+    value = negative ? -result : result;
+    return true;
+}
+
+/*
+* Whether a parsed number can be stored in an integer field of the given range.
+* Casting anything else would be undefined, and a fraction means the line is not
+* one toString wrote.
+*/
+static bool isIntegerIn(double number, double min, double max) {
+    return isfinite(number) && number >= min && number <= max && floor(number) == number;
+}
+
+static bool readInteger(LineCursor& c, int& value) {
+    double number;
+    if (!readNumber(c, number) || !isIntegerIn(number, INT_MIN, INT_MAX)) {
+        return false;
+    }
+    value = (int)number;
+    return true;
+}
+
+static bool matchLiteral(LineCursor& c, const char* literal) {
+    size_t length = strlen(literal);
+    if ((size_t)(c.end - c.p) < length || strncmp(c.p, literal, length) != 0) {
+        return false;
+    }
+    c.p += length;
+    return true;
+}
+
+/*
+* Skips any JSON value. depth is the number of containers already open around the
+* cursor, so it can resume in the middle of an array.
+*/
+static bool skipValue(LineCursor& c, int depth) {
+    do {
+        skipSpaces(c);
+        if (c.p >= c.end) {
+            return false;
+        }
+
+        char ch = *c.p;
+        if (ch == '"') {
+            if (!skipString(c)) {
+                return false;
+            }
+        } else if (ch == '{' || ch == '[') {
+            if (++depth > EVENT_LINE_MAX_DEPTH) {
+                return false;
+            }
+            c.p++;
+            continue;
+        } else if (ch == '}' || ch == ']') {
+            if (depth == 0) {
+                return false;
+            }
+            depth--;
+            c.p++;
+        } else if (ch == ',' || ch == ':') {
+            if (depth == 0) {
+                return false;
+            }
+            c.p++;
+            continue;
+        } else if (ch == 't') {
+            if (!matchLiteral(c, "true")) return false;
+        } else if (ch == 'f') {
+            if (!matchLiteral(c, "false")) return false;
+        } else if (ch == 'n') {
+            if (!matchLiteral(c, "null")) return false;
+        } else {
+            double ignored;
+            if (!readNumber(c, ignored)) {
+                return false;
+            }
+        }
+    } while (depth > 0);
+
+    return true;
+}
+
+/*
+* Reads one [variableId,cropId,value,epoch,status,timesSent] record,
+* the cursor is on the opening bracket. Fields that do not fit the record fail it.
+*/
+static bool readRecord(LineCursor& c, MeasurementRecord& record) {
+    double fields[6];
+    c.p++;
+    for (int i = 0; i < 6; i++) {
+        if (i > 0 && !expect(c, ',')) {
+            return false;
+        }
+        if (!readNumber(c, fields[i])) {
+            return false;
+        }
+    }
+    if (!expect(c, ']')) {
+        return false;
+    }
+    if (!isIntegerIn(fields[0], 0, UINT8_MAX) || !isIntegerIn(fields[1], 0, UINT8_MAX) ||
+        !isfinite(fields[2]) || fabs(fields[2]) > FLT_MAX || !isIntegerIn(fields[3], 0, UINT32_MAX) ||
+        !isIntegerIn(fields[4], INT16_MIN, INT16_MAX) || !isIntegerIn(fields[5], 0, UINT8_MAX)) {
+        return false;
+    }
+
+    record = MeasurementRecord();
+    record.variableId = (uint8_t)fields[0];
+    record.cropId = (uint8_t)fields[1];
+    record.value = (float)fields[2];
+    record.epoch = (uint32_t)fields[3];
+    record.status = (int16_t)fields[4];
+    record.timesSent = (uint8_t)fields[5];
+    return true;
+}
+
+/*
+* Reads the data value. An array whose first element is an array is read as records,
+* anything else is skipped and kept as a raw span.
+*/
+static bool readData(LineCursor& c, EventLine& out) {
+    skipSpaces(c);
+    char* start = c.p;
+    out.numRecords = 0;
+
+    if (c.p < c.end && *c.p == '[') {
+        c.p++;
+        skipSpaces(c);
+        if (c.p < c.end && *c.p == '[') {
+            while (true) {
+                if (out.numRecords >= MAX_RECORDS_PER_EVENT) {
+                    return false;
+                }
+                if (!readRecord(c, out.records[out.numRecords])) {
+                    return false;
+                }
+                out.numRecords++;
+                skipSpaces(c);
+                if (c.p < c.end && *c.p == ',') {
+                    c.p++;
+                    skipSpaces(c);
+                    if (c.p >= c.end || *c.p != '[') {
+                        return false;
+                    }
+                    continue;
+                }
+                if (!expect(c, ']')) {
+                    return false;
+                }
+                out.data = c.p;
+                out.dataLength = 0;
+                return true;
+            }
+        }
+        // an array of something else, e.g. the API payload written by older firmware
+        if (c.p < c.end && *c.p == ']') {
+            c.p++;
+        } else if (!skipValue(c, 1)) {
+            return false;
+        }
+    } else if (!skipValue(c, 0)) {
+        return false;
+    }
+
+    out.data = start;
+    out.dataLength = c.p - start;
+    return true;
+}
+
+int parseEventLine(char* line, size_t length, EventLine& out) {
+    LineCursor c = {line, line + length};
+
+    skipSpaces(c);
+    if (c.p >= c.end) {
+        return EVENT_LINE_EMPTY;
+    }
+
+    out.type = -1;
+    out.statusCode = -1;
+    out.timesSent = 0;
+    out.datetime = "";
+    out.datetimeLength = 0;
+    out.data = c.end;
+    out.dataLength = 0;
+    out.numRecords = 0;
+
+    bool hasType = false;
+    char* datetime = nullptr;
+    size_t datetimeLength = 0;
+    char* dataEnd = nullptr;
+
+    if (!expect(c, '{')) {
+        return EVENT_LINE_MALFORMED;
+    }
+
+    skipSpaces(c);
+    if (c.p < c.end && *c.p == '}') {
+        return EVENT_LINE_MALFORMED;
+    }
+
+    while (true) {
+        char* key;
+        size_t keyLength;
+        skipSpaces(c);
+        if (!readString(c, key, keyLength) || !expect(c, ':')) {
+            return EVENT_LINE_MALFORMED;
+        }
+        skipSpaces(c);
+
+        bool ok;
+        if (keyLength == 4 && strncmp(key, "type", 4) == 0) {
+            ok = readInteger(c, out.type);
+            hasType = ok;
+        } else if (keyLength == 10 && strncmp(key, "statusCode", 10) == 0) {
+            ok = readInteger(c, out.statusCode);
+        } else if (keyLength == 9 && strncmp(key, "timesSent", 9) == 0) {
+            ok = readInteger(c, out.timesSent);
+        } else if (keyLength == 8 && strncmp(key, "datetime", 8) == 0) {
+            ok = readString(c, datetime, datetimeLength);
+        } else if (keyLength == 4 && strncmp(key, "data", 4) == 0) {
+            ok = readData(c, out);
+            dataEnd = c.p;
+        } else {
+            ok = skipValue(c, 0);
+        }
+        if (!ok) {
+            return EVENT_LINE_MALFORMED;
+        }
+
+        skipSpaces(c);
+        if (c.p < c.end && *c.p == ',') {
+            c.p++;
+            continue;
+        }
+        if (!expect(c, '}')) {
+            return EVENT_LINE_MALFORMED;
+        }
+        break;
+    }
+
+    // only whitespace may follow the object
+    skipSpaces(c);
+    if (c.p != c.end || !hasType) {
+        return EVENT_LINE_MALFORMED;
+    }
+
+    // terminate the spans now that nothing else has to be read after them
+    if (datetime != nullptr) {
+        datetime[datetimeLength] = '\0';
+        out.datetime = datetime;
+        out.datetimeLength = datetimeLength;
+    }
+    if (dataEnd != nullptr && out.dataLength > 0) {
+        *dataEnd = '\0';
+    } else {
+        out.data = "";
+        out.dataLength = 0;
+    }
+
+    return EVENT_LINE_OK;
+}
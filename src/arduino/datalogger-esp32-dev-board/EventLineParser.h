@@ -0,0 +1,52 @@
+#ifndef EVENT_LINE_PARSER_H
+#define EVENT_LINE_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "MeasurementRecord.h"
+
+// Longest line loadEvents will read from the SD card, longer lines are reported as malformed
+#define EVENT_LINE_MAX_LENGTH 768
+
+// Maximum nesting of objects and arrays inside the data value
+#define EVENT_LINE_MAX_DEPTH 16
+
+// Define parsing results
+#define EVENT_LINE_OK 0
+#define EVENT_LINE_EMPTY 1
+#define EVENT_LINE_MALFORMED 2
+
+/*
+* Fields of a line written by Event::toString. The datetime and data spans point into
+* the parsed buffer and are null terminated in place, so they stay valid as long as
+* the buffer does.
+*/
+struct EventLine {
+    int type;
+    int statusCode;
+    int timesSent;
+    const char* datetime;
+    size_t datetimeLength;
+    const char* data;               // raw JSON value, empty when the data was a records array
+    size_t dataLength;
+    MeasurementRecord records[MAX_RECORDS_PER_EVENT];
+    int numRecords;
+};
+
+/*
+* Parses a line like
+*   {"type":2,"statusCode":200,"datetime":"...","data":<json value>,"timesSent":0}
+* in a single pass over the buffer, without allocating. Keys may come in any order and
+* unknown keys are skipped. The data value can be any JSON value, strings with escaped
+* quotes and nested arrays/objects are skipped correctly; an array of arrays is read
+* as measurement records. Numbers that do not fit the field they are read into, such
+* as a fraction, an out of range id or an infinite value, make the line malformed.
+* The buffer is modified: strings are unescaped and spans are null terminated.
+* @param line: buffer holding the line, it does not need to be null terminated
+* @param length: number of characters in the line, a trailing '\r' or '\n' is ignored
+* @param out: parsed fields, only meaningful when EVENT_LINE_OK is returned
+* @return EVENT_LINE_OK, EVENT_LINE_EMPTY for blank lines or EVENT_LINE_MALFORMED
+*/
+int parseEventLine(char* line, size_t length, EventLine& out);
+
+#endif // EVENT_LINE_PARSER_H
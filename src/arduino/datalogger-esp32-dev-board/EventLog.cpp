@@ -0,0 +1,356 @@
+#include "EventLog.h"
+#include "Instrumentation.h"
+#include "Log.h"
+
+// What readItem found at the read position
+#define EVENT_LOG_ITEM_EVENT 0
+#define EVENT_LOG_ITEM_COMMIT 1
+#define EVENT_LOG_ITEM_SKIPPED 2     // malformed event, reading goes on after it
+#define EVENT_LOG_ITEM_END 3         // end of the segment or a block cut short
+
+EventLog::EventLog() {
+    fs_ = nullptr;
+    cursor_ = {0, 0};
+    headSegment_ = 0;
+    headSize_ = 0;
+}
+
+void EventLog::segmentPath(uint32_t segment, char* path) const {
+    snprintf(path, EVENT_LOG_PATH_LENGTH, "%s/%08lu.log", EVENT_LOG_DIR, (unsigned long)segment);
+}
+
+bool EventLog::begin(fs::FS &fs) {
+    fs_ = &fs;
+
+    if (!fs.exists(EVENT_LOG_DIR) && !fs.mkdir(EVENT_LOG_DIR)) {
+        LOG_ERROR(STORAGE, "Failed to create the event log directory");
+        fs_ = nullptr;
+        return false;
+    }
+
+    File dir = fs.open(EVENT_LOG_DIR);
+    if (!dir || !dir.isDirectory()) {
+        LOG_ERROR(STORAGE, "Failed to open the event log directory");
+        fs_ = nullptr;
+        return false;
+    }
+
+    // find the oldest and newest segments, this is the only directory scan
+    uint32_t firstSegment = UINT32_MAX;
+    uint32_t lastSegment = 0;
+    {
+        INSTRUMENT_STAGE(STAGE_DIR_SCAN);
+        File file = dir.openNextFile();
+        while (file) {
+            const char* name = file.name();
+            const char* slash = strrchr(name, '/');
+            name = (slash != nullptr) ? slash + 1 : name;
+
+            char* end;
+            uint32_t segment = strtoul(name, &end, 10);
+            if (!file.isDirectory() && end != name && strcmp(end, ".log") == 0) {
+                firstSegment = min(firstSegment, segment);
+                lastSegment = max(lastSegment, segment);
+            }
+            file = dir.openNextFile();
+        }
+    }
+    dir.close();
+
+    // appends go to a new segment, the previous one could end with a torn line
+    headSegment_ = lastSegment + 1;
+    headSize_ = 0;
+
+    if (!loadCursor() || firstSegment == UINT32_MAX) {
+        cursor_ = {firstSegment == UINT32_MAX ? headSegment_ : firstSegment, 0};
+    } else if (cursor_.segment < firstSegment) {
+        cursor_ = {firstSegment, 0};
+    }
+
+    LOG_INFO(STORAGE, "Event log ready, reading segment %lu at %lu, writing segment %lu",
+             (unsigned long)cursor_.segment, (unsigned long)cursor_.offset, (unsigned long)headSegment_);
+    return true;
+}
+
+bool EventLog::append(const Event* events, int numEvents) {
+    INSTRUMENT_STAGE(STAGE_SD_STORE);
+    if (fs_ == nullptr) {
+        return false;
+    }
+
+    if (headSize_ >= EVENT_LOG_SEGMENT_SIZE) {
+        headSegment_++;
+        headSize_ = 0;
+    }
+
+    char path[EVENT_LOG_PATH_LENGTH];
+    segmentPath(headSegment_, path);
+    File file = fs_->open(path, FILE_APPEND, true);
+    if (!file) {
+        LOG_ERROR(STORAGE, "Failed to open %s for appending", path);
+        return false;
+    }
+
+    const Event emptyEvent = Event();
+    size_t written = 0;
+    size_t expected = 0;
+    int appended = 0;
+
+    for (int i = 0; i < numEvents && written == expected; i++) {
+        if (events[i] == emptyEvent) {
+            continue;
+        }
+        written += writeEvent(file, events[i], expected);
+        appended++;
+    }
+
+    // the marker makes the events above visible to readers, it is left out after a
+    // short write so none of them is read
+    if (appended > 0 && written == expected) {
+#if EVENT_LOG_COMPRESSED
+        static const uint8_t commitBlock[] = {EVENT_BLOCK_MAGIC, 0};
+        expected += sizeof(commitBlock);
+        written += file.write(commitBlock, sizeof(commitBlock));
+#else
+        expected += strlen(EVENT_LOG_COMMIT_MARKER "\n");
+        written += file.print(EVENT_LOG_COMMIT_MARKER "\n");
+#endif
+    }
+    file.close();
+
+    headSize_ += written;
+    if (written != expected) {
+        // e.g. a full card: the caller keeps the events, and later appends go to a
+        // new segment so they never follow the torn tail
+        LOG_ERROR(STORAGE, "Short write to %s, %lu of %lu bytes", path, (unsigned long)written,
+                  (unsigned long)expected);
+        headSegment_++;
+        headSize_ = 0;
+        return false;
+    }
+    LOG_DEBUG(STORAGE, "Appended %d events to %s", appended, path);
+    return true;
+}
+
+int EventLog::peek(Event* events, int maxEvents, EventLogCursor &next) {
+    INSTRUMENT_STAGE(STAGE_SD_LOAD);
+    next = cursor_;
+    if (fs_ == nullptr || maxEvents <= 0) {
+        return 0;
+    }
+
+    char path[EVENT_LOG_PATH_LENGTH];
+    char line[EVENT_LINE_MAX_LENGTH];
+    EventLine parsed;
+
+    while (next.segment < headSegment_ || next.offset < headSize_) {
+        segmentPath(next.segment, path);
+        File file = fs_->open(path, FILE_READ);
+        if (!file) {
+            // a missing segment has nothing left to read
+            if (next.segment >= headSegment_) {
+                return 0;
+            }
+            next = {next.segment + 1, 0};
+            continue;
+        }
+        file.seek(next.offset);
+
+        int count = 0;
+        int committedCount = 0;
+        uint32_t storedEnd = next.offset;
+        uint32_t committedEnd = next.offset;
+        bool full = false;
+
+        bool reachedEnd = true;
+        while (file.available()) {
+            int item = readItem(file, line, sizeof(line), parsed);
+            if (item == EVENT_LOG_ITEM_END) {
+                break;
+            }
+            uint32_t itemEnd = file.position();
+
+            if (item == EVENT_LOG_ITEM_COMMIT) {
+                committedCount = count;
+                committedEnd = full ? storedEnd : itemEnd;
+                if (full) {
+                    reachedEnd = false;
+                    break;
+                }
+                continue;
+            }
+            if (full || item != EVENT_LOG_ITEM_EVENT) {
+                continue;
+            }
+
+            // binary events are decoded straight into the batch, no text is built
+            events[count++] = Event(parsed);
+            storedEnd = itemEnd;
+            full = (count == maxEvents);
+        }
+        file.close();
+
+        for (int i = committedCount; i < count; i++) {
+            events[i] = Event();
+        }
+        next.offset = committedEnd;
+
+        if (committedCount > 0) {
+            return committedCount;
+        }
+        // whatever is left in an older segment was never committed, however many
+        // events it holds
+        if (reachedEnd && next.segment < headSegment_) {
+            next = {next.segment + 1, 0};
+            continue;
+        }
+        break;
+    }
+    return 0;
+}
+
+/*
+* Writes an event in the format selected by EVENT_LOG_COMPRESSED.
+* @param expected: the length of the event is added to it
+* @return bytes written, less than the length on a short write
+*/
+size_t EventLog::writeEvent(File &file, const Event &event, size_t &expected) {
+#if EVENT_LOG_COMPRESSED
+    EventLine line;
+    line.type = event.getType();
+    line.statusCode = event.getStatusCode();
+    line.timesSent = event.timesSent;
+    char timestamp[ISO_TIMESTAMP_BUFFER];
+    line.datetime = event.getTimestamp(timestamp, line.datetimeLength);
+    line.data = event.getData().c_str();
+    line.dataLength = event.getData().length();
+    line.numRecords = event.getRecordCount();
+    memcpy(line.records, event.getRecords(), line.numRecords * sizeof(MeasurementRecord));
+
+    uint8_t block[EVENT_BLOCK_MAX_PAYLOAD + EVENT_BLOCK_OVERHEAD];
+    size_t length = encodeEventBlock(line, block, sizeof(block));
+    if (length > 0) {
+        expected += length;
+        return file.write(block, length);
+    }
+    // too long for a block, a text line can hold it and is read back the same way
+#endif
+    PrintSink<File> sink(file);
+    event.writeTo(sink);
+    sink.flush();
+    expected += sink.requested();
+    return sink.written();
+}
+
+/*
+* Reads the text line or binary block at the file position.
+* @param buffer: holds the line or payload, parsed points into it
+* @return one of EVENT_LOG_ITEM_*
+*/
+int EventLog::readItem(File &file, char* buffer, size_t size, EventLine &parsed) {
+    if (file.peek() == EVENT_BLOCK_MAGIC) {
+        file.read();
+        uint8_t header[5];
+        uint32_t length = 0;
+        size_t n = 0;
+        while (n < sizeof(header) && file.available()) {
+            header[n] = file.read();
+            if ((header[n++] & 0x80) == 0) {
+                break;
+            }
+        }
+        if (readVarint(header, n, length) == 0) {
+            return EVENT_LOG_ITEM_END;
+        }
+        if (length == 0) {
+            return EVENT_LOG_ITEM_COMMIT;
+        }
+        if (length + 1 > size) {
+            file.seek(file.position() + length + 1);
+            return EVENT_LOG_ITEM_SKIPPED;
+        }
+        // a block cut short by a power loss is only ever at the end of a segment
+        if (file.read((uint8_t*)buffer, length + 1) != length + 1) {
+            return EVENT_LOG_ITEM_END;
+        }
+        const uint8_t* payload = (const uint8_t*)buffer;
+        if (eventBlockCrc(payload, length) != payload[length]
+            || decodeEventBlock(payload, length, parsed) != EVENT_LINE_OK) {
+            return EVENT_LOG_ITEM_SKIPPED;
+        }
+        return EVENT_LOG_ITEM_EVENT;
+    }
+
+    size_t length = file.readBytesUntil('\n', buffer, size);
+    if (length == size) {
+        while (file.available() && file.read() != '\n') {}
+        return EVENT_LOG_ITEM_SKIPPED;
+    }
+    const size_t markerLength = strlen(EVENT_LOG_COMMIT_MARKER);
+    if (length >= markerLength && strncmp(buffer, EVENT_LOG_COMMIT_MARKER, markerLength) == 0) {
+        return EVENT_LOG_ITEM_COMMIT;
+    }
+    return (parseEventLine(buffer, length, parsed) == EVENT_LINE_OK) ? EVENT_LOG_ITEM_EVENT : EVENT_LOG_ITEM_SKIPPED;
+}
+
+bool EventLog::advance(const EventLogCursor &next) {
+    if (fs_ == nullptr) {
+        return false;
+    }
+    if (next.segment == cursor_.segment && next.offset == cursor_.offset) {
+        return true;
+    }
+
+    const EventLogCursor previous = cursor_;
+    cursor_ = next;
+    if (!saveCursor()) {
+        cursor_ = previous;
+        return false;
+    }
+
+    char path[EVENT_LOG_PATH_LENGTH];
+    for (uint32_t segment = previous.segment; segment < next.segment; segment++) {
+        segmentPath(segment, path);
+        fs_->remove(path);
+    }
+    return true;
+}
+
+bool EventLog::hasPending() const {
+    return fs_ != nullptr && (cursor_.segment < headSegment_ || cursor_.offset < headSize_);
+}
+
+EventLogCursor EventLog::getCursor() const {
+    return cursor_;
+}
+
+bool EventLog::saveCursor() {
+    File file = fs_->open(EVENT_LOG_CURSOR_PATH, FILE_WRITE);
+    if (!file) {
+        LOG_ERROR(STORAGE, "Failed to open the event log cursor for writing");
+        return false;
+    }
+    bool written = file.printf("%lu %lu\n", (unsigned long)cursor_.segment, (unsigned long)cursor_.offset) > 0;
+    file.close();
+    return written;
+}
+
+bool EventLog::loadCursor() {
+    File file = fs_->open(EVENT_LOG_CURSOR_PATH, FILE_READ);
+    if (!file) {
+        return false;
+    }
+    char line[32];
+    size_t length = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    file.close();
+    line[length] = '\0';
+
+    char* end;
+    unsigned long segment = strtoul(line, &end, 10);
+    if (end == line) {
+        return false;
+    }
+    unsigned long offset = strtoul(end, &end, 10);
+    cursor_ = {(uint32_t)segment, (uint32_t)offset};
+    return true;
+}
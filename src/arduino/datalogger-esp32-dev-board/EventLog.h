@@ -0,0 +1,84 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "Event.h"
+#include "EventBlockCodec.h"
+
+#define EVENT_LOG_DIR "/log"
+#define EVENT_LOG_CURSOR_PATH "/log/cursor"
+#define EVENT_LOG_SEGMENT_SIZE 32768   // bytes, a new segment is started once this is reached
+#define EVENT_LOG_COMMIT_MARKER "#commit"
+#define EVENT_LOG_PATH_LENGTH 32
+
+// Append events as binary blocks (EventBlockCodec.h) instead of text lines, the
+// reader takes both so segments written before the switch are still read
+#ifndef EVENT_LOG_COMPRESSED
+#define EVENT_LOG_COMPRESSED 1
+#endif
+
+/*
+* Position of the next event to read, persisted in EVENT_LOG_CURSOR_PATH.
+*/
+struct EventLogCursor {
+    uint32_t segment;
+    uint32_t offset;
+};
+
+/*
+* Append-only log of events split in numbered segments (/log/00000001.log, ...).
+* Every append writes the events as lines, or binary blocks with EVENT_LOG_COMPRESSED,
+* followed by a commit marker, events after the last commit marker (e.g. a write torn
+* by a power loss) are never read.
+* Reading does not modify the segments: acknowledged events are consumed by advancing
+* the persisted cursor, and a segment is deleted once the cursor leaves it.
+*/
+class EventLog {
+public:
+    EventLog();
+
+    /*
+    * Restores the cursor and finds the existing segments, appends always go to a new
+    * segment after a restart so they never follow a torn line.
+    * @return true if the log can be used
+    */
+    bool begin(fs::FS &fs);
+
+    /*
+    * Appends the events that are not empty and commits them.
+    * @return true if the events were written, false if a write fell short, e.g. on
+    * a full card, and none of them will be read
+    */
+    bool append(const Event* events, int numEvents);
+
+    /*
+    * Reads up to maxEvents committed events from the cursor without consuming them.
+    * @param next: cursor to pass to advance once the events are acknowledged
+    * @return number of events read
+    */
+    int peek(Event* events, int maxEvents, EventLogCursor &next);
+
+    /*
+    * Consumes the events before next, persisting the cursor and deleting the
+    * segments that were fully read.
+    */
+    bool advance(const EventLogCursor &next);
+
+    bool hasPending() const;
+    EventLogCursor getCursor() const;
+
+private:
+    fs::FS* fs_;
+    EventLogCursor cursor_;
+    uint32_t headSegment_;
+    uint32_t headSize_;
+
+    void segmentPath(uint32_t segment, char* path) const;
+    size_t writeEvent(File &file, const Event &event, size_t &expected);
+    int readItem(File &file, char* buffer, size_t size, EventLine &parsed);
+    bool saveCursor();
+    bool loadCursor();
+};
+
+#endif // EVENT_LOG_H
@@ -0,0 +1,106 @@
+#ifndef FLOW_CONTROLLER_H
+#define FLOW_CONTROLLER_H
+
+#include <stddef.h>
+
+#define FLOW_HIGH_WATERMARK 5       // events in RAM above which they are spilled to the SD card
+#define FLOW_LOW_WATERMARK 2        // events in RAM below which the SD backlog is drained
+#define FLOW_MAX_BATCH 8            // most events read from the SD card in one step
+#define FLOW_TIME_BUDGET_MS 4000    // time a drain step should take, reading and sending
+#define FLOW_EWMA_WEIGHT 0.25f      // weight of the newest latency sample
+
+/*
+* Decides how many events move between RAM and the SD card. Above the high
+* watermark the buffer is spilled down to the low watermark in one append, and
+* while the uplink is failing everything from the low watermark up is spilled, so
+* events do not sit in RAM while they cannot be sent. Below the low watermark the
+* SD backlog is drained, in batches sized from the measured SD and HTTP latency so
+* a step stays within its time budget. This header does not depend on Arduino.
+*/
+class FlowController {
+public:
+    FlowController(size_t lowWatermark = FLOW_LOW_WATERMARK,
+                   size_t highWatermark = FLOW_HIGH_WATERMARK,
+                   size_t maxBatch = FLOW_MAX_BATCH,
+                   unsigned long timeBudgetMs = FLOW_TIME_BUDGET_MS)
+        : low_(lowWatermark), high_(highWatermark), maxBatch_(maxBatch), budget_(timeBudgetMs),
+          sdMsPerEvent_(0), httpMsPerEvent_(0), failedSends_(0) {}
+
+    /*
+    * @param attempted: events passed to the api client
+    * @param sent: events the server acknowledged
+    */
+    void recordSend(size_t attempted, size_t sent, unsigned long elapsedMs) {
+        if (attempted == 0) {
+            return;
+        }
+        failedSends_ = (sent == 0) ? failedSends_ + 1 : 0;
+        update(httpMsPerEvent_, (float)elapsedMs / attempted);
+    }
+
+    // Reads and writes are both counted, they cost about the same on the card
+    void recordSdAccess(size_t events, unsigned long elapsedMs) {
+        if (events == 0) {
+            return;
+        }
+        update(sdMsPerEvent_, (float)elapsedMs / events);
+    }
+
+    /*
+    * @param buffered: events waiting in RAM
+    * @return events to move from RAM to the SD card, oldest first
+    */
+    size_t toSpill(size_t buffered) const {
+        if (uplinkDegraded()) {
+            return (buffered >= low_) ? buffered : 0;
+        }
+        return (buffered >= high_) ? buffered - low_ : 0;
+    }
+
+    /*
+    * @param backlogPending: the SD card has events waiting
+    * @return events to read from the SD card and send
+    */
+    size_t toRefill(size_t buffered, bool backlogPending) const {
+        if (!backlogPending || uplinkDegraded() || buffered > low_) {
+            return 0;
+        }
+        return batchSize();
+    }
+
+    // Events that can be read and sent within the time budget
+    size_t batchSize() const {
+        float msPerEvent = sdMsPerEvent_ + httpMsPerEvent_;
+        if (msPerEvent <= 0) {
+            return maxBatch_;
+        }
+        size_t batch = (size_t)(budget_ / msPerEvent);
+        if (batch < 1) {
+            return 1;
+        }
+        return (batch > maxBatch_) ? maxBatch_ : batch;
+    }
+
+    // the last send did not deliver anything
+    bool uplinkDegraded() const {
+        return failedSends_ > 0;
+    }
+
+    float getSdMsPerEvent() const { return sdMsPerEvent_; }
+    float getHttpMsPerEvent() const { return httpMsPerEvent_; }
+
+private:
+    size_t low_;
+    size_t high_;
+    size_t maxBatch_;
+    unsigned long budget_;
+    float sdMsPerEvent_;
+    float httpMsPerEvent_;
+    unsigned long failedSends_;
+
+    static void update(float& average, float sample) {
+        average = (average <= 0) ? sample : average + FLOW_EWMA_WEIGHT * (sample - average);
+    }
+};
+
+#endif // FLOW_CONTROLLER_H
@@ -0,0 +1,288 @@
+#ifndef GZIP_ENCODER_H
+#define GZIP_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define GZIP_WINDOW_SIZE 1024       // farthest back a match can reach, at least GZIP_MAX_MATCH
+#define GZIP_HASH_BITS 10
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+#define GZIP_OUT_BUFFER 32
+#define GZIP_NO_POSITION 0xFFFF
+
+/*
+* Streaming gzip (RFC 1952) compressor with a small fixed window, for request
+* bodies that are produced piece by piece and never held in memory as a whole.
+* Matches are found through a hash table holding the last position of every 3 byte
+* prefix, without chains, and coded in a single fixed Huffman deflate block, so no
+* tables have to be built or sent. That suits short, repetitive JSON: the uiids and
+* keys repeat within the window. The state takes about 4 KB, keep the encoder in a
+* long lived object rather than on the stack. The output is the same for the same
+* input, so a pass over a CountingSink gives the Content-Length before the real pass.
+* Bytes go to any sink with write(const char*, size_t), see JsonEncoder.h.
+* This header does not depend on Arduino.
+*/
+class GzipEncoder {
+public:
+    GzipEncoder() : filled_(0), pos_(0), bitBuffer_(0), bitCount_(0), outLength_(0), crc_(0), inputSize_(0) {}
+
+    template <typename Sink>
+    void begin(Sink& sink) {
+        filled_ = 0;
+        pos_ = 0;
+        bitBuffer_ = 0;
+        bitCount_ = 0;
+        outLength_ = 0;
+        crc_ = 0xFFFFFFFF;
+        inputSize_ = 0;
+        for (size_t i = 0; i < (1 << GZIP_HASH_BITS); i++) {
+            head_[i] = GZIP_NO_POSITION;
+        }
+
+        // no file name nor modification time, unknown OS
+        static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+        for (size_t i = 0; i < sizeof(header); i++) {
+            putByte(sink, header[i]);
+        }
+        // the whole stream is one final block with the fixed codes
+        putBits(sink, 1, 1);
+        putBits(sink, 1, 2);
+    }
+
+    template <typename Sink>
+    void write(Sink& sink, const char* data, size_t length) {
+        inputSize_ += length;
+        while (length > 0) {
+            size_t chunk = sizeof(buffer_) - filled_;
+            if (chunk > length) {
+                chunk = length;
+            }
+            memcpy(buffer_ + filled_, data, chunk);
+            updateCrc((const uint8_t*)data, chunk);
+            filled_ += chunk;
+            data += chunk;
+            length -= chunk;
+
+            if (filled_ == sizeof(buffer_)) {
+                compress(sink, false);
+                slide();
+            }
+        }
+    }
+
+    template <typename Sink>
+    void finish(Sink& sink) {
+        compress(sink, true);
+        putSymbol(sink, 256);
+        if (bitCount_ > 0) {
+            putBits(sink, 0, 8 - bitCount_);
+        }
+        uint32_t crc = ~crc_;
+        for (int i = 0; i < 4; i++) {
+            putByte(sink, (crc >> (8 * i)) & 0xFF);
+        }
+        for (int i = 0; i < 4; i++) {
+            putByte(sink, (inputSize_ >> (8 * i)) & 0xFF);
+        }
+        flush(sink);
+    }
+
+    // bytes passed to write since begin
+    uint32_t inputSize() const { return inputSize_; }
+
+private:
+    uint8_t buffer_[2 * GZIP_WINDOW_SIZE];      // window followed by the bytes to compress
+    uint16_t head_[1 << GZIP_HASH_BITS];        // last buffer position of each hashed prefix
+    size_t filled_;
+    size_t pos_;                                // next byte to compress
+    uint32_t bitBuffer_;
+    int bitCount_;
+    uint8_t out_[GZIP_OUT_BUFFER];
+    size_t outLength_;
+    uint32_t crc_;
+    uint32_t inputSize_;
+
+    size_t hash(size_t position) const {
+        uint32_t prefix = buffer_[position] | (buffer_[position + 1] << 8) | (buffer_[position + 2] << 16);
+        return (prefix * 2654435761u) >> (32 - GZIP_HASH_BITS);
+    }
+
+    void insert(size_t position) {
+        head_[hash(position)] = (uint16_t)position;
+    }
+
+    /*
+    * Compresses the buffered bytes, leaving the last GZIP_MAX_MATCH - 1 unless this
+    * is the end of the input so a match is never cut short by a refill.
+    */
+    template <typename Sink>
+    void compress(Sink& sink, bool last) {
+        while (pos_ < filled_) {
+            size_t available = filled_ - pos_;
+            if (!last && available < GZIP_MAX_MATCH) {
+                break;
+            }
+
+            size_t length = 0;
+            size_t distance = 0;
+            if (available >= GZIP_MIN_MATCH) {
+                size_t h = hash(pos_);
+                size_t candidate = head_[h];
+                head_[h] = (uint16_t)pos_;
+                if (candidate != GZIP_NO_POSITION && candidate < pos_ && pos_ - candidate <= GZIP_WINDOW_SIZE) {
+                    size_t limit = (available < GZIP_MAX_MATCH) ? available : GZIP_MAX_MATCH;
+                    while (length < limit && buffer_[candidate + length] == buffer_[pos_ + length]) {
+                        length++;
+                    }
+                    distance = pos_ - candidate;
+                }
+            }
+
+            if (length < GZIP_MIN_MATCH) {
+                putSymbol(sink, buffer_[pos_]);
+                pos_++;
+                continue;
+            }
+
+            putMatch(sink, length, distance);
+            // the positions inside the match are hashed too, so later text can refer to them
+            size_t end = pos_ + length;
+            for (pos_++; pos_ < end; pos_++) {
+                if (filled_ - pos_ >= GZIP_MIN_MATCH) {
+                    insert(pos_);
+                }
+            }
+        }
+    }
+
+    // Drops the oldest half of the buffer, what is left is the window of the next bytes
+    void slide() {
+        memmove(buffer_, buffer_ + GZIP_WINDOW_SIZE, filled_ - GZIP_WINDOW_SIZE);
+        filled_ -= GZIP_WINDOW_SIZE;
+        pos_ -= GZIP_WINDOW_SIZE;
+        for (size_t i = 0; i < (1 << GZIP_HASH_BITS); i++) {
+            head_[i] = (head_[i] != GZIP_NO_POSITION && head_[i] >= GZIP_WINDOW_SIZE)
+                ? head_[i] - GZIP_WINDOW_SIZE : GZIP_NO_POSITION;
+        }
+    }
+
+    template <typename Sink>
+    void putMatch(Sink& sink, size_t length, size_t distance) {
+        // base values of the length (257..285) and distance (0..29) codes, RFC 1951 3.2.5
+        static const uint16_t lengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const uint8_t lengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const uint16_t distanceBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const uint8_t distanceExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        int code = 28;
+        while (lengthBase[code] > length) {
+            code--;
+        }
+        putSymbol(sink, 257 + code);
+        putBits(sink, length - lengthBase[code], lengthExtra[code]);
+
+        code = 29;
+        while (distanceBase[code] > distance) {
+            code--;
+        }
+        // distance codes are all 5 bits long
+        putBits(sink, reverse(code, 5), 5);
+        putBits(sink, distance - distanceBase[code], distanceExtra[code]);
+    }
+
+    // Writes a literal/length symbol with the fixed code, RFC 1951 3.2.6
+    template <typename Sink>
+    void putSymbol(Sink& sink, unsigned symbol) {
+        if (symbol < 144) {
+            putBits(sink, reverse(0x30 + symbol, 8), 8);
+        } else if (symbol < 256) {
+            putBits(sink, reverse(0x190 + symbol - 144, 9), 9);
+        } else if (symbol < 280) {
+            putBits(sink, reverse(symbol - 256, 7), 7);
+        } else {
+            putBits(sink, reverse(0xC0 + symbol - 280, 8), 8);
+        }
+    }
+
+    // Huffman codes are packed starting from their most significant bit
+    static uint32_t reverse(uint32_t code, int bits) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < bits; i++) {
+            reversed = (reversed << 1) | (code & 1);
+            code >>= 1;
+        }
+        return reversed;
+    }
+
+    template <typename Sink>
+    void putBits(Sink& sink, uint32_t value, int bits) {
+        bitBuffer_ |= value << bitCount_;
+        bitCount_ += bits;
+        while (bitCount_ >= 8) {
+            putByte(sink, bitBuffer_ & 0xFF);
+            bitBuffer_ >>= 8;
+            bitCount_ -= 8;
+        }
+    }
+
+    template <typename Sink>
+    void putByte(Sink& sink, uint8_t byte) {
+        out_[outLength_++] = byte;
+        if (outLength_ == sizeof(out_)) {
+            flush(sink);
+        }
+    }
+
+    template <typename Sink>
+    void flush(Sink& sink) {
+        if (outLength_ > 0) {
+            sink.write((const char*)out_, outLength_);
+            outLength_ = 0;
+        }
+    }
+
+    void updateCrc(const uint8_t* data, size_t length) {
+        // CRC-32 a nibble at a time, a 16 entry table instead of 256
+        static const uint32_t table[16] = {
+            0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+            0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+        uint32_t crc = crc_;
+        for (size_t i = 0; i < length; i++) {
+            crc ^= data[i];
+            crc = (crc >> 4) ^ table[crc & 0x0F];
+            crc = (crc >> 4) ^ table[crc & 0x0F];
+        }
+        crc_ = crc;
+    }
+};
+
+/*
+* Sink that compresses what is written to it into another sink, so the JSON
+* encoders can write gzip without knowing about it. begin and finish are called
+* by the owner of the encoder.
+*/
+template <typename Sink>
+class GzipSink {
+public:
+    GzipSink(GzipEncoder& encoder, Sink& output) : encoder_(encoder), output_(output) {}
+
+    void write(const char* data, size_t length) {
+        encoder_.write(output_, data, length);
+    }
+
+private:
+    GzipEncoder& encoder_;
+    Sink& output_;
+};
+
+#endif // GZIP_ENCODER_H
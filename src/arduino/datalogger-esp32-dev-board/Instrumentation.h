@@ -0,0 +1,314 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "JsonEncoder.h"
+#include "Log.h"
+
+// Set to 0 to compile the timers and counters out, the macros below become empty
+#ifndef INSTRUMENTATION_ENABLED
+#define INSTRUMENTATION_ENABLED 1
+#endif
+
+#define HISTOGRAM_BUCKETS 24        // bucket i counts durations below 2^(i+1) us, the last one the rest
+#define SNAPSHOT_RETRIES 8          // copies of a histogram tried while its writer records
+
+// Stages of the acquisition to upload path that are timed
+#define STAGE_RTC_READ 0
+#define STAGE_DHT_READ 1
+#define STAGE_LUX_READ 2
+#define STAGE_JSON_BUILD 3
+#define STAGE_HTTP_SEND 4
+#define STAGE_SD_STORE 5
+#define STAGE_SD_LOAD 6
+#define STAGE_DIR_SCAN 7
+#define NUMBER_OF_STAGES 8
+
+// Things that went wrong, or nearly, and are counted
+#define COUNTER_SEND_RETRIES 0      // events kept for another try after a failed send
+#define COUNTER_GIVEN_UP 1          // events dropped after using their retry budget
+#define COUNTER_DROPS 2             // events or records lost because a buffer was full
+#define COUNTER_SPILLS 3            // events moved from RAM to the SD card
+#define COUNTER_SENSOR_ERRORS 4     // readings that came back invalid
+#define NUMBER_OF_COUNTERS 5
+
+typedef unsigned long (*MicrosClock)();
+
+/*
+* Latency histogram with fixed power of two buckets, so recording is a couple of
+* shifts and no memory is needed past the counts. Percentiles come out as the
+* upper bound of the bucket they fall in, good to a factor of two.
+*/
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void record(uint32_t us) {
+        counts_[bucketOf(us)]++;
+        count_++;
+        totalUs_ += us;
+        if (us > maxUs_) {
+            maxUs_ = us;
+        }
+    }
+
+    void reset() {
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            counts_[i] = 0;
+        }
+        count_ = 0;
+        totalUs_ = 0;
+        maxUs_ = 0;
+    }
+
+    uint32_t count() const { return count_; }
+    uint32_t maxUs() const { return maxUs_; }
+    uint32_t meanUs() const { return count_ > 0 ? (uint32_t)(totalUs_ / count_) : 0; }
+    uint32_t bucketCount(int bucket) const { return counts_[bucket]; }
+
+    // Upper bound of the bucket holding the given percentile, capped at the maximum seen
+    uint32_t percentileUs(uint8_t percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint32_t rank = (uint32_t)(((uint64_t)count_ * percentile + 99) / 100);
+        uint32_t seen = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                uint32_t bound = (2UL << i) - 1;
+                return bound < maxUs_ ? bound : maxUs_;
+            }
+        }
+        return maxUs_;
+    }
+
+private:
+    uint32_t counts_[HISTOGRAM_BUCKETS];
+    uint32_t count_;
+    uint64_t totalUs_;
+    uint32_t maxUs_;
+
+    static int bucketOf(uint32_t us) {
+        int bucket = 0;
+        while (us > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+            us >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+};
+
+/*
+* A histogram per stage and the counters, for the whole firmware. Each stage is
+* timed from one task only (the RTC and the sensors on the acquisition side, the
+* rest on the uplink side), so a histogram has a single writer; the counters are
+* bumped from both and are atomic. Other tasks never write a histogram: reset
+* only flags the stages and their writer clears them before its next sample, and
+* readers take a copy under the stage's sequence count, retrying while a sample
+* is being recorded. A copy that keeps colliding is used as it is, off by the
+* sample in flight. The clock is injected as in the Scheduler, nothing is timed
+* until it is set. This header does not depend on Arduino.
+*/
+class Instrumentation {
+public:
+    Instrumentation() : clock_(nullptr) {
+        for (int i = 0; i < NUMBER_OF_STAGES; i++) {
+            sequences_[i].store(0, std::memory_order_relaxed);
+            resetPending_[i].store(false, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < NUMBER_OF_COUNTERS; i++) {
+            counters_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void setClock(MicrosClock clock) { clock_ = clock; }
+    MicrosClock clock() const { return clock_; }
+
+    // Called by the task that owns the stage only
+    void record(int stage, uint32_t us) {
+        if (stage < 0 || stage >= NUMBER_OF_STAGES) {
+            return;
+        }
+        // odd while the histogram changes
+        uint32_t sequence = sequences_[stage].load(std::memory_order_relaxed);
+        sequences_[stage].store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if (resetPending_[stage].exchange(false, std::memory_order_acquire)) {
+            stages_[stage].reset();
+        }
+        stages_[stage].record(us);
+        sequences_[stage].store(sequence + 2, std::memory_order_release);
+    }
+
+    void count(int counter, uint32_t n = 1) {
+        if (counter >= 0 && counter < NUMBER_OF_COUNTERS) {
+            counters_[counter].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    // A copy of the histogram, callable from any task
+    LatencyHistogram stage(int stage) const {
+        LatencyHistogram copy;
+        if (resetPending_[stage].load(std::memory_order_acquire)) {
+            return copy;
+        }
+        for (int attempt = 0; attempt < SNAPSHOT_RETRIES; attempt++) {
+            uint32_t before = sequences_[stage].load(std::memory_order_acquire);
+            copy = stages_[stage];
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((before & 1) == 0 && sequences_[stage].load(std::memory_order_relaxed) == before) {
+                break;
+            }
+        }
+        return copy;
+    }
+
+    uint32_t counter(int counter) const { return counters_[counter].load(std::memory_order_relaxed); }
+
+    /*
+    * Starts a new window, the telemetry covers what happened since the last reset.
+    * Callable from any task, each histogram is cleared by its own writer.
+    */
+    void reset() {
+        for (int i = 0; i < NUMBER_OF_STAGES; i++) {
+            resetPending_[i].store(true, std::memory_order_release);
+        }
+        for (int i = 0; i < NUMBER_OF_COUNTERS; i++) {
+            counters_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static const char* stageName(int stage) {
+        static const char* const names[NUMBER_OF_STAGES] = {
+            "rtc_read", "dht_read", "lux_read", "json_build", "http_send", "sd_store", "sd_load", "dir_scan"};
+        return (stage >= 0 && stage < NUMBER_OF_STAGES) ? names[stage] : "unknown";
+    }
+
+    static const char* counterName(int counter) {
+        static const char* const names[NUMBER_OF_COUNTERS] = {
+            "send_retries", "given_up", "drops", "spills", "sensor_errors"};
+        return (counter >= 0 && counter < NUMBER_OF_COUNTERS) ? names[counter] : "unknown";
+    }
+
+    /*
+    * Logs a line per stage that ran and one with the counters, through the
+    * logger so the caller does not wait for the serial port.
+    */
+    void logSummary() const {
+        for (int i = 0; i < NUMBER_OF_STAGES; i++) {
+            LatencyHistogram h = stage(i);
+            if (h.count() == 0) {
+                continue;
+            }
+            LOG_INFO(SYSTEM, "%s: %lu runs, mean %lu us, p50 %lu us, p95 %lu us, max %lu us", stageName(i),
+                     (unsigned long)h.count(), (unsigned long)h.meanUs(), (unsigned long)h.percentileUs(50),
+                     (unsigned long)h.percentileUs(95), (unsigned long)h.maxUs());
+        }
+        // a log line keeps LOG_MAX_ARGS arguments, so the names are in the format
+        static_assert(NUMBER_OF_COUNTERS == 5, "add the new counter to the line below");
+        LOG_INFO(SYSTEM, "counters: send_retries %lu, given_up %lu, drops %lu, spills %lu, sensor_errors %lu",
+                 (unsigned long)counter(COUNTER_SEND_RETRIES), (unsigned long)counter(COUNTER_GIVEN_UP),
+                 (unsigned long)counter(COUNTER_DROPS), (unsigned long)counter(COUNTER_SPILLS),
+                 (unsigned long)counter(COUNTER_SENSOR_ERRORS));
+    }
+
+    /*
+    * Writes the summary as a JSON object to a sink, see JsonEncoder.h:
+    *   {"telemetry": {"uptime_ms": <ms>, "stages": {"<stage>": {"n": .., "mean_us": ..,
+    *    "p50_us": .., "p95_us": .., "max_us": ..}, ...}, "counters": {"<counter>": .., ...}}}
+    */
+    template <typename Sink>
+    void writeJson(Sink& sink, unsigned long uptimeMs) const {
+        using namespace json_encoder;
+
+        writeText(sink, "{\"telemetry\": {\"uptime_ms\": ");
+        writeUnsigned(sink, uptimeMs);
+        writeText(sink, ", \"stages\": {");
+        bool first = true;
+        for (int i = 0; i < NUMBER_OF_STAGES; i++) {
+            LatencyHistogram h = stage(i);
+            if (h.count() == 0) {
+                continue;
+            }
+            writeText(sink, first ? "\"" : ", \"");
+            writeText(sink, stageName(i));
+            writeText(sink, "\": {\"n\": ");
+            writeUnsigned(sink, h.count());
+            writeText(sink, ", \"mean_us\": ");
+            writeUnsigned(sink, h.meanUs());
+            writeText(sink, ", \"p50_us\": ");
+            writeUnsigned(sink, h.percentileUs(50));
+            writeText(sink, ", \"p95_us\": ");
+            writeUnsigned(sink, h.percentileUs(95));
+            writeText(sink, ", \"max_us\": ");
+            writeUnsigned(sink, h.maxUs());
+            writeText(sink, "}");
+            first = false;
+        }
+        writeText(sink, "}, \"counters\": {");
+        for (int i = 0; i < NUMBER_OF_COUNTERS; i++) {
+            writeText(sink, i == 0 ? "\"" : ", \"");
+            writeText(sink, counterName(i));
+            writeText(sink, "\": ");
+            writeUnsigned(sink, counter(i));
+        }
+        writeText(sink, "}}}");
+    }
+
+private:
+    MicrosClock clock_;
+    LatencyHistogram stages_[NUMBER_OF_STAGES];
+    std::atomic<uint32_t> sequences_[NUMBER_OF_STAGES];
+    std::atomic<bool> resetPending_[NUMBER_OF_STAGES];
+    std::atomic<uint32_t> counters_[NUMBER_OF_COUNTERS];
+};
+
+// The instance shared by every translation unit
+inline Instrumentation& instrumentation() {
+    static Instrumentation instance;
+    return instance;
+}
+
+/*
+* Times the enclosing scope into a stage. Reading the clock twice is the whole
+* cost, use INSTRUMENT_STAGE so it goes away with INSTRUMENTATION_ENABLED 0.
+*/
+class ScopedTimer {
+public:
+    explicit ScopedTimer(int stage) : stage_(stage), clock_(instrumentation().clock()), start_(0) {
+        if (clock_ != nullptr) {
+            start_ = clock_();
+        }
+    }
+
+    ~ScopedTimer() {
+        if (clock_ != nullptr) {
+            instrumentation().record(stage_, (uint32_t)(clock_() - start_));
+        }
+    }
+
+private:
+    int stage_;
+    MicrosClock clock_;
+    unsigned long start_;
+
+    ScopedTimer(const ScopedTimer&);
+    ScopedTimer& operator=(const ScopedTimer&);
+};
+
+#if INSTRUMENTATION_ENABLED
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+#define INSTRUMENT_STAGE(stage) ScopedTimer INSTRUMENT_CONCAT(stageTimer_, __LINE__)(stage)
+#define INSTRUMENT_COUNT(counter, n) instrumentation().count((counter), (n))
+#else
+#define INSTRUMENT_STAGE(stage) do {} while (0)
+#define INSTRUMENT_COUNT(counter, n) do {} while (0)
+#endif
+
+#endif // INSTRUMENTATION_H
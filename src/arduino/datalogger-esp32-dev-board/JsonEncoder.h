@@ -0,0 +1,239 @@
+#ifndef JSON_ENCODER_H
+#define JSON_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "MeasurementRecord.h"
+#include "TimeUtils.h"
+
+/*
+* Zero allocation JSON encoder for measurement payloads. It writes
+*   [{"variable": <uiid>, "value": <value>, "crop": <uiid>, "datetime": "<timestamp>"}, ...]
+* straight into a sink, nothing is built on the heap. A sink is any object with a
+*   void write(const char* data, size_t length)
+* method, running the encoder over a CountingSink gives the exact length of the body
+* before anything is sent. This header does not depend on Arduino.
+*/
+
+/*
+* Tables used to translate the ids of a record into the text the API expects.
+* The uiids must already be quoted, they are written as they are.
+*/
+struct MeasurementDictionary {
+    const char* const* variables;
+    uint8_t numVariables;
+    const char* const* crops;
+    uint8_t numCrops;
+    const char* tz;                 // utc offset appended to the datetime, e.g. "-05:00"
+};
+
+// Counts the bytes that would be written, used to know the Content-Length up front
+class CountingSink {
+public:
+    size_t count = 0;
+
+    void write(const char* data, size_t length) {
+        (void)data;
+        count += length;
+    }
+};
+
+// Writes into a caller provided buffer, never past its capacity
+class BufferSink {
+public:
+    BufferSink(char* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity), length_(0), overflow_(false) {}
+
+    void write(const char* data, size_t length) {
+        if (length > capacity_ - length_) {
+            length = capacity_ - length_;
+            overflow_ = true;
+        }
+        memcpy(buffer_ + length_, data, length);
+        length_ += length;
+    }
+
+    size_t length() const { return length_; }
+    bool overflow() const { return overflow_; }
+
+private:
+    char* buffer_;
+    size_t capacity_;
+    size_t length_;
+    bool overflow_;
+};
+
+/*
+* Forwards to a Print/Stream/Client through a small fixed buffer, so a socket gets
+* a few large writes instead of one per token. Call flush() when done.
+*/
+template <typename Output, size_t BufferSize = 128>
+class PrintSink {
+public:
+    explicit PrintSink(Output& output) : output_(output), length_(0), written_(0), requested_(0) {}
+
+    ~PrintSink() {
+        flush();
+    }
+
+    void write(const char* data, size_t length) {
+        requested_ += length;
+        while (length > 0) {
+            size_t chunk = BufferSize - length_;
+            if (chunk > length) {
+                chunk = length;
+            }
+            memcpy(buffer_ + length_, data, chunk);
+            length_ += chunk;
+            data += chunk;
+            length -= chunk;
+            if (length_ == BufferSize) {
+                flush();
+            }
+        }
+    }
+
+    void flush() {
+        if (length_ > 0) {
+            written_ += output_.write(reinterpret_cast<const uint8_t*>(buffer_), length_);
+            length_ = 0;
+        }
+    }
+
+    size_t written() const { return written_; }
+    // Bytes passed to write, more than written once the output fell short
+    size_t requested() const { return requested_; }
+
+private:
+    Output& output_;
+    char buffer_[BufferSize];
+    size_t length_;
+    size_t written_;
+    size_t requested_;
+};
+
+namespace json_encoder {
+
+template <typename Sink>
+inline void writeText(Sink& sink, const char* text) {
+    sink.write(text, strlen(text));
+}
+
+// Writes an unsigned integer padded with zeros up to minDigits
+template <typename Sink>
+inline void writeUnsigned(Sink& sink, uint64_t value, int minDigits = 1) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n] = '0' + (value % 10);
+        value /= 10;
+        n++;
+    } while (value > 0 || n < minDigits);
+    sink.write(digits + sizeof(digits) - n, n);
+}
+
+template <typename Sink>
+inline void writeSigned(Sink& sink, int64_t value) {
+    if (value < 0) {
+        sink.write("-", 1);
+        writeUnsigned(sink, (uint64_t)(-(value + 1)) + 1);
+    } else {
+        writeUnsigned(sink, (uint64_t)value);
+    }
+}
+
+// Writes a value with two decimals, same precision as String(float)
+template <typename Sink>
+inline void writeValue(Sink& sink, float value) {
+    if (isnan(value) || isinf(value)) {
+        writeText(sink, "null");
+        return;
+    }
+
+    double scaled = (double)value * 100.0;
+    bool negative = scaled < 0;
+    uint64_t hundredths = (uint64_t)((negative ? -scaled : scaled) + 0.5);
+    if (negative && hundredths > 0) {
+        sink.write("-", 1);
+    }
+    writeUnsigned(sink, hundredths / 100);
+    sink.write(".", 1);
+    writeUnsigned(sink, hundredths % 100, 2);
+}
+
+inline const char* lookup(const char* const* table, uint8_t size, uint8_t id) {
+    if (table == nullptr || size == 0) {
+        return "null";
+    }
+    return table[id < size ? id : size - 1];
+}
+
+} // namespace json_encoder
+
+/*
+* Writes a single measurement object, without the surrounding array.
+*/
+template <typename Sink>
+void encodeMeasurement(Sink& sink, const MeasurementRecord& record, const MeasurementDictionary& dictionary) {
+    using namespace json_encoder;
+
+    writeText(sink, "{\"variable\": ");
+    writeText(sink, lookup(dictionary.variables, dictionary.numVariables, record.variableId));
+    writeText(sink, ", \"value\": ");
+    writeValue(sink, record.value);
+    writeText(sink, ", \"crop\": ");
+    writeText(sink, lookup(dictionary.crops, dictionary.numCrops, record.cropId));
+    writeText(sink, ", \"datetime\": \"");
+    writeIsoTimestamp(sink, record.epoch);
+    if (dictionary.tz != nullptr && dictionary.tz[0] != '\0') {
+        sink.write(" ", 1);
+        writeText(sink, dictionary.tz);
+    }
+    writeText(sink, "\"}");
+}
+
+/*
+* Writes the records as a JSON array.
+* @return number of bytes written to the sink
+*/
+template <typename Sink>
+size_t encodeMeasurements(Sink& sink,
+                          const MeasurementRecord* records,
+                          int numRecords,
+                          const MeasurementDictionary& dictionary) {
+    CountingSink counter;
+
+    struct Tee {
+        Sink& sink;
+        CountingSink& counter;
+        void write(const char* data, size_t length) {
+            sink.write(data, length);
+            counter.write(data, length);
+        }
+    } tee = {sink, counter};
+
+    tee.write("[", 1);
+    for (int i = 0; i < numRecords; i++) {
+        if (i > 0) {
+            tee.write(", ", 2);
+        }
+        encodeMeasurement(tee, records[i], dictionary);
+    }
+    tee.write("]", 1);
+
+    return counter.count;
+}
+
+/*
+* Exact length of the JSON array encodeMeasurements would write.
+*/
+inline size_t measurementsJsonLength(const MeasurementRecord* records,
+                                     int numRecords,
+                                     const MeasurementDictionary& dictionary) {
+    CountingSink counter;
+    encodeMeasurements(counter, records, numRecords, dictionary);
+    return counter.count;
+}
+
+#endif // JSON_ENCODER_H
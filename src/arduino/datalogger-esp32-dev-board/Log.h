@@ -0,0 +1,436 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Level of the modules that do not set their own, messages above it are compiled out
+#ifndef LOG_DEFAULT_LEVEL
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_INFO
+#endif
+
+// One level per module, e.g. -DLOG_LEVEL_API=LOG_LEVEL_DEBUG
+#ifndef LOG_LEVEL_API
+#define LOG_LEVEL_API LOG_DEFAULT_LEVEL
+#endif
+#ifndef LOG_LEVEL_CONNECTION
+#define LOG_LEVEL_CONNECTION LOG_DEFAULT_LEVEL
+#endif
+#ifndef LOG_LEVEL_SENSORS
+#define LOG_LEVEL_SENSORS LOG_DEFAULT_LEVEL
+#endif
+#ifndef LOG_LEVEL_STORAGE
+#define LOG_LEVEL_STORAGE LOG_DEFAULT_LEVEL
+#endif
+#ifndef LOG_LEVEL_SYSTEM
+#define LOG_LEVEL_SYSTEM LOG_DEFAULT_LEVEL
+#endif
+
+// 1 queues the lines for the log task, 0 writes them from the caller like Serial.printf
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 1
+#endif
+
+#define LOG_RING_CAPACITY 32        // lines waiting to be written, a power of two
+#define LOG_MAX_ARGS 6              // format arguments kept per line, the rest print as '?'
+#define LOG_TEXT_LENGTH 64          // bytes for the copies of the string arguments of a line
+#define LOG_LINE_LENGTH 192         // longest line written, longer ones are cut
+
+#define LOG_ARG_SIGNED 0
+#define LOG_ARG_UNSIGNED 1
+#define LOG_ARG_DOUBLE 2
+#define LOG_ARG_TEXT 3
+
+typedef unsigned long (*LogClock)();
+typedef void (*LogWriter)(const char* text, size_t length);
+
+/*
+* A line as it was logged: the format, which must be a string literal since only
+* the pointer is kept, and copies of the arguments. Strings are copied, so the
+* caller may pass buffers that go away as soon as the call returns.
+*/
+struct LogRecord {
+    const char* format;
+    const char* module;
+    unsigned long millis;
+    uint8_t level;
+    uint8_t argCount;
+    uint8_t textLength;
+    uint8_t types[LOG_MAX_ARGS];
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        uint8_t text;           // offset in text
+    } args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_LENGTH];
+};
+
+/*
+* Bounded ring of log records, any number of writers and a single reader. A
+* writer claims a slot with one compare and swap and fills it in place, the
+* reader takes slots in order once their writer published them (D. Vyukov's
+* bounded queue). Nothing blocks: a full ring refuses the record.
+*/
+class LogRing {
+public:
+    LogRing() : tail_(0), head_(0) {
+        for (uint32_t i = 0; i < LOG_RING_CAPACITY; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // @return the slot to fill and then publish, nullptr when the ring is full
+    LogRecord* claim(uint32_t& position) {
+        position = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[position & (LOG_RING_CAPACITY - 1)];
+            int32_t lag = (int32_t)(cell.sequence.load(std::memory_order_acquire) - position);
+            if (lag == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    return &cell.record;
+                }
+            } else if (lag < 0) {
+                return nullptr;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void publish(uint32_t position) {
+        cells_[position & (LOG_RING_CAPACITY - 1)].sequence.store(position + 1, std::memory_order_release);
+    }
+
+    // Reader side. @return the oldest published record, nullptr if there is none yet
+    const LogRecord* front() {
+        Cell& cell = cells_[head_ & (LOG_RING_CAPACITY - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != head_ + 1) {
+            return nullptr;
+        }
+        return &cell.record;
+    }
+
+    void pop() {
+        cells_[head_ & (LOG_RING_CAPACITY - 1)].sequence.store(head_ + LOG_RING_CAPACITY, std::memory_order_release);
+        head_++;
+    }
+
+private:
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        LogRecord record;
+    };
+
+    Cell cells_[LOG_RING_CAPACITY];
+    std::atomic<uint32_t> tail_;
+    uint32_t head_;                 // only the reader moves it
+};
+
+/*
+* Logger of the firmware. A call captures the arguments into a record, which in
+* deferred mode goes to the ring and is formatted and written later by drain(),
+* called from a low priority task; the caller never waits for the serial port.
+* Lines logged while the ring is full are counted and reported on the next
+* drain. In direct mode the line is written before the call returns.
+*
+* Only integers, floating point numbers and C strings are taken as arguments,
+* a String does not compile, so nothing is built on the heap to be printed. The
+* usual conversions are understood, without '*' widths. The clock and the writer
+* are injected as in the Scheduler. This header does not depend on Arduino.
+*/
+class Logger {
+public:
+    Logger() : clock_(nullptr), writer_(nullptr), deferred_(LOG_DEFERRED != 0), dropped_(0) {}
+
+    void begin(LogClock clock, LogWriter writer) {
+        clock_ = clock;
+        writer_ = writer;
+    }
+
+    void setDeferred(bool deferred) { deferred_ = deferred; }
+    bool isDeferred() const { return deferred_; }
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    void log(uint8_t level, const char* module, const char* format, Args... args) {
+        if (!deferred_) {
+            LogRecord record;
+            fill(record, level, module, format, args...);
+            write(record);
+            return;
+        }
+        uint32_t position;
+        LogRecord* record = ring_.claim(position);
+        if (record == nullptr) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        fill(*record, level, module, format, args...);
+        ring_.publish(position);
+    }
+
+    /*
+    * Writes up to max of the queued lines. Call it from one task only.
+    * @return number of lines written
+    */
+    size_t drain(size_t max = LOG_RING_CAPACITY) {
+        if (writer_ == nullptr) {
+            return 0;
+        }
+        uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            char line[64];
+            int length = snprintf(line, sizeof(line), "W (%lu) LOG: %lu lines dropped\n", now(), (unsigned long)dropped);
+            writer_(line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+        }
+        size_t written = 0;
+        const LogRecord* record;
+        while (written < max && (record = ring_.front()) != nullptr) {
+            write(*record);
+            ring_.pop();
+            written++;
+        }
+        return written;
+    }
+
+    /*
+    * Formats a record the way printf would have, prefixed with the level, the
+    * time in ms and the module, and ended with a newline.
+    * @return length of the line, at most capacity - 1
+    */
+    static size_t format(const LogRecord& record, char* line, size_t capacity) {
+        static const char levels[] = "?EWID";
+        // one byte stays for the newline
+        size_t limit = capacity - 1;
+        size_t length = 0;
+        append(limit, length,
+               snprintf(line, limit, "%c (%lu) %s: ", levels[record.level <= LOG_LEVEL_DEBUG ? record.level : 0],
+                        record.millis, record.module));
+
+        int arg = 0;
+        const char* p = record.format;
+        while (*p != '\0' && length < limit - 1) {
+            if (*p != '%') {
+                line[length++] = *p++;
+                continue;
+            }
+            if (p[1] == '%') {
+                line[length++] = '%';
+                p += 2;
+                continue;
+            }
+            // keep the flags, the width and the precision, the length comes from the argument
+            char spec[16] = "%";
+            size_t specLength = 1;
+            p++;
+            while (*p != '\0' && strchr("-+ #0123456789.", *p) != nullptr && specLength < sizeof(spec) - 4) {
+                spec[specLength++] = *p++;
+            }
+            while (*p != '\0' && strchr("hlLqjzt", *p) != nullptr) {
+                p++;
+            }
+            if (*p == '\0') {
+                break;
+            }
+            formatArg(record, arg++, *p++, spec, specLength, line, limit, length);
+        }
+        line[length++] = '\n';
+        line[length] = '\0';
+        return length;
+    }
+
+private:
+    LogClock clock_;
+    LogWriter writer_;
+    bool deferred_;
+    std::atomic<uint32_t> dropped_;
+    LogRing ring_;
+
+    unsigned long now() const { return clock_ != nullptr ? clock_() : 0; }
+
+    void write(const LogRecord& record) {
+        if (writer_ == nullptr) {
+            return;
+        }
+        char line[LOG_LINE_LENGTH];
+        size_t length = format(record, line, sizeof(line));
+        writer_(line, length);
+    }
+
+    template <typename... Args>
+    void fill(LogRecord& record, uint8_t level, const char* module, const char* format, Args... args) {
+        record.format = format;
+        record.module = module;
+        record.millis = now();
+        record.level = level;
+        record.argCount = 0;
+        record.textLength = 0;
+        capture(record, args...);
+    }
+
+    static void capture(LogRecord& record) { (void)record; }
+
+    template <typename T, typename... Rest>
+    static void capture(LogRecord& record, T value, Rest... rest) {
+        add(record, value);
+        capture(record, rest...);
+    }
+
+    static bool next(LogRecord& record, uint8_t type, int& index) {
+        if (record.argCount >= LOG_MAX_ARGS) {
+            return false;
+        }
+        index = record.argCount++;
+        record.types[index] = type;
+        return true;
+    }
+
+    static void add(LogRecord& record, long long value) {
+        int i;
+        if (next(record, LOG_ARG_SIGNED, i)) {
+            record.args[i].i = value;
+        }
+    }
+    static void add(LogRecord& record, int value) { add(record, (long long)value); }
+    static void add(LogRecord& record, long value) { add(record, (long long)value); }
+
+    static void add(LogRecord& record, unsigned long long value) {
+        int i;
+        if (next(record, LOG_ARG_UNSIGNED, i)) {
+            record.args[i].u = value;
+        }
+    }
+    static void add(LogRecord& record, unsigned value) { add(record, (unsigned long long)value); }
+    static void add(LogRecord& record, unsigned long value) { add(record, (unsigned long long)value); }
+
+    static void add(LogRecord& record, double value) {
+        int i;
+        if (next(record, LOG_ARG_DOUBLE, i)) {
+            record.args[i].d = value;
+        }
+    }
+
+    // Copies the string, cut to what is left of the text of the record
+    static void add(LogRecord& record, const char* value) {
+        int i;
+        if (!next(record, LOG_ARG_TEXT, i)) {
+            return;
+        }
+        if (value == nullptr) {
+            value = "(null)";
+        }
+        // the last byte is kept for a terminator, strings that find no room print empty
+        size_t start = record.textLength;
+        size_t length = strlen(value);
+        length = length < LOG_TEXT_LENGTH - 1 - start ? length : LOG_TEXT_LENGTH - 1 - start;
+        memcpy(record.text + start, value, length);
+        record.text[start + length] = '\0';
+        record.args[i].text = (uint8_t)start;
+        record.textLength = (uint8_t)(start + length < LOG_TEXT_LENGTH - 1 ? start + length + 1 : LOG_TEXT_LENGTH - 1);
+    }
+
+    static void append(size_t capacity, size_t& length, int written) {
+        if (written > 0) {
+            length += ((size_t)written < capacity - length) ? (size_t)written : capacity - length - 1;
+        }
+    }
+
+    // Formats one argument with the conversion the format asks for, whatever type it was logged as
+    static void formatArg(const LogRecord& record, int arg, char conversion, char* spec, size_t specLength,
+                          char* line, size_t capacity, size_t& length) {
+        char* out = line + length;
+        size_t room = capacity - length;
+        if (strchr("diuoxXcfFeEgGaAsp", conversion) == nullptr) {
+            line[length++] = conversion;
+            return;
+        }
+        if (arg >= record.argCount) {
+            line[length++] = '?';
+            return;
+        }
+        uint8_t type = record.types[arg];
+        if ((conversion == 's') != (type == LOG_ARG_TEXT)) {
+            line[length++] = '?';
+            return;
+        }
+        if (conversion == 's') {
+            strcpy(spec + specLength, "s");
+            append(capacity, length, snprintf(out, room, spec, record.text + record.args[arg].text));
+            return;
+        }
+
+        int64_t i = type == LOG_ARG_SIGNED ? record.args[arg].i
+                    : type == LOG_ARG_UNSIGNED ? (int64_t)record.args[arg].u
+                    : (int64_t)record.args[arg].d;
+        double d = type == LOG_ARG_DOUBLE ? record.args[arg].d
+                   : type == LOG_ARG_SIGNED ? (double)record.args[arg].i
+                   : (double)record.args[arg].u;
+        int written;
+        switch (conversion) {
+        case 'd':
+        case 'i':
+            strcpy(spec + specLength, "lld");
+            written = snprintf(out, room, spec, (long long)i);
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec[specLength++] = 'l';
+            spec[specLength++] = 'l';
+            spec[specLength++] = conversion;
+            spec[specLength] = '\0';
+            written = snprintf(out, room, spec, (unsigned long long)i);
+            break;
+        case 'c':
+            strcpy(spec + specLength, "c");
+            written = snprintf(out, room, spec, (int)i);
+            break;
+        case 'p':
+            strcpy(spec + specLength, "p");
+            written = snprintf(out, room, spec, (void*)(uintptr_t)i);
+            break;
+        default:
+            spec[specLength++] = conversion;
+            spec[specLength] = '\0';
+            written = snprintf(out, room, spec, d);
+            break;
+        }
+        append(capacity, length, written);
+    }
+};
+
+// The instance shared by every translation unit
+inline Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+/*
+* Logs a line for a module, e.g. LOG_INFO(API, "Status code: %d", statusCode). The
+* level of the module is known at compile time, lines above it and their
+* arguments are compiled out. No newline at the end, the logger adds it.
+*/
+#define LOG_AT(module, level, ...)                                  \
+    do {                                                            \
+        if (LOG_LEVEL_##module >= (level)) {                        \
+            logger().log((level), #module, __VA_ARGS__);            \
+        }                                                           \
+    } while (0)
+
+#define LOG_ERROR(module, ...) LOG_AT(module, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(module, ...) LOG_AT(module, LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(module, ...) LOG_AT(module, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(module, ...) LOG_AT(module, LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif // LOG_H
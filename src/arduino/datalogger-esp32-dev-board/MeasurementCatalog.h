@@ -0,0 +1,51 @@
+#ifndef MEASUREMENT_CATALOG_H
+#define MEASUREMENT_CATALOG_H
+
+#include <Arduino.h>
+#include "secrets.h"
+#include "MeasurementRecord.h"
+#include "JsonEncoder.h"
+
+/*
+* Maps the ids stored in a MeasurementRecord to the uiids the API expects.
+* The uiids in secrets.h are already quoted, so they can be written to the JSON as they are.
+*/
+inline const String& variableUiid(uint8_t variableId) {
+    switch (variableId) {
+        case TEMPERATURE_VARIABLE: return TEMPERATURE_UIID;
+        case HUMIDITY_VARIABLE: return HUMIDITY_UIID;
+        case VPD_VARIABLE: return VPD_UIID;
+        case DEWPOINT_VARIABLE: return DEWPOINT_UIID;
+        case LUX_VARIABLE: return LUX_UIID;
+        case DLI_VARIABLE: return DLI_UIID;
+        default: return DLI_UIID;
+    }
+}
+
+inline const String& cropUiid(uint8_t cropId) {
+    (void)cropId;   // every crop maps to the one of secrets.h for now
+    return CROP_UIID;
+}
+
+/*
+* Dictionary for the JSON encoder, it points into the Strings of secrets.h
+* so it is filled on first use instead of during static initialization.
+*/
+inline const MeasurementDictionary& measurementDictionary() {
+    static const char* variables[NUMBER_OF_VARIABLES];
+    static const char* crops[NUMBER_OF_CROPS];
+    static MeasurementDictionary dictionary = {variables, NUMBER_OF_VARIABLES, crops, NUMBER_OF_CROPS, nullptr};
+
+    if (dictionary.tz == nullptr) {
+        for (int i = 0; i < NUMBER_OF_VARIABLES; i++) {
+            variables[i] = variableUiid(i).c_str();
+        }
+        for (int i = 0; i < NUMBER_OF_CROPS; i++) {
+            crops[i] = cropUiid(i).c_str();
+        }
+        dictionary.tz = TZ.c_str();
+    }
+    return dictionary;
+}
+
+#endif // MEASUREMENT_CATALOG_H
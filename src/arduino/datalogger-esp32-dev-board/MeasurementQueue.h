@@ -0,0 +1,73 @@
+#ifndef MEASUREMENT_QUEUE_H
+#define MEASUREMENT_QUEUE_H
+
+#include <Arduino.h>
+#include "Event.h"
+#include "MeasurementRecord.h"
+#include "SpscQueue.h"
+#include "Instrumentation.h"
+#include "Log.h"
+
+#define MEASUREMENT_QUEUE_CAPACITY 64 // records, 16 bytes each, one slot is never used
+
+typedef SpscQueue<MeasurementRecord, MEASUREMENT_QUEUE_CAPACITY> MeasurementQueue;
+
+/*
+* Acquisition side of the measurement queue. It is subscribed to the measurement
+* channel of the sensors and pushes the records of every measurement event, so
+* sampling never waits for the network or the SD card.
+*/
+class MeasurementQueueWriter {
+public:
+    explicit MeasurementQueueWriter(MeasurementQueue& queue) : queue_(queue), dropped_(0) {}
+
+    void onRecords(const RecordSpan& records) {
+        // an event goes in whole or not at all, so the reader can regroup it
+        if (queue_.freeSpace() < records.size) {
+            dropped_ += records.size;
+            INSTRUMENT_COUNT(COUNTER_DROPS, records.size);
+            LOG_WARN(SENSORS, "Measurement queue full, dropped %d records (%lu so far)", (int)records.size, dropped_);
+            return;
+        }
+        for (const MeasurementRecord& record : records) {
+            queue_.push(record);
+        }
+    }
+
+    unsigned long getDroppedCount() const {
+        return dropped_;
+    }
+
+private:
+    MeasurementQueue& queue_;
+    unsigned long dropped_;
+};
+
+/*
+* Uplink side of the measurement queue. Pops records into measurement events,
+* consecutive records taken at the same time share an event.
+* @return number of events filled, at most maxEvents
+*/
+inline int drainMeasurementQueue(MeasurementQueue& queue, Event* events, int maxEvents) {
+    MeasurementRecord records[MAX_RECORDS_PER_EVENT];
+    MeasurementRecord record;
+    int numRecords = 0;
+    int numEvents = 0;
+
+    while (numEvents < maxEvents && queue.peek(record)) {
+        if (numRecords == MAX_RECORDS_PER_EVENT || (numRecords > 0 && record.epoch != records[0].epoch)) {
+            events[numEvents++] = Event(OK_STATUS, records, numRecords);
+            numRecords = 0;
+            continue;
+        }
+        queue.pop(record);
+        records[numRecords++] = record;
+    }
+
+    if (numRecords > 0) {
+        events[numEvents++] = Event(OK_STATUS, records, numRecords);
+    }
+    return numEvents;
+}
+
+#endif // MEASUREMENT_QUEUE_H
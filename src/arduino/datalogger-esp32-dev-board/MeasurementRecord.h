@@ -0,0 +1,68 @@
+#ifndef MEASUREMENT_RECORD_H
+#define MEASUREMENT_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Span.h"
+
+// Define variable ids, they index the uiid table used when sending to the API
+#define TEMPERATURE_VARIABLE 0
+#define HUMIDITY_VARIABLE 1
+#define VPD_VARIABLE 2
+#define DEWPOINT_VARIABLE 3
+#define LUX_VARIABLE 4
+#define DLI_VARIABLE 5
+#define NUMBER_OF_VARIABLES 6
+
+// Define crop ids, they index the crop uiid table
+#define DEFAULT_CROP 0
+#define NUMBER_OF_CROPS 1
+
+// Maximum number of records a single measurement event can carry
+#define MAX_RECORDS_PER_EVENT 4
+
+/*
+* Fixed layout measurement record. It has no pointers nor heap allocated members,
+* so copying it is a plain memberwise copy and it can live in fixed size arrays.
+* The JSON representation is only built when the record is transmitted.
+* This header does not depend on Arduino so it can be compiled on the host.
+*/
+struct MeasurementRecord {
+    uint32_t epoch;       // seconds since 1970-01-01 00:00:00 of the RTC wall clock
+    float value;
+    int16_t status;       // last status code returned by the server for this record
+    uint8_t variableId;
+    uint8_t cropId;
+    uint8_t timesSent;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(MeasurementRecord) == 16, "MeasurementRecord layout must stay fixed");
+
+// The records of one measurement event, as published by the sensors
+typedef Span<MeasurementRecord> RecordSpan;
+
+inline MeasurementRecord makeMeasurementRecord(uint8_t variableId,
+                                               uint8_t cropId,
+                                               float value,
+                                               uint32_t epoch) {
+    MeasurementRecord record = {};
+    record.epoch = epoch;
+    record.value = value;
+    record.status = 0;
+    record.variableId = variableId;
+    record.cropId = cropId;
+    record.timesSent = 0;
+    return record;
+}
+
+inline bool operator==(const MeasurementRecord& a, const MeasurementRecord& b) {
+    return a.epoch == b.epoch && a.value == b.value && a.status == b.status &&
+           a.variableId == b.variableId && a.cropId == b.cropId && a.timesSent == b.timesSent;
+}
+
+inline bool operator!=(const MeasurementRecord& a, const MeasurementRecord& b) {
+    return !(a == b);
+}
+
+#endif // MEASUREMENT_RECORD_H
@@ -0,0 +1,191 @@
+#include "MqttClient.h"
+#include "Log.h"
+
+MqttClient::MqttClient(Client& client) : client_(client) {
+    keepAliveSecs_ = MQTT_KEEP_ALIVE_SECS;
+    lastSent_ = 0;
+    writeFailed_ = false;
+    outLength_ = 0;
+}
+
+bool MqttClient::connect(const char* host, uint16_t port, const char* clientId,
+                         const char* username, const char* password,
+                         uint16_t keepAliveSecs) {
+    if (!client_.connect(host, port)) {
+        LOG_WARN(CONNECTION, "MQTT: failed to open the socket");
+        return false;
+    }
+    keepAliveSecs_ = keepAliveSecs;
+    writeFailed_ = false;
+    outLength_ = 0;
+
+    uint8_t flags = 0x02; // clean session
+    size_t length = 10 + 2 + strlen(clientId);
+    if (username != nullptr) {
+        flags |= 0x80;
+        length += 2 + strlen(username);
+    }
+    if (password != nullptr) {
+        flags |= 0x40;
+        length += 2 + strlen(password);
+    }
+
+    writeByte(MQTT_CONNECT);
+    writeRemainingLength(length);
+    writeString("MQTT");
+    writeByte(4); // protocol level 3.1.1
+    writeByte(flags);
+    writeUint16(keepAliveSecs);
+    writeString(clientId);
+    if (username != nullptr) {
+        writeString(username);
+    }
+    if (password != nullptr) {
+        writeString(password);
+    }
+    flushOut();
+    lastSent_ = millis();
+
+    // CONNACK: 0x20, 2, session present, return code
+    int type = readByte(MQTT_READ_TIMEOUT);
+    int connackLength = readByte(MQTT_READ_TIMEOUT);
+    readByte(MQTT_READ_TIMEOUT);
+    int returnCode = readByte(MQTT_READ_TIMEOUT);
+    if (writeFailed_ || type != MQTT_CONNACK || connackLength != 2 || returnCode != 0) {
+        LOG_WARN(CONNECTION, "MQTT: connection refused (%d)", returnCode);
+        client_.stop();
+        return false;
+    }
+    return true;
+}
+
+bool MqttClient::connected() {
+    return !writeFailed_ && client_.connected();
+}
+
+void MqttClient::disconnect() {
+    if (client_.connected()) {
+        writeByte(MQTT_DISCONNECT);
+        writeByte(0);
+        flushOut();
+    }
+    client_.stop();
+}
+
+bool MqttClient::beginPublish(const char* topic, size_t payloadLength, uint16_t packetId) {
+    writeByte(MQTT_PUBLISH | 0x02); // QoS 1
+    writeRemainingLength(2 + strlen(topic) + 2 + payloadLength);
+    writeString(topic);
+    writeUint16(packetId);
+    flushOut();
+    return !writeFailed_;
+}
+
+Client& MqttClient::payload() {
+    return client_;
+}
+
+bool MqttClient::endPublish() {
+    // no flush(), on the ESP32 it discards the received bytes, PUBACKs included
+    lastSent_ = millis();
+    return !writeFailed_ && client_.connected();
+}
+
+bool MqttClient::readPacket(uint8_t& type, uint16_t& packetId) {
+    if (client_.available() <= 0) {
+        return false;
+    }
+
+    int header = readByte(MQTT_READ_TIMEOUT);
+    if (header < 0) {
+        return false;
+    }
+    type = header & 0xF0;
+
+    // remaining length, up to 4 bytes of 7 bits
+    size_t length = 0;
+    int shift = 0;
+    int digit;
+    do {
+        digit = readByte(MQTT_READ_TIMEOUT);
+        if (digit < 0 || shift > 21) {
+            client_.stop();
+            return false;
+        }
+        length |= (size_t)(digit & 0x7F) << shift;
+        shift += 7;
+    } while (digit & 0x80);
+
+    packetId = 0;
+    for (size_t i = 0; i < length; i++) {
+        int value = readByte(MQTT_READ_TIMEOUT);
+        if (value < 0) {
+            client_.stop();
+            return false;
+        }
+        // only the packet identifier of a PUBACK is used, the rest is skipped
+        if (i < 2) {
+            packetId = (packetId << 8) | value;
+        }
+    }
+    return true;
+}
+
+void MqttClient::keepAlive() {
+    if (millis() - lastSent_ < keepAliveSecs_ * 500UL) {
+        return;
+    }
+    writeByte(MQTT_PINGREQ);
+    writeByte(0);
+    flushOut();
+    lastSent_ = millis();
+}
+
+void MqttClient::flushOut() {
+    if (outLength_ > 0 && client_.write(out_, outLength_) != outLength_) {
+        writeFailed_ = true;
+    }
+    outLength_ = 0;
+}
+
+void MqttClient::writeByte(uint8_t value) {
+    if (outLength_ == sizeof(out_)) {
+        flushOut();
+    }
+    out_[outLength_++] = value;
+}
+
+void MqttClient::writeUint16(uint16_t value) {
+    writeByte(value >> 8);
+    writeByte(value & 0xFF);
+}
+
+void MqttClient::writeString(const char* value) {
+    size_t length = strlen(value);
+    writeUint16(length);
+    for (size_t i = 0; i < length; i++) {
+        writeByte(value[i]);
+    }
+}
+
+void MqttClient::writeRemainingLength(size_t length) {
+    do {
+        uint8_t digit = length % 128;
+        length /= 128;
+        if (length > 0) {
+            digit |= 0x80;
+        }
+        writeByte(digit);
+    } while (length > 0);
+}
+
+int MqttClient::readByte(unsigned long timeout) {
+    unsigned long start = millis();
+    while (client_.available() <= 0) {
+        if (!client_.connected() || millis() - start >= timeout) {
+            return -1;
+        }
+        delay(1);
+    }
+    return client_.read();
+}
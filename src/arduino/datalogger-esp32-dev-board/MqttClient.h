@@ -0,0 +1,75 @@
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include <Arduino.h>
+#include "WiFi.h"
+
+#define MQTT_KEEP_ALIVE_SECS 60
+#define MQTT_READ_TIMEOUT 5000      // ms to wait for the rest of a packet or for a CONNACK
+#define MQTT_OUT_BUFFER 64          // packet headers are gathered so they leave in one segment
+
+// control packet types, upper nibble of the first byte
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+/*
+* Minimal MQTT 3.1.1 client over any Arduino Client. It only publishes, with QoS 1,
+* and does not wait for the PUBACKs, so many publishes can be in flight and their
+* acknowledgements are read later with readPacket. The payload is written straight
+* to the socket between beginPublish and endPublish.
+*/
+class MqttClient {
+public:
+    explicit MqttClient(Client& client);
+
+    /*
+    * Opens the socket, sends CONNECT with a clean session and waits for the CONNACK.
+    * @param username, password: nullptr when the broker does not need them
+    */
+    bool connect(const char* host, uint16_t port, const char* clientId,
+                 const char* username, const char* password,
+                 uint16_t keepAliveSecs = MQTT_KEEP_ALIVE_SECS);
+    bool connected();
+    void disconnect();
+
+    /*
+    * Writes the header of a QoS 1 PUBLISH, exactly payloadLength bytes must follow
+    * through payload().
+    */
+    bool beginPublish(const char* topic, size_t payloadLength, uint16_t packetId);
+    Client& payload();
+    bool endPublish();
+
+    /*
+    * Reads one packet if there is one waiting.
+    * @param type: packet type, e.g. MQTT_PUBACK
+    * @param packetId: packet identifier of a PUBACK
+    * @return false if no packet was waiting or it could not be read
+    */
+    bool readPacket(uint8_t& type, uint16_t& packetId);
+
+    // Sends a PINGREQ when nothing was sent for half the keep alive
+    void keepAlive();
+
+private:
+    Client& client_;
+    uint16_t keepAliveSecs_;
+    unsigned long lastSent_;
+    bool writeFailed_;
+    uint8_t out_[MQTT_OUT_BUFFER];
+    size_t outLength_;
+
+    void flushOut();
+    void writeByte(uint8_t value);
+    void writeUint16(uint16_t value);
+    void writeString(const char* value);
+    void writeRemainingLength(size_t length);
+    int readByte(unsigned long timeout);
+};
+
+#endif // MQTT_CLIENT_H
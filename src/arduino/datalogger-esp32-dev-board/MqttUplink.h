@@ -0,0 +1,211 @@
+#ifndef MQTT_UPLINK_H
+#define MQTT_UPLINK_H
+
+#include <Arduino.h>
+#include "WiFi.h"
+
+#include "Event.h"
+#include "Uplink.h"
+#include "MqttClient.h"
+#include "JsonEncoder.h"
+#include "MeasurementCatalog.h"
+#include "Log.h"
+
+// broker settings, define them in secrets.h to override these
+#ifndef MQTT_BROKER
+#define MQTT_BROKER "localhost"
+#endif
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+#ifndef MQTT_CLIENT_ID
+#define MQTT_CLIENT_ID "maticas-datalogger"
+#endif
+#ifndef MQTT_USERNAME
+#define MQTT_USERNAME nullptr
+#endif
+#ifndef MQTT_PASSWORD
+#define MQTT_PASSWORD nullptr
+#endif
+#ifndef MQTT_TOPIC
+#define MQTT_TOPIC "maticas/measurements"
+#endif
+
+#define MQTT_MAX_EVENTS 30          // events per call, like the http client
+#define MQTT_MAX_INFLIGHT 16        // publishes waiting for their PUBACK
+#define MQTT_ACK_TIMEOUT 5000       // ms to wait for the PUBACKs of a call
+
+/*
+* Publishes every measurement event as one QoS 1 message with the same JSON body
+* the http client posts. The publishes of a call are pipelined, up to
+* MQTT_MAX_INFLIGHT at a time, and each PUBACK is matched by packet id to the event
+* it acknowledges. Events without a PUBACK by the end of the call are reported as
+* failed so they stay in the RAM or SD backlog, a late PUBACK for them is ignored
+* and they are published again later (QoS 1 is at least once anyway).
+*/
+class MqttUplink : public Uplink {
+public:
+    explicit MqttUplink(Client& client) : mqtt_(client) {
+        nextPacketId_ = 1;
+        publishedCount_ = 0;
+        ackedCount_ = 0;
+        reset_last_results();
+    }
+
+    int* sendEvents(const Event* events, int n) override {
+        reset_last_results();
+        n = min(n, MQTT_MAX_EVENTS);
+        for (int i = 0; i < n; i++) {
+            inflightIds_[i] = 0;
+        }
+
+        if (!ensureConnected()) {
+            for (int i = 0; i < n; i++) {
+                last_results[i] = (events[i].getType() == MEASUREMENT_EVENT) ? SERVICE_UNAVAILABLE_STATUS : OK_STATUS;
+            }
+            return last_results;
+        }
+
+        const MeasurementDictionary& dictionary = measurementDictionary();
+        int inflight = 0;
+        int i = 0;
+        for (; i < n; i++) {
+            //if event is different from measurement, omit it
+            if (events[i].getType() != MEASUREMENT_EVENT) {
+                last_results[i] = OK_STATUS;
+                continue;
+            }
+
+            // wait for room in the window
+            unsigned long start = millis();
+            while (inflight >= MQTT_MAX_INFLIGHT && millis() - start < MQTT_ACK_TIMEOUT) {
+                if (!readAck(n, inflight)) {
+                    delay(1);
+                }
+            }
+            if (inflight >= MQTT_MAX_INFLIGHT || !publish(events[i], dictionary)) {
+                break;
+            }
+            inflightIds_[i] = lastPacketId_;
+            inflight++;
+        }
+
+        // wait for the acknowledgements of what is still in flight
+        unsigned long start = millis();
+        while (inflight > 0 && millis() - start < MQTT_ACK_TIMEOUT && mqtt_.connected()) {
+            if (!readAck(n, inflight)) {
+                delay(1);
+            }
+        }
+
+        // whatever was not acknowledged or not published stays in the backlog
+        for (int j = 0; j < n; j++) {
+            if (last_results[j] == -1) {
+                last_results[j] = SERVICE_UNAVAILABLE_STATUS;
+            }
+        }
+        if (i < n || inflight > 0) {
+            LOG_WARN(API, "MQTT: %d events not acknowledged", inflight + (n - i));
+        }
+        // a broker that stopped answering is most likely behind a half-open
+        // connection, the next call opens a new one
+        if (inflight > 0) {
+            mqtt_.disconnect();
+        }
+        mqtt_.keepAlive();
+        return last_results;
+    }
+
+    int* getLastResults() override {
+        return last_results;
+    }
+
+    void disconnect() override {
+        mqtt_.disconnect();
+    }
+
+    unsigned long getPublishedCount() const {
+        return publishedCount_;
+    }
+
+    unsigned long getAckedCount() const {
+        return ackedCount_;
+    }
+
+private:
+    MqttClient mqtt_;
+    int last_results[MQTT_MAX_EVENTS];
+    uint16_t inflightIds_[MQTT_MAX_EVENTS];
+    uint16_t nextPacketId_;
+    uint16_t lastPacketId_;
+    unsigned long publishedCount_;
+    unsigned long ackedCount_;
+
+    void reset_last_results() {
+        for (int i = 0; i < MQTT_MAX_EVENTS; i++) {
+            last_results[i] = -1;
+        }
+    }
+
+    bool ensureConnected() {
+        if (mqtt_.connected()) {
+            return true;
+        }
+        LOG_INFO(CONNECTION, "MQTT: connecting to the broker...");
+        return mqtt_.connect(MQTT_BROKER, MQTT_PORT, MQTT_CLIENT_ID, MQTT_USERNAME, MQTT_PASSWORD);
+    }
+
+    bool publish(const Event& event, const MeasurementDictionary& dictionary) {
+        // packet id 0 is not allowed
+        lastPacketId_ = nextPacketId_;
+        nextPacketId_ = (nextPacketId_ == 0xFFFF) ? 1 : nextPacketId_ + 1;
+
+        size_t length = (event.getRecordCount() > 0)
+            ? measurementsJsonLength(event.getRecords(), event.getRecordCount(), dictionary)
+            : event.getData().length();
+
+        if (!mqtt_.beginPublish(MQTT_TOPIC, length, lastPacketId_)) {
+            return false;
+        }
+        {
+            PrintSink<Client> sink(mqtt_.payload());
+            if (event.getRecordCount() > 0) {
+                encodeMeasurements(sink, event.getRecords(), event.getRecordCount(), dictionary);
+            } else {
+                sink.write(event.getData().c_str(), event.getData().length());
+            }
+        }
+        if (!mqtt_.endPublish()) {
+            return false;
+        }
+        publishedCount_++;
+        return true;
+    }
+
+    /*
+    * Reads one packet and, if it is a PUBACK of an event in flight, marks it as sent.
+    * @return false if there was nothing to read
+    */
+    bool readAck(int n, int& inflight) {
+        uint8_t type;
+        uint16_t packetId;
+        if (!mqtt_.readPacket(type, packetId)) {
+            return false;
+        }
+        if (type != MQTT_PUBACK) {
+            return true;
+        }
+        for (int i = 0; i < n; i++) {
+            if (inflightIds_[i] == packetId) {
+                inflightIds_[i] = 0;
+                last_results[i] = OK_STATUS;
+                inflight--;
+                ackedCount_++;
+                break;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // MQTT_UPLINK_H
@@ -0,0 +1,80 @@
+#ifndef NTP_CLOCK_H
+#define NTP_CLOCK_H
+
+#include <atomic>
+#include <time.h>
+#include <Arduino.h>
+#include "esp_sntp.h"
+#include "ClockService.h"
+#include "ConnectionStateMachine.h"
+#include "Log.h"
+#include "secrets.h"
+
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+#define NTP_MIN_VALID_EPOCH 1700000000UL    // earlier system times mean SNTP has not set the clock yet
+
+/*
+* NTP as the reference source of ClockService. SNTP is started the first time
+* ConnectionEventManager reports the link up and then keeps the system time
+* synced in the background (hourly by default). read() only gives a time after
+* a sync that has not been read yet, so the RTC is compared against fresh NTP
+* time and nothing at all happens while WiFi is down. The RTC keeps local time,
+* so the UTC offset is taken from TZ ("+hh:mm" or "-hh:mm").
+*/
+class NtpClock : public ClockSource {
+public:
+    NtpClock() : started_(false), offset_(parseOffset(TZ.c_str())) {}
+
+    // Subscribed to the link channel of ConnectionEventManager, called on the uplink task
+    void onLink(const LinkState& state) {
+        if (started_ || state != LINK_UP) {
+            return;
+        }
+        sntp_set_time_sync_notification_cb(onSync);
+        configTime(0, 0, NTP_SERVER);
+        started_ = true;
+        LOG_INFO(CONNECTION, "NtpClock: SNTP started");
+    }
+
+    // Called on the task of ClockService
+    bool read(uint32_t& epoch) override {
+        if (!synced().exchange(false)) {
+            return false;
+        }
+        time_t utc = time(nullptr);
+        if (utc < (time_t)NTP_MIN_VALID_EPOCH) {
+            return false;
+        }
+        epoch = (uint32_t)((long)utc + offset_);
+        return true;
+    }
+
+private:
+    std::atomic<bool> started_;
+    long offset_;       // s, local minus UTC
+
+    // set by the SNTP task after every sync
+    static std::atomic<bool>& synced() {
+        static std::atomic<bool> flag(false);
+        return flag;
+    }
+
+    static void onSync(struct timeval* tv) {
+        (void)tv;
+        synced() = true;
+    }
+
+    static long parseOffset(const char* tz) {
+        if ((tz[0] != '+' && tz[0] != '-') || strlen(tz) < 6) {
+            return 0;
+        }
+        long hours = (tz[1] - '0') * 10 + (tz[2] - '0');
+        long minutes = (tz[4] - '0') * 10 + (tz[5] - '0');
+        long offset = hours * 3600 + minutes * 60;
+        return tz[0] == '-' ? -offset : offset;
+    }
+};
+
+#endif // NTP_CLOCK_H
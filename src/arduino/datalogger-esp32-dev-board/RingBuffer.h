@@ -0,0 +1,153 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+#include <utility>
+
+/*
+* What push does when the buffer is full.
+*/
+enum OverflowPolicy {
+    OVERFLOW_SPILL,         // refuse the item, the owner moves the oldest items elsewhere and retries
+    OVERFLOW_DROP_OLDEST,   // make room by dropping the oldest item
+    OVERFLOW_DROP_NEWEST    // drop the incoming item
+};
+
+/*
+* Fixed capacity FIFO with head/tail indexing, so push, pop and peek are O(1) and
+* items never move when the indexes wrap. Removed slots are reset to T() so they
+* do not keep memory alive. Dropped items are counted. This header does not depend
+* on Arduino.
+*/
+template <typename T, size_t Capacity>
+class RingBuffer {
+public:
+    explicit RingBuffer(OverflowPolicy policy = OVERFLOW_DROP_OLDEST)
+        : head_(0), count_(0), dropped_(0), policy_(policy) {}
+
+    /*
+    * @return false if the item was not stored, which happens when the buffer is
+    * full and the policy is OVERFLOW_SPILL or OVERFLOW_DROP_NEWEST
+    */
+    bool push(const T& item) {
+        if (count_ == Capacity) {
+            if (policy_ != OVERFLOW_DROP_OLDEST) {
+                if (policy_ == OVERFLOW_DROP_NEWEST) {
+                    dropped_++;
+                }
+                return false;
+            }
+            dropOldest();
+        }
+        items_[slot(count_)] = item;
+        count_++;
+        return true;
+    }
+
+    bool pop(T& item) {
+        if (count_ == 0) {
+            return false;
+        }
+        item = std::move(items_[head_]);
+        discard(1);
+        return true;
+    }
+
+    /*
+    * Longest run of items stored contiguously from position, 0 being the oldest, so
+    * they can be handed out without copying. When the indexes wrapped the rest is
+    * returned by a second call at position + the returned count.
+    * @return number of items at first, at most max
+    */
+    size_t peek(T*& first, size_t max, size_t position = 0) {
+        if (position >= count_) {
+            first = nullptr;
+            return 0;
+        }
+        size_t start = slot(position);
+        size_t run = Capacity - start;
+        size_t left = count_ - position;
+        first = &items_[start];
+        run = (run < left) ? run : left;
+        return (run < max) ? run : max;
+    }
+
+    // Removes the n oldest items
+    void discard(size_t n) {
+        if (n > count_) {
+            n = count_;
+        }
+        for (size_t i = 0; i < n; i++) {
+            items_[head_] = T();
+            head_ = (head_ + 1) % Capacity;
+        }
+        count_ -= n;
+    }
+
+    // Removes the oldest item and counts it as dropped
+    void dropOldest() {
+        if (count_ > 0) {
+            discard(1);
+            dropped_++;
+        }
+    }
+
+    /*
+    * Keeps, in order, the items for which keep(item, position) is true. Kept items
+    * are moved into the gaps, never copied.
+    * @return number of items removed
+    */
+    template <typename Keep>
+    size_t retain(Keep keep) {
+        size_t write = 0;
+        for (size_t read = 0; read < count_; read++) {
+            if (!keep(items_[slot(read)], read)) {
+                continue;
+            }
+            if (write != read) {
+                items_[slot(write)] = std::move(items_[slot(read)]);
+            }
+            write++;
+        }
+        for (size_t i = write; i < count_; i++) {
+            items_[slot(i)] = T();
+        }
+        size_t removed = count_ - write;
+        count_ = write;
+        return removed;
+    }
+
+    // Item at position, 0 being the oldest
+    T& operator[](size_t position) {
+        return items_[slot(position)];
+    }
+
+    const T& operator[](size_t position) const {
+        return items_[slot(position)];
+    }
+
+    void clear() {
+        discard(count_);
+    }
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    bool full() const { return count_ == Capacity; }
+    static size_t capacity() { return Capacity; }
+    unsigned long dropped() const { return dropped_; }
+    OverflowPolicy policy() const { return policy_; }
+    void setPolicy(OverflowPolicy policy) { policy_ = policy; }
+
+private:
+    T items_[Capacity];
+    size_t head_;
+    size_t count_;
+    unsigned long dropped_;
+    OverflowPolicy policy_;
+
+    size_t slot(size_t position) const {
+        return (head_ + position) % Capacity;
+    }
+};
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,285 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Log.h"
+
+#define SCHEDULER_MAX_TASKS 8
+#define SCHEDULER_MAX_WAIT 1000     // ms, longest wait tick() asks for when nothing is due
+#define TASK_FINISHED -1            // returned by a resumable task that has nothing left to do
+
+typedef unsigned long (*SchedulerClock)();
+typedef uint32_t (*HeapProbe)();    // free heap in bytes
+typedef void (*TaskFunction)(void* context);
+
+/*
+* A task that runs in steps, e.g. a state machine waiting for a sensor or a
+* connection. Each call does a bounded amount of work and returns how long to
+* wait, in ms, before it is resumed, or TASK_FINISHED.
+*/
+class ResumableTask {
+public:
+    virtual ~ResumableTask() {}
+    virtual long resume(unsigned long now) = 0;
+};
+
+/*
+* Timing of a task. Jitter is how late a run started compared to its deadline,
+* an overrun is a periodic run that ended after the following deadline.
+* With a heap probe the heap a run keeps is counted too: a task that does not
+* leak has a net delta that stays around zero however long it runs.
+*/
+struct TaskStats {
+    const char* name;
+    unsigned long runs;
+    unsigned long overruns;
+    unsigned long maxJitter;
+    unsigned long totalJitter;
+    unsigned long maxDuration;
+    long lastHeapDelta;         // bytes the last run left allocated, negative if it freed more
+    long maxHeapDelta;
+    long netHeapDelta;          // sum over all runs
+};
+
+/*
+* Cooperative scheduler that runs the due tasks in deadline order. Nothing is
+* preempted, so tasks must return quickly and split long work in steps with a
+* ResumableTask. Periodic deadlines advance by the period, so a late run does
+* not shift the ones that follow. The clock is injected so the scheduler can be
+* driven by a simulated clock. This header does not depend on Arduino.
+*/
+class Scheduler {
+public:
+    explicit Scheduler(SchedulerClock clock) : clock_(clock), heap_(nullptr), running_(-1), tickCount_(0) {
+        for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+            slots_[i].kind = FREE;
+        }
+    }
+
+    /*
+    * Runs fn every period ms, the first run is after firstDelay ms.
+    * @return the task id, or -1 if there is no free slot
+    */
+    int every(unsigned long period, TaskFunction fn, void* context, const char* name, unsigned long firstDelay = 0) {
+        int id = allocate(PERIODIC, name, firstDelay);
+        if (id >= 0) {
+            slots_[id].period = period;
+            slots_[id].function = fn;
+            slots_[id].context = context;
+        }
+        return id;
+    }
+
+    // Runs fn once after delay ms
+    int after(unsigned long delay, TaskFunction fn, void* context, const char* name) {
+        int id = allocate(ONE_SHOT, name, delay);
+        if (id >= 0) {
+            slots_[id].function = fn;
+            slots_[id].context = context;
+        }
+        return id;
+    }
+
+    // Resumes the task after delay ms and then as often as it asks for
+    int start(ResumableTask& task, const char* name, unsigned long delay = 0) {
+        int id = allocate(RESUMABLE, name, delay);
+        if (id >= 0) {
+            slots_[id].task = &task;
+        }
+        return id;
+    }
+
+    /*
+    * Counts the heap every run keeps in its TaskStats. The probe sees the whole
+    * heap, so what other cores allocate meanwhile shows up as noise around zero.
+    */
+    void setHeapProbe(HeapProbe probe) {
+        heap_ = probe;
+    }
+
+    void cancel(int id) {
+        if (id >= 0 && id < SCHEDULER_MAX_TASKS) {
+            slots_[id].kind = FREE;
+        }
+    }
+
+    bool isActive(int id) const {
+        return id >= 0 && id < SCHEDULER_MAX_TASKS && slots_[id].kind != FREE;
+    }
+
+    /*
+    * Runs every task that is due, earliest deadline first and each at most once,
+    * so a task that is always late cannot starve the others.
+    * @return ms until the next deadline, at most SCHEDULER_MAX_WAIT
+    */
+    unsigned long tick() {
+        tickCount_++;
+
+        while (true) {
+            unsigned long now = clock_();
+            int next = -1;
+            for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+                const Slot& slot = slots_[i];
+                if (slot.kind == FREE || slot.lastTick == tickCount_ || !reached(now, slot.deadline)) {
+                    continue;
+                }
+                if (next < 0 || before(slot.deadline, slots_[next].deadline)) {
+                    next = i;
+                }
+            }
+            if (next < 0) {
+                break;
+            }
+            run(next, now);
+        }
+
+        return waitTime(clock_());
+    }
+
+    const TaskStats* stats(int id) const {
+        return isActive(id) ? &slots_[id].stats : nullptr;
+    }
+
+    /*
+    * Logs one line per task, and one for the heap it keeps when there is a probe.
+    * They go through the logger, so with the deferred log the caller never waits
+    * for the serial port.
+    */
+    void logStats() const {
+        for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+            if (slots_[i].kind == FREE) {
+                continue;
+            }
+            const TaskStats& s = slots_[i].stats;
+            LOG_INFO(SYSTEM, "%s: %lu runs, jitter avg %lu ms max %lu ms, longest run %lu ms, %lu overruns",
+                     s.name, s.runs, s.runs > 0 ? s.totalJitter / s.runs : 0UL,
+                     s.maxJitter, s.maxDuration, s.overruns);
+            if (heap_ != nullptr) {
+                LOG_INFO(SYSTEM, "%s: heap kept last %ld B, max %ld B, net %ld B",
+                         s.name, s.lastHeapDelta, s.maxHeapDelta, s.netHeapDelta);
+            }
+        }
+    }
+
+private:
+    enum Kind { FREE, PERIODIC, ONE_SHOT, RESUMABLE };
+
+    struct Slot {
+        Kind kind;
+        unsigned long deadline;
+        unsigned long period;
+        TaskFunction function;
+        void* context;
+        ResumableTask* task;
+        unsigned long lastTick;
+        TaskStats stats;
+    };
+
+    SchedulerClock clock_;
+    HeapProbe heap_;
+    Slot slots_[SCHEDULER_MAX_TASKS];
+    int running_;
+    unsigned long tickCount_;
+
+    // comparisons that keep working when millis() wraps around
+    static bool reached(unsigned long now, unsigned long deadline) {
+        return (long)(now - deadline) >= 0;
+    }
+
+    static bool before(unsigned long a, unsigned long b) {
+        return (long)(a - b) < 0;
+    }
+
+    int allocate(Kind kind, const char* name, unsigned long delay) {
+        for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+            // the slot of the running task is still in use even if it was cancelled
+            if (slots_[i].kind != FREE || i == running_) {
+                continue;
+            }
+            Slot& slot = slots_[i];
+            slot.kind = kind;
+            slot.deadline = clock_() + delay;
+            slot.period = 0;
+            slot.function = nullptr;
+            slot.context = nullptr;
+            slot.task = nullptr;
+            slot.lastTick = tickCount_;
+            slot.stats = TaskStats();
+            slot.stats.name = name;
+            return i;
+        }
+        return -1;
+    }
+
+    void run(int id, unsigned long now) {
+        Slot& slot = slots_[id];
+        unsigned long jitter = now - slot.deadline;
+        slot.lastTick = tickCount_;
+
+        uint32_t freeBefore = (heap_ != nullptr) ? heap_() : 0;
+        running_ = id;
+        long wait = 0;
+        if (slot.kind == RESUMABLE) {
+            wait = slot.task->resume(now);
+        } else {
+            slot.function(slot.context);
+        }
+        running_ = -1;
+
+        unsigned long end = clock_();
+        TaskStats& stats = slot.stats;
+        stats.runs++;
+        stats.totalJitter += jitter;
+        if (jitter > stats.maxJitter) {
+            stats.maxJitter = jitter;
+        }
+        if (end - now > stats.maxDuration) {
+            stats.maxDuration = end - now;
+        }
+        if (heap_ != nullptr) {
+            long kept = (long)freeBefore - (long)heap_();
+            stats.lastHeapDelta = kept;
+            stats.netHeapDelta += kept;
+            if (kept > stats.maxHeapDelta) {
+                stats.maxHeapDelta = kept;
+            }
+        }
+
+        // the task cancelled itself while running
+        if (slot.kind == FREE) {
+            return;
+        }
+
+        if (slot.kind == ONE_SHOT || (slot.kind == RESUMABLE && wait == TASK_FINISHED)) {
+            slot.kind = FREE;
+        } else if (slot.kind == RESUMABLE) {
+            slot.deadline = end + (unsigned long)(wait > 0 ? wait : 0);
+        } else {
+            slot.deadline += slot.period;
+            if (slot.period > 0 && reached(end, slot.deadline)) {
+                // skip the runs that were missed instead of running them back to back
+                stats.overruns++;
+                slot.deadline += ((end - slot.deadline) / slot.period + 1) * slot.period;
+            }
+        }
+    }
+
+    unsigned long waitTime(unsigned long now) const {
+        unsigned long wait = SCHEDULER_MAX_WAIT;
+        for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+            if (slots_[i].kind == FREE) {
+                continue;
+            }
+            if (reached(now, slots_[i].deadline)) {
+                return 0;
+            }
+            if (slots_[i].deadline - now < wait) {
+                wait = slots_[i].deadline - now;
+            }
+        }
+        return wait;
+    }
+};
+
+#endif // SCHEDULER_H
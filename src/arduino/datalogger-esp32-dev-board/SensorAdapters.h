@@ -5,6 +5,9 @@
 #include "Event.h"
 #include "Adapter.h"
 #include "CustomUtils.h"
+#include "MeasurementRecord.h"
+#include "Instrumentation.h"
+#include "Log.h"
 
 #define DHTPIN 33
 #define DHTTYPE DHT11
@@ -75,17 +78,24 @@ private:
     int retryDelay;
     long int lastRequestTimestamp = -1;
 
+    // state of the sampling round
+    float temperatureArray[MAX_RETRIES];
+    float humidityArray[MAX_RETRIES];
+    int readingsTaken = 0;
+    int validReadings = 0;
+    unsigned long nextReadingAt = 0;
+
 public:
-    DHTAdapter(int maxRetries = 5, int retryDelay = 2100) : Adapter()
+    DHTAdapter(int maxRetries = MAX_RETRIES, int retryDelay = 2100) : Adapter()
     {
         dht.begin();
-        this->maxRetries = maxRetries;
+        this->maxRetries = min(maxRetries, MAX_RETRIES);
         this->retryDelay = retryDelay;
     }
 
     Event request(Event timeEvent)
     {
-        Serial.println("DHTAdapter handling request...");
+        LOG_DEBUG(SENSORS, "DHTAdapter handling request...");
         return specificRequest(timeEvent);
     }
 
@@ -105,56 +115,91 @@ public:
 
     Event default_request(Event timeEvent)
     {
-        float temperatureArray[maxRetries];
-        float humidityArray[maxRetries];
+        return sampleBlocking(timeEvent);
+    }
 
-        try
+    void startSampling(const Event &timeEvent, unsigned long now) override
+    {
+        LOG_DEBUG(SENSORS, "DHTAdapter starting sampling...");
+        timeEvent_ = timeEvent;
+        result_ = Event();
+        readingsTaken = 0;
+        validReadings = 0;
+        nextReadingAt = now;
+        dht.begin();
+    }
+
+    // takes one reading every retryDelay ms, the sensor cannot be read faster
+    long pollSampling(unsigned long now) override
+    {
+        if ((long)(now - nextReadingAt) < 0)
         {
-            dht.begin();
-            int validReadings = 0;
+            return nextReadingAt - now;
+        }
 
-            for (int i = 0; i < maxRetries; i++)
+        try
+        {
+            float humidity;
+            float temperature;
             {
-                float humidity = dht.readHumidity();
-                float temperature = dht.readTemperature();
-                Serial.println("Humidity: " + String(humidity) + " %\t Temperature: " + String(temperature) + " *C ");
-
-                if (isvalid(humidity) && isvalid(temperature))
-                {
-                    temperatureArray[i] = temperature;
-                    humidityArray[i] = humidity;
-                    validReadings++;
-                }
-
-                delay(retryDelay);
+                INSTRUMENT_STAGE(STAGE_DHT_READ);
+                humidity = dht.readHumidity();
+                temperature = dht.readTemperature();
             }
+            LOG_DEBUG(SENSORS, "Humidity: %.2f %%\t Temperature: %.2f *C", humidity, temperature);
 
-            if (validReadings == 0)
+            if (isvalid(humidity) && isvalid(temperature))
             {
-                Serial.println("No valid data.");
-                return Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "No valid data");
+                temperatureArray[validReadings] = temperature;
+                humidityArray[validReadings] = humidity;
+                validReadings++;
             }
+            else
+            {
+                INSTRUMENT_COUNT(COUNTER_SENSOR_ERRORS, 1);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            // Log the message of the exception
+            LOG_ERROR(SENSORS, "%s", e.what());
+            result_ = Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "DHT sensor not found");
+            return SAMPLING_DONE;
+        }
 
-            float temperature = average(temperatureArray, validReadings);
-            float humidity = average(humidityArray, validReadings);
-            float vpd = calculateVPD(temperature, humidity);
-            float dewPoint = calculateDewPoint(temperature, humidity);
-
-            // Format data in JSON-like string as a list of measurements
-            const String timestamp = String(timeEvent.getTimestamp());
-            const String data1 = "{\"variable\": " + TEMPERATURE_UIID + ", \"value\": " + String(temperature) + ", \"crop\": " + CROP_UIID + ", \"datetime\": \"" + timestamp + "\"}";
-            const String data2 = "{\"variable\": " + HUMIDITY_UIID + ", \"value\": " + String(humidity) + ", \"crop\": " + CROP_UIID + ", \"datetime\": \"" + timestamp + "\"}";
-            const String data3 = "{\"variable\": " + VPD_UIID + ", \"value\": " + String(vpd) + ", \"crop\": " + CROP_UIID + ", \"datetime\": \"" + timestamp + "\"}";
-            const String data4 = "{\"variable\": " + DEWPOINT_UIID + ", \"value\": " + String(dewPoint) + ", \"crop\": " + CROP_UIID + ", \"datetime\": \"" + timestamp + "\"}";
-            const String data = "[" + data1 + ", " + data2 + ", " + data3 + ", " + data4 + "]";
-            return Event(MEASUREMENT_EVENT, OK_STATUS, timestamp, data);
+        readingsTaken++;
+        if (readingsTaken < maxRetries)
+        {
+            nextReadingAt = now + retryDelay;
+            return retryDelay;
         }
-        catch (std::exception e)
+
+        result_ = buildEvent();
+        return SAMPLING_DONE;
+    }
+
+private:
+    Event buildEvent()
+    {
+        if (validReadings == 0)
         {
-            // Print the exception and the message
-            Serial.println(e.what());
-            return Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "DHT sensor not found");
+            LOG_WARN(SENSORS, "No valid data");
+            return Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "No valid data");
         }
+
+        float temperature = average(temperatureArray, validReadings);
+        float humidity = average(humidityArray, validReadings);
+        float vpd = calculateVPD(temperature, humidity);
+        float dewPoint = calculateDewPoint(temperature, humidity);
+
+        // Store the measurements as records, the JSON is built when they are sent
+        const uint32_t epoch = timeEvent_.getEpoch();
+        const MeasurementRecord records[] = {
+            makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, temperature, epoch),
+            makeMeasurementRecord(HUMIDITY_VARIABLE, DEFAULT_CROP, humidity, epoch),
+            makeMeasurementRecord(VPD_VARIABLE, DEFAULT_CROP, vpd, epoch),
+            makeMeasurementRecord(DEWPOINT_VARIABLE, DEFAULT_CROP, dewPoint, epoch)};
+        return Event(OK_STATUS, records, 4);
     }
 };
 
@@ -172,14 +217,20 @@ private:
     int measurement_interval; // in seconds
 
     // used for DLI calculation
-    DateTime prevDateTime = DateTime(0, 0, 0, 0, 0, 0);
+    uint32_t prevEpoch = 0;
     double lastLux = 0;
     double dailyLightSum = 0;
     long int lastRequestTimestamp = -1;
 
+    // state of the sampling round
+    float luxArray[MAX_RETRIES];
+    int readingsTaken = 0;
+    int validReadings = 0;
+    unsigned long nextReadingAt = 0;
+
 public:
     LuxAndDLIAdapter(int measurement_interval,
-                     int maxRetries = 5,
+                     int maxRetries = MAX_RETRIES,
                      int retryDelay = 250) : Adapter()
     {
         // Initialize the I2C bus (BH1750 library doesn't do this automatically)
@@ -187,24 +238,24 @@ public:
         // Initialize BH1750
         if (!lightMeter.begin(BH1750::CONTINUOUS_HIGH_RES_MODE))
         {
-            Serial.println(F("Error initializing BH1750 sensor!"));
+            LOG_ERROR(SENSORS, "Error initializing BH1750 sensor");
         }
 
         // wait a bit and retry
         delay(1000);
         if (!lightMeter.begin(BH1750::CONTINUOUS_HIGH_RES_MODE))
         {
-            Serial.println(F("Error initializing BH1750 sensor!"));
+            LOG_ERROR(SENSORS, "Error initializing BH1750 sensor");
         }
 
-        this->maxRetries = maxRetries;
+        this->maxRetries = min(maxRetries, MAX_RETRIES);
         this->retryDelay = retryDelay;
         this->measurement_interval = measurement_interval;
     }
 
     Event request(Event timeEvent)
     {
-        Serial.println("DHTAdapter handling request...");
+        LOG_DEBUG(SENSORS, "DHTAdapter handling request...");
         return specificRequest(timeEvent);
     }
 
@@ -224,85 +275,117 @@ public:
 
     Event default_request(Event timeEvent)
     {
+        return sampleBlocking(timeEvent);
+    }
 
-        DateTime currentDateTime = fromTimestampStringToDatetime(timeEvent.getTimestamp());
-        float luxArray[maxRetries];
+    void startSampling(const Event &timeEvent, unsigned long now) override
+    {
+        LOG_DEBUG(SENSORS, "LuxAndDLIAdapter starting sampling...");
+        timeEvent_ = timeEvent;
+        result_ = Event();
+        readingsTaken = 0;
+        validReadings = 0;
+        nextReadingAt = now;
+    }
 
-        try
+    // takes one reading every retryDelay ms
+    long pollSampling(unsigned long now) override
+    {
+        if ((long)(now - nextReadingAt) < 0)
         {
-            int validReadings = 0;
+            return nextReadingAt - now;
+        }
 
-            for (int i = 0; i < maxRetries; i++)
+        try
+        {
+            float lux;
             {
-                float lux = lightMeter.readLightLevel();
-                Serial.println("Lux: " + String(lux) + " lx");
-
-                if (isvalid(lux))
-                {
-                    luxArray[i] = lux;
-                    validReadings++;
-                }
-
-                delay(retryDelay);
+                INSTRUMENT_STAGE(STAGE_LUX_READ);
+                lux = lightMeter.readLightLevel();
             }
+            LOG_DEBUG(SENSORS, "Lux: %.2f lx", lux);
 
-            if (validReadings == 0)
+            if (isvalid(lux))
             {
-                Serial.println("No valid data.");
-                return Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "No valid data");
+                luxArray[validReadings] = lux;
+                validReadings++;
             }
-
-            double lux = average(luxArray, validReadings);
-            double par = lux * lux2parConversionFactor; // Convert lux to PAR (need definition of lux2parConversionFactor)
-
-            // Update DLI using the trapezoidal rule
-            if (lastLux >= 0)
-            { // Check if a previous measurement exists
-                // Calculate the average of the last and current lux readings
-                double averageLux = (lastLux + lux) / 2;
-                double timeDifference = 0;
-
-                // If the previous timestamp is was the default value use as time difference the measurement interval
-                // Otherwise calculate the time difference between the current and previous timestamp
-                if (prevDateTime.year == 0){
-                    timeDifference = measurement_interval;
-                }else{
-                    timeDifference = fromDatetimeToUnix(currentDateTime) - fromDatetimeToUnix(prevDateTime);
-                }
-
-                // Check if the DLI should be reset, if not, update the DLI
-                if (!resetDLI(currentDateTime)){
-                    dailyLightSum += (averageLux * timeDifference * lux2parConversionFactor) / 3600.0; // Convert seconds to hours for DLI calculation
-                }
+            else
+            {
+                INSTRUMENT_COUNT(COUNTER_SENSOR_ERRORS, 1);
             }
+        }
+        catch (const std::exception& e)
+        {
+            // Log the message of the exception
+            LOG_ERROR(SENSORS, "%s", e.what());
+            result_ = Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "BH1750 sensor not found");
+            return SAMPLING_DONE;
+        }
+
+        readingsTaken++;
+        if (readingsTaken < maxRetries)
+        {
+            nextReadingAt = now + retryDelay;
+            return retryDelay;
+        }
 
-            // Update the lastLux for the next measurement
-            lastLux = lux;
+        result_ = buildEvent();
+        return SAMPLING_DONE;
+    }
 
-            // Update the previous date time for the next measurement
-            prevDateTime = currentDateTime;
+    Event buildEvent()
+    {
+        const uint32_t epoch = timeEvent_.getEpoch();
 
-            // Format data in JSON-like string as a list of measurements
-            const String timestamp = String(timeEvent.getTimestamp());
-            const String data1 = "{\"variable\": " + LUX_UIID + ", \"value\": " + String(lux) + ", \"crop\": " + CROP_UIID + ", \"datetime\": \"" + timestamp + "\"}";
-            const String data2 = "{\"variable\": " + DLI_UIID + ", \"value\": " + String(dailyLightSum) + ", \"crop\": " + CROP_UIID + ", \"datetime\": \"" + timestamp + "\"}";
-            const String data = "[" + data1 + ", " + data2 + "]";
-            return Event(MEASUREMENT_EVENT, OK_STATUS, timestamp, data);
-        }
-        catch (std::exception e)
+        if (validReadings == 0)
         {
-            // Print the exception and the message
-            Serial.println(e.what());
-            return Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "BH1750 sensor not found");
+            LOG_WARN(SENSORS, "No valid data");
+            return Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "No valid data");
         }
+
+        double lux = average(luxArray, validReadings);
+
+        // Update DLI using the trapezoidal rule
+        if (lastLux >= 0)
+        { // Check if a previous measurement exists
+            // Calculate the average of the last and current lux readings
+            double averageLux = (lastLux + lux) / 2;
+            double timeDifference = 0;
+
+            // If the previous timestamp is was the default value use as time difference the measurement interval
+            // Otherwise calculate the time difference between the current and previous timestamp
+            if (prevEpoch == 0){
+                timeDifference = measurement_interval;
+            }else{
+                timeDifference = (double)epoch - (double)prevEpoch;
+            }
+
+            // Check if the DLI should be reset, if not, update the DLI
+            if (!resetDLI(epoch)){
+                dailyLightSum += (averageLux * timeDifference * lux2parConversionFactor) / 3600.0; // Convert seconds to hours for DLI calculation
+            }
+        }
+
+        // Update the lastLux for the next measurement
+        lastLux = lux;
+
+        // Update the previous time for the next measurement
+        prevEpoch = epoch;
+
+        // Store the measurements as records, the JSON is built when they are sent
+        const MeasurementRecord records[] = {
+            makeMeasurementRecord(LUX_VARIABLE, DEFAULT_CROP, lux, epoch),
+            makeMeasurementRecord(DLI_VARIABLE, DEFAULT_CROP, dailyLightSum, epoch)};
+        return Event(OK_STATUS, records, 2);
     }
 
     //checks whether the DLI should be reset
-    bool resetDLI(const DateTime &currentDateTime){
+    bool resetDLI(uint32_t epoch){
 
-        if (prevDateTime.year != currentDateTime.year || prevDateTime.month != currentDateTime.month || prevDateTime.day != currentDateTime.day)
+        if (dayNumber(prevEpoch) != dayNumber(epoch))
         {
-            prevDateTime = currentDateTime;
+            prevEpoch = epoch;
             dailyLightSum = 0;
             return true;
         }
@@ -1,12 +1,22 @@
 #include "Event.h"
-#include "EventManager.h"
-#include "Subscriber.h"
+#include "EventBus.h"
+#include "MeasurementRecord.h"
 #include "Adapter.h"
+#include "Scheduler.h"
+#include "Log.h"
 
 #define MAX_STORED_EVENTS 30 //maximum number of events to store in the microservice
 #define MAX_SENSORS 10 //maximum number of sensors to store in the microservice
+#define MEASUREMENT_SUBSCRIBERS 2
 
-class SensorsMicroService : public EventManager, public Subscriber {
+/*
+* Samples every sensor and publishes the records of each measurement event on the
+* measurement channel. The sensors of a round are sampled at the same time, so the
+* round takes as long as the slowest sensor.
+* Run it from the scheduler as a ResumableTask to sample without blocking, or call
+* notify to sample and publish in one go.
+*/
+class SensorsMicroService : public ResumableTask {
 
     private:
         Event last_time_event_;
@@ -16,14 +26,22 @@ class SensorsMicroService : public EventManager, public Subscriber {
         int nmeasurement_events_;
         int sensors_count;
 
-        Subscriber* subscribers_[MAX_NUMBER_OF_SUBSCRIBERS];
-        int number_of_subs;
+        // state of the sampling round
+        bool pending_[MAX_SENSORS];
+        bool sampling_;
+        unsigned long samplingInterval_;
+        unsigned long nextRoundAt_;
 
     public:
+        // the records of every measurement event, once the round is over
+        Channel<RecordSpan, MEASUREMENT_SUBSCRIBERS> measurementChannel;
+
         SensorsMicroService(){
             sensors_count = 0;
             nmeasurement_events_ = 0;
-            number_of_subs = 0;
+            sampling_ = false;
+            samplingInterval_ = 0;
+            nextRoundAt_ = 0;
 
             // Initialize last_measurement_events_ to empty events
             for (int i = 0; i < MAX_STORED_EVENTS; i++) {
@@ -32,87 +50,64 @@ class SensorsMicroService : public EventManager, public Subscriber {
         }
 
         //-------------------------------------------------------------
-        //-------------------Event Manager Interface-------------------
+        //-------------------Blocking Interface------------------------
         //-------------------------------------------------------------
-        void main() override {
-            Serial.println("\nSensorsMicroService running business logic...");
-
-            // Iterate over the sensors and get the data
-            for (int i = 0; i < MAX_SENSORS; i++) {
-                if (i < sensors_count && sensors_[i] != nullptr) {
-                    Event event = sensors_[i]->request(last_time_event_);
-
-                    if (event.getStatusCode() == INTERNAL_SERVER_ERROR) {
-                        Serial.println("SensorsMicroService got an error event: ");
-                        Serial.print(event.toString());
-                        continue;
-                    }
+        void main() {
+            LOG_DEBUG(SENSORS, "Sampling the sensors");
 
-                    // store the event
-                    last_measurement_events_[i] = event; 
-
-                    Serial.println("SensorsMicroService got event: ");
-                    Serial.print(last_measurement_events_[i].toString());
-                    nmeasurement_events_++;
-                }
+            startRound(millis());
+            long wait;
+            while ((wait = pollRound(millis())) != SAMPLING_DONE) {
+                delay(wait);
             }
+            sampling_ = false;
         }
 
 
-        void notify() override{
+        void notify() {
             main();
-            Serial.println("\nSensorsMicroService notifying subscribers...");
+            publish();
+        }
 
-            //iterate over the subscribers and notify them
-            for (int i = 0; i < number_of_subs; i++){
-                subscribers_[i]->update(last_measurement_events_, nmeasurement_events_); 
+        //-------------------------------------------------------------
+        //-------------------Resumable Task Interface------------------
+        //-------------------------------------------------------------
+        /*
+        * Starts a round every sampling interval and polls the sensors until all of
+        * them are done, then notifies the subscribers.
+        */
+        long resume(unsigned long now) override {
+            if (!sampling_) {
+                LOG_DEBUG(SENSORS, "Starting a sampling round");
+                startRound(now);
+                nextRoundAt_ = now + samplingInterval_;
             }
 
-            // Reset the last_measurement_events_ to empty events
-            for (int i = 0; i < MAX_STORED_EVENTS; i++) {
-                last_measurement_events_[i] = Event();
+            long wait = pollRound(now);
+            if (wait != SAMPLING_DONE) {
+                return wait;
             }
 
-            // Reset the number of measurement events
-            nmeasurement_events_ = 0;
+            sampling_ = false;
+            publish();
+            long untilNextRound = (long)(nextRoundAt_ - now);
+            return (untilNextRound > 0) ? untilNextRound : 0;
         }
 
-        void subscribe(Subscriber* subscriber){
-            Serial.println("\nSensorsMicroService subscribing...");
-            if (number_of_subs < MAX_NUMBER_OF_SUBSCRIBERS){
-                subscribers_[number_of_subs] = subscriber;
-                number_of_subs++;
-            }else{
-                Serial.println("Max number of subscribers reached.");
-            }
-        }
-
-        void unsubscribe(Subscriber* subscriber){
-            Serial.println("\nSensorsMicroService unsubscribing...");   
-            for (int i = 0; i < number_of_subs; i++){
-                if (subscribers_[i] == subscriber){
-                    for (int j = i; j < number_of_subs - 1; j++){
-                        subscribers_[j] = subscribers_[j + 1];
-                    }
-                    number_of_subs--;
-                    break;
-                }
-            }
+        void setSamplingInterval(unsigned long interval) {
+            samplingInterval_ = interval;
         }
 
         //----------------------------------------------------------
-        //-------------------Subscriber Interface-------------------
+        //-------------------Time Subscriber------------------------
         //----------------------------------------------------------
-        void update(const Event& event) override{
-            Serial.println("\nSensorsMicroService got event: ");
-            Serial.print(event.toString());
-
+        // Subscribed to the time channel of TimeEventManager
+        void onTime(const Event& event) {
             if (event.getType() == TIME_EVENT){
+                LOG_DEBUG(SENSORS, "Got the time %lu", (unsigned long)event.getEpoch());
                 last_time_event_ = event;
             }else{
-                Serial.println("\nSensorsMicroService got an event of type: ");
-                Serial.print(event.getType());
-                Serial.println("Which is unsuporrted by this microservice");
+                LOG_WARN(SENSORS, "Got an event of type %d, which is unsupported by this microservice", event.getType());
             }
         }
         
@@ -120,6 +115,76 @@ class SensorsMicroService : public EventManager, public Subscriber {
         //----------------------------------------------------
         //-------------------Business Logic-------------------
         //----------------------------------------------------
+        void startRound(unsigned long now) {
+            for (int i = 0; i < sensors_count; i++) {
+                pending_[i] = (sensors_[i] != nullptr);
+                if (pending_[i]) {
+                    sensors_[i]->startSampling(last_time_event_, now);
+                }
+            }
+            sampling_ = true;
+        }
+
+        /*
+        * Polls the sensors that are not done and stores the events of the ones that finish.
+        * @return ms until a sensor needs to be polled again, or SAMPLING_DONE
+        */
+        long pollRound(unsigned long now) {
+            long wait = SAMPLING_DONE;
+            for (int i = 0; i < sensors_count; i++) {
+                if (!pending_[i]) {
+                    continue;
+                }
+
+                long sensorWait = sensors_[i]->pollSampling(now);
+                if (sensorWait == SAMPLING_DONE) {
+                    pending_[i] = false;
+                    store(sensors_[i]->collectSampling());
+                } else if (wait == SAMPLING_DONE || sensorWait < wait) {
+                    wait = sensorWait;
+                }
+            }
+            return wait;
+        }
+
+        void store(const Event& event) {
+            if (event.getStatusCode() == INTERNAL_SERVER_ERROR) {
+                LOG_WARN(SENSORS, "Sensor failed: %s", event.getData().c_str());
+                return;
+            }
+            if (nmeasurement_events_ >= MAX_STORED_EVENTS) {
+                LOG_ERROR(SENSORS, "No room for more events");
+                return;
+            }
+
+            // store the event
+            last_measurement_events_[nmeasurement_events_] = event;
+
+            LOG_DEBUG(SENSORS, "Got %d records taken at %lu", event.getRecordCount(), (unsigned long)event.getEpoch());
+            nmeasurement_events_++;
+        }
+
+        void publish() {
+            LOG_DEBUG(SENSORS, "Publishing %d events", nmeasurement_events_);
+
+            // the records are handed out where they are stored, one span per event
+            for (int i = 0; i < nmeasurement_events_; i++) {
+                const Event& event = last_measurement_events_[i];
+                if (event.getRecordCount() > 0) {
+                    RecordSpan records = {event.getRecords(), (size_t)event.getRecordCount()};
+                    measurementChannel.publish(records);
+                }
+            }
+
+            // Reset the stored events to empty events
+            for (int i = 0; i < nmeasurement_events_; i++) {
+                last_measurement_events_[i] = Event();
+            }
+
+            // Reset the number of measurement events
+            nmeasurement_events_ = 0;
+        }
+
         const Event* getLastMeasurementEvent() const{
             return last_measurement_events_;
         }
@@ -128,7 +193,7 @@ class SensorsMicroService : public EventManager, public Subscriber {
                 sensors_[sensors_count] = sensor; // Add sensor pointer to the array
                 sensors_count++; // Increment the count of added sensors
             } else {
-                Serial.println("Max number of sensors reached.");
+                LOG_ERROR(SENSORS, "Max number of sensors reached");
             }
         }
 
@@ -0,0 +1,20 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stddef.h>
+
+/*
+* A run of items owned by the publisher, handed to the subscribers without
+* copying. It is only valid during the call it is passed to. This header does
+* not depend on Arduino.
+*/
+template <typename T>
+struct Span {
+    const T* data;
+    size_t size;
+
+    const T* begin() const { return data; }
+    const T* end() const { return data + size; }
+};
+
+#endif // SPAN_H
@@ -0,0 +1,79 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+* Lock-free queue for exactly one producer and one consumer, e.g. two tasks running
+* on different cores. The producer only writes tail_ and the consumer only writes
+* head_, the release/acquire pairs make the slot contents visible before the index
+* that publishes them. Capacity must be a power of two, one slot is never used.
+* This header does not depend on Arduino.
+*/
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue() : head_(0), tail_(0) {}
+
+    // Producer side, returns false when the queue is full
+    bool push(const T& item) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t next = (tail + 1) & (Capacity - 1);
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items_[tail] = item;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side, slots that can be pushed without failing
+    size_t freeSpace() const {
+        return Capacity - 1 - size();
+    }
+
+    // Consumer side, returns false when the queue is empty
+    bool pop(T& item) {
+        if (!peek(item)) {
+            return false;
+        }
+        head_.store((head_.load(std::memory_order_relaxed) + 1) & (Capacity - 1), std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, reads the oldest item without removing it
+    bool peek(T& item) const {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items_[head];
+        return true;
+    }
+
+    // Exact from either side when the other one is idle, a snapshot otherwise
+    size_t size() const {
+        const size_t head = head_.load(std::memory_order_acquire);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        return (tail - head) & (Capacity - 1);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    static size_t capacity() {
+        return Capacity - 1;
+    }
+
+private:
+    T items_[Capacity];
+    // kept apart so the two cores do not keep stealing the same cache line
+    alignas(32) std::atomic<size_t> head_;
+    alignas(32) std::atomic<size_t> tail_;
+};
+
+#endif // SPSC_QUEUE_H
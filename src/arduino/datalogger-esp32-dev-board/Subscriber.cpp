@@ -1,20 +0,0 @@
-#include "Subscriber.h"
-
-Subscriber::Subscriber() {
-    // Constructor implementation (if needed)
-}
-
-void Subscriber::update(const Event& event) {
-    // Default update method
-    // Implement your custom update logic here
-}
-
-void Subscriber::update(const Event* events, int size) {
-    // Default update method
-    // Implement your custom update logic here
-}
-
-//void Subscriber::update(const Event events[], int size) {
-    // Default update method
-    // Implement your custom update logic here
-//}
\ No newline at end of file
@@ -4,149 +4,125 @@
   #include "SD.h"
   #include "SPI.h"
   #include "WiFi.h"
-  #include "I2C_RTC.h"
   #include <Arduino.h>
   #include <ArduinoHttpClient.h>
 #endif
 
 #include "Event.h"
-#include "EventManager.h"
-#include "Subscriber.h"
+#include "EventBus.h"
 #include "secrets.h"
-
+#include "TimeUtils.h"
+#include "ClockService.h"
+#include "Log.h"
+
+// The firmware keeps its heap flat, so it no longer restarts every few hours,
+// which lost the events in RAM and the DLI of the day. Set to 1 to restart anyway.
+#ifndef PERIODIC_RESTART
+#define PERIODIC_RESTART 0
+#endif
 #define RESTART_INTERVAL_SECS 10800 // 3 hours
-
-static DS3231 RTC;
-
-class TimeEventManager : public EventManager {
+#define RESTART_MIN_HEAP_BLOCK 8192 // B, below this the heap is too fragmented to send and the device restarts
+#define TIME_SUBSCRIBERS 2
+
+/*
+* Publishes the time every update interval. The time comes from ClockService,
+* which reads the RTC only now and then, so a tick costs no bus traffic.
+*/
+class TimeEventManager {
 private:
+    ClockService& clock;
     int updateIntervalSecs;
     int startTimeUnix;
+    Event firstEvent;
+    Event lastEvent;
 
 public:
-    TimeEventManager(int defaultTimeUpdateIntervalSecs) {
-        RTC.begin();
-        RTC.setHourMode(CLOCK_H24);
-        //RTC.setDay(19);
-        //RTC.setMonth(4);
-        //RTC.setYear(2024);
-        //RTC.setHours(18);
-        //RTC.setMinutes(8);
-        //RTC.setSeconds(0);
-
-        firstEvent = Event();
-        lastEvent = Event();
+    // the TIME_EVENT of every tick
+    Channel<Event, TIME_SUBSCRIBERS> timeChannel;
+
+    TimeEventManager(ClockService& clockService, int defaultTimeUpdateIntervalSecs) : clock(clockService) {
 
         updateIntervalSecs = defaultTimeUpdateIntervalSecs;
-        startTimeUnix = RTC.getEpoch();
+        startTimeUnix = clock.now();
 
-        Serial.begin(9600);
-        Serial.println("Initialized TimeEventManager.");
+        LOG_INFO(SYSTEM, "Initialized TimeEventManager");
     }
 
-    void notify() override {
+    void notify() {
         main();
 
-        Serial.println("\nTimeEventManager notifying subscribers...");
-        for (int i = 0; i < number_of_subs; i++){
-            subscribers_[i]->update(lastEvent);
-        }
+        LOG_DEBUG(SYSTEM, "TimeEventManager notifying subscribers...");
+        timeChannel.publish(lastEvent);
+    }
+
+    /*
+    * Scheduler entry point, calls notify on the TimeEventManager passed as context.
+    */
+    static void notifyTask(void* manager) {
+        static_cast<TimeEventManager*>(manager)->notify();
+    }
+
+    Event getFirstEvent() {
+        return firstEvent;
     }
 
+    // The restart messages are written straight to the serial port, a line queued
+    // for the log task would be lost with the restart
     void checkForRestart() {
+#if PERIODIC_RESTART
         //if the distance in time between the current time and the first event's timestamp
         //is than the RESTART_INTERVAL_SECS, then restart the device
-        int currentTimeUnix = RTC.getEpoch();
+        int currentTimeUnix = clock.now();
         int timeDiff = currentTimeUnix - startTimeUnix;
 
         if (timeDiff > RESTART_INTERVAL_SECS) {
             Serial.println("TimeEventManager: Restarting device due to time interval.");
             ESP.restart();
         }
+#endif
+        // last resort if something does leak or fragment the heap after all
+        if (ESP.getMaxAllocHeap() < RESTART_MIN_HEAP_BLOCK) {
+            Serial.printf("TimeEventManager: Restarting device, largest free block is %u B.\n", (unsigned)ESP.getMaxAllocHeap());
+            ESP.restart();
+        }
     }
 
-    void main() override {
-        Serial.println("\nTimeEventManager running business logic...");
+    void main() {
+        LOG_DEBUG(SYSTEM, "TimeEventManager running business logic...");
         checkForRestart();
 
-        String data = "";
-
-        try {
-            
-            int year = RTC.getYear();
-            int month = RTC.getMonth();
-            int day = RTC.getDay();
-            int hour = RTC.getHours();
-            int minute = RTC.getMinutes();
-            int second = RTC.getSeconds();
-
-            // Create timestamp add zero padding
-            const String monthStr = (month < 10) ? "0" + String(month) : String(month);
-            const String dayStr = (day < 10) ? "0" + String(day) : String(day);
-            const String hourStr = (hour < 10) ? "0" + String(hour) : String(hour);
-            const String minuteStr = (minute < 10) ? "0" + String(minute) : String(minute);
-            const String secondStr = (second < 10) ? "0" + String(second) : String(second);
-
-            String timestamp = String(year) + "-" + monthStr + "-" + dayStr + "T" +
-                              hourStr + ":" + minuteStr + ":" + secondStr + " " + TZ;
-
-            Event timeEvent(TIME_EVENT, OK_STATUS, timestamp, data);
-
-            firstEvent = (firstEvent.getType() == UNKNOWN_EVENT) ? timeEvent : firstEvent;
-            lastEvent = timeEvent;
-
-            Serial.print("\tupdate: ");
-            Serial.println(lastEvent.getTimestamp());
-        } catch (const std::exception& e1) {
-            Serial.print("Error on RTC read: ");
-            Serial.println(e1.what());
-
-            // Work around RTC failure
-            try {
-                Event timeEvent = workAroundRtcFailure();
-
-            } catch (const std::exception& e2) {
-                Serial.print("Error during work around RTC failure: ");
-                Serial.println(e2.what());
-            }
+        if (!clock.isValid()) {
+            // the RTC was never read, keep counting from the last known time
+            LOG_ERROR(SYSTEM, "Error on RTC read: the clock is not set");
+            lastEvent = workAroundRtcFailure();
+            return;
+        }
+
+        // the timestamp is only formatted when it is printed or sent
+        uint32_t epoch = clock.now();
+
+        Event timeEvent(TIME_EVENT, OK_STATUS, "", "");
+        timeEvent.setEpoch(epoch);
+
+        firstEvent = (firstEvent.getType() == UNKNOWN_EVENT) ? timeEvent : firstEvent;
+        lastEvent = timeEvent;
+
+        // formatted only when debugging, the arguments are compiled out otherwise
+        if (LOG_LEVEL_SYSTEM >= LOG_LEVEL_DEBUG) {
+            char timestamp[ISO_TIMESTAMP_BUFFER];
+            formatIsoTimestamp(epoch, timestamp);
+            LOG_DEBUG(SYSTEM, "update: %s %s (drift %.1f ppm)", timestamp, TZ.c_str(), clock.getDriftPpm());
         }
     }
 
     long int getEpoch() {
-        return RTC.getEpoch();
+        return clock.now();
     }
 
+    // Moves the last known time forward by the update interval
     Event workAroundRtcFailure() {
-        String data = "";
-        String lastTimestamp = lastEvent.getTimestamp();
-
-        String date = lastTimestamp.substring(0, 10);
-        String time = lastTimestamp.substring(11);
-
-        int year = date.substring(0, 4).toInt();
-        int month = date.substring(5, 7).toInt();
-        int day = date.substring(8, 10).toInt();
-
-        int hour = time.substring(0, 2).toInt();
-        int minute = time.substring(3, 5).toInt();
-        int second = time.substring(6, 8).toInt();
-
-        second += updateIntervalSecs;
-        minute += second / 60;
-        second %= 60;
-        hour += minute / 60;
-        minute %= 60;
-        day += hour / 24;
-        hour %= 24;
-        month += day / 30;
-        day %= 30;
-        year += month / 12;
-        month %= 12;
-
-        String newTimestamp = String(year) + "-" + String(month) + "-" + String(day) + " " +
-                             String(hour) + ":" + String(minute) + ":" + String(second);
-
-        Event timeEvent(TIME_EVENT, BUG_RESILIENCE_STATUS, newTimestamp, data);
+        Event timeEvent(TIME_EVENT, BUG_RESILIENCE_STATUS, "", "");
+        timeEvent.setEpoch(lastEvent.getEpoch() + updateIntervalSecs);
         return timeEvent;
     }
 };
\ No newline at end of file
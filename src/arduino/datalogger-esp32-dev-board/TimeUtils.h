@@ -0,0 +1,161 @@
+#ifndef TIME_UTILS_H
+#define TIME_UTILS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SECONDS_PER_DAY 86400UL
+#define ISO_TIMESTAMP_LENGTH 19     // YYYY-MM-DDThh:mm:ss
+#define ISO_TIMESTAMP_BUFFER 20     // with the terminating null
+
+/*
+* Timestamps are carried as epoch seconds of the RTC wall clock (uint32_t, good
+* until 2106) and only turned into text when they are written out. The civil date
+* conversions are Howard Hinnant's days_from_civil / civil_from_days, a fixed
+* number of operations instead of a loop over the years, and valid for every
+* date from 1970-01-01 to 2106-02-07. This header does not depend on Arduino.
+*/
+struct CivilTime {
+    uint16_t year;
+    uint8_t month;      // 1..12
+    uint8_t day;        // 1..31
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+};
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+inline int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day) {
+    year -= (month <= 2);
+    const int32_t era = (year >= 0 ? year : year - 399) / 400;
+    const uint32_t yearOfEra = (uint32_t)(year - era * 400);
+    const uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int32_t)dayOfEra - 719468;
+}
+
+inline bool isLeapYear(uint32_t year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+inline uint8_t daysInMonth(uint32_t year, uint32_t month) {
+    static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return (month == 2 && isLeapYear(year)) ? 29 : days[month - 1];
+}
+
+inline CivilTime civilFromEpoch(uint32_t epoch) {
+    const uint32_t days = epoch / SECONDS_PER_DAY;
+    const uint32_t secondsOfDay = epoch % SECONDS_PER_DAY;
+
+    const uint32_t z = days + 719468;
+    const uint32_t era = z / 146097;
+    const uint32_t dayOfEra = z - era * 146097;
+    const uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const uint32_t mp = (5 * dayOfYear + 2) / 153;
+    const uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+
+    CivilTime civil;
+    civil.day = (uint8_t)(dayOfYear - (153 * mp + 2) / 5 + 1);
+    civil.month = (uint8_t)month;
+    civil.year = (uint16_t)(yearOfEra + era * 400 + (month <= 2));
+    civil.hour = (uint8_t)(secondsOfDay / 3600);
+    civil.minute = (uint8_t)((secondsOfDay / 60) % 60);
+    civil.second = (uint8_t)(secondsOfDay % 60);
+    return civil;
+}
+
+inline uint32_t epochFromCivil(const CivilTime& civil) {
+    const int32_t days = daysFromCivil(civil.year, civil.month, civil.day);
+    return (uint32_t)days * SECONDS_PER_DAY + civil.hour * 3600UL + civil.minute * 60UL + civil.second;
+}
+
+// Days since 1970-01-01, two epochs on the same day give the same number
+inline uint32_t dayNumber(uint32_t epoch) {
+    return epoch / SECONDS_PER_DAY;
+}
+
+/*
+* Writes 'YYYY-MM-DDThh:mm:ss' and a terminating null into out, which must hold
+* ISO_TIMESTAMP_BUFFER characters.
+* @return ISO_TIMESTAMP_LENGTH
+*/
+inline size_t formatIsoTimestamp(uint32_t epoch, char* out) {
+    const CivilTime civil = civilFromEpoch(epoch);
+    const uint32_t fields[6] = {civil.year, civil.month, civil.day, civil.hour, civil.minute, civil.second};
+    static const char separators[6] = {'-', '-', 'T', ':', ':', '\0'};
+
+    char* p = out;
+    for (int i = 0; i < 6; i++) {
+        uint32_t value = fields[i];
+        int width = (i == 0) ? 4 : 2;
+        for (int d = width - 1; d >= 0; d--) {
+            p[d] = (char)('0' + value % 10);
+            value /= 10;
+        }
+        p += width;
+        *p++ = separators[i];
+    }
+    return ISO_TIMESTAMP_LENGTH;
+}
+
+/*
+* Writes the epoch as 'YYYY-MM-DDThh:mm:ss' to any sink with
+* write(const char*, size_t), see JsonEncoder.h.
+*/
+template <typename Sink>
+inline void writeIsoTimestamp(Sink& sink, uint32_t epoch) {
+    char text[ISO_TIMESTAMP_BUFFER];
+    formatIsoTimestamp(epoch, text);
+    sink.write(text, ISO_TIMESTAMP_LENGTH);
+}
+
+/*
+* Reads 'YYYY-MM-DD?hh:mm:ss' at fixed positions, the separators are not checked
+* so 'T' and ' ' are both taken, and anything after the seconds is ignored.
+* @return false if the text is too short, a field is not a number in range or
+* the day is not in the month
+*/
+inline bool parseIsoTimestamp(const char* text, size_t length, uint32_t& epoch) {
+    static const uint8_t offsets[6] = {0, 5, 8, 11, 14, 17};
+    if (length < ISO_TIMESTAMP_LENGTH) {
+        return false;
+    }
+
+    uint32_t fields[6];
+    for (int i = 0; i < 6; i++) {
+        const int width = (i == 0) ? 4 : 2;
+        uint32_t value = 0;
+        for (int d = 0; d < width; d++) {
+            const char c = text[offsets[i] + d];
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            value = value * 10 + (uint32_t)(c - '0');
+        }
+        fields[i] = value;
+    }
+
+    if (fields[0] < 1970 || fields[0] > 2106 || fields[1] < 1 || fields[1] > 12 || fields[2] < 1 || fields[2] > 31 ||
+        fields[3] > 23 || fields[4] > 59 || fields[5] > 59 || fields[2] > daysInMonth(fields[0], fields[1])) {
+        return false;
+    }
+    CivilTime civil;
+    civil.year = (uint16_t)fields[0];
+    civil.month = (uint8_t)fields[1];
+    civil.day = (uint8_t)fields[2];
+    civil.hour = (uint8_t)fields[3];
+    civil.minute = (uint8_t)fields[4];
+    civil.second = (uint8_t)fields[5];
+
+    // past 2106-02-07T06:28:15 the epoch does not fit
+    const uint64_t seconds = (uint64_t)daysFromCivil(civil.year, civil.month, civil.day) * SECONDS_PER_DAY +
+                             civil.hour * 3600UL + civil.minute * 60UL + civil.second;
+    if (seconds > UINT32_MAX) {
+        return false;
+    }
+    epoch = (uint32_t)seconds;
+    return true;
+}
+
+#endif // TIME_UTILS_H
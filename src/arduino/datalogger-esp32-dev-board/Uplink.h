@@ -0,0 +1,32 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include "Event.h"
+
+// transports the ConnectionEventManager can send through
+#define UPLINK_HTTP 0
+#define UPLINK_MQTT 1
+
+// most events a single sendEvents call takes, the rest are not sent
+#define UPLINK_MAX_EVENTS 30
+
+/*
+* Common interface of the transports that deliver measurement events.
+*/
+class Uplink {
+public:
+    virtual ~Uplink() {}
+
+    /*
+    * Sends the events, the result of each one is stored at the same index of the
+    * returned array. OK_STATUS or CREATED_STATUS mean the event was delivered, any
+    * other status keeps it in the RAM or SD backlog.
+    */
+    virtual int* sendEvents(const Event* events, int n) = 0;
+    virtual int* getLastResults() = 0;
+
+    // Closes the connection, e.g. when the WiFi link is restarted
+    virtual void disconnect() = 0;
+};
+
+#endif // UPLINK_H
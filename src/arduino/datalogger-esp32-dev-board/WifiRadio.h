@@ -0,0 +1,59 @@
+#ifndef WIFI_RADIO_H
+#define WIFI_RADIO_H
+
+#include <Arduino.h>
+#include "WiFi.h"
+#include "secrets.h"
+#include "Uplink.h"
+#include "Log.h"
+
+// Host probed once the link has been quiet for a while, e.g. the hotspot address.
+// Define it in secrets.h; without it the station status is all there is to check.
+#ifndef CONNECTION_PROBE_PORT
+#define CONNECTION_PROBE_PORT 80
+#endif
+#define CONNECTION_PROBE_TIMEOUT 2000   // ms, the probe is the only call here that waits
+
+/*
+* The WiFi side of ConnectionStateMachine. Every call returns right away, except
+* the probe which waits at most CONNECTION_PROBE_TIMEOUT.
+*/
+class WifiRadio {
+public:
+    WifiRadio(Uplink& http, Uplink& mqtt) : http_(http), mqtt_(mqtt) {}
+
+    void begin() {
+        LOG_INFO(CONNECTION, "Connecting to hotspot...");
+        WiFi.begin(MY_SSID, MY_PASSWORD);
+    }
+
+    bool isConnected() {
+        return WiFi.status() == WL_CONNECTED;
+    }
+
+    // The kept uplink connections go with the link
+    void disconnect() {
+        http_.disconnect();
+        mqtt_.disconnect();
+        WiFi.disconnect();
+    }
+
+    bool probe() {
+#ifdef CONNECTION_PROBE_HOST
+        WiFiClient probe;
+        bool reachable = probe.connect(CONNECTION_PROBE_HOST, CONNECTION_PROBE_PORT, CONNECTION_PROBE_TIMEOUT);
+        probe.stop();
+        LOG_INFO(CONNECTION, "Link probe %s", reachable ? "answered" : "failed");
+        return reachable;
+#else
+        // a quiet uplink is no reason to drop a link the station still reports up
+        return isConnected();
+#endif
+    }
+
+private:
+    Uplink& http_;
+    Uplink& mqtt_;
+};
+
+#endif // WIFI_RADIO_H
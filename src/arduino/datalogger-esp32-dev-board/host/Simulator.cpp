@@ -0,0 +1,409 @@
+/*
+* Runs the firmware off-device: setup() and loop() of main.ino against the
+* Arduino stand-ins in arduino/, on simulated time. The run ends after the set
+* duration or when the firmware restarts the board, then a summary is printed.
+*
+*   datalogger-sim --days 3 --wifi-outage 20:6 --sd /tmp/card
+*   datalogger-sim --trace scenarios/overnight-outage.trace --json result.json
+*
+* A trace holds the same options one per line without the dashes, e.g.
+* "wifi-outage 20:6", so outage and recovery patterns can be kept and replayed.
+* The --max and --min options are limits the run is checked against; if one is
+* exceeded, or the firmware restarts the board while a limit is set, the
+* simulator exits with 3, so the scenarios run as tests.
+*/
+
+#include <chrono>
+#include <ftw.h>
+#include <Arduino.h>
+#include <SD.h>
+#include <Wire.h>
+#include "HostRuntime.h"
+#include "Instrumentation.h"
+
+#define SIM_MAX_LINE 256
+
+void setup();
+void loop();
+
+static bool keepSd = false;
+static char jsonPath[HOST_SD_ROOT_LENGTH] = "";
+static char traceName[HOST_SD_ROOT_LENGTH] = "";
+
+// What a run is checked against, -1 leaves a limit unchecked
+struct Limits {
+    long long maxHeapPeak;      // B
+    long long maxLost;          // events given up after their retry budget
+    long long maxDrops;         // events or records lost to a full buffer
+    long long minDelivered;     // records that reached the server
+    long long maxDrainMin;      // min from the end of an outage until its backlog was delivered
+    long long minLargestFree;   // B, lowest the largest free heap block may get, i.e. fragmentation
+};
+
+static Limits limits = {-1, -1, -1, -1, -1, -1};
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --days N               simulated duration in days (default 1)\n"
+            "  --hours N              simulated duration in hours\n"
+            "  --seed N               seed of esp_random and the sensor noise\n"
+            "  --start EPOCH          RTC time at the start\n"
+            "  --wifi-outage H:D      access point down from hour H for D hours, repeatable\n"
+            "  --server-down H:D      API server down from hour H for D hours, repeatable\n"
+            "  --server-status CODE   status the API server answers with (default 201)\n"
+            "  --request-ms N         round trip of a request (default 150)\n"
+            "  --rtc-drift PPM        how much faster the RTC runs than millis()\n"
+            "  --sd DIR               directory holding the SD card (default sim-sd)\n"
+            "  --keep-sd              start from the card left by an earlier run\n"
+            "  --serial               echo the Serial output\n"
+            "  --baud N               charge Serial output at N baud\n"
+            "  --trace FILE           read options from a trace file\n"
+            "  --json FILE            also write the summary as JSON\n"
+            "  --max-heap-peak B      fail if the heap peak is above B bytes\n"
+            "  --max-lost N           fail if more than N events were given up\n"
+            "  --max-drops N          fail if more than N events or records were dropped\n"
+            "  --min-delivered N      fail if fewer than N records reached the server\n"
+            "  --max-drain-min M      fail if an outage backlog took more than M min to drain\n"
+            "  --min-largest-free B   fail if the largest free heap block fell below B bytes\n",
+            program);
+}
+
+static bool parseWindow(const char* text, host::Window& window) {
+    double start;
+    double duration;
+    if (sscanf(text, "%lf:%lf", &start, &duration) != 2 || start < 0 || duration <= 0) {
+        return false;
+    }
+    window.start = (uint64_t)(start * 3600000.0);
+    window.end = window.start + (uint64_t)(duration * 3600000.0);
+    return true;
+}
+
+// Options that take no value
+static bool isFlag(const char* name) {
+    return strcmp(name, "keep-sd") == 0 || strcmp(name, "serial") == 0;
+}
+
+static bool readTrace(const char* path);
+
+/*
+* Applies one option, by its name without the dashes.
+* @return false if the option or its value is not understood
+*/
+static bool applyOption(const char* name, const char* value) {
+    host::Config& config = host::config();
+    if (strcmp(name, "keep-sd") == 0) {
+        keepSd = true;
+    } else if (strcmp(name, "serial") == 0) {
+        config.echoSerial = true;
+    } else if (value == nullptr) {
+        return false;
+    } else if (strcmp(name, "days") == 0) {
+        config.durationMs = (uint64_t)(atof(value) * 24 * 3600000.0);
+    } else if (strcmp(name, "hours") == 0) {
+        config.durationMs = (uint64_t)(atof(value) * 3600000.0);
+    } else if (strcmp(name, "seed") == 0) {
+        config.seed = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(name, "start") == 0) {
+        config.startEpoch = (uint32_t)strtoul(value, nullptr, 10);
+    } else if (strcmp(name, "wifi-outage") == 0 || strcmp(name, "server-down") == 0) {
+        bool wifi = strcmp(name, "wifi-outage") == 0;
+        host::Window* windows = wifi ? config.wifiOutages : config.serverOutages;
+        int& count = wifi ? config.wifiOutageCount : config.serverOutageCount;
+        if (count >= HOST_MAX_WINDOWS || !parseWindow(value, windows[count])) {
+            return false;
+        }
+        count++;
+    } else if (strcmp(name, "server-status") == 0) {
+        config.serverStatus = atoi(value);
+    } else if (strcmp(name, "request-ms") == 0) {
+        config.requestMs = strtoul(value, nullptr, 10);
+    } else if (strcmp(name, "rtc-drift") == 0) {
+        config.rtcDriftPpm = atof(value);
+    } else if (strcmp(name, "sd") == 0) {
+        snprintf(config.sdRoot, sizeof(config.sdRoot), "%s", value);
+    } else if (strcmp(name, "baud") == 0) {
+        config.serialBaud = strtoul(value, nullptr, 10);
+    } else if (strcmp(name, "json") == 0) {
+        snprintf(jsonPath, sizeof(jsonPath), "%s", value);
+    } else if (strcmp(name, "max-heap-peak") == 0) {
+        limits.maxHeapPeak = strtoll(value, nullptr, 10);
+    } else if (strcmp(name, "max-lost") == 0) {
+        limits.maxLost = strtoll(value, nullptr, 10);
+    } else if (strcmp(name, "max-drops") == 0) {
+        limits.maxDrops = strtoll(value, nullptr, 10);
+    } else if (strcmp(name, "min-delivered") == 0) {
+        limits.minDelivered = strtoll(value, nullptr, 10);
+    } else if (strcmp(name, "max-drain-min") == 0) {
+        limits.maxDrainMin = strtoll(value, nullptr, 10);
+    } else if (strcmp(name, "min-largest-free") == 0) {
+        limits.minLargestFree = strtoll(value, nullptr, 10);
+    } else if (strcmp(name, "trace") == 0) {
+        return readTrace(value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool readTrace(const char* path) {
+    FILE* trace = fopen(path, "r");
+    if (trace == nullptr) {
+        fprintf(stderr, "Cannot open trace %s\n", path);
+        return false;
+    }
+    const char* base = strrchr(path, '/');
+    snprintf(traceName, sizeof(traceName), "%s", base != nullptr ? base + 1 : path);
+
+    char line[SIM_MAX_LINE];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), trace) != nullptr) {
+        number++;
+        char* comment = strchr(line, '#');
+        if (comment != nullptr) {
+            *comment = '\0';
+        }
+        char* name = strtok(line, " \t\r\n");
+        if (name == nullptr) {
+            continue;
+        }
+        char* value = strtok(nullptr, " \t\r\n");
+        if (!applyOption(name, value)) {
+            fprintf(stderr, "%s:%d: bad option %s\n", path, number, name);
+            ok = false;
+        }
+    }
+    fclose(trace);
+    return ok;
+}
+
+static int removeEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+// How long the backlog of the window took to reach the server, -1 if nothing came after it
+static long long drainMs(const host::Window& window, uint64_t drainedAt) {
+    return drainedAt >= window.end ? (long long)(drainedAt - window.end) : -1;
+}
+
+static void printWindows(const char* label, const host::Window* windows, int count, const uint64_t* drainedAt) {
+    for (int i = 0; i < count; i++) {
+        long long drain = drainMs(windows[i], drainedAt[i]);
+        printf("%-22s %.1f h for %.1f h, ", label, windows[i].start / 3600000.0,
+               (windows[i].end - windows[i].start) / 3600000.0);
+        if (drain < 0) {
+            printf("backlog not drained\n");
+        } else {
+            printf("drained %.1f min after\n", drain / 60000.0);
+        }
+    }
+}
+
+static void writeJsonWindows(FILE* out, const char* key, const host::Window* windows, int count,
+                             const uint64_t* drainedAt) {
+    fprintf(out, "  \"%s\": [", key);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s{\"start_ms\": %llu, \"end_ms\": %llu, \"drain_ms\": %lld}", i > 0 ? ", " : "",
+                (unsigned long long)windows[i].start, (unsigned long long)windows[i].end,
+                drainMs(windows[i], drainedAt[i]));
+    }
+    fprintf(out, "],\n");
+}
+
+static int checkWindows(const char* label, const host::Window* windows, int count, const uint64_t* drainedAt) {
+    int exceeded = 0;
+    for (int i = 0; i < count; i++) {
+        long long drain = drainMs(windows[i], drainedAt[i]);
+        if (drain < 0 || drain > limits.maxDrainMin * 60000) {
+            fprintf(stderr, "limit exceeded: %s at %.1f h drained after %.1f min, at most %lld allowed\n", label,
+                    windows[i].start / 3600000.0, drain / 60000.0, limits.maxDrainMin);
+            exceeded++;
+        }
+    }
+    return exceeded;
+}
+
+static int checkLimit(const char* what, long long value, long long limit, bool atMost) {
+    if (limit < 0 || (atMost ? value <= limit : value >= limit)) {
+        return 0;
+    }
+    fprintf(stderr, "limit exceeded: %s %lld, %s %lld %s\n", what, value, atMost ? "at most" : "at least", limit,
+            atMost ? "allowed" : "required");
+    return 1;
+}
+
+/*
+* Checks the run against the limits, each one exceeded is reported on stderr.
+* @return number of limits exceeded
+*/
+static int checkLimits(bool restarted) {
+    const host::Config& config = host::config();
+    const host::Stats& stats = host::stats();
+    const Instrumentation& counters = instrumentation();
+    bool any = limits.maxHeapPeak >= 0 || limits.maxLost >= 0 || limits.maxDrops >= 0 || limits.minDelivered >= 0 ||
+               limits.maxDrainMin >= 0 || limits.minLargestFree >= 0;
+    int exceeded = 0;
+    if (any && restarted) {
+        fprintf(stderr, "limit exceeded: the firmware restarted the board\n");
+        exceeded++;
+    }
+    exceeded += checkLimit("heap peak", (long long)host::heap().peak, limits.maxHeapPeak, true);
+    exceeded += checkLimit("events given up", (long long)counters.counter(COUNTER_GIVEN_UP), limits.maxLost, true);
+    exceeded += checkLimit("drops", (long long)counters.counter(COUNTER_DROPS), limits.maxDrops, true);
+    exceeded += checkLimit("delivered records", (long long)stats.deliveredRecords, limits.minDelivered, false);
+    exceeded += checkLimit("largest free heap block", (long long)host::heap().minLargestFree, limits.minLargestFree,
+                           false);
+    if (limits.maxDrainMin >= 0) {
+        exceeded += checkWindows("wifi outage", config.wifiOutages, config.wifiOutageCount, stats.wifiDrainedAt);
+        exceeded += checkWindows("server outage", config.serverOutages, config.serverOutageCount,
+                                 stats.serverDrainedAt);
+    }
+    return exceeded;
+}
+
+// Lets the firmware JSON encoders write straight to a file
+struct FileSink {
+    FILE* out;
+    void write(const char* data, size_t length) { fwrite(data, 1, length, out); }
+};
+
+static bool writeJson(const char* path, const char* ending, double wallSeconds, int exceeded) {
+    FILE* out = fopen(path, "w");
+    if (out == nullptr) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return false;
+    }
+    const host::Config& config = host::config();
+    const host::Stats& stats = host::stats();
+    host::HeapUsage heap = host::heap();
+    fprintf(out, "{\n");
+    fprintf(out, "  \"trace\": \"%s\",\n", traceName);
+    fprintf(out, "  \"seed\": %u,\n", (unsigned)config.seed);
+    fprintf(out, "  \"ended\": \"%s\",\n", ending);
+    fprintf(out, "  \"simulated_ms\": %llu,\n", (unsigned long long)(host::nowMicros() / 1000));
+    fprintf(out, "  \"wall_s\": %.3f,\n", wallSeconds);
+    fprintf(out, "  \"limits_exceeded\": %d,\n", exceeded);
+    writeJsonWindows(out, "wifi_outages", config.wifiOutages, config.wifiOutageCount, stats.wifiDrainedAt);
+    writeJsonWindows(out, "server_outages", config.serverOutages, config.serverOutageCount, stats.serverDrainedAt);
+    fprintf(out, "  \"max_delivery_delay_ms\": %llu,\n", (unsigned long long)stats.maxDeliveryDelayMs);
+    fprintf(out, "  \"associations\": %lu,\n", stats.associations);
+    fprintf(out, "  \"link_losses\": %lu,\n", stats.linkLosses);
+    fprintf(out, "  \"connections\": %lu,\n", stats.connections);
+    fprintf(out, "  \"requests\": %lu,\n", stats.requests);
+    fprintf(out, "  \"refused_requests\": %lu,\n", stats.refusedRequests);
+    fprintf(out, "  \"compressed_requests\": %lu,\n", stats.compressedRequests);
+    fprintf(out, "  \"delivered_records\": %lu,\n", stats.deliveredRecords);
+    fprintf(out, "  \"corrupt_bodies\": %lu,\n", stats.corruptBodies);
+    fprintf(out, "  \"body_bytes\": %llu,\n", (unsigned long long)stats.bodyBytes);
+    fprintf(out, "  \"i2c_transactions\": %lu,\n", Wire.transactions());
+    fprintf(out, "  \"serial_bytes\": %lu,\n", stats.serialBytes);
+    fprintf(out, "  \"heap_in_use\": %zu,\n", heap.inUse);
+    fprintf(out, "  \"heap_peak\": %zu,\n", heap.peak);
+    fprintf(out, "  \"allocations\": %lu,\n", heap.allocations);
+    fprintf(out, "  \"live_blocks\": %lu,\n", heap.liveBlocks);
+    fprintf(out, "  \"largest_free_block\": %zu,\n", heap.largestFree);
+    fprintf(out, "  \"min_largest_free_block\": %zu,\n", heap.minLargestFree);
+    fprintf(out, "  \"sd_peak_bytes\": %llu,\n", (unsigned long long)stats.sdPeakBytes);
+    fprintf(out, "  \"sd_used_bytes\": %llu,\n", (unsigned long long)SD.usedBytes());
+    fprintf(out, "  \"sd_writes\": %lu,\n", SD.writeCount());
+    fprintf(out, "  \"sd_written_bytes\": %llu,\n", (unsigned long long)SD.writtenBytes());
+    // the stage timings are in simulated time, only the waits the stand-ins charge show up
+    fprintf(out, "  \"instrumentation\": ");
+    FileSink sink = {out};
+    instrumentation().writeJson(sink, (unsigned long)(host::nowMicros() / 1000));
+    fprintf(out, "\n}\n");
+    fclose(out);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char* name = arg + 2;
+        const char* value = (!isFlag(name) && i + 1 < argc) ? argv[++i] : nullptr;
+        if (!applyOption(name, value)) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    host::Config& config = host::config();
+    if (!keepSd) {
+        // a fresh card, only what the firmware writes in this run is on it
+        nftw(config.sdRoot, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    host::begin();
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+    const char* ending = "duration reached";
+    bool restarted = false;
+    try {
+        setup();
+        while (true) {
+            loop();
+        }
+    } catch (const host::SimulationEnd&) {
+    } catch (const host::RestartRequested&) {
+        ending = "the firmware restarted the board";
+        restarted = true;
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    fflush(stdout);
+
+    const host::Stats& stats = host::stats();
+    host::HeapUsage heap = host::heap();
+    double simulatedSeconds = host::nowMicros() / 1e6;
+    printf("\n--- simulation summary ---\n");
+    if (traceName[0] != '\0') {
+        printf("%-22s %s\n", "trace", traceName);
+    }
+    printf("%-22s %s\n", "ended", ending);
+    printf("%-22s %.1f h\n", "simulated", simulatedSeconds / 3600.0);
+    printf("%-22s %.2f s (%.0fx)\n", "wall time", wallSeconds,
+           wallSeconds > 0 ? simulatedSeconds / wallSeconds : 0.0);
+    printf("%-22s %lu associations, %lu losses\n", "wifi", stats.associations, stats.linkLosses);
+    printWindows("wifi outage", config.wifiOutages, config.wifiOutageCount, stats.wifiDrainedAt);
+    printWindows("server outage", config.serverOutages, config.serverOutageCount, stats.serverDrainedAt);
+    printf("%-22s %lu connections, %lu requests, %lu refused, %lu gzip\n", "api", stats.connections,
+           stats.requests, stats.refusedRequests, stats.compressedRequests);
+    if (stats.brokerConnections > 0) {
+        printf("%-22s %lu connections, %lu publishes, at most %lu in flight\n", "mqtt",
+               stats.brokerConnections, stats.publishes, stats.maxInflight);
+    }
+    printf("%-22s %lu, at most %.1f min after sampling\n", "delivered records", stats.deliveredRecords,
+           stats.maxDeliveryDelayMs / 60000.0);
+    if (stats.corruptBodies > 0) {
+        printf("%-22s %lu\n", "corrupt gzip bodies", stats.corruptBodies);
+    }
+    printf("%-22s %llu B\n", "request bodies", (unsigned long long)stats.bodyBytes);
+    printf("%-22s %lu temperature, %lu humidity, %lu light\n", "sensor reads", stats.temperatureReads,
+           stats.humidityReads, stats.lightReads);
+    printf("%-22s %lu transactions\n", "i2c", Wire.transactions());
+    printf("%-22s %lu B\n", "serial output", stats.serialBytes);
+    printf("%-22s %zu B in use in %lu blocks, %zu B peak, %lu allocations\n", "heap", heap.inUse, heap.liveBlocks,
+           heap.peak, heap.allocations);
+    printf("%-22s %zu B now, %zu B at the lowest\n", "largest free block", heap.largestFree, heap.minLargestFree);
+    printf("%-22s %llu B used, %llu B peak, %lu writes of %llu B\n", "sd card", (unsigned long long)SD.usedBytes(),
+           (unsigned long long)stats.sdPeakBytes, SD.writeCount(), (unsigned long long)SD.writtenBytes());
+    printf("%-22s", "counters");
+    for (int i = 0; i < NUMBER_OF_COUNTERS; i++) {
+        printf(" %s %lu", Instrumentation::counterName(i), (unsigned long)instrumentation().counter(i));
+    }
+    printf("\n");
+    fflush(stdout);
+
+    int exceeded = checkLimits(restarted);
+    if (jsonPath[0] != '\0' && !writeJson(jsonPath, ending, wallSeconds, exceeded)) {
+        return 1;
+    }
+    return exceeded > 0 ? 3 : 0;
+}
@@ -0,0 +1,3 @@
+// The Arduino IDE builds main.ino as C++ with Arduino.h in front, this does the same
+#include <Arduino.h>
+#include "main.ino"
@@ -0,0 +1,94 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+* Host stand-in for the Arduino ESP32 core, just what the firmware uses. Time is
+* simulated: millis() only moves when the firmware calls delay(), so days of
+* operation run in seconds and every run is reproducible. See HostRuntime.h for
+* the knobs of the simulation.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <algorithm>
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define F(text) (text)
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+/*
+* Serial port. Output is dropped unless the simulation echoes it; with a baud
+* rate set, writing takes the simulated time the bytes need on the wire.
+*/
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+/*
+* Heap figures come from the host runtime, which counts every operator new of
+* the process against a heap the size of the ESP32 one. The free heap is taken
+* as one block, fragmentation is not modelled.
+*/
+class EspClass {
+public:
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    uint32_t getPsramSize() { return 0; }
+    uint32_t getFreePsram() { return 0; }
+    [[noreturn]] void restart();
+};
+
+extern EspClass ESP;
+
+uint32_t esp_random();
+
+// SNTP is not simulated, the sync callback never fires
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1,
+                const char* server2 = nullptr, const char* server3 = nullptr);
+
+// FreeRTOS tasks are not simulated, build the sketch with DUAL_CORE 0
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stackDepth, void* parameters,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,67 @@
+#ifndef HOST_ARDUINO_HTTP_CLIENT_H
+#define HOST_ARDUINO_HTTP_CLIENT_H
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+#define HTTP_SUCCESS 0
+#define HTTP_ERROR_CONNECTION_FAILED -1
+#define HTTP_ERROR_API -2
+#define HTTP_ERROR_TIMED_OUT -3
+#define HTTP_ERROR_INVALID_RESPONSE -4
+
+/*
+* Stand-in for ArduinoHttpClient that talks to the mock API server of the host
+* runtime. The server counts the requests and the records in their bodies and
+* answers with the status the simulation sets, with an empty body, or with what
+* its handler returns. A request takes the simulated round trip time.
+*/
+class HttpClient : public Client {
+public:
+    static const int kNoContentLengthHeader = -1;
+
+    HttpClient(Client& client, const char* host, uint16_t port);
+    HttpClient(Client& client, const String& host, uint16_t port);
+
+    void connectionKeepAlive() {}
+    void noDefaultRequestHeaders() {}
+    void setHttpResponseTimeout(uint32_t timeout) { (void)timeout; }
+
+    void beginRequest();
+    int post(const char* path);
+    void sendHeader(const char* name, const char* value);
+    void sendHeader(const char* name, const String& value) { sendHeader(name, value.c_str()); }
+    void sendHeader(const char* name, int value);
+    void beginBody() {}
+    void endRequest();
+
+    int responseStatusCode();
+    int skipResponseHeaders() { return status_ > 0 ? HTTP_SUCCESS : HTTP_ERROR_API; }
+    bool isResponseChunked() { return false; }
+    int contentLength() { return (int)responseLength_; }
+    bool endOfBodyReached() { return responsePosition_ >= responseLength_; }
+
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override { return (int)(responseLength_ - responsePosition_); }
+    int read() override { return endOfBodyReached() ? -1 : (uint8_t)response_[responsePosition_++]; }
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override { return endOfBodyReached() ? -1 : (uint8_t)response_[responsePosition_]; }
+    void stop() override { connected_ = false; }
+    uint8_t connected() override;
+
+private:
+    bool connected_;
+    bool compressed_;
+    int status_;
+    size_t bodyBytes_;
+    unsigned long records_;
+    unsigned long generation_;      // of the server when connected, see host::dropConnections
+    const char* response_;
+    size_t responseLength_;
+    size_t responsePosition_;
+};
+
+#endif // HOST_ARDUINO_HTTP_CLIENT_H
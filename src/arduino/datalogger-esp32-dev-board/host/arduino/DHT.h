@@ -0,0 +1,22 @@
+#ifndef HOST_DHT_H
+#define HOST_DHT_H
+
+#include "Arduino.h"
+
+#define DHT11 11
+#define DHT22 22
+
+// Stand-in for the DHT sensor, the readings follow the simulated weather
+class DHT {
+public:
+    DHT(uint8_t pin, uint8_t type) {
+        (void)pin;
+        (void)type;
+    }
+
+    void begin() {}
+    float readTemperature(bool fahrenheit = false, bool force = false);
+    float readHumidity(bool force = false);
+};
+
+#endif // HOST_DHT_H
@@ -0,0 +1,245 @@
+#include "HostRuntime.h"
+
+#include <sys/stat.h>
+#include "Arduino.h"
+#include "Wire.h"
+#include "SD.h"
+#include "SPI.h"
+#include "DHT.h"
+#include "BH1750.h"
+#include "esp_sntp.h"
+#include "TimeUtils.h"
+
+#define HOST_DS3231_ADDRESS 0x68
+#define HOST_DS3231_REGISTERS 0x13
+#define HOST_CARD_SIZE (8ULL * 1024 * 1024 * 1024)
+
+/*
+* The DS3231 keeps its own time from the start epoch, running rtcDriftPpm faster
+* than millis(). A write of the time registers sets it, the fraction of the
+* second starts over like on the chip. The other registers read back what was
+* written.
+*/
+class Ds3231Device : public I2cDevice {
+public:
+    Ds3231Device() : pointer_(0), setAtMicros_(0), setToMicros_(0) {
+        memset(registers_, 0, sizeof(registers_));
+    }
+
+    void reset(uint32_t epoch) {
+        setAtMicros_ = host::nowMicros();
+        setToMicros_ = (uint64_t)epoch * 1000000;
+    }
+
+    uint32_t epoch() const {
+        double elapsed = (double)(host::nowMicros() - setAtMicros_) * (1.0 + host::config().rtcDriftPpm * 1e-6);
+        return (uint32_t)((setToMicros_ + (uint64_t)elapsed) / 1000000);
+    }
+
+    void receive(const uint8_t* data, size_t length) override {
+        if (length == 0) {
+            return;
+        }
+        pointer_ = data[0] % HOST_DS3231_REGISTERS;
+        if (length == 1) {
+            return;
+        }
+        bool timeWritten = pointer_ == 0 && length - 1 >= 7;
+        for (size_t i = 1; i < length; i++) {
+            registers_[pointer_] = data[i];
+            pointer_ = (pointer_ + 1) % HOST_DS3231_REGISTERS;
+        }
+        if (timeWritten) {
+            CivilTime civil;
+            civil.second = fromBcd(registers_[0] & 0x7F);
+            civil.minute = fromBcd(registers_[1] & 0x7F);
+            civil.hour = fromBcd(registers_[2] & 0x3F);
+            civil.day = fromBcd(registers_[4] & 0x3F);
+            civil.month = fromBcd(registers_[5] & 0x1F);
+            civil.year = 2000 + fromBcd(registers_[6]) + ((registers_[5] & 0x80) ? 100 : 0);
+            reset(epochFromCivil(civil));
+        }
+    }
+
+    size_t send(uint8_t* data, size_t length) override {
+        CivilTime civil = civilFromEpoch(epoch());
+        registers_[0] = toBcd(civil.second);
+        registers_[1] = toBcd(civil.minute);
+        registers_[2] = toBcd(civil.hour);
+        registers_[3] = (uint8_t)((dayNumber(epoch()) + 4) % 7 + 1);
+        registers_[4] = toBcd(civil.day);
+        registers_[5] = toBcd(civil.month) | (civil.year >= 2100 ? 0x80 : 0);
+        registers_[6] = toBcd(civil.year % 100);
+        for (size_t i = 0; i < length; i++) {
+            data[i] = registers_[pointer_];
+            pointer_ = (pointer_ + 1) % HOST_DS3231_REGISTERS;
+        }
+        return length;
+    }
+
+private:
+    uint8_t registers_[HOST_DS3231_REGISTERS];
+    uint8_t pointer_;
+    uint64_t setAtMicros_;
+    uint64_t setToMicros_;
+
+    static uint8_t toBcd(uint8_t value) { return (uint8_t)(((value / 10) << 4) | (value % 10)); }
+    static uint8_t fromBcd(uint8_t value) { return (uint8_t)((value >> 4) * 10 + (value & 0x0F)); }
+};
+
+static Ds3231Device ds3231_;
+
+namespace host {
+
+void attachDevices() {
+    ds3231_.reset(config().startEpoch);
+    Wire.attach(HOST_DS3231_ADDRESS, &ds3231_);
+}
+
+uint32_t rtcEpoch() {
+    return ds3231_.epoch();
+}
+
+} // namespace host
+
+TwoWire Wire;
+
+TwoWire::TwoWire() : address_(0), txLength_(0), rxLength_(0), rxPosition_(0), transactions_(0) {
+    for (int i = 0; i < 128; i++) {
+        devices_[i] = nullptr;
+    }
+}
+
+bool TwoWire::begin() {
+    return true;
+}
+
+void TwoWire::attach(uint8_t address, I2cDevice* device) {
+    devices_[address & 0x7F] = device;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    address_ = address & 0x7F;
+    txLength_ = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+    (void)sendStop;
+    transactions_++;
+    I2cDevice* device = devices_[address_];
+    if (device == nullptr) {
+        return 2;   // NACK on the address
+    }
+    device->receive(tx_, txLength_);
+    txLength_ = 0;
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool sendStop) {
+    (void)sendStop;
+    transactions_++;
+    rxLength_ = 0;
+    rxPosition_ = 0;
+    I2cDevice* device = devices_[address & 0x7F];
+    if (device == nullptr) {
+        return 0;
+    }
+    rxLength_ = device->send(rx_, min((size_t)quantity, sizeof(rx_)));
+    return (uint8_t)rxLength_;
+}
+
+size_t TwoWire::write(uint8_t c) {
+    if (txLength_ >= sizeof(tx_)) {
+        return 0;
+    }
+    tx_[txLength_++] = c;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && write(buffer[n]) == 1) {
+        n++;
+    }
+    return n;
+}
+
+int TwoWire::available() {
+    return (int)(rxLength_ - rxPosition_);
+}
+
+int TwoWire::read() {
+    return rxPosition_ < rxLength_ ? rx_[rxPosition_++] : -1;
+}
+
+int TwoWire::peek() {
+    return rxPosition_ < rxLength_ ? rx_[rxPosition_] : -1;
+}
+
+/*
+* The weather follows the real time of day rather than the RTC, with the
+* warmest and driest hour at 15:00 and daylight from 06:00 to 18:00.
+*/
+static double hourOfDay() {
+    uint64_t seconds = host::config().startEpoch + host::nowMicros() / 1000000;
+    return (double)(seconds % SECONDS_PER_DAY) / 3600.0;
+}
+
+static double noise(double amplitude) {
+    return amplitude * ((double)(host::nextRandom() % 2001) / 1000.0 - 1.0);
+}
+
+float DHT::readTemperature(bool fahrenheit, bool force) {
+    (void)force;
+    host::stats().temperatureReads++;
+    double celsius = 21.0 + 6.0 * sin(2 * M_PI * (hourOfDay() - 9.0) / 24.0) + noise(0.2);
+    return (float)(fahrenheit ? celsius * 9.0 / 5.0 + 32.0 : celsius);
+}
+
+float DHT::readHumidity(bool force) {
+    (void)force;
+    host::stats().humidityReads++;
+    return (float)(60.0 - 15.0 * sin(2 * M_PI * (hourOfDay() - 9.0) / 24.0) + noise(0.5));
+}
+
+float BH1750::readLightLevel() {
+    host::stats().lightReads++;
+    double daylight = sin(M_PI * (hourOfDay() - 6.0) / 12.0);
+    return (float)(daylight > 0 ? 40000.0 * daylight + noise(50.0) : 0.0);
+}
+
+fs::SDFS SD;
+
+bool fs::SDFS::begin(uint8_t ssPin) {
+    (void)ssPin;
+    char path[HOST_SD_ROOT_LENGTH];
+    snprintf(path, sizeof(path), "%s", host::config().sdRoot);
+    // create the missing parents of the card directory too
+    for (char* slash = strchr(path + 1, '/'); slash != nullptr; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        ::mkdir(path, 0755);
+        *slash = '/';
+    }
+    ::mkdir(path, 0755);
+    setRoot(path);
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+uint8_t fs::SDFS::cardType() {
+    return CARD_SDHC;
+}
+
+uint64_t fs::SDFS::cardSize() {
+    return HOST_CARD_SIZE;
+}
+
+uint64_t fs::SDFS::totalBytes() {
+    return HOST_CARD_SIZE;
+}
+
+SPIClass SPI;
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {
+    (void)callback;
+}
@@ -0,0 +1,331 @@
+#include "FS.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <new>
+
+namespace fs {
+
+#define HOST_PATH_LENGTH 512
+
+/*
+* The state of an open file lives outside the counted heap, so the heap figures
+* show what the firmware allocates and not the length of the host paths.
+*/
+template <typename T>
+struct UncountedAllocator {
+    typedef T value_type;
+
+    UncountedAllocator() {}
+    template <typename U>
+    UncountedAllocator(const UncountedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        T* block = (T*)malloc(n * sizeof(T));
+        if (block == nullptr) {
+            throw std::bad_alloc();
+        }
+        return block;
+    }
+    void deallocate(T* block, size_t) { free(block); }
+
+    template <typename U>
+    bool operator==(const UncountedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const UncountedAllocator<U>&) const { return false; }
+};
+
+struct FileImpl {
+    FILE* file = nullptr;
+    DIR* dir = nullptr;
+    FS* owner = nullptr;                // the card the file is on
+    char path[HOST_PATH_LENGTH];        // as the firmware sees it, from the root of the card
+    char hostPath[HOST_PATH_LENGTH];
+
+    FileImpl(const char* path, const char* hostPath) {
+        snprintf(this->path, sizeof(this->path), "%s", path);
+        snprintf(this->hostPath, sizeof(this->hostPath), "%s", hostPath);
+    }
+
+    ~FileImpl() {
+        if (file != nullptr) {
+            fclose(file);
+        }
+        if (dir != nullptr) {
+            closedir(dir);
+        }
+    }
+};
+
+size_t File::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+    if (impl_ == nullptr || impl_->file == nullptr) {
+        return 0;
+    }
+    if (impl_->owner->capacity() > 0) {
+        // what is buffered counts against the capacity
+        fflush(impl_->file);
+        size = impl_->owner->reserve(size);
+    }
+    return impl_->owner->countWrite(size > 0 ? fwrite(buffer, 1, size, impl_->file) : 0);
+}
+
+int File::available() {
+    if (impl_ == nullptr || impl_->file == nullptr) {
+        return 0;
+    }
+    long position = ftell(impl_->file);
+    struct stat st;
+    fflush(impl_->file);
+    if (position < 0 || fstat(fileno(impl_->file), &st) != 0) {
+        return 0;
+    }
+    return st.st_size > position ? (int)(st.st_size - position) : 0;
+}
+
+int File::read() {
+    if (impl_ == nullptr || impl_->file == nullptr) {
+        return -1;
+    }
+    int c = fgetc(impl_->file);
+    return c == EOF ? -1 : c;
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+    if (impl_ == nullptr || impl_->file == nullptr) {
+        return 0;
+    }
+    return fread(buffer, 1, size, impl_->file);
+}
+
+int File::peek() {
+    int c = read();
+    if (c >= 0) {
+        ungetc(c, impl_->file);
+    }
+    return c;
+}
+
+void File::flush() {
+    if (impl_ != nullptr && impl_->file != nullptr) {
+        fflush(impl_->file);
+    }
+}
+
+bool File::seek(uint32_t position) {
+    return impl_ != nullptr && impl_->file != nullptr && fseek(impl_->file, position, SEEK_SET) == 0;
+}
+
+size_t File::position() const {
+    if (impl_ == nullptr || impl_->file == nullptr) {
+        return 0;
+    }
+    long position = ftell(impl_->file);
+    return position > 0 ? (size_t)position : 0;
+}
+
+size_t File::size() const {
+    struct stat st;
+    if (impl_ == nullptr || stat(impl_->hostPath, &st) != 0) {
+        return 0;
+    }
+    if (impl_->file != nullptr) {
+        fflush(impl_->file);
+        fstat(fileno(impl_->file), &st);
+    }
+    return (size_t)st.st_size;
+}
+
+void File::close() {
+    impl_.reset();
+}
+
+const char* File::name() const {
+    if (impl_ == nullptr) {
+        return "";
+    }
+    const char* slash = strrchr(impl_->path, '/');
+    return (slash != nullptr && slash[1] != '\0') ? slash + 1 : impl_->path;
+}
+
+const char* File::path() const {
+    return impl_ != nullptr ? impl_->path : "";
+}
+
+bool File::isDirectory() const {
+    return impl_ != nullptr && impl_->dir != nullptr;
+}
+
+File File::openNextFile(const char* mode) {
+    if (impl_ == nullptr || impl_->dir == nullptr) {
+        return File();
+    }
+    struct dirent* entry;
+    while ((entry = readdir(impl_->dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char hostPath[HOST_PATH_LENGTH];
+        char path[HOST_PATH_LENGTH];
+        size_t length = strlen(impl_->path);
+        int hostLength = snprintf(hostPath, sizeof(hostPath), "%s/%s", impl_->hostPath, entry->d_name);
+        int pathLength = snprintf(path, sizeof(path), "%s%s%s", impl_->path,
+                                  (length > 0 && impl_->path[length - 1] == '/') ? "" : "/", entry->d_name);
+        if (hostLength < 0 || hostLength >= (int)sizeof(hostPath) || pathLength < 0 ||
+            pathLength >= (int)sizeof(path)) {
+            continue;
+        }
+
+        std::shared_ptr<FileImpl> next = std::allocate_shared<FileImpl>(UncountedAllocator<FileImpl>(), path, hostPath);
+        next->owner = impl_->owner;
+        struct stat st;
+        if (stat(hostPath, &st) == 0 && S_ISDIR(st.st_mode)) {
+            next->dir = opendir(hostPath);
+        } else {
+            next->file = fopen(hostPath, strcmp(mode, FILE_READ) == 0 ? "rb" : "ab+");
+        }
+        return File(next);
+    }
+    return File();
+}
+
+FS::FS(const char* root) : capacity_(0), writeCount_(0), writtenBytes_(0) {
+    setRoot(root);
+}
+
+void FS::setRoot(const char* root) {
+    snprintf(root_, sizeof(root_), "%s", root);
+    size_t length = strlen(root_);
+    if (length > 0 && root_[length - 1] == '/') {
+        root_[length - 1] = '\0';
+    }
+}
+
+const char* FS::root() const {
+    return root_;
+}
+
+void FS::hostPath(const char* path, char* out, size_t size) const {
+    snprintf(out, size, "%s%s%s", root_, path[0] == '/' ? "" : "/", path);
+}
+
+File FS::open(const char* path, const char* mode, bool create) {
+    char host[HOST_PATH_LENGTH];
+    hostPath(path, host, sizeof(host));
+
+    std::shared_ptr<FileImpl> impl = std::allocate_shared<FileImpl>(UncountedAllocator<FileImpl>(), path, host);
+    impl->owner = this;
+
+    struct stat st;
+    bool exists = stat(host, &st) == 0;
+    if (exists && S_ISDIR(st.st_mode)) {
+        impl->dir = opendir(host);
+        return impl->dir != nullptr ? File(impl) : File();
+    }
+    if (strcmp(mode, FILE_READ) == 0) {
+        impl->file = exists ? fopen(host, "rb") : nullptr;
+    } else {
+        // writing creates the file as on the device, create is about missing parent
+        // directories there and they are never missing here
+        (void)create;
+        impl->file = fopen(host, strcmp(mode, FILE_APPEND) == 0 ? "ab+" : "wb+");
+    }
+    return impl->file != nullptr ? File(impl) : File();
+}
+
+bool FS::exists(const char* path) {
+    char host[HOST_PATH_LENGTH];
+    hostPath(path, host, sizeof(host));
+    struct stat st;
+    return stat(host, &st) == 0;
+}
+
+bool FS::remove(const char* path) {
+    char host[HOST_PATH_LENGTH];
+    hostPath(path, host, sizeof(host));
+    return unlink(host) == 0;
+}
+
+bool FS::rename(const char* from, const char* to) {
+    char hostFrom[HOST_PATH_LENGTH];
+    char hostTo[HOST_PATH_LENGTH];
+    hostPath(from, hostFrom, sizeof(hostFrom));
+    hostPath(to, hostTo, sizeof(hostTo));
+    return ::rename(hostFrom, hostTo) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+    char host[HOST_PATH_LENGTH];
+    hostPath(path, host, sizeof(host));
+    return ::mkdir(host, 0755) == 0;
+}
+
+bool FS::rmdir(const char* path) {
+    char host[HOST_PATH_LENGTH];
+    hostPath(path, host, sizeof(host));
+    return ::rmdir(host) == 0;
+}
+
+static uint64_t directoryBytes(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir == nullptr) {
+        return 0;
+    }
+    uint64_t total = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char child[HOST_PATH_LENGTH];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (stat(child, &st) != 0) {
+            continue;
+        }
+        total += S_ISDIR(st.st_mode) ? directoryBytes(child) : (uint64_t)st.st_size;
+    }
+    closedir(dir);
+    return total;
+}
+
+uint64_t FS::usedBytes() {
+    return directoryBytes(root_);
+}
+
+void FS::setCapacity(uint64_t bytes) {
+    capacity_ = bytes;
+}
+
+uint64_t FS::capacity() const {
+    return capacity_;
+}
+
+size_t FS::reserve(size_t size) {
+    if (capacity_ == 0) {
+        return size;
+    }
+    uint64_t used = usedBytes();
+    uint64_t room = used < capacity_ ? capacity_ - used : 0;
+    return room < size ? (size_t)room : size;
+}
+
+size_t FS::countWrite(size_t written) {
+    writeCount_++;
+    writtenBytes_ += written;
+    return written;
+}
+
+unsigned long FS::writeCount() const {
+    return writeCount_;
+}
+
+uint64_t FS::writtenBytes() const {
+    return writtenBytes_;
+}
+
+} // namespace fs
@@ -0,0 +1,95 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <memory>
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+struct FileImpl;
+
+/*
+* Stand-in for the ESP32 fs::File, backed by a file or directory of the host.
+* Copies share the open file, which is closed with the last one, as on the device.
+*/
+class File : public Stream {
+public:
+    File() {}
+    explicit File(std::shared_ptr<FileImpl> impl) : impl_(impl) {}
+
+    explicit operator bool() const { return impl_ != nullptr; }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    size_t read(uint8_t* buffer, size_t size);
+    using Stream::read;
+    int peek() override;
+    void flush() override;
+    bool seek(uint32_t position);
+    size_t position() const;
+    size_t size() const;
+    void close();
+
+    const char* name() const;
+    const char* path() const;
+    bool isDirectory() const;
+    File openNextFile(const char* mode = FILE_READ);
+
+private:
+    std::shared_ptr<FileImpl> impl_;
+};
+
+/*
+* A directory of the host seen as the root of the card, so the backlog of one
+* simulation can be inspected or reused by the next.
+*/
+class FS {
+public:
+    explicit FS(const char* root = "");
+
+    void setRoot(const char* root);
+    const char* root() const;
+
+    File open(const char* path, const char* mode = FILE_READ, bool create = false);
+    bool exists(const char* path);
+    bool remove(const char* path);
+    bool rename(const char* from, const char* to);
+    bool mkdir(const char* path);
+    bool rmdir(const char* path);
+
+    // Bytes taken by the files under the root
+    uint64_t usedBytes();
+
+    // Writes past capacity bytes are cut short as on a full card, 0 for no limit
+    void setCapacity(uint64_t bytes);
+    uint64_t capacity() const;
+    // What a write of size bytes gets to write on a card with a capacity, and
+    // counting what it wrote, both called by File
+    size_t reserve(size_t size);
+    size_t countWrite(size_t written);
+
+    // Write calls and the bytes they wrote, what wears the card
+    unsigned long writeCount() const;
+    uint64_t writtenBytes() const;
+
+private:
+    char root_[256];
+    uint64_t capacity_;
+    unsigned long writeCount_;
+    uint64_t writtenBytes_;
+
+    void hostPath(const char* path, char* out, size_t size) const;
+};
+
+} // namespace fs
+
+using fs::File;
+
+#endif // HOST_FS_H
@@ -0,0 +1,413 @@
+#include "HostRuntime.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "SD.h"
+
+namespace host {
+
+static Config config_ = {
+    24ULL * 3600 * 1000,    // durationMs
+    1,                      // seed
+    1717200000,             // startEpoch, 2024-06-01T00:00:00
+    0.0,                    // rtcDriftPpm
+    0,                      // serialBaud
+    false,                  // echoSerial
+    "sim-sd",               // sdRoot
+    201,                    // serverStatus
+    150,                    // requestMs
+    true,                   // inspectBodies
+    nullptr,                // serverHandler
+    {},
+    0,
+    {},
+    0
+};
+static Stats stats_ = {};
+static uint64_t now_ = 0;
+static uint32_t random_ = 1;
+
+// kept outside the heap they count, the counters must not allocate
+static size_t heapInUse_ = 0;
+static size_t heapPeak_ = 0;
+static unsigned long heapAllocations_ = 0;
+static unsigned long heapLiveBlocks_ = 0;
+
+// The simulated layout, live blocks in address order with their overhead
+struct PlacedBlock {
+    size_t offset;
+    size_t size;
+};
+static PlacedBlock placed_[HOST_HEAP_MAX_BLOCKS];
+static size_t placedCount_ = 0;
+static size_t minLargestFree_ = HOST_HEAP_SIZE - HOST_HEAP_BLOCK_OVERHEAD;
+
+static size_t largestFree() {
+    size_t largest = 0;
+    size_t end = 0;
+    for (size_t i = 0; i < placedCount_; i++) {
+        largest = std::max(largest, placed_[i].offset - end);
+        end = placed_[i].offset + placed_[i].size;
+    }
+    largest = std::max(largest, (size_t)HOST_HEAP_SIZE - end);
+    return largest > HOST_HEAP_BLOCK_OVERHEAD ? largest - HOST_HEAP_BLOCK_OVERHEAD : 0;
+}
+
+/*
+* Puts a block in the first gap it fits, as the ESP32 heap does.
+* @return its offset, or HOST_HEAP_SIZE if the heap or the table is full
+*/
+static size_t placeBlock(size_t size) {
+    size_t needed = HOST_HEAP_BLOCK_OVERHEAD + ((size + 3) & ~(size_t)3);
+    if (placedCount_ == HOST_HEAP_MAX_BLOCKS) {
+        return HOST_HEAP_SIZE;
+    }
+    size_t end = 0;
+    size_t at = 0;
+    while (at < placedCount_ && placed_[at].offset - end < needed) {
+        end = placed_[at].offset + placed_[at].size;
+        at++;
+    }
+    if (at == placedCount_ && HOST_HEAP_SIZE - end < needed) {
+        return HOST_HEAP_SIZE;
+    }
+    memmove(&placed_[at + 1], &placed_[at], (placedCount_ - at) * sizeof(PlacedBlock));
+    placed_[at].offset = end;
+    placed_[at].size = needed;
+    placedCount_++;
+    minLargestFree_ = std::min(minLargestFree_, largestFree());
+    return end;
+}
+
+static void releaseBlock(size_t offset) {
+    if (offset >= HOST_HEAP_SIZE) {
+        return;
+    }
+    size_t low = 0;
+    size_t high = placedCount_;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (placed_[middle].offset < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < placedCount_ && placed_[low].offset == offset) {
+        memmove(&placed_[low], &placed_[low + 1], (placedCount_ - low - 1) * sizeof(PlacedBlock));
+        placedCount_--;
+    }
+}
+
+Config& config() {
+    return config_;
+}
+
+Stats& stats() {
+    return stats_;
+}
+
+HeapUsage heap() {
+    HeapUsage usage = {heapInUse_, heapPeak_, heapAllocations_, heapLiveBlocks_, largestFree(), minLargestFree_};
+    return usage;
+}
+
+void resetHeapPeak() {
+    heapPeak_ = heapInUse_;
+    minLargestFree_ = largestFree();
+}
+
+uint64_t nowMicros() {
+    return now_;
+}
+
+void advance(uint64_t micros) {
+    uint64_t minute = now_ / 60000000;
+    now_ += micros;
+    if (now_ / 60000000 != minute) {
+        stats_.sdPeakBytes = max(stats_.sdPeakBytes, SD.usedBytes());
+    }
+    WiFi.simulate(millis());
+    if (now_ / 1000 >= config_.durationMs) {
+        throw SimulationEnd();
+    }
+}
+
+static bool inside(const Window* windows, int count) {
+    uint64_t now = now_ / 1000;
+    for (int i = 0; i < count; i++) {
+        if (now >= windows[i].start && now < windows[i].end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool linkAvailable() {
+    return !inside(config_.wifiOutages, config_.wifiOutageCount);
+}
+
+bool serverAvailable() {
+    return linkAvailable() && !inside(config_.serverOutages, config_.serverOutageCount);
+}
+
+/*
+* Record timestamps are taken on the RTC timeline, drift and time zone aside that
+* is the start epoch plus the simulated time.
+*/
+static void noteDrain(const Window* windows, int count, uint64_t* drainedAt, uint64_t stampedMs, uint64_t now) {
+    for (int i = 0; i < count; i++) {
+        if (stampedMs < windows[i].end && now >= windows[i].end) {
+            drainedAt[i] = max(drainedAt[i], now);
+        }
+    }
+}
+
+void recordDelivered(uint32_t epoch) {
+    uint64_t now = now_ / 1000;
+    uint64_t stampedMs = epoch > config_.startEpoch ? (uint64_t)(epoch - config_.startEpoch) * 1000 : 0;
+    if (now > stampedMs) {
+        stats_.maxDeliveryDelayMs = max(stats_.maxDeliveryDelayMs, now - stampedMs);
+    }
+    noteDrain(config_.wifiOutages, config_.wifiOutageCount, stats_.wifiDrainedAt, stampedMs, now);
+    noteDrain(config_.serverOutages, config_.serverOutageCount, stats_.serverDrainedAt, stampedMs, now);
+}
+
+uint32_t nextRandom() {
+    random_ ^= random_ << 13;
+    random_ ^= random_ >> 17;
+    random_ ^= random_ << 5;
+    return random_;
+}
+
+// in Devices.cpp
+void attachDevices();
+
+void begin() {
+    random_ = config_.seed != 0 ? config_.seed : 1;
+    attachDevices();
+}
+
+} // namespace host
+
+/*
+* Heap accounting: every block carries its size and its place in the simulated
+* heap in front of it so delete can take it off the count and the layout.
+*/
+static const size_t HEAP_HEADER = alignof(std::max_align_t);
+static_assert(HEAP_HEADER >= 2 * sizeof(size_t), "the header holds the size and the offset");
+
+static void* countedAlloc(size_t size) {
+    unsigned char* block = (unsigned char*)malloc(size + HEAP_HEADER);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    ((size_t*)block)[0] = size;
+    ((size_t*)block)[1] = host::placeBlock(size);
+    host::heapInUse_ += size;
+    host::heapAllocations_++;
+    host::heapLiveBlocks_++;
+    if (host::heapInUse_ > host::heapPeak_) {
+        host::heapPeak_ = host::heapInUse_;
+    }
+    return block + HEAP_HEADER;
+}
+
+static void countedFree(void* pointer) {
+    if (pointer == nullptr) {
+        return;
+    }
+    unsigned char* block = (unsigned char*)pointer - HEAP_HEADER;
+    host::heapInUse_ -= ((size_t*)block)[0];
+    host::heapLiveBlocks_--;
+    host::releaseBlock(((size_t*)block)[1]);
+    free(block);
+}
+
+void* operator new(size_t size) {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+    return countedAlloc(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return countedAlloc(size);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return countedAlloc(size);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* pointer) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    countedFree(pointer);
+}
+
+unsigned long millis() {
+    return (unsigned long)(host::nowMicros() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)host::nowMicros();
+}
+
+void delay(unsigned long ms) {
+    host::advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    host::advance(us);
+}
+
+void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    (void)pin;
+    (void)value;
+}
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud) {
+    (void)baud;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    host::Config& config = host::config();
+    host::stats().serialBytes += size;
+    if (config.echoSerial) {
+        fwrite(buffer, 1, size, stdout);
+    }
+    if (config.serialBaud > 0) {
+        // 10 bits per byte on the wire, the driver blocks until they are out
+        host::advance((uint64_t)size * 10 * 1000000 / config.serialBaud);
+    }
+    return size;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size-- > 0) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) {
+        return 0;
+    }
+    if ((size_t)length < sizeof(text)) {
+        return write((const uint8_t*)text, length);
+    }
+    // like the ESP32 core, a long line goes through a temporary buffer
+    char* longText = new char[length + 1];
+    va_start(args, format);
+    vsnprintf(longText, length + 1, format, args);
+    va_end(args);
+    size_t n = write((const uint8_t*)longText, length);
+    delete[] longText;
+    return n;
+}
+
+size_t Print::print(long value, int base) {
+    return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long value, int base) {
+    return print(String(value, (unsigned char)base));
+}
+
+size_t Print::print(double value, int digits) {
+    char text[64];
+    int length = snprintf(text, sizeof(text), "%.*f", digits, value);
+    return write(text, length);
+}
+
+EspClass ESP;
+
+uint32_t EspClass::getHeapSize() {
+    return HOST_HEAP_SIZE;
+}
+
+uint32_t EspClass::getFreeHeap() {
+    size_t used = host::heap().inUse;
+    return used < HOST_HEAP_SIZE ? (uint32_t)(HOST_HEAP_SIZE - used) : 0;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    size_t peak = host::heap().peak;
+    return peak < HOST_HEAP_SIZE ? (uint32_t)(HOST_HEAP_SIZE - peak) : 0;
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+    return (uint32_t)host::heap().largestFree;
+}
+
+void EspClass::restart() {
+    throw host::RestartRequested();
+}
+
+uint32_t esp_random() {
+    return host::nextRandom();
+}
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1, const char* server2,
+                const char* server3) {
+    (void)gmtOffsetSec;
+    (void)daylightOffsetSec;
+    (void)server1;
+    (void)server2;
+    (void)server3;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stackDepth, void* parameters,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    (void)task;
+    (void)stackDepth;
+    (void)parameters;
+    (void)priority;
+    (void)handle;
+    (void)core;
+    fprintf(stderr, "Task %s cannot run on the host, build the sketch with DUAL_CORE 0\n", name);
+    abort();
+}
@@ -0,0 +1,127 @@
+#ifndef HOST_RUNTIME_H
+#define HOST_RUNTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HOST_HEAP_SIZE 327680UL         // B, internal RAM heap of an ESP32 without PSRAM
+#define HOST_HEAP_BLOCK_OVERHEAD 8      // B, header of every block in that heap
+#define HOST_HEAP_MAX_BLOCKS 16384      // live blocks laid out in it, past this they are only counted
+#define HOST_MAX_WINDOWS 16
+#define HOST_WIFI_ASSOCIATION_MS 3000   // from WiFi.begin to connected once the access point is up
+#define HOST_SD_ROOT_LENGTH 256
+
+/*
+* Controls the simulation behind the Arduino stand-ins: the clock, the network,
+* the API server, the RTC and the weather the sensors see. The firmware does not
+* include this, only the simulator does. Everything runs on one thread.
+*/
+namespace host {
+
+// Thrown out of delay() once the simulated time is up, it unwinds loop()
+struct SimulationEnd {};
+
+// Thrown by ESP.restart()
+struct RestartRequested {};
+
+// A span of simulated time, in ms from the start
+struct Window {
+    uint64_t start;
+    uint64_t end;
+};
+
+// What the mock API server answers to a request that reached it
+struct Response {
+    int status;
+    const char* body;                   // nullptr for an empty body, read until the next request
+    bool close;                         // the server closes the connection once it answered
+};
+
+// Answers in place of serverStatus, gets the request body (inflated if gzip)
+typedef Response (*ServerHandler)(const char* body, size_t length);
+
+struct Config {
+    uint64_t durationMs;
+    uint32_t seed;
+    uint32_t startEpoch;                // RTC wall clock at the start
+    double rtcDriftPpm;                 // how much faster the RTC runs than millis()
+    unsigned long serialBaud;           // 0: printing takes no time
+    bool echoSerial;
+    char sdRoot[HOST_SD_ROOT_LENGTH];   // host directory the card is kept in
+    int serverStatus;                   // answer to every request that reaches the server
+    unsigned long requestMs;            // round trip of a request
+    bool inspectBodies;                 // the mock server reads the records out of the bodies
+    ServerHandler serverHandler;        // nullptr: every request gets serverStatus
+    Window wifiOutages[HOST_MAX_WINDOWS];
+    int wifiOutageCount;
+    Window serverOutages[HOST_MAX_WINDOWS];
+    int serverOutageCount;
+};
+
+struct Stats {
+    unsigned long serialBytes;
+    unsigned long associations;
+    unsigned long linkLosses;
+    unsigned long connections;          // connections opened to the API server
+    unsigned long requests;
+    unsigned long refusedRequests;      // the link or the server was down
+    unsigned long compressedRequests;
+    unsigned long brokerConnections;    // MQTT sessions opened with the mock broker
+    unsigned long publishes;            // QoS 1 PUBLISH packets the broker acknowledged
+    unsigned long maxInflight;          // most publishes the broker had not acknowledged yet
+    unsigned long deliveredRecords;     // records in accepted bodies
+    unsigned long corruptBodies;        // gzip bodies the server could not inflate
+    uint64_t bodyBytes;
+    unsigned long temperatureReads;
+    unsigned long humidityReads;
+    unsigned long lightReads;
+    // Drain of every outage window: when the server last got a record stamped
+    // before the window ended, 0 if none came in after it
+    uint64_t wifiDrainedAt[HOST_MAX_WINDOWS];
+    uint64_t serverDrainedAt[HOST_MAX_WINDOWS];
+    uint64_t maxDeliveryDelayMs;        // longest a record took from its timestamp to the server
+    uint64_t sdPeakBytes;               // sampled once a simulated minute
+};
+
+/*
+* Every operator new of the process, stand-ins included. The blocks are also laid
+* out first fit in a heap of HOST_HEAP_SIZE, so the largest free block shows how
+* fragmented the ESP32 heap would be after the same calls.
+*/
+struct HeapUsage {
+    size_t inUse;
+    size_t peak;
+    unsigned long allocations;
+    unsigned long liveBlocks;       // allocated and not freed yet, grows if the heap fragments
+    size_t largestFree;             // largest block that could be allocated now, as ESP.getMaxAllocHeap
+    size_t minLargestFree;          // lowest it was since the start or resetHeapPeak
+};
+
+Config& config();
+Stats& stats();
+HeapUsage heap();
+// Starts the peak and the lowest largest free block over from what is in use now
+void resetHeapPeak();
+
+// Attaches the simulated devices, call once the config is set and before setup()
+void begin();
+
+uint64_t nowMicros();
+// Moves the clock, throws SimulationEnd once the duration is over
+void advance(uint64_t micros);
+
+bool linkAvailable();
+bool serverAvailable();
+// The server forgets the open connections without closing them (half-open): the
+// client still sees them connected and the next request on each times out
+void dropConnections();
+// What the simulated DS3231 shows now
+uint32_t rtcEpoch();
+// The mock server took a record with this timestamp, in RTC seconds
+void recordDelivered(uint32_t epoch);
+// Deterministic for a seed, behind esp_random()
+uint32_t nextRandom();
+
+} // namespace host
+
+#endif // HOST_RUNTIME_H
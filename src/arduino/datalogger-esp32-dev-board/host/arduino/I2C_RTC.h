@@ -0,0 +1,23 @@
+#ifndef HOST_I2C_RTC_H
+#define HOST_I2C_RTC_H
+
+#include "Arduino.h"
+#include "Wire.h"
+
+#define CLOCK_H12 1
+#define CLOCK_H24 0
+
+// The part of the I2C_RTC library still in use, the DS3231 is read by Ds3231Clock
+struct DateTime {
+    int year;
+    int month;
+    int day;
+    int hours;
+    int minutes;
+    int seconds;
+
+    DateTime(int year, int month, int day, int hours, int minutes, int seconds)
+        : year(year), month(month), day(day), hours(hours), minutes(minutes), seconds(seconds) {}
+};
+
+#endif // HOST_I2C_RTC_H
@@ -0,0 +1,628 @@
+#include "WiFi.h"
+#include "ArduinoHttpClient.h"
+#include "HostRuntime.h"
+#include "TimeUtils.h"
+
+#define HOST_CONNECT_MS 30          // TCP handshake with the API server or the broker
+#define HOST_MQTT_PORT 1883
+#define HOST_BROKER_REPLIES 64      // answers of the broker on their way back
+
+// the packet types the mock broker understands, upper nibble of the first byte
+#define MQTT_HOST_CONNECT 0x10
+#define MQTT_HOST_CONNACK 0x20
+#define MQTT_HOST_PUBLISH 0x30
+#define MQTT_HOST_PUBACK 0x40
+#define MQTT_HOST_PINGREQ 0xC0
+#define MQTT_HOST_PINGRESP 0xD0
+#define HOST_RECORD_MARKER "\"variable\""
+#define HOST_DATETIME_MARKER "\"datetime\": \""
+
+/*
+* The mock server keeps the body of a request and reads the records out of it at
+* the end, inflating gzip bodies first. Only stored and fixed Huffman blocks are
+* understood, which is all GzipEncoder writes. The buffers come from malloc so
+* they stay out of the heap figures of the firmware.
+*/
+struct HostBuffer {
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+};
+
+static HostBuffer body_ = {nullptr, 0, 0};
+static HostBuffer inflated_ = {nullptr, 0, 0};
+
+// Bumped by host::dropConnections, connections opened before it are half-open
+static unsigned long serverGeneration_ = 0;
+
+void host::dropConnections() {
+    serverGeneration_++;
+}
+
+static bool append(HostBuffer& buffer, const uint8_t* data, size_t length) {
+    if (buffer.length + length > buffer.capacity) {
+        size_t capacity = max(buffer.capacity * 2, buffer.length + length + 1024);
+        uint8_t* grown = (uint8_t*)realloc(buffer.data, capacity);
+        if (grown == nullptr) {
+            return false;
+        }
+        buffer.data = grown;
+        buffer.capacity = capacity;
+    }
+    memcpy(buffer.data + buffer.length, data, length);
+    buffer.length += length;
+    return true;
+}
+
+struct BitReader {
+    const uint8_t* data;
+    size_t length;
+    size_t position;    // in bits
+    bool overrun;
+
+    unsigned bits(int count) {
+        unsigned value = 0;
+        for (int i = 0; i < count; i++) {
+            if (position / 8 >= length) {
+                overrun = true;
+                return 0;
+            }
+            value |= ((data[position / 8] >> (position % 8)) & 1u) << i;
+            position++;
+        }
+        return value;
+    }
+
+    // Huffman codes are packed from their most significant bit
+    unsigned code(int count) {
+        unsigned value = 0;
+        for (int i = 0; i < count; i++) {
+            value = (value << 1) | bits(1);
+        }
+        return value;
+    }
+};
+
+static int fixedSymbol(BitReader& in) {
+    unsigned code = in.code(7);
+    if (code <= 0x17) {
+        return 256 + code;
+    }
+    code = (code << 1) | in.bits(1);
+    if (code >= 0x30 && code <= 0xBF) {
+        return code - 0x30;
+    }
+    if (code >= 0xC0 && code <= 0xC7) {
+        return 280 + code - 0xC0;
+    }
+    code = (code << 1) | in.bits(1);
+    return 144 + code - 0x190;
+}
+
+static bool inflate(const uint8_t* data, size_t length, HostBuffer& out) {
+    static const uint16_t lengthBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t lengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t distanceBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                            193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                            6145, 8193, 12289, 16385, 24577};
+    static const uint8_t distanceExtra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                            6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    // a 10 byte header without optional fields and an 8 byte trailer
+    if (length < 18 || data[0] != 0x1F || data[1] != 0x8B || data[2] != 8 || data[3] != 0) {
+        return false;
+    }
+    out.length = 0;
+    BitReader in = {data + 10, length - 18, 0, false};
+    bool last = false;
+    while (!last) {
+        last = in.bits(1) != 0;
+        unsigned type = in.bits(2);
+        if (type == 0) {
+            in.position = (in.position + 7) / 8 * 8;
+            unsigned size = in.bits(16);
+            in.bits(16);
+            for (unsigned i = 0; i < size; i++) {
+                uint8_t c = (uint8_t)in.bits(8);
+                append(out, &c, 1);
+            }
+        } else if (type == 1) {
+            while (true) {
+                int symbol = fixedSymbol(in);
+                if (in.overrun || symbol > 285) {
+                    return false;
+                }
+                if (symbol < 256) {
+                    uint8_t c = (uint8_t)symbol;
+                    append(out, &c, 1);
+                    continue;
+                }
+                if (symbol == 256) {
+                    break;
+                }
+                unsigned matchLength = lengthBase[symbol - 257] + in.bits(lengthExtra[symbol - 257]);
+                unsigned distanceCode = in.code(5);
+                if (distanceCode >= 30) {
+                    return false;
+                }
+                unsigned distance = distanceBase[distanceCode] + in.bits(distanceExtra[distanceCode]);
+                if (distance > out.length) {
+                    return false;
+                }
+                for (unsigned i = 0; i < matchLength; i++) {
+                    uint8_t c = out.data[out.length - distance];
+                    append(out, &c, 1);
+                }
+            }
+        } else {
+            return false;
+        }
+        if (in.overrun) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const uint8_t* find(const uint8_t* from, const uint8_t* end, const char* marker) {
+    size_t length = strlen(marker);
+    for (; from + length <= end; from++) {
+        if (memcmp(from, marker, length) == 0) {
+            return from;
+        }
+    }
+    return nullptr;
+}
+
+/*
+* Counts the records of a body and hands the timestamp of each to the runtime,
+* which works out how long the backlog of an outage took to drain.
+*/
+static unsigned long readRecords(const uint8_t* data, size_t length, bool deliver) {
+    const uint8_t* end = data + length;
+    unsigned long records = 0;
+    const uint8_t* record = find(data, end, HOST_RECORD_MARKER);
+    while (record != nullptr) {
+        records++;
+        const uint8_t* next = find(record + 1, end, HOST_RECORD_MARKER);
+        const uint8_t* datetime = find(record, next != nullptr ? next : end, HOST_DATETIME_MARKER);
+        uint32_t epoch;
+        if (deliver && datetime != nullptr) {
+            datetime += strlen(HOST_DATETIME_MARKER);
+            if (datetime + ISO_TIMESTAMP_LENGTH <= end &&
+                parseIsoTimestamp((const char*)datetime, ISO_TIMESTAMP_LENGTH, epoch)) {
+                host::recordDelivered(epoch);
+            }
+        }
+        record = next;
+    }
+    return records;
+}
+
+WiFiClass WiFi;
+
+WiFiClass::WiFiClass()
+    : started_(false), connected_(false), startedAt_(0), linkWasAvailable_(true), availableSince_(0),
+      handlerCount_(0) {}
+
+wl_status_t WiFiClass::begin(const char* ssid, const char* password) {
+    (void)ssid;
+    (void)password;
+    if (!started_) {
+        started_ = true;
+        startedAt_ = millis();
+    }
+    return status();
+}
+
+wl_status_t WiFiClass::status() {
+    if (connected_) {
+        return WL_CONNECTED;
+    }
+    return started_ ? WL_DISCONNECTED : WL_IDLE_STATUS;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp) {
+    (void)wifiOff;
+    (void)eraseAp;
+    bool wasConnected = connected_;
+    started_ = false;
+    connected_ = false;
+    if (wasConnected) {
+        fire(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    }
+    return true;
+}
+
+IPAddress WiFiClass::localIP() {
+    return connected_ ? IPAddress(192, 168, 1, 50) : IPAddress();
+}
+
+int WiFiClass::onEvent(WiFiEventFuncCb callback, arduino_event_id_t event) {
+    if (handlerCount_ >= MAX_HANDLERS) {
+        return -1;
+    }
+    handlers_[handlerCount_] = callback;
+    handlerEvents_[handlerCount_] = event;
+    return handlerCount_++;
+}
+
+void WiFiClass::simulate(unsigned long now) {
+    bool available = host::linkAvailable();
+    if (available && !linkWasAvailable_) {
+        availableSince_ = now;
+    }
+    linkWasAvailable_ = available;
+
+    if (connected_ && !available) {
+        connected_ = false;
+        host::stats().linkLosses++;
+        // the station keeps trying on its own, like the ESP32 with auto reconnect
+        startedAt_ = now;
+        fire(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+        return;
+    }
+    if (started_ && !connected_ && available) {
+        unsigned long since = max(startedAt_, availableSince_);
+        if (now - since >= HOST_WIFI_ASSOCIATION_MS) {
+            connected_ = true;
+            host::stats().associations++;
+            fire(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+            fire(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+        }
+    }
+}
+
+void WiFiClass::fire(arduino_event_id_t event) {
+    arduino_event_info_t info;
+    info.unused = 0;
+    for (int i = 0; i < handlerCount_; i++) {
+        if (handlerEvents_[i] == event || handlerEvents_[i] == ARDUINO_EVENT_MAX) {
+            handlers_[i](event, info);
+        }
+    }
+}
+
+/*
+* The mock broker behind the socket connected to HOST_MQTT_PORT. It reads the
+* packets the client writes, takes the records out of every QoS 1 PUBLISH like
+* the API server does, and queues its answers to come back a round trip
+* (requestMs) later, so the publishes pipelined by the client share one. There is
+* one session, a new connection replaces the previous one. While the server is
+* down the connection is reset, after host::dropConnections it is half-open and
+* nothing comes back.
+*/
+struct BrokerReply {
+    uint64_t dueMs;
+    uint8_t bytes[4];
+    uint8_t length;
+};
+
+static HostBuffer brokerIn_ = {nullptr, 0, 0};
+static BrokerReply brokerReplies_[HOST_BROKER_REPLIES];
+static size_t brokerHead_ = 0;          // oldest reply
+static size_t brokerCount_ = 0;
+static size_t brokerPosition_ = 0;      // bytes of the oldest reply already read
+static unsigned long brokerSession_ = 0;
+static unsigned long brokerGeneration_ = 0;
+
+static void brokerReply(uint8_t type, uint16_t packetId) {
+    if (brokerCount_ == HOST_BROKER_REPLIES) {
+        return;
+    }
+    BrokerReply& reply = brokerReplies_[(brokerHead_ + brokerCount_++) % HOST_BROKER_REPLIES];
+    reply.dueMs = millis() + host::config().requestMs;
+    reply.bytes[0] = type;
+    reply.bytes[1] = (type == MQTT_HOST_CONNACK || type == MQTT_HOST_PUBACK) ? 2 : 0;
+    reply.bytes[2] = packetId >> 8;
+    reply.bytes[3] = packetId & 0xFF;
+    reply.length = 2 + reply.bytes[1];
+    if (type == MQTT_HOST_CONNACK) {
+        // no session present, accepted
+        reply.bytes[2] = 0;
+        reply.bytes[3] = 0;
+    }
+}
+
+static size_t brokerPendingAcks() {
+    size_t acks = 0;
+    for (size_t i = 0; i < brokerCount_; i++) {
+        if (brokerReplies_[(brokerHead_ + i) % HOST_BROKER_REPLIES].bytes[0] == MQTT_HOST_PUBACK) {
+            acks++;
+        }
+    }
+    return acks;
+}
+
+// Handles one whole packet, the fixed header included
+static void brokerPacket(const uint8_t* packet, size_t header, size_t length) {
+    host::Stats& stats = host::stats();
+    uint8_t type = packet[0] & 0xF0;
+    const uint8_t* body = packet + header;
+    if (type == MQTT_HOST_CONNECT) {
+        brokerReply(MQTT_HOST_CONNACK, 0);
+    } else if (type == MQTT_HOST_PUBLISH && length >= 2) {
+        size_t topicLength = (body[0] << 8) | body[1];
+        bool qos1 = ((packet[0] >> 1) & 3) == 1;
+        size_t payload = 2 + topicLength + (qos1 ? 2 : 0);
+        if (payload > length) {
+            return;
+        }
+        stats.bodyBytes += length - payload;
+        if (host::config().inspectBodies) {
+            stats.deliveredRecords += readRecords(body + payload, length - payload, true);
+        }
+        if (qos1) {
+            brokerReply(MQTT_HOST_PUBACK, (body[2 + topicLength] << 8) | body[3 + topicLength]);
+            stats.publishes++;
+            stats.maxInflight = max(stats.maxInflight, (unsigned long)brokerPendingAcks());
+        }
+    } else if (type == MQTT_HOST_PINGREQ) {
+        brokerReply(MQTT_HOST_PINGRESP, 0);
+    }
+}
+
+// Handles the whole packets gathered so far and keeps the incomplete one
+static void brokerRead() {
+    size_t used = 0;
+    while (used + 2 <= brokerIn_.length) {
+        const uint8_t* packet = brokerIn_.data + used;
+        size_t length = 0;
+        size_t header = 1;
+        int shift = 0;
+        bool complete = false;
+        while (used + header < brokerIn_.length && header <= 4) {
+            uint8_t digit = packet[header++];
+            length |= (size_t)(digit & 0x7F) << shift;
+            shift += 7;
+            if ((digit & 0x80) == 0) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete || used + header + length > brokerIn_.length) {
+            break;
+        }
+        brokerPacket(packet, header, length);
+        used += header + length;
+    }
+    memmove(brokerIn_.data, brokerIn_.data + used, brokerIn_.length - used);
+    brokerIn_.length -= used;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+    (void)host;
+    stop();
+    if (WiFi.status() != WL_CONNECTED) {
+        return 0;
+    }
+    if (port != HOST_MQTT_PORT) {
+        connected_ = true;
+        return 1;
+    }
+    delay(HOST_CONNECT_MS);
+    if (!host::serverAvailable()) {
+        return 0;
+    }
+    connected_ = true;
+    session_ = ++brokerSession_;
+    brokerGeneration_ = serverGeneration_;
+    brokerIn_.length = 0;
+    brokerCount_ = 0;
+    brokerPosition_ = 0;
+    host::stats().brokerConnections++;
+    return 1;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port, int32_t timeout) {
+    (void)timeout;
+    return connect(host, port);
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+    if (!connected()) {
+        return 0;
+    }
+    if (session_ != 0 && brokerGeneration_ == serverGeneration_) {
+        append(brokerIn_, buffer, size);
+        brokerRead();
+    }
+    return size;
+}
+
+int WiFiClient::available() {
+    if (!connected() || session_ == 0 || brokerGeneration_ != serverGeneration_) {
+        return 0;
+    }
+    int ready = 0;
+    for (size_t i = 0; i < brokerCount_; i++) {
+        const BrokerReply& reply = brokerReplies_[(brokerHead_ + i) % HOST_BROKER_REPLIES];
+        if (reply.dueMs > millis()) {
+            break;
+        }
+        ready += reply.length;
+    }
+    return ready - (int)brokerPosition_;
+}
+
+int WiFiClient::peek() {
+    if (available() <= 0) {
+        return -1;
+    }
+    return brokerReplies_[brokerHead_].bytes[brokerPosition_];
+}
+
+int WiFiClient::read() {
+    int value = peek();
+    if (value < 0) {
+        return -1;
+    }
+    if (++brokerPosition_ == brokerReplies_[brokerHead_].length) {
+        brokerHead_ = (brokerHead_ + 1) % HOST_BROKER_REPLIES;
+        brokerCount_--;
+        brokerPosition_ = 0;
+    }
+    return value;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+    size_t count = 0;
+    while (count < size) {
+        int value = read();
+        if (value < 0) {
+            break;
+        }
+        buffer[count++] = (uint8_t)value;
+    }
+    return count > 0 ? (int)count : -1;
+}
+
+void WiFiClient::stop() {
+    connected_ = false;
+    session_ = 0;
+}
+
+uint8_t WiFiClient::connected() {
+    if (connected_ && WiFi.status() != WL_CONNECTED) {
+        stop();
+    }
+    // the broker went away and reset the connection, a half-open one still looks fine
+    if (session_ != 0 && (session_ != brokerSession_ ||
+                          (!host::serverAvailable() && brokerGeneration_ == serverGeneration_))) {
+        stop();
+    }
+    return connected_ ? 1 : 0;
+}
+
+HttpClient::HttpClient(Client& client, const char* host, uint16_t port)
+    : connected_(false), compressed_(false), status_(0), bodyBytes_(0), records_(0), generation_(0),
+      response_(nullptr), responseLength_(0), responsePosition_(0) {
+    (void)client;
+    (void)host;
+    (void)port;
+}
+
+HttpClient::HttpClient(Client& client, const String& host, uint16_t port)
+    : HttpClient(client, host.c_str(), port) {}
+
+void HttpClient::beginRequest() {
+    compressed_ = false;
+    status_ = 0;
+    bodyBytes_ = 0;
+    records_ = 0;
+    body_.length = 0;
+    response_ = nullptr;
+    responseLength_ = 0;
+    responsePosition_ = 0;
+}
+
+int HttpClient::post(const char* path) {
+    (void)path;
+    if (!connected_ && connect(nullptr, 0) == 0) {
+        return HTTP_ERROR_CONNECTION_FAILED;
+    }
+    return HTTP_SUCCESS;
+}
+
+void HttpClient::sendHeader(const char* name, const char* value) {
+    if (strcmp(name, "Content-Encoding") == 0 && strcmp(value, "gzip") == 0) {
+        compressed_ = true;
+    }
+}
+
+void HttpClient::sendHeader(const char* name, int value) {
+    (void)name;
+    (void)value;
+}
+
+void HttpClient::endRequest() {
+    host::Stats& stats = host::stats();
+    stats.requests++;
+    // the server answers only if it is still there once the request is through
+    const host::Config& config = host::config();
+    delay(config.requestMs);
+    // a half-open connection looks fine until nothing comes back
+    if (!connected() || !host::serverAvailable() || generation_ != serverGeneration_) {
+        connected_ = false;
+        stats.refusedRequests++;
+        status_ = HTTP_ERROR_TIMED_OUT;
+        return;
+    }
+    stats.bodyBytes += bodyBytes_;
+    if (compressed_) {
+        stats.compressedRequests++;
+    }
+
+    const HostBuffer* text = &body_;
+    if (compressed_ && (config.inspectBodies || config.serverHandler != nullptr)) {
+        text = inflate(body_.data, body_.length, inflated_) ? &inflated_ : nullptr;
+        if (text == nullptr) {
+            stats.corruptBodies++;
+        }
+    }
+
+    host::Response response = {config.serverStatus, nullptr, false};
+    if (config.serverHandler != nullptr) {
+        response = config.serverHandler(text != nullptr ? (const char*)text->data : "", text != nullptr ? text->length : 0);
+    }
+    status_ = response.status;
+    response_ = response.body;
+    responseLength_ = response.body != nullptr ? strlen(response.body) : 0;
+    if (response.close) {
+        connected_ = false;
+    }
+
+    bool accepted = status_ >= 200 && status_ < 300;
+    if (config.inspectBodies && text != nullptr) {
+        records_ = readRecords(text->data, text->length, accepted);
+    }
+    if (accepted) {
+        stats.deliveredRecords += records_;
+    }
+}
+
+int HttpClient::read(uint8_t* buffer, size_t size) {
+    size_t length = min(size, responseLength_ - responsePosition_);
+    if (length == 0) {
+        return -1;
+    }
+    memcpy(buffer, response_ + responsePosition_, length);
+    responsePosition_ += length;
+    return (int)length;
+}
+
+int HttpClient::responseStatusCode() {
+    return status_ != 0 ? status_ : HTTP_ERROR_API;
+}
+
+int HttpClient::connect(const char* host, uint16_t port) {
+    (void)host;
+    (void)port;
+    if (WiFi.status() != WL_CONNECTED || !host::serverAvailable()) {
+        delay(HOST_CONNECT_MS);
+        return 0;
+    }
+    delay(HOST_CONNECT_MS);
+    connected_ = true;
+    generation_ = serverGeneration_;
+    host::stats().connections++;
+    return 1;
+}
+
+size_t HttpClient::write(const uint8_t* buffer, size_t size) {
+    if (!connected()) {
+        return 0;
+    }
+    bodyBytes_ += size;
+    append(body_, buffer, size);
+    return size;
+}
+
+uint8_t HttpClient::connected() {
+    if (connected_ && WiFi.status() != WL_CONNECTED) {
+        connected_ = false;
+    }
+    return connected_ ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+
+class Print;
+
+// Objects that know how to print themselves, e.g. IPAddress
+class Printable {
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print& output) const = 0;
+};
+
+/*
+* Stand-in for the Arduino Print: everything ends up in write(const uint8_t*, size_t),
+* which subclasses may override to take whole buffers at once.
+*/
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    size_t write(const char* text) { return text != nullptr ? write(text, strlen(text)) : 0; }
+    virtual void flush() {}
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const String& text) { return write(text.c_str(), text.length()); }
+    size_t print(const char* text) { return write(text); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(long long value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned long long value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(double value, int digits = 2);
+    size_t print(const Printable& value) { return value.printTo(*this); }
+
+    size_t println() { return write("\r\n", 2); }
+    template <typename T>
+    size_t println(const T& value) {
+        size_t n = print(value);
+        return n + println();
+    }
+    template <typename T>
+    size_t println(const T& value, int format) {
+        size_t n = print(value, format);
+        return n + println();
+    }
+};
+
+#endif // HOST_PRINT_H
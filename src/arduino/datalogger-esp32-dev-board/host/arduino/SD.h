@@ -0,0 +1,28 @@
+#ifndef HOST_SD_H
+#define HOST_SD_H
+
+#include "FS.h"
+
+#define CARD_NONE 0
+#define CARD_MMC 1
+#define CARD_SD 2
+#define CARD_SDHC 3
+#define CARD_UNKNOWN 4
+
+namespace fs {
+
+// The card, its root is the directory set by the simulation
+class SDFS : public FS {
+public:
+    bool begin(uint8_t ssPin = 5);
+    void end() {}
+    uint8_t cardType();
+    uint64_t cardSize();
+    uint64_t totalBytes();
+};
+
+} // namespace fs
+
+extern fs::SDFS SD;
+
+#endif // HOST_SD_H
@@ -0,0 +1,43 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include "Print.h"
+
+// Stand-in for the Arduino Stream, reads never wait
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { (void)timeout; }
+
+    size_t readBytes(char* buffer, size_t length) {
+        size_t n = 0;
+        int c;
+        while (n < length && (c = read()) >= 0) {
+            buffer[n++] = (char)c;
+        }
+        return n;
+    }
+
+    size_t readBytesUntil(char terminator, char* buffer, size_t length) {
+        size_t n = 0;
+        int c;
+        while (n < length && (c = read()) >= 0 && c != terminator) {
+            buffer[n++] = (char)c;
+        }
+        return n;
+    }
+
+    String readStringUntil(char terminator) {
+        String text;
+        int c;
+        while ((c = read()) >= 0 && c != terminator) {
+            text.concat((char)c);
+        }
+        return text;
+    }
+};
+
+#endif // HOST_STREAM_H
@@ -0,0 +1,319 @@
+#include "WString.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+String::String() : heap_(nullptr), capacity_(INLINE_CAPACITY), length_(0) {
+    inline_[0] = '\0';
+}
+
+String::String(const char* text) : String() {
+    if (text != nullptr) {
+        assign(text, strlen(text));
+    }
+}
+
+String::String(const char* text, size_t length) : String() {
+    assign(text, length);
+}
+
+String::String(const String& other) : String() {
+    assign(other.c_str(), other.length_);
+}
+
+String::String(String&& other) noexcept : String() {
+    *this = static_cast<String&&>(other);
+}
+
+String::String(char c) : String() {
+    assign(&c, 1);
+}
+
+static void formatInteger(String& out, unsigned long value, bool negative, unsigned char base) {
+    char digits[66];
+    int n = sizeof(digits);
+    digits[--n] = '\0';
+    do {
+        unsigned digit = value % base;
+        digits[--n] = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value > 0);
+    if (negative) {
+        digits[--n] = '-';
+    }
+    out = digits + n;
+}
+
+String::String(int value, unsigned char base) : String((long)value, base) {}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {}
+
+String::String(long value, unsigned char base) : String() {
+    bool negative = value < 0 && base == 10;
+    formatInteger(*this, negative ? 0UL - (unsigned long)value : (unsigned long)value, negative, base);
+}
+
+String::String(unsigned long value, unsigned char base) : String() {
+    formatInteger(*this, value, false, base);
+}
+
+String::String(float value, unsigned int decimals) : String((double)value, decimals) {}
+
+String::String(double value, unsigned int decimals) : String() {
+    char text[64];
+    snprintf(text, sizeof(text), "%.*f", (int)decimals, value);
+    assign(text, strlen(text));
+}
+
+String::~String() {
+    release();
+}
+
+String& String::operator=(const String& other) {
+    if (this != &other) {
+        assign(other.c_str(), other.length_);
+    }
+    return *this;
+}
+
+String& String::operator=(String&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    if (other.heap_ == nullptr) {
+        assign(other.inline_, other.length_);
+    } else {
+        release();
+        heap_ = other.heap_;
+        capacity_ = other.capacity_;
+        length_ = other.length_;
+        other.heap_ = nullptr;
+        other.capacity_ = INLINE_CAPACITY;
+    }
+    other.length_ = 0;
+    other.inline_[0] = '\0';
+    return *this;
+}
+
+String& String::operator=(const char* text) {
+    assign(text != nullptr ? text : "", text != nullptr ? strlen(text) : 0);
+    return *this;
+}
+
+bool String::reserve(size_t size) {
+    if (size <= capacity_) {
+        return true;
+    }
+    char* grown = new char[size + 1];
+    memcpy(grown, buffer(), length_ + 1);
+    delete[] heap_;
+    heap_ = grown;
+    capacity_ = size;
+    return true;
+}
+
+void String::assign(const char* text, size_t length) {
+    if (length > capacity_) {
+        // nothing to keep, so the old buffer goes before the new one is taken
+        release();
+        heap_ = new char[length + 1];
+        capacity_ = length;
+    }
+    memmove(buffer(), text, length);
+    length_ = length;
+    buffer()[length_] = '\0';
+}
+
+void String::release() {
+    delete[] heap_;
+    heap_ = nullptr;
+    capacity_ = INLINE_CAPACITY;
+}
+
+bool String::concat(const char* text, size_t length) {
+    if (text == nullptr) {
+        return false;
+    }
+    if (length_ + length > capacity_) {
+        // the text may point into this string
+        size_t offset = (size_t)(text - buffer());
+        bool inside = text >= buffer() && text < buffer() + length_;
+        reserve(length_ + length);
+        if (inside) {
+            text = buffer() + offset;
+        }
+    }
+    memmove(buffer() + length_, text, length);
+    length_ += length;
+    buffer()[length_] = '\0';
+    return true;
+}
+
+bool String::concat(const char* text) {
+    return text != nullptr && concat(text, strlen(text));
+}
+
+bool String::concat(const String& other) {
+    return concat(other.c_str(), other.length_);
+}
+
+bool String::concat(char c) {
+    return concat(&c, 1);
+}
+
+bool String::concat(int value) {
+    return concat(String(value));
+}
+
+bool String::concat(unsigned int value) {
+    return concat(String(value));
+}
+
+bool String::concat(long value) {
+    return concat(String(value));
+}
+
+bool String::concat(unsigned long value) {
+    return concat(String(value));
+}
+
+bool String::concat(float value) {
+    return concat(String(value));
+}
+
+bool String::concat(double value) {
+    return concat(String(value));
+}
+
+bool String::equals(const char* text) const {
+    return strcmp(c_str(), text != nullptr ? text : "") == 0;
+}
+
+bool String::equals(const String& other) const {
+    return length_ == other.length_ && memcmp(c_str(), other.c_str(), length_) == 0;
+}
+
+bool String::operator<(const String& other) const {
+    return strcmp(c_str(), other.c_str()) < 0;
+}
+
+char String::charAt(size_t index) const {
+    return index < length_ ? buffer()[index] : '\0';
+}
+
+int String::indexOf(char c, size_t from) const {
+    if (from >= length_) {
+        return -1;
+    }
+    const char* found = (const char*)memchr(buffer() + from, c, length_ - from);
+    return found != nullptr ? (int)(found - buffer()) : -1;
+}
+
+int String::indexOf(const char* text, size_t from) const {
+    if (from > length_) {
+        return -1;
+    }
+    const char* found = strstr(buffer() + from, text);
+    return found != nullptr ? (int)(found - buffer()) : -1;
+}
+
+int String::lastIndexOf(char c) const {
+    const char* found = strrchr(buffer(), c);
+    return found != nullptr ? (int)(found - buffer()) : -1;
+}
+
+bool String::startsWith(const char* prefix) const {
+    size_t length = strlen(prefix);
+    return length <= length_ && memcmp(buffer(), prefix, length) == 0;
+}
+
+bool String::endsWith(const char* suffix) const {
+    size_t length = strlen(suffix);
+    return length <= length_ && memcmp(buffer() + length_ - length, suffix, length) == 0;
+}
+
+String String::substring(size_t from) const {
+    return substring(from, length_);
+}
+
+String String::substring(size_t from, size_t to) const {
+    if (from > to) {
+        size_t swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from >= length_) {
+        return String();
+    }
+    if (to > length_) {
+        to = length_;
+    }
+    return String(buffer() + from, to - from);
+}
+
+void String::remove(size_t index) {
+    if (index < length_) {
+        remove(index, length_ - index);
+    }
+}
+
+void String::remove(size_t index, size_t count) {
+    if (index >= length_) {
+        return;
+    }
+    if (count > length_ - index) {
+        count = length_ - index;
+    }
+    memmove(buffer() + index, buffer() + index + count, length_ - index - count + 1);
+    length_ -= count;
+}
+
+void String::trim() {
+    size_t start = 0;
+    while (start < length_ && (buffer()[start] == ' ' || (buffer()[start] >= '\t' && buffer()[start] <= '\r'))) {
+        start++;
+    }
+    size_t end = length_;
+    while (end > start && (buffer()[end - 1] == ' ' || (buffer()[end - 1] >= '\t' && buffer()[end - 1] <= '\r'))) {
+        end--;
+    }
+    memmove(buffer(), buffer() + start, end - start);
+    length_ = end - start;
+    buffer()[length_] = '\0';
+}
+
+long String::toInt() const {
+    return atol(c_str());
+}
+
+float String::toFloat() const {
+    return (float)atof(c_str());
+}
+
+void String::toCharArray(char* out, size_t size) const {
+    if (size == 0) {
+        return;
+    }
+    size_t length = length_ < size - 1 ? length_ : size - 1;
+    memcpy(out, buffer(), length);
+    out[length] = '\0';
+}
+
+String operator+(const String& left, const String& right) {
+    String sum(left);
+    sum.concat(right);
+    return sum;
+}
+
+String operator+(const String& left, const char* right) {
+    String sum(left);
+    sum.concat(right);
+    return sum;
+}
+
+String operator+(const char* left, const String& right) {
+    String sum(left);
+    sum.concat(right);
+    return sum;
+}
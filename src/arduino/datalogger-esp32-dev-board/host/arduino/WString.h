@@ -0,0 +1,101 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* Stand-in for the Arduino String, with the part of its interface the firmware
+* uses. Like the ESP32 core it keeps short strings inline and puts longer ones
+* on the heap, so the heap accounting of the host runtime sees the same
+* allocations the device would make.
+*/
+class String {
+public:
+    String();
+    String(const char* text);
+    String(const char* text, size_t length);
+    String(const String& other);
+    String(String&& other) noexcept;
+    explicit String(char c);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(float value, unsigned int decimals = 2);
+    explicit String(double value, unsigned int decimals = 2);
+    ~String();
+
+    String& operator=(const String& other);
+    String& operator=(String&& other) noexcept;
+    String& operator=(const char* text);
+
+    bool reserve(size_t size);
+    size_t length() const { return length_; }
+    bool isEmpty() const { return length_ == 0; }
+    const char* c_str() const { return buffer(); }
+    char* begin() { return buffer(); }
+    char* end() { return buffer() + length_; }
+    const char* begin() const { return buffer(); }
+    const char* end() const { return buffer() + length_; }
+
+    bool concat(const char* text, size_t length);
+    bool concat(const char* text);
+    bool concat(const String& other);
+    bool concat(char c);
+    bool concat(int value);
+    bool concat(unsigned int value);
+    bool concat(long value);
+    bool concat(unsigned long value);
+    bool concat(float value);
+    bool concat(double value);
+
+    template <typename T>
+    String& operator+=(const T& value) {
+        concat(value);
+        return *this;
+    }
+
+    bool equals(const char* text) const;
+    bool equals(const String& other) const;
+    bool operator==(const char* text) const { return equals(text); }
+    bool operator==(const String& other) const { return equals(other); }
+    bool operator!=(const char* text) const { return !equals(text); }
+    bool operator!=(const String& other) const { return !equals(other); }
+    bool operator<(const String& other) const;
+
+    char charAt(size_t index) const;
+    char operator[](size_t index) const { return charAt(index); }
+    int indexOf(char c, size_t from = 0) const;
+    int indexOf(const char* text, size_t from = 0) const;
+    int lastIndexOf(char c) const;
+    bool startsWith(const char* prefix) const;
+    bool endsWith(const char* suffix) const;
+    String substring(size_t from) const;
+    String substring(size_t from, size_t to) const;
+    void remove(size_t index);
+    void remove(size_t index, size_t count);
+    void trim();
+    long toInt() const;
+    float toFloat() const;
+    void toCharArray(char* out, size_t size) const;
+
+private:
+    enum { INLINE_CAPACITY = 15 };
+
+    char* heap_;                        // nullptr while the text fits inline
+    size_t capacity_;
+    size_t length_;
+    char inline_[INLINE_CAPACITY + 1];
+
+    char* buffer() { return heap_ != nullptr ? heap_ : inline_; }
+    const char* buffer() const { return heap_ != nullptr ? heap_ : inline_; }
+    void assign(const char* text, size_t length);
+    void release();
+};
+
+String operator+(const String& left, const String& right);
+String operator+(const String& left, const char* right);
+String operator+(const char* left, const String& right);
+
+#endif // HOST_WSTRING_H
@@ -0,0 +1,116 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <functional>
+#include "Arduino.h"
+
+#define WL_IDLE_STATUS 0
+#define WL_NO_SSID_AVAIL 1
+#define WL_CONNECTED 3
+#define WL_CONNECT_FAILED 4
+#define WL_CONNECTION_LOST 5
+#define WL_DISCONNECTED 6
+
+typedef int wl_status_t;
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_STA_START = 2,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED = 4,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP = 7,
+    ARDUINO_EVENT_MAX = 64
+} arduino_event_id_t;
+
+typedef union {
+    int unused;
+} arduino_event_info_t;
+
+typedef std::function<void(arduino_event_id_t event, arduino_event_info_t info)> WiFiEventFuncCb;
+
+class IPAddress : public Printable {
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : bytes_{a, b, c, d} {}
+    size_t printTo(Print& output) const override {
+        return output.printf("%u.%u.%u.%u", bytes_[0], bytes_[1], bytes_[2], bytes_[3]);
+    }
+    uint8_t operator[](int index) const { return bytes_[index]; }
+
+private:
+    uint8_t bytes_[4];
+};
+
+class Client : public Stream {
+public:
+    virtual int connect(const char* host, uint16_t port) = 0;
+    virtual int read(uint8_t* buffer, size_t size) = 0;
+    using Stream::read;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+};
+
+/*
+* A socket on the simulated network. It connects while the link is up; the one
+* connected to HOST_MQTT_PORT talks to the mock broker of the host runtime, the
+* others have no peer behind them and never receive anything (the HTTP server is
+* reached through the HttpClient stand-in instead).
+*/
+class WiFiClient : public Client {
+public:
+    WiFiClient() : connected_(false), session_(0) {}
+
+    int connect(const char* host, uint16_t port) override;
+    int connect(const char* host, uint16_t port, int32_t timeout);
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    void stop() override;
+    uint8_t connected() override;
+
+private:
+    bool connected_;
+    unsigned long session_;     // broker session, 0 when not connected to the broker
+};
+
+/*
+* The station interface. Associating takes a few simulated seconds and fails
+* while the simulation has the access point down; losing the link fires the
+* STA_DISCONNECTED handlers, from within delay() like the WiFi task would.
+*/
+class WiFiClass {
+public:
+    WiFiClass();
+
+    wl_status_t begin(const char* ssid, const char* password = nullptr);
+    wl_status_t status();
+    bool isConnected() { return status() == WL_CONNECTED; }
+    bool disconnect(bool wifiOff = false, bool eraseAp = false);
+    IPAddress localIP();
+    int8_t RSSI() { return status() == WL_CONNECTED ? -60 : 0; }
+    void setAutoReconnect(bool autoReconnect) { (void)autoReconnect; }
+    int onEvent(WiFiEventFuncCb callback, arduino_event_id_t event = ARDUINO_EVENT_MAX);
+
+    // Called by the host runtime whenever the simulated time moves
+    void simulate(unsigned long now);
+
+private:
+    enum { MAX_HANDLERS = 4 };
+
+    bool started_;
+    bool connected_;
+    unsigned long startedAt_;
+    bool linkWasAvailable_;
+    unsigned long availableSince_;
+    WiFiEventFuncCb handlers_[MAX_HANDLERS];
+    arduino_event_id_t handlerEvents_[MAX_HANDLERS];
+    int handlerCount_;
+
+    void fire(arduino_event_id_t event);
+};
+
+extern WiFiClass WiFi;
+
+#endif // HOST_WIFI_H
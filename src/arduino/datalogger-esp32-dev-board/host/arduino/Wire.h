@@ -0,0 +1,60 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define I2C_BUFFER_LENGTH 128
+
+// A device on the simulated bus, see HostRuntime.h for the DS3231
+class I2cDevice {
+public:
+    virtual ~I2cDevice() {}
+    // bytes of one write transaction
+    virtual void receive(const uint8_t* data, size_t length) = 0;
+    // fills a read transaction, returns how many bytes the device sent
+    virtual size_t send(uint8_t* data, size_t length) = 0;
+};
+
+/*
+* Stand-in for the ESP32 TwoWire, transactions go to the device attached at
+* the address or fail with a NACK like an empty bus.
+*/
+class TwoWire : public Stream {
+public:
+    TwoWire();
+
+    bool begin();
+    void attach(uint8_t address, I2cDevice* device);
+
+    void beginTransmission(uint8_t address);
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    // like the ESP32 core, so write(0x00) is not ambiguous
+    size_t write(int n) { return write((uint8_t)n); }
+    size_t write(unsigned int n) { return write((uint8_t)n); }
+    size_t write(long n) { return write((uint8_t)n); }
+    size_t write(unsigned long n) { return write((uint8_t)n); }
+    int available() override;
+    int read() override;
+    int peek() override;
+
+    unsigned long transactions() const { return transactions_; }
+
+private:
+    I2cDevice* devices_[128];
+    uint8_t address_;
+    uint8_t tx_[I2C_BUFFER_LENGTH];
+    size_t txLength_;
+    uint8_t rx_[I2C_BUFFER_LENGTH];
+    size_t rxLength_;
+    size_t rxPosition_;
+    unsigned long transactions_;
+};
+
+extern TwoWire Wire;
+
+#endif // HOST_WIRE_H
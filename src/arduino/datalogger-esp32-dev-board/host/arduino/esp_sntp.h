@@ -0,0 +1,11 @@
+#ifndef HOST_ESP_SNTP_H
+#define HOST_ESP_SNTP_H
+
+#include <sys/time.h>
+
+// SNTP is not simulated, the callback is kept but never called
+typedef void (*sntp_sync_time_cb_t)(struct timeval* tv);
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+
+#endif // HOST_ESP_SNTP_H
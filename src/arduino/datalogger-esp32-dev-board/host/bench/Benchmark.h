@@ -0,0 +1,115 @@
+#ifndef HOST_BENCHMARK_H
+#define HOST_BENCHMARK_H
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include "HostRuntime.h"
+
+#define BENCH_MAX_RESULTS 64
+#define BENCH_NAME_LENGTH 64
+#define BENCH_DEFAULT_MIN_TIME_MS 200
+
+/*
+* Result of one benchmark. Wall time is host time and only good for comparing
+* runs on the same machine; allocations and the heap peak come from the host
+* runtime and match what the firmware does on the device. Simulated time is
+* what the operation spent in delay(), e.g. waiting for the API server.
+*/
+struct BenchmarkResult {
+    char name[BENCH_NAME_LENGTH];
+    unsigned long iterations;
+    double nsPerOp;
+    double simulatedUsPerOp;
+    double allocationsPerOp;
+    size_t heapPeakBytes;       // above what was in use before the run
+    unsigned long itemsPerOp;   // events or records one operation handles
+    double bytesPerItem;        // encoded size of one item, 0 when the benchmark encodes nothing
+};
+
+/*
+* Runs benchmarks and collects their results. The body is repeated, doubling the
+* count, until a batch takes at least the minimum time; only that batch counts.
+*/
+class BenchmarkRunner {
+public:
+    BenchmarkRunner() : count_(0), minTimeMs_(BENCH_DEFAULT_MIN_TIME_MS) {
+        filter_[0] = '\0';
+    }
+
+    void setFilter(const char* filter) { snprintf(filter_, sizeof(filter_), "%s", filter); }
+    void setMinTimeMs(unsigned long minTimeMs) { minTimeMs_ = minTimeMs; }
+
+    bool selected(const char* name) const {
+        return filter_[0] == '\0' || strstr(name, filter_) != nullptr;
+    }
+
+    template <typename Body>
+    void run(const char* name, unsigned long itemsPerOp, Body body, double bytesPerItem = 0) {
+        if (!selected(name) || count_ >= BENCH_MAX_RESULTS) {
+            return;
+        }
+        // once to warm up, the first run may open files or fill caches
+        body();
+
+        unsigned long iterations = 1;
+        while (true) {
+            host::HeapUsage before = host::heap();
+            host::resetHeapPeak();
+            uint64_t simulatedStart = host::nowMicros();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (unsigned long i = 0; i < iterations; i++) {
+                body();
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            host::HeapUsage after = host::heap();
+
+            if (ns >= minTimeMs_ * 1e6 || iterations >= (1UL << 30)) {
+                BenchmarkResult& result = results_[count_++];
+                snprintf(result.name, sizeof(result.name), "%s", name);
+                result.iterations = iterations;
+                result.nsPerOp = ns / iterations;
+                result.simulatedUsPerOp = (double)(host::nowMicros() - simulatedStart) / iterations;
+                result.allocationsPerOp = (double)(after.allocations - before.allocations) / iterations;
+                result.heapPeakBytes = after.peak > before.inUse ? after.peak - before.inUse : 0;
+                result.itemsPerOp = itemsPerOp;
+                result.bytesPerItem = bytesPerItem;
+                print(result);
+                return;
+            }
+            iterations *= 2;
+        }
+    }
+
+    void writeJson(FILE* out) const {
+        fprintf(out, "{\n  \"suite\": \"datalogger\",\n  \"results\": [\n");
+        for (size_t i = 0; i < count_; i++) {
+            const BenchmarkResult& result = results_[i];
+            fprintf(out,
+                    "    {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.1f, \"sim_us_per_op\": %.1f, "
+                    "\"allocs_per_op\": %.2f, \"heap_peak_bytes\": %zu, \"items_per_op\": %lu, \"bytes_per_item\": %.1f}%s\n",
+                    result.name, result.iterations, result.nsPerOp, result.simulatedUsPerOp, result.allocationsPerOp,
+                    result.heapPeakBytes, result.itemsPerOp, result.bytesPerItem, i + 1 < count_ ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+    }
+
+    size_t count() const { return count_; }
+
+private:
+    BenchmarkResult results_[BENCH_MAX_RESULTS];
+    size_t count_;
+    char filter_[BENCH_NAME_LENGTH];
+    unsigned long minTimeMs_;
+
+    static void print(const BenchmarkResult& result) {
+        fprintf(stderr, "%-36s %12.0f ns/op %10.0f sim us/op %8.2f allocs/op %8zu B peak", result.name,
+                result.nsPerOp, result.simulatedUsPerOp, result.allocationsPerOp, result.heapPeakBytes);
+        if (result.bytesPerItem > 0) {
+            fprintf(stderr, " %8.1f B/item", result.bytesPerItem);
+        }
+        fprintf(stderr, "\n");
+    }
+};
+
+#endif // HOST_BENCHMARK_H
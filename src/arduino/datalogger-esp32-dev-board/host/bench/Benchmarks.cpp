@@ -0,0 +1,717 @@
+/*
+* Benchmarks of the acquisition to upload path, run against the host stand-ins:
+* event serialization, sampling, the SD card formats, the pending buffer and the
+* API client. Progress goes to stderr and the results to stdout as JSON, or to
+* the file given with --json, so runs can be compared over time.
+*
+*   datalogger-bench --json bench.json --filter event_
+*/
+
+#include <ftw.h>
+#include <Arduino.h>
+#include <SD.h>
+#include "HostRuntime.h"
+#include "Benchmark.h"
+
+#include "CustomUtils.h"
+#include "EventLog.h"
+#include "EventBlockCodec.h"
+#include "SensorAdapters.h"
+#include "MeasurementQueue.h"
+#include "ConnectionEventManager.h"
+#include "EventBus.h"
+#include "Log.h"
+
+#define BENCH_START_EPOCH 1717243200    // 2024-06-01T12:00:00, daylight for the light sensor
+#define BENCH_FILE "/bench.txt"
+#define BENCH_SERIAL_BAUD 9600          // what the sketch opens the serial port at
+#define BENCH_SUBSCRIBERS 3
+
+// the logging benchmarks log through a module that is on and one that is compiled out
+#define LOG_LEVEL_BENCH LOG_LEVEL_DEBUG
+#define LOG_LEVEL_BENCH_OFF LOG_LEVEL_NONE
+
+static const int backlogSizes[] = {10, 100, 1000};
+
+static Event measurementEvent(uint32_t epoch) {
+    const MeasurementRecord records[] = {
+        makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 23.45f, epoch),
+        makeMeasurementRecord(HUMIDITY_VARIABLE, DEFAULT_CROP, 61.2f, epoch),
+        makeMeasurementRecord(VPD_VARIABLE, DEFAULT_CROP, 1.12f, epoch),
+        makeMeasurementRecord(DEWPOINT_VARIABLE, DEFAULT_CROP, 15.67f, epoch)};
+    return Event(OK_STATUS, records, MAX_RECORDS_PER_EVENT);
+}
+
+static Event timeEvent(uint32_t epoch) {
+    Event event(TIME_EVENT, OK_STATUS, "", "");
+    event.setEpoch(epoch);
+    return event;
+}
+
+static void fillEvents(Event* events, int count, uint32_t epoch) {
+    for (int i = 0; i < count; i++) {
+        events[i] = measurementEvent(epoch + i * 10);
+    }
+}
+
+static int removeEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void clearCard() {
+    nftw(host::config().sdRoot, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    SD.begin();
+}
+
+// Writes backlog files the way older firmware left them, /<timestamp>.txt
+static void writeBacklog(int files) {
+    Event events[MAX_EVENTS_PER_FILE];
+    fillEvents(events, MAX_EVENTS_PER_FILE, BENCH_START_EPOCH);
+    for (int i = 0; i < files; i++) {
+        char path[24];
+        snprintf(path, sizeof(path), "/%lu.txt", (unsigned long)(BENCH_START_EPOCH - i * 60));
+        File file = SD.open(path, FILE_WRITE);
+        for (int j = 0; j < MAX_EVENTS_PER_FILE; j++) {
+            events[j].printTo(file);
+        }
+        file.close();
+    }
+}
+
+static void benchEvents(BenchmarkRunner& runner) {
+    Event event = measurementEvent(BENCH_START_EPOCH);
+    String line = event.toString();
+
+    runner.run("event_to_string", 1, [&]() {
+        String text = event.toString();
+        (void)text;
+    });
+    runner.run("event_write_to", 1, [&]() {
+        CountingSink sink;
+        event.writeTo(sink);
+    });
+    runner.run("event_from_string", 1, [&]() {
+        Event parsed(line);
+        (void)parsed;
+    });
+    runner.run("event_round_trip", 1, [&]() {
+        Event parsed(event.toString());
+        if (parsed != event) {
+            fprintf(stderr, "event_round_trip: the event changed\n");
+        }
+    });
+}
+
+/*
+* The measurement event as it was before the records, the API payload built as a
+* String when sampling and kept in data_ next to the text timestamp.
+*/
+struct StringEvent {
+    int timesSent = 0;
+    int lastSentStatus = TO_BE_SENT_STATUS;
+    int type;
+    int statusCode;
+    String timestamp;
+    String data;
+};
+
+static StringEvent stringEvent(const Event& event) {
+    char json[512];
+    BufferSink sink(json, sizeof(json) - 1);
+    encodeMeasurements(sink, event.getRecords(), event.getRecordCount(), measurementDictionary());
+    json[sink.length()] = '\0';
+
+    StringEvent legacy;
+    legacy.type = MEASUREMENT_EVENT;
+    legacy.statusCode = OK_STATUS;
+    legacy.timestamp = event.getTimestamp();
+    legacy.data = json;
+    return legacy;
+}
+
+/*
+* A line of older firmware, with the API payload in data, read by the single pass
+* parser and by the indexOf/substring parsing Event(String) did before it, and a
+* line as toString writes it now, which only the single pass parser reads.
+*/
+static void benchLineParsing(BenchmarkRunner& runner) {
+    StringEvent legacy = stringEvent(measurementEvent(BENCH_START_EPOCH));
+    String line = "{\"type\":2,\"statusCode\":200,\"datetime\":\"" + legacy.timestamp + "\",\"data\":" + legacy.data +
+                  ",\"timesSent\":0}";
+    size_t fields = 0;
+
+    String current = measurementEvent(BENCH_START_EPOCH).toString();
+    runner.run("line_parse_records", 1, [&]() {
+        char buffer[EVENT_LINE_MAX_LENGTH];
+        memcpy(buffer, current.c_str(), current.length());
+        EventLine parsed;
+        if (parseEventLine(buffer, current.length(), parsed) == EVENT_LINE_OK) {
+            fields += parsed.numRecords;
+        }
+    });
+    runner.run("line_parse", 1, [&]() {
+        char buffer[EVENT_LINE_MAX_LENGTH];
+        memcpy(buffer, line.c_str(), line.length());
+        EventLine parsed;
+        if (parseEventLine(buffer, line.length(), parsed) == EVENT_LINE_OK) {
+            fields += parsed.dataLength;
+        }
+    });
+    runner.run("line_parse_substring", 1, [&]() {
+        int typeIndex = line.indexOf("\"type\":") + 7;
+        int statusCodeIndex = line.indexOf("\"statusCode\":") + 14;
+        int timestampIndex = line.indexOf("\"datetime\":\"") + 12;
+        int dataIndex = line.indexOf("\"data\":") + 7;
+        StringEvent parsed;
+        parsed.type = line.substring(typeIndex, line.indexOf(",", typeIndex)).toInt();
+        parsed.statusCode = line.substring(statusCodeIndex, line.indexOf(",", statusCodeIndex)).toInt();
+        parsed.timestamp = line.substring(timestampIndex, line.indexOf("\",", timestampIndex));
+        parsed.data = line.substring(dataIndex, line.indexOf("timesSent") - 2);
+        parsed.timesSent = line.substring(line.indexOf("timesSent") + 11,
+                                          line.indexOf("}", line.indexOf("timesSent"))).toInt();
+        fields += parsed.data.length();
+    });
+    if (runner.selected("line_parse") && fields == 0) {
+        fprintf(stderr, "line_parse: nothing was parsed\n");
+    }
+}
+
+// Copying a pending buffer worth of events, as the RAM buffer and the SD arrays do
+static void benchEventCopies(BenchmarkRunner& runner) {
+    const int count = MAX_EVENTS_PER_FILE;
+    Event event = measurementEvent(BENCH_START_EPOCH);
+    size_t records = 0;
+    runner.run("event_copy", count, [&]() {
+        for (int i = 0; i < count; i++) {
+            Event copy(event);
+            records += copy.getRecordCount();
+        }
+    });
+
+    StringEvent legacy = stringEvent(event);
+    size_t bytes = 0;
+    runner.run("event_copy_strings", count, [&]() {
+        for (int i = 0; i < count; i++) {
+            StringEvent copy(legacy);
+            bytes += copy.data.length();
+        }
+    });
+    // keeps the copies from being optimized away
+    if (runner.selected("event_copy") && records + bytes == 0) {
+        fprintf(stderr, "event_copy: nothing was copied\n");
+    }
+}
+
+/*
+* The body of a DHT reading: encoded into a buffer, and chained together from
+* String temporaries the way the adapters built it before the encoder.
+*/
+static void benchPayloads(BenchmarkRunner& runner) {
+    Event event = measurementEvent(BENCH_START_EPOCH);
+    const MeasurementRecord* records = event.getRecords();
+    const MeasurementDictionary& dictionary = measurementDictionary();
+    size_t bytes = 0;
+
+    runner.run("payload_encode/4", MAX_RECORDS_PER_EVENT, [&]() {
+        char body[512];
+        BufferSink sink(body, sizeof(body));
+        encodeMeasurements(sink, records, MAX_RECORDS_PER_EVENT, dictionary);
+        bytes += sink.length();
+    });
+    runner.run("payload_string_concat/4", MAX_RECORDS_PER_EVENT, [&]() {
+        const String timestamp = event.getTimestamp();
+        String items[MAX_RECORDS_PER_EVENT];
+        for (int i = 0; i < MAX_RECORDS_PER_EVENT; i++) {
+            items[i] = "{\"variable\": " + variableUiid(records[i].variableId) + ", \"value\": " +
+                       String(records[i].value) + ", \"crop\": " + CROP_UIID + ", \"datetime\": \"" + timestamp + "\"}";
+        }
+        const String data = "[" + items[0] + ", " + items[1] + ", " + items[2] + ", " + items[3] + "]";
+        bytes += data.length();
+    });
+    if (runner.selected("payload_") && bytes == 0) {
+        fprintf(stderr, "payload: nothing was encoded\n");
+    }
+}
+
+// The fields of an event as EventLog::writeEvent hands them to the block codec
+static void toEventLine(const Event& event, EventLine& line, char* timestamp) {
+    line.type = event.getType();
+    line.statusCode = event.getStatusCode();
+    line.timesSent = event.timesSent;
+    line.datetime = event.getTimestamp(timestamp, line.datetimeLength);
+    line.data = event.getData().c_str();
+    line.dataLength = event.getData().length();
+    line.numRecords = event.getRecordCount();
+    memcpy(line.records, event.getRecords(), line.numRecords * sizeof(MeasurementRecord));
+}
+
+/*
+* An event of four measurements in the two formats of the SD card: the binary
+* block of the event log and the text line of the older files, per measurement.
+*/
+static void benchCodec(BenchmarkRunner& runner) {
+    const int records = MAX_RECORDS_PER_EVENT;
+    Event event = measurementEvent(BENCH_START_EPOCH);
+    char timestamp[ISO_TIMESTAMP_BUFFER];
+    EventLine line;
+    toEventLine(event, line, timestamp);
+    size_t decoded = 0;
+
+    uint8_t block[EVENT_BLOCK_MAX_PAYLOAD + EVENT_BLOCK_OVERHEAD];
+    size_t blockLength = encodeEventBlock(line, block, sizeof(block));
+    runner.run("codec_block_encode/4", records, [&]() {
+        char text[ISO_TIMESTAMP_BUFFER];
+        EventLine fields;
+        toEventLine(event, fields, text);
+        uint8_t out[EVENT_BLOCK_MAX_PAYLOAD + EVENT_BLOCK_OVERHEAD];
+        decoded += encodeEventBlock(fields, out, sizeof(out)) > 0 ? 1 : 0;
+    }, (double)blockLength / records);
+
+    // the payload sits behind the magic and its length, the crc follows it
+    uint32_t payloadLength = 0;
+    const uint8_t* payload = block + 1 + readVarint(block + 1, blockLength - 1, payloadLength);
+    runner.run("codec_block_decode/4", records, [&]() {
+        uint8_t buffer[EVENT_BLOCK_MAX_PAYLOAD];
+        memcpy(buffer, payload, payloadLength + 1);
+        EventLine fields;
+        if (eventBlockCrc(buffer, payloadLength) == buffer[payloadLength] &&
+            decodeEventBlock(buffer, payloadLength, fields) == EVENT_LINE_OK) {
+            Event restored(fields);
+            decoded += restored.getRecordCount();
+        }
+    }, (double)blockLength / records);
+
+    char text[EVENT_LINE_MAX_LENGTH];
+    BufferSink textSink(text, sizeof(text));
+    event.writeTo(textSink);
+    size_t textLength = textSink.length();
+    runner.run("codec_line_encode/4", records, [&]() {
+        char out[EVENT_LINE_MAX_LENGTH];
+        BufferSink sink(out, sizeof(out));
+        event.writeTo(sink);
+        decoded += sink.length() > 0 ? 1 : 0;
+    }, (double)textLength / records);
+    runner.run("codec_line_decode/4", records, [&]() {
+        char buffer[EVENT_LINE_MAX_LENGTH];
+        memcpy(buffer, text, textLength);
+        EventLine fields;
+        if (parseEventLine(buffer, textLength, fields) == EVENT_LINE_OK) {
+            Event restored(fields);
+            decoded += restored.getRecordCount();
+        }
+    }, (double)textLength / records);
+    if (runner.selected("codec_") && decoded == 0) {
+        fprintf(stderr, "codec: nothing was decoded\n");
+    }
+}
+
+static void benchAdapters(BenchmarkRunner& runner) {
+    // no pause between readings, the sampling itself is what is measured
+    DHTAdapter dhtAdapter(MAX_RETRIES, 0);
+    LuxAndDLIAdapter luxAdapter(600, MAX_RETRIES, 0);
+    Event time = timeEvent(BENCH_START_EPOCH);
+
+    runner.run("adapter_dht_sample", 4, [&]() {
+        Event result = dhtAdapter.sampleBlocking(time);
+        (void)result;
+    });
+    runner.run("adapter_lux_sample", 2, [&]() {
+        Event result = luxAdapter.sampleBlocking(time);
+        (void)result;
+    });
+}
+
+static void benchStorage(BenchmarkRunner& runner) {
+    Event events[MAX_EVENTS_PER_FILE];
+    Event loaded[MAX_EVENTS_PER_FILE];
+    fillEvents(events, MAX_EVENTS_PER_FILE, BENCH_START_EPOCH);
+
+    clearCard();
+    storeEvents(SD, events, MAX_EVENTS_PER_FILE, BENCH_FILE);
+    double fileBytes = (double)SD.usedBytes() / MAX_EVENTS_PER_FILE;
+    runner.run("store_events", MAX_EVENTS_PER_FILE, [&]() {
+        storeEvents(SD, events, MAX_EVENTS_PER_FILE, BENCH_FILE);
+    }, fileBytes);
+    runner.run("load_events", MAX_EVENTS_PER_FILE, [&]() {
+        loadEvents(SD, loaded, MAX_EVENTS_PER_FILE, BENCH_FILE);
+    });
+
+    for (size_t i = 0; i < sizeof(backlogSizes) / sizeof(backlogSizes[0]); i++) {
+        int files = backlogSizes[i];
+        char name[BENCH_NAME_LENGTH];
+        snprintf(name, sizeof(name), "find_file_by_date_cold/%d", files);
+        if (!runner.selected(name) && !runner.selected("find_file_by_date_warm")) {
+            continue;
+        }
+        clearCard();
+        writeBacklog(files);
+        char path[24];
+        // the directory is scanned again every time
+        runner.run(name, files, [&]() {
+            rebuildBacklogIndex(SD, "/", true);
+            findFileByDate(SD, "/", path, sizeof(path), true);
+        });
+        // answered from the index kept in RAM
+        snprintf(name, sizeof(name), "find_file_by_date_warm/%d", files);
+        runner.run(name, files, [&]() {
+            findFileByDate(SD, "/", path, sizeof(path), true);
+        });
+    }
+
+    clearCard();
+    EventLog log;
+    log.begin(SD);
+    // what one append adds to the card, the commit marker included
+    uint64_t used = SD.usedBytes();
+    log.append(events, MAX_EVENTS_PER_FILE);
+    double logBytes = (double)(SD.usedBytes() - used) / MAX_EVENTS_PER_FILE;
+    runner.run("event_log_append", MAX_EVENTS_PER_FILE, [&]() {
+        log.append(events, MAX_EVENTS_PER_FILE);
+    }, logBytes);
+    runner.run("event_log_drain", MAX_EVENTS_PER_FILE, [&]() {
+        EventLogCursor next;
+        if (log.peek(loaded, MAX_EVENTS_PER_FILE, next) == 0) {
+            log.append(events, MAX_EVENTS_PER_FILE);
+            log.peek(loaded, MAX_EVENTS_PER_FILE, next);
+        }
+        log.advance(next);
+    });
+}
+
+/*
+* The compaction of the former fixed array after a send, kept here to compare
+* against: the events that stay are copied down over the ones that went.
+*/
+static int compactLegacy(Event* events, int count, bool (*keep)(int position)) {
+    int readIndex = 0, writeIndex = 0;
+    while (readIndex < count) {
+        if (!keep(readIndex)) {
+            events[readIndex] = Event();
+        } else {
+            if (writeIndex != readIndex) {
+                events[writeIndex] = events[readIndex];
+            }
+            writeIndex++;
+        }
+        readIndex++;
+    }
+    int remaining = writeIndex;
+    while (writeIndex < count) {
+        events[writeIndex++] = Event();
+    }
+    return remaining;
+}
+
+static bool keepAll(int position) {
+    (void)position;
+    return true;
+}
+
+static bool keepOdd(int position) {
+    return position % 2 == 1;
+}
+
+static void benchPending(BenchmarkRunner& runner, ConnectionEventManager& manager) {
+    const size_t capacity = MAX_MEASUREMENTS + MAX_EXCESS_EVENTS;
+    Event event = measurementEvent(BENCH_START_EPOCH);
+
+    // what a failed send of the whole buffer does, every event stays
+    runner.run("pending_retain_all", capacity, [&]() {
+        while (manager.measurementEvents.size() < capacity) {
+            manager.measurementEvents.push(event);
+        }
+        manager.measurementEvents.retain([](Event&, size_t) { return true; });
+    });
+    // a partly successful send, every other event goes and the rest moves up
+    runner.run("pending_retain_half", capacity, [&]() {
+        while (manager.measurementEvents.size() < capacity) {
+            manager.measurementEvents.push(event);
+        }
+        manager.measurementEvents.retain([](Event&, size_t position) { return position % 2 == 1; });
+    });
+    manager.measurementEvents.clear();
+
+    // the same two sends on the former array
+    Event legacy[MAX_MEASUREMENTS + MAX_EXCESS_EVENTS];
+    int legacyCount = 0;
+    runner.run("pending_compact_legacy_all", capacity, [&]() {
+        while (legacyCount < (int)capacity) {
+            legacy[legacyCount++] = event;
+        }
+        legacyCount = compactLegacy(legacy, legacyCount, keepAll);
+    });
+    legacyCount = 0;
+    runner.run("pending_compact_legacy_half", capacity, [&]() {
+        while (legacyCount < (int)capacity) {
+            legacy[legacyCount++] = event;
+        }
+        legacyCount = compactLegacy(legacy, legacyCount, keepOdd);
+    });
+}
+
+static void benchApi(BenchmarkRunner& runner) {
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[UPLINK_MAX_EVENTS];
+    fillEvents(events, UPLINK_MAX_EVENTS, BENCH_START_EPOCH);
+
+    // the mock server would add its own parsing to the wall time
+    host::config().inspectBodies = false;
+    api.setCompressionEnabled(false);
+    runner.run("api_send_events/1", 1, [&]() { api.sendEvents(events, 1); });
+    runner.run("api_send_events/3", 3, [&]() { api.sendEvents(events, 3); });
+    runner.run("api_send_events/30", UPLINK_MAX_EVENTS, [&]() { api.sendEvents(events, UPLINK_MAX_EVENTS); });
+    api.setCompressionEnabled(true);
+    runner.run("api_send_events_gzip/30", UPLINK_MAX_EVENTS,
+               [&]() { api.sendEvents(events, UPLINK_MAX_EVENTS); });
+
+    // the same drain as QoS 1 publishes, pipelined against the mock broker
+    WiFiClient socket;
+    MqttUplink mqtt(socket);
+    runner.run("mqtt_send_events/1", 1, [&]() { mqtt.sendEvents(events, 1); });
+    runner.run("mqtt_send_events/30", UPLINK_MAX_EVENTS, [&]() { mqtt.sendEvents(events, UPLINK_MAX_EVENTS); });
+    mqtt.disconnect();
+    host::config().inspectBodies = true;
+}
+
+// The fan-out of the former EventManager and Subscriber, kept here to compare against
+class VirtualSubscriber {
+public:
+    virtual ~VirtualSubscriber() {}
+    virtual void update(const Event* events, int size) = 0;
+};
+
+class VirtualRecordCounter : public VirtualSubscriber {
+public:
+    unsigned long records = 0;
+
+    void update(const Event* events, int size) override {
+        for (int i = 0; i < size; i++) {
+            if (events[i].getType() != MEASUREMENT_EVENT) {
+                continue;
+            }
+            for (int r = 0; r < events[i].getRecordCount(); r++) {
+                records += events[i].getRecords()[r].variableId + 1;
+            }
+        }
+    }
+};
+
+struct RecordCounter {
+    unsigned long records = 0;
+
+    void onRecords(const RecordSpan& span) {
+        for (const MeasurementRecord& record : span) {
+            records += record.variableId + 1;
+        }
+    }
+};
+
+/*
+* Delivery of a sampling round, a DHT event of four records and a light event of
+* two, to three subscribers: through virtual update calls on the events, as the
+* sensors published before, and as record spans on a channel.
+*/
+static void benchDispatch(BenchmarkRunner& runner) {
+    const MeasurementRecord lightRecords[] = {
+        makeMeasurementRecord(LUX_VARIABLE, DEFAULT_CROP, 1200.0f, BENCH_START_EPOCH),
+        makeMeasurementRecord(DLI_VARIABLE, DEFAULT_CROP, 8.5f, BENCH_START_EPOCH)};
+    Event round[] = {measurementEvent(BENCH_START_EPOCH), Event(OK_STATUS, lightRecords, 2)};
+    const int roundSize = sizeof(round) / sizeof(round[0]);
+    const unsigned long recordsPerRound = 6;
+
+    VirtualRecordCounter virtualCounters[BENCH_SUBSCRIBERS];
+    VirtualSubscriber* subscribers[BENCH_SUBSCRIBERS];
+    for (int i = 0; i < BENCH_SUBSCRIBERS; i++) {
+        subscribers[i] = &virtualCounters[i];
+    }
+    runner.run("dispatch_virtual/3", recordsPerRound, [&]() {
+        for (int i = 0; i < BENCH_SUBSCRIBERS; i++) {
+            subscribers[i]->update(round, roundSize);
+        }
+    });
+
+    RecordCounter counters[BENCH_SUBSCRIBERS];
+    Channel<RecordSpan, BENCH_SUBSCRIBERS> channel;
+    for (int i = 0; i < BENCH_SUBSCRIBERS; i++) {
+        channel.subscribe<RecordCounter, &RecordCounter::onRecords>(&counters[i]);
+    }
+    runner.run("dispatch_channel/3", recordsPerRound, [&]() {
+        for (int i = 0; i < roundSize; i++) {
+            RecordSpan records = {round[i].getRecords(), (size_t)round[i].getRecordCount()};
+            channel.publish(records);
+        }
+    });
+
+    // only the benches the filter selected have run
+    bool virtualRan = runner.selected("dispatch_virtual/3");
+    bool channelRan = runner.selected("dispatch_channel/3");
+    for (int i = 0; i < BENCH_SUBSCRIBERS; i++) {
+        if ((virtualRan && virtualCounters[i].records == 0) || (channelRan && counters[i].records == 0)) {
+            fprintf(stderr, "dispatch: a subscriber got nothing\n");
+        }
+    }
+}
+
+static void writeLogToSerial(const char* text, size_t length) {
+    Serial.write((const uint8_t*)text, length);
+}
+
+static void discardLog(const char* text, size_t length) {
+    (void)text;
+    (void)length;
+}
+
+/*
+* The acquisition side handing an event to a full measurement queue, which drops
+* it and logs a warning every time: the path that keeps logging while the uplink
+* is stalled. With no writer the line is captured and thrown away, direct writes
+* it to the serial port before returning and deferred queues it for the log task.
+*/
+static void benchLoggedDrops(BenchmarkRunner& runner) {
+    static MeasurementQueue queue;
+    MeasurementQueueWriter writer(queue);
+    while (queue.push(makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 21.5f, BENCH_START_EPOCH))) {
+    }
+    Event event = measurementEvent(BENCH_START_EPOCH);
+    RecordSpan records = {event.getRecords(), (size_t)event.getRecordCount()};
+
+    logger().begin(millis, nullptr);
+    logger().setDeferred(false);
+    runner.run("queue_full_drop/log_off", 1, [&]() {
+        writer.onRecords(records);
+    });
+
+    logger().begin(millis, writeLogToSerial);
+    runner.run("queue_full_drop/log_direct", 1, [&]() {
+        writer.onRecords(records);
+    });
+
+    logger().begin(millis, discardLog);
+    logger().setDeferred(true);
+    unsigned long queued = 0;
+    runner.run("queue_full_drop/log_deferred", 1, [&]() {
+        writer.onRecords(records);
+        if (++queued % LOG_RING_CAPACITY == 0) {
+            logger().drain();
+        }
+    });
+    logger().drain();
+}
+
+/*
+* What a log line of the upload path costs the caller: compiled out, written to
+* the serial port before returning (as Serial.printf did) and queued for the log
+* task. The serial port is charged at the sketch baud rate, so the simulated
+* time is how long the caller is held up. The queued lines are formatted when
+* the ring fills, into a writer that drops them, so the wall time of the deferred
+* case includes formatting them later but not the wire.
+*/
+static void benchLogging(BenchmarkRunner& runner) {
+    host::Config& config = host::config();
+    const char* path = "/log/00000042.log";
+    unsigned long requests = 1234;
+    config.serialBaud = BENCH_SERIAL_BAUD;
+
+    runner.run("log_line_off", 1, [&]() {
+        LOG_DEBUG(BENCH_OFF, "Requests so far: %lu, storing %d events in file: %s", requests, 30, path);
+    });
+    runner.run("log_line_printf", 1, [&]() {
+        Serial.printf("Requests so far: %lu, storing %d events in file: %s\n", requests, 30, path);
+    });
+
+    logger().begin(millis, writeLogToSerial);
+    logger().setDeferred(false);
+    runner.run("log_line_direct", 1, [&]() {
+        LOG_DEBUG(BENCH, "Requests so far: %lu, storing %d events in file: %s", requests, 30, path);
+    });
+
+    logger().begin(millis, discardLog);
+    logger().setDeferred(true);
+    unsigned long queued = 0;
+    runner.run("log_line_deferred", 1, [&]() {
+        LOG_DEBUG(BENCH, "Requests so far: %lu, storing %d events in file: %s", requests, 30, path);
+        if (++queued % LOG_RING_CAPACITY == 0) {
+            logger().drain();
+        }
+    });
+    logger().drain();
+
+    benchLoggedDrops(runner);
+
+    config.serialBaud = 0;
+    logger().begin(nullptr, nullptr);
+    logger().setDeferred(LOG_DEFERRED != 0);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--json FILE] [--filter TEXT] [--min-time-ms N] [--sd DIR]\n"
+            "  results go to stdout as JSON unless --json is given\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    BenchmarkRunner runner;
+    const char* jsonPath = nullptr;
+    host::Config& config = host::config();
+    snprintf(config.sdRoot, sizeof(config.sdRoot), "%s", "bench-sd");
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(argv[i], "--json") == 0) {
+            jsonPath = value;
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            runner.setFilter(value);
+        } else if (strcmp(argv[i], "--min-time-ms") == 0) {
+            runner.setMinTimeMs(strtoul(value, nullptr, 10));
+        } else if (strcmp(argv[i], "--sd") == 0) {
+            snprintf(config.sdRoot, sizeof(config.sdRoot), "%s", value);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+
+    // the benchmarks never run out of simulated time
+    config.durationMs = UINT64_MAX;
+    config.startEpoch = BENCH_START_EPOCH;
+    host::begin();
+    clearCard();
+
+    // the link is up for the whole run, the association takes a few simulated seconds
+    ConnectionEventManager manager;
+    WiFi.begin(MY_SSID, MY_PASSWORD);
+    delay(HOST_WIFI_ASSOCIATION_MS + 1);
+
+    benchEvents(runner);
+    benchEventCopies(runner);
+    benchPayloads(runner);
+    benchLineParsing(runner);
+    benchCodec(runner);
+    benchAdapters(runner);
+    benchStorage(runner);
+    benchPending(runner, manager);
+    benchApi(runner);
+    benchLogging(runner);
+    benchDispatch(runner);
+
+    FILE* out = jsonPath != nullptr ? fopen(jsonPath, "w") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "Cannot write %s\n", jsonPath);
+        return 1;
+    }
+    runner.writeJson(out);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
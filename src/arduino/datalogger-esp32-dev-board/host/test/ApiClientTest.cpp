@@ -0,0 +1,413 @@
+/*
+* The HTTP uplink against the mock API server of the host runtime, which answers
+* through a handler so each test plays a different server: batching, its
+* fallbacks and the kept connection.
+*/
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "ApiClient.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define TEST_EVENTS UPLINK_MAX_EVENTS
+#define TEST_RECORDS 4
+#define TEST_BAD_VALUE 9999.0f  // the validating server rejects records with this value
+#define TEST_BODY_LIMIT 1400    // the limiting server answers 413 to larger bodies, two events fit
+#define TEST_DAYS 7
+#define TEST_DRAIN_PERIOD 300000UL
+#define TEST_DRAINS_PER_DAY (24 * 3600000UL / TEST_DRAIN_PERIOD)
+
+#define RECORD_MARKER "\"variable\""
+#define VALUE_MARKER "\"value\": "
+
+// What the server saw, reset by each test
+static int requests = 0;
+static int records = 0;
+static size_t largestBody = 0;
+static char requestBody[8192];
+static char responseBody[2048];
+
+static int countRecords(const char* body, size_t length) {
+    int count = 0;
+    for (size_t i = 0; i + strlen(RECORD_MARKER) <= length; i++) {
+        if (memcmp(body + i, RECORD_MARKER, strlen(RECORD_MARKER)) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void note(const char* body, size_t length) {
+    requests++;
+    records += countRecords(body, length);
+    largestBody = max(largestBody, length);
+}
+
+static host::Response accepting(const char* body, size_t length) {
+    note(body, length);
+    return {CREATED_STATUS, nullptr, false};
+}
+
+// Answers and hangs up, as a server without keep-alive does
+static host::Response closing(const char* body, size_t length) {
+    note(body, length);
+    return {CREATED_STATUS, nullptr, true};
+}
+
+// Takes one event per request, as servers without the batch endpoint do
+static host::Response rejectingBatches(const char* body, size_t length) {
+    note(body, length);
+    return {countRecords(body, length) > TEST_RECORDS ? NOT_FOUND_STATUS : CREATED_STATUS, nullptr, false};
+}
+
+// Takes bodies up to TEST_BODY_LIMIT bytes, as a proxy in front of the API
+static host::Response limitingBodies(const char* body, size_t length) {
+    note(body, length);
+    return {length > TEST_BODY_LIMIT ? PAYLOAD_TOO_LARGE_STATUS : CREATED_STATUS, nullptr, false};
+}
+
+// Rejects a body with a bad value, answering the result of each item like the API
+static host::Response validating(const char* body, size_t length) {
+    note(body, length);
+    // the body is not null terminated
+    length = min(length, sizeof(requestBody) - 1);
+    memcpy(requestBody, body, length);
+    requestBody[length] = '\0';
+
+    size_t used = snprintf(responseBody, sizeof(responseBody), "[");
+    bool rejected = false;
+    for (const char* value = strstr(requestBody, VALUE_MARKER); value != nullptr;
+         value = strstr(value + 1, VALUE_MARKER)) {
+        bool bad = strtof(value + strlen(VALUE_MARKER), nullptr) == TEST_BAD_VALUE;
+        rejected = rejected || bad;
+        used += snprintf(responseBody + used, sizeof(responseBody) - used, "%s%s", used > 1 ? ", " : "",
+                         bad ? "{\"value\": [\"Out of range.\"]}" : "{}");
+    }
+    snprintf(responseBody + used, sizeof(responseBody) - used, "]");
+    return rejected ? host::Response{BAD_REQUEST_STATUS, responseBody, false}
+                    : host::Response{CREATED_STATUS, nullptr, false};
+}
+
+static void startServer(host::ServerHandler handler) {
+    requests = 0;
+    records = 0;
+    largestBody = 0;
+    host::config().serverHandler = handler;
+    host::config().serverStatus = CREATED_STATUS;
+    WiFi.begin("test", "test");
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(100);
+    }
+}
+
+static void fillEvents(Event* events, int badEvery = 0) {
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        MeasurementRecord eventRecords[TEST_RECORDS];
+        for (int r = 0; r < TEST_RECORDS; r++) {
+            bool bad = badEvery > 0 && i % badEvery == badEvery - 1 && r == 1;
+            eventRecords[r] = makeMeasurementRecord(r, DEFAULT_CROP, bad ? TEST_BAD_VALUE : 20.0f + i,
+                                                    TEST_EPOCH + i * 60);
+        }
+        events[i] = Event(OK_STATUS, eventRecords, TEST_RECORDS);
+    }
+}
+
+static bool delivered(int status) {
+    return status == OK_STATUS || status == CREATED_STATUS;
+}
+
+TEST(batches_drain_many_events_per_request) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    int* results = api.sendEvents(events, TEST_EVENTS);
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        CHECK(delivered(results[i]));
+    }
+    CHECK_EQUAL(records, TEST_EVENTS * TEST_RECORDS);
+    CHECK_EQUAL(api.getDeliveredEventCount(), (unsigned long)TEST_EVENTS);
+    CHECK(largestBody <= API_BATCH_MAX_BYTES);
+    // as many events as the budget takes, and at most BATCH_RESULT_MAX_ITEMS records
+    size_t eventBytes = measurementsJsonLength(events[0].getRecords(), TEST_RECORDS, measurementDictionary());
+    int perBatch = min((int)(API_BATCH_MAX_BYTES / eventBytes), BATCH_RESULT_MAX_ITEMS / TEST_RECORDS);
+    CHECK(perBatch > 1);
+    CHECK_EQUAL(requests, (TEST_EVENTS + perBatch - 1) / perBatch);
+    fprintf(stderr, "        batched: %.2f requests per drained event\n", (double)requests / TEST_EVENTS);
+}
+
+TEST(single_event_mode_sends_one_request_per_event) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    api.setBatchingEnabled(false);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    int* results = api.sendEvents(events, TEST_EVENTS);
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        CHECK(delivered(results[i]));
+    }
+    CHECK_EQUAL(requests, TEST_EVENTS);
+    CHECK_EQUAL(records, TEST_EVENTS * TEST_RECORDS);
+    fprintf(stderr, "        single: %.2f requests per drained event\n", (double)requests / TEST_EVENTS);
+}
+
+TEST(batches_stay_within_the_budget) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+    size_t eventBytes = measurementsJsonLength(events[0].getRecords(), TEST_RECORDS, measurementDictionary());
+
+    api.setBatchBudget(3 * eventBytes);
+    api.sendEvents(events, TEST_EVENTS);
+    CHECK(largestBody <= 3 * eventBytes);
+    CHECK_EQUAL(requests, TEST_EVENTS / 3);
+
+    // an event larger than the budget still goes, on its own
+    startServer(accepting);
+    api.setBatchBudget(eventBytes / 2);
+    int* results = api.sendEvents(events, TEST_EVENTS);
+    CHECK(delivered(results[TEST_EVENTS - 1]));
+    CHECK_EQUAL(requests, TEST_EVENTS);
+}
+
+TEST(falls_back_to_single_events_when_batches_are_rejected) {
+    startServer(rejectingBatches);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    int* results = api.sendEvents(events, TEST_EVENTS);
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        CHECK(delivered(results[i]));
+    }
+    CHECK(!api.isBatchingEnabled());
+    // the rejected batch, then every event on its own
+    CHECK_EQUAL(requests, 1 + TEST_EVENTS);
+    CHECK_EQUAL(api.getDeliveredEventCount(), (unsigned long)TEST_EVENTS);
+
+    // and it stays off for the next drain
+    startServer(rejectingBatches);
+    api.sendEvents(events, TEST_EVENTS);
+    CHECK_EQUAL(requests, TEST_EVENTS);
+
+    // until the pause is over, then a batch is tried again
+    delay(API_BATCH_RETRY_MS);
+    startServer(accepting);
+    api.sendEvents(events, TEST_EVENTS);
+    CHECK(api.isBatchingEnabled());
+    CHECK(requests < TEST_EVENTS);
+}
+
+TEST(body_too_large_shrinks_the_batches) {
+    startServer(limitingBodies);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    int* results = api.sendEvents(events, TEST_EVENTS);
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        CHECK(delivered(results[i]));
+    }
+    CHECK_EQUAL(api.getDeliveredEventCount(), (unsigned long)TEST_EVENTS);
+    // still batching, within what the server takes
+    CHECK(api.isBatchingEnabled());
+    CHECK(api.getBatchBudget() < API_BATCH_MAX_BYTES);
+    CHECK(api.getBatchBudget() >= API_BATCH_MIN_BYTES);
+
+    // the next drain fits at once
+    startServer(limitingBodies);
+    api.sendEvents(events, TEST_EVENTS);
+    CHECK(largestBody <= TEST_BODY_LIMIT);
+    CHECK_EQUAL(requests, (TEST_EVENTS + 1) / 2);
+    fprintf(stderr, "        shrunk to %d bytes: %.2f requests per drained event\n",
+            (int)api.getBatchBudget(), (double)requests / TEST_EVENTS);
+}
+
+TEST(partial_failures_retry_only_the_valid_events) {
+    startServer(validating);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events, 10);
+
+    int* results = api.sendEvents(events, TEST_EVENTS);
+    int rejected = 0;
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        if (i % 10 == 9) {
+            CHECK_EQUAL(results[i], BAD_REQUEST_STATUS);
+            rejected++;
+        } else {
+            CHECK(delivered(results[i]));
+        }
+    }
+    CHECK_EQUAL(rejected, 3);
+    CHECK(api.isBatchingEnabled());
+    CHECK_EQUAL(api.getDeliveredEventCount(), (unsigned long)(TEST_EVENTS - rejected));
+    // the bad events are not sent again on their own
+    CHECK(requests < TEST_EVENTS);
+}
+
+TEST(server_errors_keep_every_event) {
+    startServer(nullptr);
+    host::config().serverStatus = SERVICE_UNAVAILABLE_STATUS;
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    int* results = api.sendEvents(events, TEST_EVENTS);
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        CHECK_EQUAL(results[i], SERVICE_UNAVAILABLE_STATUS);
+    }
+    CHECK(api.isBatchingEnabled());
+    CHECK_EQUAL(api.getDeliveredEventCount(), 0ul);
+}
+
+TEST(keeps_one_connection_for_every_request) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    api.setBatchingEnabled(false);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    unsigned long connections = host::stats().connections;
+    api.sendEvents(events, TEST_EVENTS);
+    CHECK_EQUAL(requests, TEST_EVENTS);
+    CHECK_EQUAL(host::stats().connections - connections, 1ul);
+    CHECK_EQUAL(api.getNewConnectionCount(), 1ul);
+    CHECK_EQUAL(api.getReusedConnectionCount(), (unsigned long)TEST_EVENTS - 1);
+
+    // the next drain goes on the same connection
+    api.sendEvents(events, 1);
+    CHECK_EQUAL(api.getNewConnectionCount(), 1ul);
+}
+
+TEST(idle_connection_is_replaced) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    api.sendEvents(events, 1);
+    delay(API_KEEP_ALIVE_IDLE_MS / 2);
+    api.sendEvents(events, 1);
+    CHECK_EQUAL(api.getReusedConnectionCount(), 1ul);
+
+    // a NAT may have dropped it without notice, it is not trusted any more
+    delay(API_KEEP_ALIVE_IDLE_MS + 1000);
+    unsigned long refused = host::stats().refusedRequests;
+    api.sendEvents(events, 1);
+    CHECK_EQUAL(api.getNewConnectionCount(), 2ul);
+    CHECK_EQUAL(api.getReusedConnectionCount(), 1ul);
+    CHECK_EQUAL(host::stats().refusedRequests, refused);
+}
+
+TEST(connection_closed_by_the_server_is_reopened) {
+    startServer(closing);
+    WiFiClient client;
+    ApiClient api(client);
+    api.setBatchingEnabled(false);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    unsigned long refused = host::stats().refusedRequests;
+    int* results = api.sendEvents(events, 5);
+    for (int i = 0; i < 5; i++) {
+        CHECK(delivered(results[i]));
+    }
+    CHECK_EQUAL(requests, 5);
+    CHECK_EQUAL(api.getNewConnectionCount(), 5ul);
+    CHECK_EQUAL(api.getReusedConnectionCount(), 0ul);
+    CHECK_EQUAL(host::stats().refusedRequests, refused);
+}
+
+TEST(half_open_connection_is_retried_on_a_new_one) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    api.sendEvents(events, 1);
+    host::dropConnections();
+
+    unsigned long refused = host::stats().refusedRequests;
+    int* results = api.sendEvents(events, 1);
+    CHECK(delivered(results[0]));
+    // the request lost on the dead connection and the one that went through
+    CHECK_EQUAL(host::stats().refusedRequests - refused, 1ul);
+    CHECK_EQUAL(requests, 2);
+    CHECK_EQUAL(api.getReusedConnectionCount(), 1ul);
+    CHECK_EQUAL(api.getNewConnectionCount(), 2ul);
+    CHECK_EQUAL(api.getDeliveredEventCount(), 2ul);
+}
+
+TEST(disconnect_closes_the_kept_connection) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    api.sendEvents(events, 1);
+    api.disconnect();
+    api.sendEvents(events, 1);
+    CHECK_EQUAL(api.getNewConnectionCount(), 2ul);
+    CHECK_EQUAL(api.getReusedConnectionCount(), 0ul);
+}
+
+TEST(week_of_requests_leaves_the_heap_as_it_found_it) {
+    startServer(accepting);
+    WiFiClient client;
+    ApiClient api(client);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+    host::Config& config = host::config();
+
+    // the first request sets up what is kept for the next ones
+    api.sendEvents(events, 1);
+    host::HeapUsage before = host::heap();
+    host::resetHeapPeak();
+
+    // a drain every TEST_DRAIN_PERIOD of a varying number of events, compressed from
+    // the fourth day, with the server gone for six hours on the second
+    config.serverOutages[0].start = millis() + 30 * 3600000UL;
+    config.serverOutages[0].end = config.serverOutages[0].start + 6 * 3600000UL;
+    config.serverOutageCount = 1;
+    unsigned long drains = 0;
+    unsigned long grown = 0;
+    for (unsigned long end = millis() + TEST_DAYS * 24 * 3600000UL; millis() < end; drains++) {
+        api.setCompressionEnabled(drains >= TEST_DRAINS_PER_DAY * 3);
+        api.sendEvents(events, 1 + (int)(drains * 7 % TEST_EVENTS));
+        host::HeapUsage after = host::heap();
+        grown += (after.inUse != before.inUse || after.liveBlocks != before.liveBlocks) ? 1 : 0;
+        delay(TEST_DRAIN_PERIOD);
+    }
+    config.serverOutageCount = 0;
+
+    // nothing left behind, and nothing allocated on the way: the peak stays flat
+    host::HeapUsage after = host::heap();
+    CHECK_EQUAL(grown, 0ul);
+    CHECK_EQUAL(after.liveBlocks, before.liveBlocks);
+    CHECK_EQUAL(after.peak, before.inUse);
+    CHECK_EQUAL(after.allocations, before.allocations);
+    // and no holes left in the heap
+    CHECK_EQUAL(after.minLargestFree, before.largestFree);
+    CHECK(requests > 0);
+    CHECK(api.getSentBodyBytes() < api.getRawBodyBytes());
+    fprintf(stderr, "        %d days, %lu drains: peak %zu B over the %zu B kept, %.2f allocations per drain\n",
+            TEST_DAYS, drains, after.peak - before.inUse, before.inUse,
+            (double)(after.allocations - before.allocations) / drains);
+}
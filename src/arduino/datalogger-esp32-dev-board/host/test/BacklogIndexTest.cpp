@@ -0,0 +1,157 @@
+/*
+* The backlog index, alone and behind findFileByDate on a card holding far more
+* files than it keeps.
+*/
+
+#include <Arduino.h>
+#include <SD.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "BacklogIndex.h"
+#include "CustomUtils.h"
+#include "Instrumentation.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define TEST_FILES 10000
+#define TEST_SCANS ((TEST_FILES + BACKLOG_INDEX_CAPACITY - 1) / BACKLOG_INDEX_CAPACITY)
+
+// The timestamps of TEST_FILES files a minute apart, in a scrambled order
+static uint32_t fileTimestamp(int i) {
+    // 7919 is prime, so this walks every index once
+    return TEST_EPOCH + (uint32_t)((i * 7919) % TEST_FILES) * 60;
+}
+
+static void rebuild(BacklogIndex& index, bool keepNewest) {
+    index.beginRebuild(keepNewest);
+    for (int i = 0; i < TEST_FILES; i++) {
+        index.add(fileTimestamp(i));
+    }
+}
+
+TEST(unbuilt_index_asks_for_a_scan) {
+    BacklogIndex index;
+    uint32_t timestamp = 0;
+    CHECK(index.needsRebuild(true));
+    CHECK(index.needsRebuild(false));
+    index.add(TEST_EPOCH);
+    CHECK(!index.oldest(timestamp));
+
+    index.beginRebuild(true);
+    CHECK(!index.needsRebuild(true));
+    CHECK(!index.needsRebuild(false));
+    CHECK(!index.newest(timestamp));
+}
+
+TEST(keeps_the_newest_files_when_truncated) {
+    BacklogIndex index;
+    rebuild(index, true);
+    CHECK(index.truncated());
+    CHECK_EQUAL(index.size(), BACKLOG_INDEX_CAPACITY);
+
+    uint32_t timestamp = 0;
+    CHECK(index.newest(timestamp));
+    CHECK_EQUAL(timestamp, (uint32_t)(TEST_EPOCH + (TEST_FILES - 1) * 60));
+    CHECK(index.oldest(timestamp));
+    CHECK_EQUAL(timestamp, (uint32_t)(TEST_EPOCH + (TEST_FILES - BACKLOG_INDEX_CAPACITY) * 60));
+
+    // the dropped end is not known, asking for it needs a scan
+    CHECK(!index.needsRebuild(true));
+    CHECK(index.needsRebuild(false));
+}
+
+TEST(keeps_the_oldest_files_when_truncated) {
+    BacklogIndex index;
+    rebuild(index, false);
+    CHECK(index.truncated());
+
+    uint32_t timestamp = 0;
+    CHECK(index.oldest(timestamp));
+    CHECK_EQUAL(timestamp, (uint32_t)TEST_EPOCH);
+    CHECK(index.newest(timestamp));
+    CHECK_EQUAL(timestamp, (uint32_t)(TEST_EPOCH + (BACKLOG_INDEX_CAPACITY - 1) * 60));
+    CHECK(index.needsRebuild(true));
+}
+
+TEST(truncated_index_ignores_files_past_the_window) {
+    BacklogIndex index;
+    rebuild(index, true);
+    uint32_t oldest = 0;
+    CHECK(index.oldest(oldest));
+
+    // older than a dropped file: would be offered before files still on the card
+    index.add(oldest - 90);
+    CHECK_EQUAL(index.size(), BACKLOG_INDEX_CAPACITY);
+    uint32_t timestamp = 0;
+    CHECK(index.oldest(timestamp));
+    CHECK_EQUAL(timestamp, oldest);
+
+    // a new file pushes the oldest kept one out
+    uint32_t newer = TEST_EPOCH + TEST_FILES * 60;
+    index.add(newer);
+    CHECK_EQUAL(index.size(), BACKLOG_INDEX_CAPACITY);
+    CHECK(index.newest(timestamp));
+    CHECK_EQUAL(timestamp, newer);
+    CHECK(index.oldest(timestamp));
+    CHECK_EQUAL(timestamp, oldest + 60);
+
+    // and duplicates change nothing
+    index.add(newer);
+    CHECK_EQUAL(index.size(), BACKLOG_INDEX_CAPACITY);
+}
+
+TEST(draining_rebuilds_once_per_window) {
+    BacklogIndex index;
+    index.invalidate();
+    int rebuilds = 0;
+    uint32_t previous = UINT32_MAX;
+    for (int drained = 0; drained < TEST_FILES; drained++) {
+        if (index.needsRebuild(true)) {
+            index.beginRebuild(true);
+            // only the files not drained yet are still on the card
+            for (int i = 0; i < TEST_FILES; i++) {
+                if (fileTimestamp(i) < previous) {
+                    index.add(fileTimestamp(i));
+                }
+            }
+            rebuilds++;
+        }
+        uint32_t timestamp = 0;
+        CHECK(index.newest(timestamp));
+        CHECK_EQUAL(timestamp, (uint32_t)(TEST_EPOCH + (TEST_FILES - 1 - drained) * 60));
+        index.remove(timestamp);
+        previous = timestamp;
+    }
+    CHECK_EQUAL(rebuilds, TEST_SCANS);
+    CHECK_EQUAL(index.size(), 0);
+}
+
+TEST(find_file_by_date_drains_a_large_card_in_order) {
+    clearTestCard();
+    for (int i = 0; i < TEST_FILES; i++) {
+        char path[24];
+        snprintf(path, sizeof(path), "/%lu.txt", (unsigned long)fileTimestamp(i));
+        File file = SD.open(path, FILE_WRITE);
+        CHECK(file);
+        file.close();
+    }
+
+    // count the directory scans through their stage timer
+    instrumentation().setClock(micros);
+    instrumentation().reset();
+    rebuildBacklogIndex(SD, "/", false);
+    CHECK(hasBacklogFiles());
+
+    char path[24];
+    char expected[24];
+    for (int drained = 0; drained < TEST_FILES; drained++) {
+        CHECK(findFileByDate(SD, "/", path, sizeof(path), false));
+        snprintf(expected, sizeof(expected), "/%lu.txt", (unsigned long)(TEST_EPOCH + drained * 60));
+        CHECK_EQUAL(path, expected);
+        deleteFile(SD, path);
+    }
+    CHECK(!findFileByDate(SD, "/", path, sizeof(path), false));
+    CHECK(!hasBacklogFiles());
+    // one scan per window of files, the last window fits and is not truncated
+    CHECK_EQUAL(instrumentation().stage(STAGE_DIR_SCAN).count(), (uint32_t)TEST_SCANS);
+    instrumentation().setClock(nullptr);
+}
@@ -0,0 +1,350 @@
+/*
+* The circuit breaker on a clock of its own against a flaky server, then the
+* retry budget of the ConnectionEventManager against the mock API server: only
+* rejections use it up, outages do not. Last the link under the manager: quiet but
+* up, and lost while the server is down.
+*/
+
+#include <limits.h>
+#include <Arduino.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "CircuitBreaker.h"
+#include "ConnectionEventManager.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define TEST_PERIOD 1000        // ms between the sends of the flaky server tests
+
+static unsigned long now = 0;
+
+static unsigned long testClock() {
+    return now;
+}
+
+// Fails until the breaker opens
+static void failUntilOpen(CircuitBreaker& breaker) {
+    while (breaker.state() != BREAKER_OPEN) {
+        CHECK(breaker.allowRequest());
+        breaker.recordFailure();
+    }
+}
+
+TEST(opens_after_the_threshold) {
+    now = 0;
+    CircuitBreaker breaker(testClock, 7);
+    for (int i = 0; i < BREAKER_FAILURE_THRESHOLD - 1; i++) {
+        CHECK(breaker.allowRequest());
+        breaker.recordFailure();
+        CHECK_EQUAL(breaker.state(), BREAKER_CLOSED);
+    }
+    // an answer in between starts the count again
+    breaker.recordSuccess();
+    breaker.recordFailure();
+    CHECK_EQUAL(breaker.state(), BREAKER_CLOSED);
+    breaker.recordFailure();
+    breaker.recordFailure();
+    CHECK_EQUAL(breaker.state(), BREAKER_OPEN);
+    CHECK(!breaker.allowRequest());
+    CHECK(!breaker.wouldAllow());
+    CHECK_EQUAL(breaker.retryIn(), breaker.getBackoff());
+}
+
+TEST(backoff_doubles_with_jitter_up_to_the_cap) {
+    now = 0;
+    CircuitBreaker breaker(testClock, 12345);
+    failUntilOpen(breaker);
+    unsigned long nominal = BREAKER_BASE_BACKOFF;
+    for (int opening = 0; opening < 12; opening++) {
+        unsigned long backoff = breaker.getBackoff();
+        CHECK(backoff >= nominal / 2);
+        CHECK(backoff <= nominal);
+
+        // the probe is refused until the backoff is over, then fails
+        now += backoff - 1;
+        CHECK(!breaker.allowRequest());
+        now += 1;
+        CHECK(breaker.allowRequest());
+        CHECK_EQUAL(breaker.state(), BREAKER_HALF_OPEN);
+        breaker.recordFailure();
+        CHECK_EQUAL(breaker.state(), BREAKER_OPEN);
+        nominal = min(nominal * 2, (unsigned long)BREAKER_MAX_BACKOFF);
+    }
+    CHECK(breaker.getBackoff() >= BREAKER_MAX_BACKOFF / 2);
+}
+
+TEST(half_open_lets_one_probe_through) {
+    now = 0;
+    CircuitBreaker breaker(testClock, 99);
+    failUntilOpen(breaker);
+    now += breaker.getBackoff();
+
+    CHECK(breaker.wouldAllow());
+    CHECK(breaker.allowRequest());
+    CHECK(breaker.isProbing());
+    // everyone else waits for the probe
+    CHECK(!breaker.wouldAllow());
+    CHECK(!breaker.allowRequest());
+
+    // a probe that never went out hands over to the next caller
+    breaker.releaseProbe();
+    CHECK(breaker.allowRequest());
+    breaker.recordSuccess();
+    CHECK_EQUAL(breaker.state(), BREAKER_CLOSED);
+    CHECK(breaker.allowRequest());
+    CHECK(breaker.allowRequest());
+
+    // and the backoff starts over
+    failUntilOpen(breaker);
+    CHECK(breaker.getBackoff() <= BREAKER_BASE_BACKOFF);
+}
+
+TEST(retry_time_survives_the_clock_wrapping) {
+    now = ULONG_MAX - 1000;
+    CircuitBreaker breaker(testClock, 5);
+    failUntilOpen(breaker);
+    unsigned long backoff = breaker.getBackoff();
+    now += backoff - 1;
+    CHECK(!breaker.allowRequest());
+    CHECK_EQUAL(breaker.retryIn(), 1ul);
+    now += 1;
+    CHECK(breaker.allowRequest());
+}
+
+TEST(devices_that_failed_together_come_back_apart) {
+    now = 0;
+    CircuitBreaker first(testClock, 1);
+    CircuitBreaker second(testClock, 2);
+    failUntilOpen(first);
+    failUntilOpen(second);
+    int same = 0;
+    for (int opening = 0; opening < 8; opening++) {
+        same += (first.getBackoff() == second.getBackoff()) ? 1 : 0;
+        // both probe once the longest backoff is over, and fail again
+        now += BREAKER_MAX_BACKOFF;
+        CHECK(first.allowRequest());
+        CHECK(second.allowRequest());
+        first.recordFailure();
+        second.recordFailure();
+    }
+    CHECK(same <= 1);
+}
+
+// A server that is down for a window and drops some requests at random otherwise
+struct FlakyServer {
+    unsigned long downFrom;
+    unsigned long downUntil;
+    uint32_t dropOneIn;
+    uint32_t random;
+
+    bool answers() {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        bool down = now >= downFrom && now < downUntil;
+        return !down && random % dropOneIn != 0;
+    }
+};
+
+struct FlakyRun {
+    unsigned long attempts;
+    unsigned long attemptsWhileDown;
+    unsigned long openings;
+    unsigned long openMs;
+    unsigned long recoveredAt;
+};
+
+// Sends every TEST_PERIOD through the breaker for the given ms
+static FlakyRun runFlaky(CircuitBreaker& breaker, FlakyServer& server, unsigned long duration) {
+    FlakyRun run = {0, 0, 0, 0, 0};
+    unsigned long end = now + duration;
+    for (; now < end; now += TEST_PERIOD) {
+        if (breaker.state() == BREAKER_OPEN) {
+            run.openMs += TEST_PERIOD;
+        }
+        if (!breaker.allowRequest()) {
+            continue;
+        }
+        run.attempts++;
+        bool down = now >= server.downFrom && now < server.downUntil;
+        run.attemptsWhileDown += down ? 1 : 0;
+        if (server.answers()) {
+            breaker.recordSuccess();
+            if (run.recoveredAt == 0 && now >= server.downUntil) {
+                run.recoveredAt = now;
+            }
+        } else {
+            BreakerState before = breaker.state();
+            breaker.recordFailure();
+            run.openings += (before != BREAKER_OPEN && breaker.state() == BREAKER_OPEN) ? 1 : 0;
+        }
+    }
+    return run;
+}
+
+TEST(flaky_server_is_spared_during_an_outage_and_found_again) {
+    now = 0;
+    CircuitBreaker breaker(testClock, 2024);
+    // a request in 20 is lost, and the server is gone for half an hour
+    FlakyServer server = {10 * 60000UL, 40 * 60000UL, 20, 77};
+    FlakyRun run = runFlaky(breaker, server, 60 * 60000UL);
+
+    // three failures open it, then one probe per backoff: 5 s doubling up to 10 min
+    unsigned long outageMs = server.downUntil - server.downFrom;
+    unsigned long probes = 0;
+    unsigned long elapsed = 0;
+    for (unsigned long nominal = BREAKER_BASE_BACKOFF; elapsed < outageMs; probes++) {
+        elapsed += nominal / 2;
+        nominal = min(nominal * 2, (unsigned long)BREAKER_MAX_BACKOFF);
+    }
+    CHECK(run.attemptsWhileDown <= BREAKER_FAILURE_THRESHOLD + probes);
+    CHECK(run.recoveredAt >= server.downUntil);
+    CHECK(run.recoveredAt - server.downUntil <= BREAKER_MAX_BACKOFF + TEST_PERIOD);
+    // the lost requests alone hardly ever open it
+    CHECK(run.openMs <= outageMs + BREAKER_MAX_BACKOFF + 3 * BREAKER_BASE_BACKOFF);
+    fprintf(stderr, "        %lu attempts, %lu of them in the %lu min outage, back %lu s after it, open %lu min\n",
+            run.attempts, run.attemptsWhileDown, outageMs / 60000, (run.recoveredAt - server.downUntil) / 1000,
+            run.openMs / 60000);
+}
+
+// The manager against the mock API server of the host runtime
+static void connect(ConnectionEventManager& manager) {
+    host::config().serverHandler = nullptr;
+    host::config().serverStatus = CREATED_STATUS;
+    host::config().serverOutageCount = 0;
+    while (!manager.isConnected()) {
+        long wait = manager.resume(millis());
+        delay(wait > 0 ? min(wait, 100L) : 1);
+    }
+}
+
+static void fillEvents(Event* events, int count) {
+    for (int i = 0; i < count; i++) {
+        MeasurementRecord record = makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 20.0f + i,
+                                                         TEST_EPOCH + i * 60);
+        events[i] = Event(OK_STATUS, &record, 1);
+    }
+}
+
+TEST(outages_do_not_use_up_the_retry_budget) {
+    ConnectionEventManager manager;
+    connect(manager);
+    Event events[MAX_MEASUREMENTS];
+    fillEvents(events, MAX_MEASUREMENTS);
+
+    // the server is gone for an hour, the pending events are tried every 10 s
+    host::Config& config = host::config();
+    config.serverOutages[0].start = millis();
+    config.serverOutages[0].end = millis() + 3600000UL;
+    config.serverOutageCount = 1;
+    CHECK_EQUAL(manager.sendNewEvents(events, MAX_MEASUREMENTS), (size_t)0);
+    unsigned long end = millis() + 3600000UL;
+    while (millis() < end) {
+        CHECK_EQUAL(manager.sendMemAllocatedData(), (size_t)0);
+        delay(10000);
+    }
+    CHECK_EQUAL(manager.measurementEvents.size(), (size_t)MAX_MEASUREMENTS);
+    for (size_t i = 0; i < manager.measurementEvents.size(); i++) {
+        CHECK_EQUAL(manager.measurementEvents[i].timesSent, 0);
+    }
+
+    // once it is back the breaker lets a probe through within its longest
+    // backoff, and the rest right after
+    end = millis() + BREAKER_MAX_BACKOFF + 20000;
+    size_t sent = 0;
+    while (!manager.measurementEvents.empty() && millis() < end) {
+        sent += manager.sendMemAllocatedData();
+        delay(10000);
+    }
+    CHECK_EQUAL(sent, (size_t)MAX_MEASUREMENTS);
+    CHECK(manager.measurementEvents.empty());
+    CHECK_EQUAL(manager.getGivenUpCount(), 0ul);
+    config.serverOutageCount = 0;
+}
+
+TEST(rejected_events_are_given_up_and_not_counted_as_sent) {
+    ConnectionEventManager manager;
+    connect(manager);
+    Event events[MAX_MEASUREMENTS];
+    fillEvents(events, MAX_MEASUREMENTS);
+
+    host::config().serverStatus = BAD_REQUEST_STATUS;
+    CHECK_EQUAL(manager.sendNewEvents(events, MAX_MEASUREMENTS), (size_t)0);
+    CHECK_EQUAL(manager.measurementEvents[0].timesSent, 1);
+    for (int i = 1; i < EVENT_RETRY_BUDGET - 1; i++) {
+        CHECK_EQUAL(manager.sendMemAllocatedData(), (size_t)0);
+        CHECK_EQUAL(manager.measurementEvents[0].timesSent, i + 1);
+    }
+    // the last try gives them up, which is not a send
+    CHECK_EQUAL(manager.sendMemAllocatedData(), (size_t)0);
+    CHECK(manager.measurementEvents.empty());
+    CHECK_EQUAL(manager.getGivenUpCount(), (unsigned long)MAX_MEASUREMENTS);
+    CHECK_EQUAL(manager.getLastSentCount(), (size_t)0);
+
+    // what the server takes is counted
+    host::config().serverStatus = CREATED_STATUS;
+    host::config().serverHandler = nullptr;
+    CHECK_EQUAL(manager.sendNewEvents(events, 1), (size_t)1);
+}
+
+// Resumes the manager for duration ms as the scheduler does
+static void runLink(ConnectionEventManager& manager, unsigned long duration) {
+    unsigned long end = millis() + duration;
+    while (millis() < end) {
+        long wait = manager.resume(millis());
+        delay(wait > 0 ? min(wait, 1000L) : 1);
+    }
+}
+
+TEST(quiet_link_stays_up_without_a_probe_host) {
+    ConnectionEventManager manager;
+    connect(manager);
+    unsigned long reconnects = manager.getLinkStats().reconnects;
+    unsigned long attempts = manager.getLinkStats().attempts;
+
+    // nothing sent for three liveness timeouts, the station is still associated
+    runLink(manager, 3 * LIVENESS_TIMEOUT);
+    CHECK(manager.isConnected());
+    CHECK_EQUAL(manager.getLinkStats().reconnects, reconnects);
+    CHECK_EQUAL(manager.getLinkStats().attempts, attempts);
+}
+
+TEST(breaker_keeps_its_backoff_across_a_reconnect) {
+    ConnectionEventManager manager;
+    connect(manager);
+    Event events[MAX_MEASUREMENTS];
+    fillEvents(events, MAX_MEASUREMENTS);
+
+    // the server is gone long enough for the breaker to reach its longest backoff
+    host::Config& config = host::config();
+    config.serverOutages[0].start = millis();
+    config.serverOutages[0].end = millis() + 3 * 3600000UL;
+    config.serverOutageCount = 1;
+    manager.sendNewEvents(events, MAX_MEASUREMENTS);
+    unsigned long end = millis() + 3600000UL;
+    while (millis() < end) {
+        manager.sendMemAllocatedData();
+        runLink(manager, 10000);
+    }
+    CHECK(!manager.uplinkReady());
+
+    // the WiFi drops for a moment right after the next probe failed
+    while (!manager.uplinkReady()) {
+        runLink(manager, 1000);
+    }
+    CHECK_EQUAL(manager.sendMemAllocatedData(), (size_t)0);
+    CHECK(!manager.uplinkReady());
+    unsigned long reconnects = manager.getLinkStats().reconnects;
+    config.wifiOutages[0].start = millis();
+    config.wifiOutages[0].end = millis() + 30000;
+    config.wifiOutageCount = 1;
+    end = millis() + 30000;
+    while (millis() < end || !manager.isConnected()) {
+        runLink(manager, 1000);
+    }
+    config.wifiOutageCount = 0;
+    CHECK_EQUAL(manager.getLinkStats().reconnects, reconnects + 1);
+
+    // the link is back, the server is not: no new probe before the backoff is over
+    CHECK(!manager.uplinkReady());
+    config.serverOutageCount = 0;
+}
@@ -0,0 +1,267 @@
+/*
+* The clock service against an RTC whose second drifts from millis(): the
+* drift estimate, how far the served time strays between syncs, a reference
+* that steps the RTC, and an RTC that glitches or stops ticking.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "Test.h"
+#include "ClockService.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define TEST_PHASE_MS 300       // where in its second the RTC is at the start
+#define TEST_HOURS 12
+
+static unsigned long now = 0;
+
+static unsigned long testClock() {
+    return now;
+}
+
+/*
+* An RTC whose second lasts 1 + ppm / 1e6 of a millis() second, that is millis()
+* runs ppm faster. Writing it starts a new second, as the DS3231 does.
+*/
+struct DriftingRtc : public ClockSource {
+    double ppm;
+    uint32_t baseEpoch;
+    unsigned long baseMs;
+    double phaseMs;
+    bool stuck;
+    int writes;
+
+    DriftingRtc(double driftPpm)
+        : ppm(driftPpm), baseEpoch(TEST_EPOCH), baseMs(now), phaseMs(TEST_PHASE_MS), stuck(false), writes(0) {}
+
+    // RTC time since the base, in ms
+    double rtcMs() const {
+        return (double)(now - baseMs) / (1.0 + ppm / 1e6) + phaseMs;
+    }
+
+    uint32_t epoch() const {
+        return baseEpoch + (uint32_t)(rtcMs() / 1000.0);
+    }
+
+    // RTC time in ms since the epoch, to measure the served time against
+    double epochMs() const {
+        return baseEpoch * 1000.0 + rtcMs();
+    }
+
+    bool read(uint32_t& value) override {
+        value = stuck ? baseEpoch : epoch();
+        return true;
+    }
+
+    bool write(uint32_t value) override {
+        baseEpoch = value;
+        baseMs = now;
+        phaseMs = 0;
+        writes++;
+        return true;
+    }
+};
+
+/*
+* A reference that has a new time once a minute. It starts offset s ahead of the
+* RTC and runs at its rate, so once the RTC is set from it they agree.
+*/
+struct OffsetReference : public ClockSource {
+    double ppm;
+    double baseEpochMs;
+    unsigned long baseMs;
+    unsigned long lastMs;
+
+    OffsetReference(const DriftingRtc& rtc, long offset)
+        : ppm(rtc.ppm), baseEpochMs(rtc.epochMs() + offset * 1000.0), baseMs(now), lastMs(0) {}
+
+    bool read(uint32_t& value) override {
+        if (now - lastMs < 60000) {
+            return false;
+        }
+        lastMs = now;
+        value = (uint32_t)((baseEpochMs + (double)(now - baseMs) / (1.0 + ppm / 1e6)) / 1000.0);
+        return true;
+    }
+};
+
+struct RunStats {
+    // both once the drift is known, from the second sync on
+    double worstErrorMs;        // served minus RTC time, largest magnitude
+    long worstSyncOffsetMs;     // RTC minus served time at the syncs after that
+    bool monotonic;
+};
+
+// Resumes the service as a scheduler would and reads the served time every second
+static RunStats runFor(ClockService& clock, DriftingRtc& rtc, unsigned long duration) {
+    RunStats stats = {0, 0, true};
+    unsigned long end = now + duration;
+    unsigned long syncs = clock.getSyncCount();
+    uint32_t last = clock.now();
+    while (now < end) {
+        long wait = clock.resume(now);
+        now += (wait > 0) ? wait : 1;
+
+        uint32_t served = clock.now();
+        stats.monotonic = stats.monotonic && served >= last;
+        last = served;
+        if (clock.getSyncCount() < 2) {
+            continue;
+        }
+        // the served second is truncated, measure from its middle
+        double error = served * 1000.0 + 500.0 - rtc.epochMs();
+        stats.worstErrorMs = fmax(stats.worstErrorMs, fabs(error));
+        if (clock.getSyncCount() != syncs) {
+            syncs = clock.getSyncCount();
+            if (syncs > 2) {
+                stats.worstSyncOffsetMs = std::max(stats.worstSyncOffsetMs, labs(clock.getLastOffsetMs()));
+            }
+        }
+    }
+    return stats;
+}
+
+// The error one hour of the given drift would build up without the correction
+static double uncorrectedMs(double ppm) {
+    return fabs(ppm) * CLOCK_SYNC_INTERVAL / 1e6;
+}
+
+static void checkDrift(double ppm) {
+    now = 1000;
+    DriftingRtc rtc(ppm);
+    ClockService clock(rtc, testClock);
+    CHECK(clock.begin());
+    RunStats stats = runFor(clock, rtc, TEST_HOURS * CLOCK_SYNC_INTERVAL);
+
+    // an edge is found within CLOCK_EDGE_POLL, over an interval of CLOCK_SYNC_INTERVAL
+    double resolutionPpm = 2.0 * CLOCK_EDGE_POLL * 1e6 / CLOCK_SYNC_INTERVAL;
+    CHECK_NEAR(clock.getDriftPpm(), ppm, resolutionPpm);
+    CHECK(stats.monotonic);
+    CHECK_EQUAL(clock.getFailureCount(), 0ul);
+    CHECK(clock.getSyncCount() >= (unsigned long)TEST_HOURS);
+    // corrected, the served time is within an edge poll of the RTC at every sync,
+    // and within its truncated second in between
+    CHECK(stats.worstSyncOffsetMs <= CLOCK_EDGE_POLL);
+    CHECK(stats.worstErrorMs <= 500.0 + CLOCK_EDGE_POLL);
+    fprintf(stderr, "        %+.0f ppm: estimate %+.1f ppm, worst offset at a sync %ld ms"
+            " (%.0f ms uncorrected)\n", ppm, clock.getDriftPpm(), stats.worstSyncOffsetMs, uncorrectedMs(ppm));
+}
+
+TEST(drift_is_measured_and_corrected) {
+    checkDrift(100);
+    checkDrift(-250);
+    checkDrift(20);
+}
+
+TEST(starts_serving_at_begin) {
+    now = 5000;
+    DriftingRtc rtc(0);
+    ClockService clock(rtc, testClock);
+    CHECK(!clock.isValid());
+    CHECK_EQUAL(clock.now(), 0u);
+    CHECK(clock.begin());
+    CHECK(clock.isValid());
+    CHECK_EQUAL(clock.now(), (uint32_t)TEST_EPOCH);
+
+    // aligned to the RTC second at the first edge, before the first hour is over
+    runFor(clock, rtc, 2000);
+    CHECK_EQUAL(clock.getSyncCount(), 1ul);
+    CHECK_EQUAL(clock.now(), rtc.epoch());
+}
+
+TEST(glitch_in_the_rtc_does_not_move_the_estimate) {
+    now = 1000;
+    DriftingRtc rtc(80);
+    ClockService clock(rtc, testClock);
+    CHECK(clock.begin());
+    runFor(clock, rtc, 4 * CLOCK_SYNC_INTERVAL);
+    float before = clock.getDriftPpm();
+    unsigned long syncs = clock.getSyncCount();
+
+    // the RTC jumps 5 s between two syncs, more than CLOCK_MAX_DRIFT_PPM over the interval
+    rtc.baseEpoch += 5;
+    bool monotonic = true;
+    for (unsigned long end = now + CLOCK_SYNC_INTERVAL + 2000; clock.getSyncCount() == syncs && now < end;) {
+        monotonic = monotonic && runFor(clock, rtc, 1000).monotonic;
+    }
+    CHECK_EQUAL(clock.getSyncCount(), syncs + 1);
+    CHECK_EQUAL(clock.getDriftPpm(), before);
+    // the served time follows the RTC at the sync
+    CHECK_NEAR(clock.getLastOffsetMs(), 5000, 3 * CLOCK_EDGE_POLL);
+    CHECK_EQUAL(clock.now(), rtc.epoch());
+    CHECK(monotonic);
+}
+
+TEST(reference_steps_the_rtc_and_drift_is_measured_again) {
+    now = 1000;
+    DriftingRtc rtc(150);
+    ClockService clock(rtc, testClock);
+    OffsetReference reference(rtc, 10);
+    CHECK(clock.begin());
+    runFor(clock, rtc, 2 * CLOCK_SYNC_INTERVAL);
+    clock.setReference(&reference);
+
+    runFor(clock, rtc, CLOCK_REFERENCE_INTERVAL + 2000);
+    CHECK_EQUAL(rtc.writes, 1);
+    uint32_t expected = rtc.epoch();
+    CHECK(clock.now() + 1 >= expected && clock.now() <= expected);
+
+    // from here on the reference is within tolerance and leaves the RTC alone
+    RunStats stats = runFor(clock, rtc, 3 * CLOCK_SYNC_INTERVAL);
+    CHECK_EQUAL(rtc.writes, 1);
+    // the 10 s step did not become a drift sample
+    double resolutionPpm = 2.0 * CLOCK_EDGE_POLL * 1e6 / CLOCK_SYNC_INTERVAL;
+    CHECK_NEAR(clock.getDriftPpm(), 150.0, resolutionPpm);
+    CHECK(stats.worstSyncOffsetMs <= CLOCK_EDGE_POLL);
+}
+
+TEST(reference_behind_the_rtc_steps_it_back_once) {
+    now = 1000;
+    DriftingRtc rtc(0);
+    ClockService clock(rtc, testClock);
+    OffsetReference reference(rtc, -5);
+    CHECK(clock.begin());
+    runFor(clock, rtc, 2 * CLOCK_SYNC_INTERVAL);
+    clock.setReference(&reference);
+
+    runFor(clock, rtc, CLOCK_REFERENCE_INTERVAL + 2000);
+    CHECK_EQUAL(rtc.writes, 1);
+    uint32_t expected = rtc.epoch();
+    CHECK(clock.now() + 1 >= expected && clock.now() <= expected);
+
+    // a second or less behind is within tolerance, not a step of 2^32 - 1 s
+    runFor(clock, rtc, 10 * CLOCK_REFERENCE_INTERVAL);
+    CHECK_EQUAL(rtc.writes, 1);
+    CHECK_EQUAL(clock.getFailureCount(), 0ul);
+}
+
+TEST(reference_within_tolerance_behind_leaves_the_rtc_alone) {
+    now = 1000;
+    DriftingRtc rtc(0);
+    ClockService clock(rtc, testClock);
+    OffsetReference reference(rtc, -CLOCK_RTC_TOLERANCE);
+    CHECK(clock.begin());
+    runFor(clock, rtc, 2 * CLOCK_SYNC_INTERVAL);
+    clock.setReference(&reference);
+
+    runFor(clock, rtc, 10 * CLOCK_REFERENCE_INTERVAL);
+    CHECK_EQUAL(rtc.writes, 0);
+}
+
+TEST(stuck_rtc_is_a_failure_and_time_goes_on) {
+    now = 1000;
+    DriftingRtc rtc(0);
+    ClockService clock(rtc, testClock);
+    CHECK(clock.begin());
+    runFor(clock, rtc, 2000);
+    uint32_t before = clock.now();
+
+    rtc.baseEpoch = rtc.epoch();
+    rtc.stuck = true;
+    RunStats stats = runFor(clock, rtc, CLOCK_SYNC_INTERVAL + 2 * CLOCK_EDGE_TIMEOUT);
+    CHECK_EQUAL(clock.getFailureCount(), 1ul);
+    CHECK(stats.monotonic);
+    // served from millis() all along
+    CHECK(clock.now() >= before + CLOCK_SYNC_INTERVAL / 1000);
+}
@@ -0,0 +1,254 @@
+/*
+* The WiFi state machine against a mocked radio on a clock of its own: how long
+* the link takes to come back, and how long a resume keeps the caller waiting,
+* next to the blocking connect loop it replaced.
+*/
+
+#include <algorithm>
+#include "Test.h"
+#include "ConnectionStateMachine.h"
+
+#define TEST_ASSOCIATION_MS 3000    // from begin to connected while the access point is up
+#define TEST_BEGIN_MS 5             // what the radio calls take, charged to the clock
+#define TEST_PROBE_MS 40
+#define LEGACY_CONNECT_TRIES 600    // the loop of the former connect, one second apart
+
+static unsigned long now = 0;
+
+static unsigned long testClock() {
+    return now;
+}
+
+/*
+* The station interface: associates TEST_ASSOCIATION_MS after begin while the
+* access point is up, and drops as soon as it goes down.
+*/
+struct MockRadio {
+    bool apUp = true;
+    bool probeAnswers = true;
+    bool started = false;
+    unsigned long startedAt = 0;
+    int begins = 0;
+    int disconnects = 0;
+    int probes = 0;
+
+    void begin() {
+        begins++;
+        started = true;
+        startedAt = now;
+        now += TEST_BEGIN_MS;
+    }
+
+    bool isConnected() {
+        if (!apUp) {
+            startedAt = now;
+            return false;
+        }
+        return started && now - startedAt >= TEST_ASSOCIATION_MS;
+    }
+
+    void disconnect() {
+        disconnects++;
+        started = false;
+    }
+
+    bool probe() {
+        probes++;
+        now += TEST_PROBE_MS;
+        return probeAnswers;
+    }
+};
+
+typedef ConnectionStateMachine<MockRadio> Link;
+
+struct RunStats {
+    unsigned long longestStall;     // longest a single resume kept the caller
+    unsigned long longestWait;      // longest a resume asked to sleep
+    unsigned long resumes;
+};
+
+// Resumes the link for duration ms as a scheduler would, flipping the access point with apAt
+static RunStats runFor(Link& link, MockRadio& radio, unsigned long duration, bool (*apAt)(unsigned long) = nullptr) {
+    RunStats stats = {0, 0, 0};
+    unsigned long end = now + duration;
+    while ((long)(now - end) < 0) {
+        if (apAt != nullptr) {
+            radio.apUp = apAt(now);
+        }
+        unsigned long start = now;
+        long wait = link.resume(now);
+        stats.longestStall = std::max(stats.longestStall, now - start);
+        stats.longestWait = std::max(stats.longestWait, (unsigned long)wait);
+        stats.resumes++;
+        now += (wait > 0) ? wait : 1;
+    }
+    return stats;
+}
+
+// Runs until the link is up, for at most limit ms
+static bool waitUp(Link& link, MockRadio& radio, unsigned long limit) {
+    unsigned long end = now + limit;
+    while (!link.isUp() && (long)(now - end) < 0) {
+        runFor(link, radio, 1);
+    }
+    return link.isUp();
+}
+
+TEST(first_resume_starts_connecting) {
+    now = 1000;
+    MockRadio radio;
+    Link link(radio, testClock, 1);
+    CHECK_EQUAL(link.state(), LINK_DOWN);
+    CHECK_EQUAL(link.resume(now), (long)CONNECT_POLL_INTERVAL);
+    CHECK_EQUAL(link.state(), LINK_CONNECTING);
+    CHECK_EQUAL(radio.begins, 1);
+
+    CHECK(waitUp(link, radio, TEST_ASSOCIATION_MS + CONNECT_POLL_INTERVAL + TEST_BEGIN_MS));
+    CHECK_EQUAL(link.stats().attempts, 1ul);
+    CHECK_EQUAL(link.stats().reconnects, 0ul);
+}
+
+TEST(attempt_times_out_and_resets_the_radio) {
+    now = 0;
+    MockRadio radio;
+    radio.apUp = false;
+    Link link(radio, testClock, 2);
+    runFor(link, radio, CONNECT_TIMEOUT + CONNECT_POLL_INTERVAL);
+    CHECK_EQUAL(link.state(), LINK_DOWN);
+    CHECK_EQUAL(radio.disconnects, 1);
+    CHECK_EQUAL(radio.begins, 1);
+}
+
+static bool apDownForAMinute(unsigned long time) {
+    return time < 10000 || time >= 70000;
+}
+
+TEST(lost_link_comes_back_right_after_the_access_point) {
+    now = 0;
+    MockRadio radio;
+    Link link(radio, testClock, 3);
+    RunStats stats = runFor(link, radio, 120000, apDownForAMinute);
+
+    CHECK(link.isUp());
+    CHECK_EQUAL(link.stats().reconnects, 1ul);
+    // the station keeps trying in the current attempt, which sees the access point back;
+    // the loss is noticed at the next status check
+    unsigned long outage = 60000;
+    CHECK(link.stats().lastReconnectMs >= outage + TEST_ASSOCIATION_MS - LINK_CHECK_INTERVAL);
+    CHECK(link.stats().lastReconnectMs <= outage + TEST_ASSOCIATION_MS + RECONNECT_BASE_BACKOFF * 8 + CONNECT_TIMEOUT);
+    CHECK(stats.longestStall <= TEST_BEGIN_MS);
+    CHECK(stats.longestWait <= LINK_CHECK_INTERVAL);
+}
+
+static bool apDownForAnHour(unsigned long time) {
+    return time < 10000 || time >= 10000 + 3600000UL;
+}
+
+TEST(retries_back_off_during_a_long_outage) {
+    now = 0;
+    MockRadio radio;
+    Link link(radio, testClock, 4);
+    RunStats stats = runFor(link, radio, 3600000UL + 600000UL, apDownForAnHour);
+
+    // every attempt lasts CONNECT_TIMEOUT, then waits at least half of a doubling backoff
+    unsigned long attempts = 1;
+    unsigned long elapsed = CONNECT_TIMEOUT;
+    for (unsigned long backoff = RECONNECT_BASE_BACKOFF; elapsed < 3600000UL; attempts++) {
+        elapsed += backoff / 2 + CONNECT_TIMEOUT;
+        backoff = std::min(backoff * 2, (unsigned long)RECONNECT_MAX_BACKOFF);
+    }
+    CHECK(link.isUp());
+    CHECK(link.stats().attempts <= 1 + attempts + 1);
+    CHECK(link.stats().lastReconnectMs <= 3600000UL + RECONNECT_MAX_BACKOFF + CONNECT_TIMEOUT);
+    // the caller is never held, nor asked to sleep past a status check
+    CHECK(stats.longestStall <= TEST_BEGIN_MS);
+    CHECK(stats.longestWait <= LINK_CHECK_INTERVAL);
+    fprintf(stderr, "        1 h outage: %lu attempts, back %lu s after it, longest stall %lu ms\n",
+            link.stats().attempts, (link.stats().lastReconnectMs - 3600000UL) / 1000, stats.longestStall);
+}
+
+TEST(lost_link_notice_is_acted_on_at_the_next_resume) {
+    now = 0;
+    MockRadio radio;
+    Link link(radio, testClock, 5);
+    CHECK(waitUp(link, radio, 10000));
+
+    // the radio still says connected, the event handler knows better
+    link.notifyLinkLost();
+    // and the first attempt does not wait for a backoff
+    CHECK_EQUAL(link.resume(now), (long)CONNECT_POLL_INTERVAL);
+    CHECK_EQUAL(link.state(), LINK_CONNECTING);
+    CHECK_EQUAL(radio.disconnects, 1);
+    CHECK_EQUAL(radio.begins, 2);
+    CHECK(waitUp(link, radio, TEST_ASSOCIATION_MS + CONNECT_POLL_INTERVAL + TEST_BEGIN_MS));
+    CHECK_EQUAL(link.stats().reconnects, 1ul);
+}
+
+TEST(quiet_link_is_probed_and_reset_when_the_probe_fails) {
+    now = 0;
+    MockRadio radio;
+    Link link(radio, testClock, 6);
+    CHECK(waitUp(link, radio, 10000));
+
+    // answers from the uplink keep the probe away
+    for (int i = 0; i < 20; i++) {
+        link.noteAlive();
+        runFor(link, radio, LIVENESS_TIMEOUT / 10);
+    }
+    CHECK_EQUAL(radio.probes, 0);
+
+    RunStats stats = runFor(link, radio, LIVENESS_TIMEOUT + LINK_CHECK_INTERVAL);
+    CHECK_EQUAL(radio.probes, 1);
+    CHECK(link.isUp());
+    CHECK(stats.longestStall <= TEST_PROBE_MS);
+
+    radio.probeAnswers = false;
+    runFor(link, radio, LIVENESS_TIMEOUT + LINK_CHECK_INTERVAL);
+    CHECK_EQUAL(radio.probes, 2);
+    CHECK_EQUAL(link.stats().reconnects, 1ul);
+}
+
+/*
+* The connect of the former ConnectionEventManager: begin, then a status check
+* every second for up to ten minutes, all of it inside one call.
+* @return true if the link came up
+*/
+static bool legacyConnect(MockRadio& radio, bool (*apAt)(unsigned long)) {
+    radio.disconnect();
+    radio.begin();
+    for (int count = 0; count < LEGACY_CONNECT_TRIES; count++) {
+        radio.apUp = apAt(now);
+        if (radio.isConnected()) {
+            return true;
+        }
+        now += 1000;
+    }
+    return false;
+}
+
+static bool apDownForFiveMinutes(unsigned long time) {
+    return time < 10000 || time >= 310000;
+}
+
+TEST(stall_compared_with_the_blocking_connect) {
+    now = 0;
+    MockRadio radio;
+    Link link(radio, testClock, 7);
+    RunStats stats = runFor(link, radio, 400000, apDownForFiveMinutes);
+    CHECK(link.isUp());
+    unsigned long reconnectMs = link.stats().lastReconnectMs;
+
+    // the legacy loop gets the link back as soon, holding the loop all along
+    now = 10000;
+    MockRadio legacy;
+    unsigned long start = now;
+    CHECK(legacyConnect(legacy, apDownForFiveMinutes));
+    unsigned long legacyStall = now - start;
+
+    CHECK(stats.longestStall <= TEST_BEGIN_MS);
+    CHECK(legacyStall >= 300000);
+    CHECK(reconnectMs <= legacyStall + RECONNECT_MAX_BACKOFF);
+    fprintf(stderr, "        5 min outage: state machine back after %lu s, longest stall %lu ms;"
+            " blocking connect back after %lu s, stalled %lu s\n",
+            reconnectMs / 1000, stats.longestStall, legacyStall / 1000, legacyStall / 1000);
+}
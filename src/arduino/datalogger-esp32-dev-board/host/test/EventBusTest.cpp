@@ -0,0 +1,254 @@
+/*
+* The typed channels: delivery in subscription order, a full subscriber table,
+* and handlers that subscribe, unsubscribe or publish again while the channel is
+* dispatching.
+*/
+
+#include "Test.h"
+#include "EventBus.h"
+#include "MeasurementRecord.h"
+
+#define TEST_SUBSCRIBERS 4
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+
+typedef Channel<int, TEST_SUBSCRIBERS> TestChannel;
+
+// Every call of every recorder, in order
+static int calls[64];
+static int callCount = 0;
+
+static void resetCalls() {
+    callCount = 0;
+}
+
+struct Recorder {
+    int id;
+    int received;
+    int last;
+    TestChannel* channel;
+    Recorder* other;        // what the handlers below act on
+
+    explicit Recorder(int recorderId)
+        : id(recorderId), received(0), last(-1), channel(nullptr), other(nullptr) {}
+
+    void note(int message) {
+        received++;
+        last = message;
+        if (callCount < (int)(sizeof(calls) / sizeof(calls[0]))) {
+            calls[callCount] = id;
+        }
+        callCount++;
+    }
+
+    void onMessage(const int& message) {
+        note(message);
+    }
+
+    void onMessageUnsubscribeOther(const int& message) {
+        note(message);
+        channel->unsubscribe<Recorder, &Recorder::onMessage>(other);
+    }
+
+    void onMessageUnsubscribeSelf(const int& message) {
+        note(message);
+        channel->unsubscribe<Recorder, &Recorder::onMessageUnsubscribeSelf>(this);
+    }
+
+    void onMessageSubscribeOther(const int& message) {
+        note(message);
+        channel->subscribe<Recorder, &Recorder::onMessage>(other);
+    }
+
+    // publishes the message one smaller until it reaches zero
+    void onMessageCountDown(const int& message) {
+        note(message);
+        if (message > 0) {
+            channel->publish(message - 1);
+        }
+    }
+
+    // as above, and drops the other subscriber in the innermost dispatch
+    void onMessageCountDownThenUnsubscribe(const int& message) {
+        note(message);
+        if (message > 0) {
+            channel->publish(message - 1);
+        } else {
+            channel->unsubscribe<Recorder, &Recorder::onMessage>(other);
+        }
+    }
+};
+
+// The plain handler, in one argument for CHECK
+static bool subscribe(TestChannel& channel, Recorder* recorder) {
+    return channel.subscribe<Recorder, &Recorder::onMessage>(recorder);
+}
+
+static bool unsubscribe(TestChannel& channel, Recorder* recorder) {
+    return channel.unsubscribe<Recorder, &Recorder::onMessage>(recorder);
+}
+
+TEST(subscribers_are_called_in_the_order_they_subscribed) {
+    TestChannel channel;
+    Recorder a(1), b(2), c(3);
+    CHECK(subscribe(channel, &b));
+    CHECK(subscribe(channel, &a));
+    CHECK(subscribe(channel, &c));
+    // once each
+    CHECK(!subscribe(channel, &a));
+    CHECK_EQUAL(channel.subscriberCount(), (size_t)3);
+
+    resetCalls();
+    channel.publish(7);
+    CHECK_EQUAL(callCount, 3);
+    CHECK_EQUAL(calls[0], 2);
+    CHECK_EQUAL(calls[1], 1);
+    CHECK_EQUAL(calls[2], 3);
+    CHECK_EQUAL(a.last, 7);
+
+    CHECK(unsubscribe(channel, &a));
+    CHECK(!unsubscribe(channel, &a));
+    channel.publish(8);
+    CHECK_EQUAL(a.received, 1);
+    CHECK_EQUAL(b.received, 2);
+    CHECK_EQUAL(c.last, 8);
+}
+
+TEST(full_subscriber_table_rejects_another) {
+    TestChannel channel;
+    Recorder recorders[TEST_SUBSCRIBERS + 1] = {Recorder(0), Recorder(1), Recorder(2), Recorder(3), Recorder(4)};
+    for (int i = 0; i < TEST_SUBSCRIBERS; i++) {
+        CHECK(subscribe(channel, &recorders[i]));
+    }
+    CHECK(!subscribe(channel, &recorders[TEST_SUBSCRIBERS]));
+    CHECK(!channel.subscribe(nullptr, &recorders[TEST_SUBSCRIBERS]));
+    CHECK_EQUAL(channel.subscriberCount(), (size_t)TEST_SUBSCRIBERS);
+
+    channel.publish(1);
+    CHECK_EQUAL(recorders[TEST_SUBSCRIBERS].received, 0);
+    for (int i = 0; i < TEST_SUBSCRIBERS; i++) {
+        CHECK_EQUAL(recorders[i].received, 1);
+    }
+
+    // a freed slot takes the next one
+    CHECK(unsubscribe(channel, &recorders[1]));
+    CHECK(subscribe(channel, &recorders[TEST_SUBSCRIBERS]));
+    channel.publish(2);
+    CHECK_EQUAL(recorders[1].received, 1);
+    CHECK_EQUAL(recorders[TEST_SUBSCRIBERS].received, 1);
+}
+
+TEST(unsubscribe_during_dispatch_skips_the_removed_subscriber) {
+    TestChannel channel;
+    Recorder first(1), second(2), third(3);
+    first.channel = &channel;
+    first.other = &second;
+    third.channel = &channel;
+    channel.subscribe<Recorder, &Recorder::onMessageUnsubscribeOther>(&first);
+    channel.subscribe<Recorder, &Recorder::onMessage>(&second);
+    channel.subscribe<Recorder, &Recorder::onMessageUnsubscribeSelf>(&third);
+
+    // second is removed before its turn, third removes itself after being called
+    resetCalls();
+    channel.publish(1);
+    CHECK_EQUAL(callCount, 2);
+    CHECK_EQUAL(calls[0], 1);
+    CHECK_EQUAL(calls[1], 3);
+    CHECK_EQUAL(second.received, 0);
+    CHECK_EQUAL(channel.subscriberCount(), (size_t)1);
+
+    // the cleared slots were compacted away once the dispatch ended
+    channel.publish(2);
+    CHECK_EQUAL(first.received, 2);
+    CHECK_EQUAL(third.received, 1);
+    Recorder others[TEST_SUBSCRIBERS - 1] = {Recorder(4), Recorder(5), Recorder(6)};
+    for (int i = 0; i < TEST_SUBSCRIBERS - 1; i++) {
+        CHECK(subscribe(channel, &others[i]));
+    }
+}
+
+TEST(subscribe_during_dispatch_takes_effect_on_the_next_message) {
+    TestChannel channel;
+    Recorder adder(1), added(2);
+    adder.channel = &channel;
+    adder.other = &added;
+    channel.subscribe<Recorder, &Recorder::onMessageSubscribeOther>(&adder);
+
+    channel.publish(1);
+    CHECK_EQUAL(added.received, 0);
+    CHECK_EQUAL(channel.subscriberCount(), (size_t)2);
+
+    // subscribing again from the handler is refused, added is called once
+    channel.publish(2);
+    CHECK_EQUAL(added.received, 1);
+    CHECK_EQUAL(added.last, 2);
+    CHECK_EQUAL(channel.subscriberCount(), (size_t)2);
+}
+
+TEST(nested_publish_reaches_every_subscriber_at_each_depth) {
+    TestChannel channel;
+    Recorder counter(1), listener(2);
+    counter.channel = &channel;
+    channel.subscribe<Recorder, &Recorder::onMessageCountDown>(&counter);
+    channel.subscribe<Recorder, &Recorder::onMessage>(&listener);
+
+    // 3 publishes 2, which publishes 1 and 0, each before the listener sees the outer one
+    resetCalls();
+    channel.publish(3);
+    CHECK_EQUAL(counter.received, 4);
+    CHECK_EQUAL(listener.received, 4);
+    CHECK_EQUAL(callCount, 8);
+    CHECK_EQUAL(calls[0], 1);
+    CHECK_EQUAL(calls[3], 1);
+    CHECK_EQUAL(calls[4], 2);
+    // the outermost message reached the listener last
+    CHECK_EQUAL(listener.last, 3);
+}
+
+TEST(unsubscribe_in_a_nested_publish_holds_for_the_outer_ones) {
+    TestChannel channel;
+    Recorder counter(1), listener(2);
+    counter.channel = &channel;
+    counter.other = &listener;
+    channel.subscribe<Recorder, &Recorder::onMessageCountDownThenUnsubscribe>(&counter);
+    channel.subscribe<Recorder, &Recorder::onMessage>(&listener);
+
+    // the innermost dispatch removes the listener before any dispatch reached it
+    channel.publish(2);
+    CHECK_EQUAL(counter.received, 3);
+    CHECK_EQUAL(listener.received, 0);
+    CHECK_EQUAL(channel.subscriberCount(), (size_t)1);
+
+    // removed for good once the outermost dispatch ended
+    channel.publish(0);
+    CHECK_EQUAL(listener.received, 0);
+    CHECK(subscribe(channel, &listener));
+}
+
+// The channel the sensors publish on, with spans of records
+struct SpanSum {
+    float total;
+    size_t records;
+
+    SpanSum() : total(0), records(0) {}
+
+    void onRecords(const RecordSpan& span) {
+        for (const MeasurementRecord& record : span) {
+            total += record.value;
+            records++;
+        }
+    }
+};
+
+TEST(record_spans_are_handed_over_without_copying) {
+    Channel<RecordSpan, TEST_SUBSCRIBERS> channel;
+    SpanSum sum;
+    channel.subscribe<SpanSum, &SpanSum::onRecords>(&sum);
+    MeasurementRecord records[] = {
+        makeMeasurementRecord(TEMPERATURE_VARIABLE, 0, 21.5f, TEST_EPOCH),
+        makeMeasurementRecord(HUMIDITY_VARIABLE, 0, 60.0f, TEST_EPOCH)};
+    RecordSpan span = {records, 2};
+    CHECK(span.end() - span.begin() == 2);
+    channel.publish(span);
+    CHECK_EQUAL(sum.records, (size_t)2);
+    CHECK_NEAR(sum.total, 81.5, 0.001);
+}
@@ -0,0 +1,281 @@
+/*
+* The single pass parser of the event lines kept on the SD card: the lines
+* toString writes, those of older firmware, broken ones, and a fuzz run over
+* mutations of all of them. Build with DATALOGGER_SANITIZE to have reads past
+* the line caught as well.
+*/
+
+#include <limits.h>
+#include <math.h>
+#include <Arduino.h>
+#include "Test.h"
+#include "Event.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define FUZZ_ITERATIONS 50000
+#define FUZZ_MAX_LINE 1024
+
+// Parses a copy, the parser writes into its buffer
+static int parse(const char* text, EventLine& out, char* buffer, size_t size) {
+    size_t length = strlen(text);
+    if (length > size) {
+        return -1;
+    }
+    memcpy(buffer, text, length);
+    return parseEventLine(buffer, length, out);
+}
+
+static int parse(const char* text) {
+    char buffer[FUZZ_MAX_LINE];
+    EventLine line;
+    return parse(text, line, buffer, sizeof(buffer));
+}
+
+static Event dhtEvent() {
+    const MeasurementRecord records[] = {
+        makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 23.45f, TEST_EPOCH),
+        makeMeasurementRecord(HUMIDITY_VARIABLE, DEFAULT_CROP, 61.2f, TEST_EPOCH),
+        makeMeasurementRecord(VPD_VARIABLE, DEFAULT_CROP, 1.12f, TEST_EPOCH),
+        makeMeasurementRecord(DEWPOINT_VARIABLE, DEFAULT_CROP, -15.67f, TEST_EPOCH)};
+    return Event(OK_STATUS, records, 4);
+}
+
+// Lines as they are found on cards, the first ones written by toString
+static const char* const legacyLines[] = {
+    "{\"type\":2,\"statusCode\":200,\"datetime\":\"2024-06-01T12:00:00\",\"data\":[{\"variable\": \"a\", "
+    "\"value\": 23.45, \"crop\": \"c\", \"datetime\": \"2024-06-01T12:00:00\"}],\"timesSent\":1}",
+    "{\"type\":2,\"statusCode\":500,\"datetime\":\"\",\"data\":\"DHT sensor not found\",\"timesSent\":0}\n",
+    "{\"type\":0,\"statusCode\":200,\"datetime\":\"2024-06-01 12:00:00 -05:00\",\"data\":\"\",\"timesSent\":0}\r\n",
+    "{\"type\":2,\"statusCode\":200,\"datetime\":\"x\",\"data\":{\"note\":\"a } and \\\"timesSent\\\": 9\"},"
+    "\"timesSent\":2}",
+    "{ \"timesSent\" : 3 , \"data\" : [1,[2,[3,[]]]] , \"type\" : 2 , \"extra\" : [true,false,null] }",
+};
+
+TEST(reads_what_to_string_writes) {
+    Event event = dhtEvent();
+    event.timesSent = 4;
+    String text = event.toString();
+    char buffer[FUZZ_MAX_LINE];
+    EventLine line;
+    CHECK_EQUAL(parse(text.c_str(), line, buffer, sizeof(buffer)), EVENT_LINE_OK);
+    CHECK_EQUAL(line.type, MEASUREMENT_EVENT);
+    CHECK_EQUAL(line.statusCode, OK_STATUS);
+    CHECK_EQUAL(line.timesSent, 4);
+    CHECK_EQUAL(line.numRecords, 4);
+    CHECK_EQUAL(line.dataLength, (size_t)0);
+    // the records carry the time, the event itself has none
+    CHECK_EQUAL(line.datetimeLength, (size_t)0);
+    for (int i = 0; i < 4; i++) {
+        CHECK(line.records[i] == event.getRecords()[i]);
+    }
+}
+
+TEST(keeps_the_payload_of_older_firmware) {
+    char buffer[FUZZ_MAX_LINE];
+    EventLine line;
+    CHECK_EQUAL(parse(legacyLines[0], line, buffer, sizeof(buffer)), EVENT_LINE_OK);
+    CHECK_EQUAL(line.numRecords, 0);
+    CHECK_EQUAL(line.timesSent, 1);
+    CHECK(strncmp(line.data, "[{\"variable\": \"a\"", 17) == 0);
+    CHECK_EQUAL(line.data[line.dataLength - 1], ']');
+
+    CHECK_EQUAL(parse(legacyLines[1], line, buffer, sizeof(buffer)), EVENT_LINE_OK);
+    CHECK_EQUAL(line.data, "\"DHT sensor not found\"");
+}
+
+TEST(skips_quotes_and_braces_inside_strings) {
+    char buffer[FUZZ_MAX_LINE];
+    EventLine line;
+    CHECK_EQUAL(parse(legacyLines[3], line, buffer, sizeof(buffer)), EVENT_LINE_OK);
+    CHECK_EQUAL(line.timesSent, 2);
+    CHECK_EQUAL(line.data, "{\"note\":\"a } and \\\"timesSent\\\": 9\"}");
+}
+
+TEST(takes_keys_in_any_order) {
+    char buffer[FUZZ_MAX_LINE];
+    EventLine line;
+    CHECK_EQUAL(parse(legacyLines[4], line, buffer, sizeof(buffer)), EVENT_LINE_OK);
+    CHECK_EQUAL(line.type, 2);
+    CHECK_EQUAL(line.timesSent, 3);
+    CHECK_EQUAL(line.statusCode, -1);
+    // a missing datetime is empty, not the end of the buffer
+    CHECK_EQUAL(line.datetime, "");
+}
+
+TEST(reports_blank_lines) {
+    CHECK_EQUAL(parse(""), EVENT_LINE_EMPTY);
+    CHECK_EQUAL(parse(" \t\r\n"), EVENT_LINE_EMPTY);
+}
+
+TEST(reports_broken_lines) {
+    CHECK_EQUAL(parse("{}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"statusCode\":200}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2} trailing"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"datetime\":\"unterminated}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"datetime\":\"bad \\q escape\"}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"data\":[[1,0,2.5,1717243200,0]]}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"data\":[[1,0,2.5,1717243200,0,0],[1]]}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"data\":[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"data\":tru}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":-}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":1e}"), EVENT_LINE_MALFORMED);
+}
+
+TEST(rejects_records_that_do_not_fit) {
+    // each of these casts would be undefined or silently wrap
+    const char* const lines[] = {
+        "{\"type\":2,\"data\":[[256,0,1.0,1717243200,0,0]]}",
+        "{\"type\":2,\"data\":[[-1,0,1.0,1717243200,0,0]]}",
+        "{\"type\":2,\"data\":[[0,300,1.0,1717243200,0,0]]}",
+        "{\"type\":2,\"data\":[[0,0,1e39,1717243200,0,0]]}",
+        "{\"type\":2,\"data\":[[0,0,1e999999999,1717243200,0,0]]}",
+        "{\"type\":2,\"data\":[[0,0,1.0,4294967296,0,0]]}",
+        "{\"type\":2,\"data\":[[0,0,1.0,-1,0,0]]}",
+        "{\"type\":2,\"data\":[[0,0,1.0,1717243200,40000,0]]}",
+        "{\"type\":2,\"data\":[[0,0,1.0,1717243200,0,1000]]}",
+        "{\"type\":2,\"data\":[[0.5,0,1.0,1717243200,0,0]]}",
+        "{\"type\":2,\"data\":[[0,0,1.0,1717243200.5,0,0]]}",
+    };
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        CHECK_EQUAL(parse(lines[i]), EVENT_LINE_MALFORMED);
+    }
+}
+
+TEST(rejects_integer_fields_that_do_not_fit) {
+    CHECK_EQUAL(parse("{\"type\":2.5}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":1e10}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"statusCode\":-3000000000}"), EVENT_LINE_MALFORMED);
+    CHECK_EQUAL(parse("{\"type\":2,\"timesSent\":1e999999999}"), EVENT_LINE_MALFORMED);
+}
+
+TEST(accepts_the_edges_of_every_field) {
+    char buffer[FUZZ_MAX_LINE];
+    EventLine line;
+    CHECK_EQUAL(parse("{\"type\":-2147483648,\"data\":[[255,255,-3.4e38,4294967295,-32768,255],"
+                      "[0,0,0,0,32767,0]]}",
+                      line, buffer, sizeof(buffer)),
+                EVENT_LINE_OK);
+    CHECK_EQUAL(line.type, INT_MIN);
+    CHECK_EQUAL(line.records[0].variableId, (uint8_t)255);
+    CHECK_EQUAL(line.records[0].epoch, (uint32_t)UINT32_MAX);
+    CHECK_EQUAL(line.records[0].status, (int16_t)INT16_MIN);
+    CHECK_EQUAL(line.records[1].status, (int16_t)INT16_MAX);
+    CHECK_EQUAL(parse("{\"type\":2,\"data\":[[0,0,1.5e-3,1.7e9,2e2,0]]}"), EVENT_LINE_OK);
+}
+
+// xorshift, so a failing iteration can be replayed
+static uint32_t fuzzState = 2463534242u;
+
+static uint32_t fuzzNext(uint32_t bound) {
+    fuzzState ^= fuzzState << 13;
+    fuzzState ^= fuzzState >> 17;
+    fuzzState ^= fuzzState << 5;
+    return fuzzState % bound;
+}
+
+// Applies one random edit, the characters are those that matter to the parser
+static size_t mutate(char* line, size_t length, size_t capacity) {
+    static const char alphabet[] = "{}[]\",:\\-+.eE0123456789 tfnu\n";
+    static const char* const numbers[] = {"1e999999999", "-1", "4294967296", "1e39", "2.5", "99999999999999999999",
+                                          "-0", "1e-999"};
+    size_t at = length > 0 ? fuzzNext(length) : 0;
+    switch (fuzzNext(6)) {
+        case 0:  // replace a character
+            if (length > 0) {
+                line[at] = alphabet[fuzzNext(sizeof(alphabet) - 1)];
+            }
+            return length;
+        case 1:  // insert a character
+            if (length < capacity) {
+                memmove(line + at + 1, line + at, length - at);
+                line[at] = alphabet[fuzzNext(sizeof(alphabet) - 1)];
+                return length + 1;
+            }
+            return length;
+        case 2: {  // delete a run
+            size_t run = fuzzNext(8) + 1;
+            run = at + run > length ? length - at : run;
+            memmove(line + at, line + at + run, length - at - run);
+            return length - run;
+        }
+        case 3:  // cut the line short, as a power loss would
+            return at;
+        case 4: {  // put a number that does not fit somewhere
+            const char* number = numbers[fuzzNext(sizeof(numbers) / sizeof(numbers[0]))];
+            size_t size = strlen(number);
+            if (length + size > capacity) {
+                return length;
+            }
+            memmove(line + at + size, line + at, length - at);
+            memcpy(line + at, number, size);
+            return length + size;
+        }
+        default: {  // repeat a piece, nesting grows this way
+            size_t run = fuzzNext(16) + 1;
+            run = at + run > length ? length - at : run;
+            if (length + run > capacity) {
+                return length;
+            }
+            memmove(line + at + run, line + at, length - at);
+            return length + run;
+        }
+    }
+}
+
+TEST(fuzzed_lines_never_break_the_parser) {
+    // the corpus: what toString writes for each kind of event and what older firmware wrote
+    const int corpusSize = 4 + sizeof(legacyLines) / sizeof(legacyLines[0]);
+    String corpus[corpusSize];
+    corpus[0] = dhtEvent().toString();
+    Event timeEvent(TIME_EVENT, OK_STATUS, "", "");
+    timeEvent.setEpoch(TEST_EPOCH);
+    corpus[1] = timeEvent.toString();
+    corpus[2] = Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "No valid data").toString();
+    corpus[3] = Event().toString();
+    for (size_t i = 0; i < sizeof(legacyLines) / sizeof(legacyLines[0]); i++) {
+        corpus[4 + i] = legacyLines[i];
+    }
+
+    int results[3] = {0, 0, 0};
+    for (int iteration = 0; iteration < FUZZ_ITERATIONS; iteration++) {
+        char work[FUZZ_MAX_LINE];
+        const String& seed = corpus[fuzzNext(corpusSize)];
+        size_t length = seed.length();
+        memcpy(work, seed.c_str(), length);
+        int edits = fuzzNext(4) + 1;
+        for (int i = 0; i < edits; i++) {
+            length = mutate(work, length, sizeof(work));
+        }
+
+        // exactly as long as the line, so a sanitizer build sees any read past it
+        char* line = new char[length > 0 ? length : 1];
+        memcpy(line, work, length);
+        EventLine parsed;
+        int result = parseEventLine(line, length, parsed);
+        if (result != EVENT_LINE_OK && result != EVENT_LINE_EMPTY && result != EVENT_LINE_MALFORMED) {
+            CHECK_EQUAL(result, EVENT_LINE_MALFORMED);
+        } else {
+            results[result]++;
+        }
+
+        if (result == EVENT_LINE_OK) {
+            CHECK(parsed.numRecords >= 0 && parsed.numRecords <= MAX_RECORDS_PER_EVENT);
+            CHECK(parsed.dataLength == 0 || (parsed.data >= line && parsed.data + parsed.dataLength <= line + length));
+            CHECK(parsed.datetimeLength == 0 ||
+                  (parsed.datetime >= line && parsed.datetime + parsed.datetimeLength <= line + length));
+            for (int i = 0; i < parsed.numRecords; i++) {
+                CHECK(isfinite(parsed.records[i].value));
+            }
+            Event event(parsed);
+            (void)event;
+        }
+        delete[] line;
+    }
+    fprintf(stderr, "        fuzz: %d parsed, %d blank, %d malformed\n", results[EVENT_LINE_OK],
+            results[EVENT_LINE_EMPTY], results[EVENT_LINE_MALFORMED]);
+    // the mutations are small, plenty of lines still parse
+    CHECK(results[EVENT_LINE_OK] > FUZZ_ITERATIONS / 20);
+    CHECK(results[EVENT_LINE_MALFORMED] > FUZZ_ITERATIONS / 20);
+}
@@ -0,0 +1,238 @@
+/*
+* The segmented event log on the host file system, the card is test-sd-EventLogTest/
+* of the directory the test runs in and every test starts from an empty one.
+*/
+
+#include <Arduino.h>
+#include <SD.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "EventLog.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define TEST_BATCH 64
+
+// Values in quarters, blocks keep hundredths and these read back exactly
+static Event measurementEvent(int i) {
+    const MeasurementRecord records[] = {
+        makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 20.0f + (i % 64) * 0.25f, TEST_EPOCH + i * 60),
+        makeMeasurementRecord(HUMIDITY_VARIABLE, DEFAULT_CROP, 60.0f - (i % 64) * 0.25f, TEST_EPOCH + i * 60)};
+    Event event(OK_STATUS, records, 2);
+    event.timesSent = i % 3;
+    return event;
+}
+
+static void appendEvents(EventLog& log, int first, int count) {
+    Event events[TEST_BATCH];
+    for (int i = 0; i < count; i++) {
+        events[i] = measurementEvent(first + i);
+    }
+    CHECK(log.append(events, count));
+}
+
+// Reads and consumes everything committed, checking the events follow first, first + 1, ...
+static int drainLog(EventLog& log, int first, int batch = TEST_BATCH) {
+    Event events[TEST_BATCH];
+    EventLogCursor next;
+    int read = 0;
+    for (int n = log.peek(events, batch, next); n > 0; n = log.peek(events, batch, next)) {
+        for (int i = 0; i < n; i++) {
+            CHECK(events[i] == measurementEvent(first + read + i));
+            CHECK_EQUAL(events[i].timesSent, (first + read + i) % 3);
+        }
+        read += n;
+        CHECK(log.advance(next));
+    }
+    return read;
+}
+
+static bool segmentExists(uint32_t segment) {
+    char path[EVENT_LOG_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%08lu.log", EVENT_LOG_DIR, (unsigned long)segment);
+    return SD.exists(path);
+}
+
+TEST(reads_back_what_was_appended) {
+    clearTestCard();
+    EventLog log;
+    CHECK(log.begin(SD));
+    CHECK(!log.hasPending());
+
+    appendEvents(log, 0, 10);
+    appendEvents(log, 10, 5);
+    CHECK(log.hasPending());
+    CHECK_EQUAL(drainLog(log, 0), 15);
+    CHECK(!log.hasPending());
+}
+
+TEST(peek_does_not_consume) {
+    clearTestCard();
+    EventLog log;
+    CHECK(log.begin(SD));
+    appendEvents(log, 0, 6);
+
+    Event events[TEST_BATCH];
+    EventLogCursor next;
+    CHECK_EQUAL(log.peek(events, 4, next), 4);
+    CHECK_EQUAL(log.peek(events, 4, next), 4);
+    CHECK(events[0] == measurementEvent(0));
+
+    // stopping inside a commit leaves the cursor after the last event returned
+    CHECK(log.advance(next));
+    CHECK_EQUAL(log.peek(events, TEST_BATCH, next), 2);
+    CHECK(events[0] == measurementEvent(4));
+}
+
+TEST(empty_events_are_not_written) {
+    clearTestCard();
+    EventLog log;
+    CHECK(log.begin(SD));
+
+    Event events[] = {Event(), measurementEvent(0), Event(), measurementEvent(1)};
+    CHECK(log.append(events, 4));
+    CHECK_EQUAL(drainLog(log, 0), 2);
+
+    // nothing to commit, nothing pending
+    Event empty[2];
+    CHECK(log.append(empty, 2));
+    CHECK(!log.hasPending());
+}
+
+TEST(cursor_survives_a_restart) {
+    clearTestCard();
+    {
+        EventLog log;
+        CHECK(log.begin(SD));
+        appendEvents(log, 0, 10);
+        Event events[TEST_BATCH];
+        EventLogCursor next;
+        CHECK_EQUAL(log.peek(events, 3, next), 3);
+        CHECK(log.advance(next));
+    }
+
+    EventLog log;
+    CHECK(log.begin(SD));
+    CHECK(log.hasPending());
+    CHECK_EQUAL(log.getCursor().segment, 1u);
+
+    // appends after a restart start a new segment, read after the old one
+    appendEvents(log, 10, 4);
+    CHECK(segmentExists(2));
+    CHECK_EQUAL(drainLog(log, 3), 11);
+    CHECK(!segmentExists(1));
+}
+
+TEST(uncommitted_tail_is_never_read) {
+    clearTestCard();
+    {
+        EventLog log;
+        CHECK(log.begin(SD));
+        appendEvents(log, 0, 5);
+    }
+
+    // a power loss in the middle of the next append: an event without its commit
+    // marker, then a block cut short
+    File file = SD.open(EVENT_LOG_DIR "/00000001.log", FILE_APPEND);
+    CHECK(file);
+    measurementEvent(99).printTo(file);
+    const uint8_t torn[] = {EVENT_BLOCK_MAGIC, 40, 1, 2, 3};
+    file.write(torn, sizeof(torn));
+    file.close();
+
+    EventLog log;
+    CHECK(log.begin(SD));
+    appendEvents(log, 5, 5);
+    CHECK_EQUAL(drainLog(log, 0), 10);
+    CHECK(!log.hasPending());
+}
+
+TEST(torn_tail_longer_than_a_batch_does_not_stop_the_drain) {
+    clearTestCard();
+    {
+        EventLog log;
+        CHECK(log.begin(SD));
+        appendEvents(log, 0, 3);
+    }
+
+    // more uncommitted events than a peek takes at the end of the older segment
+    File file = SD.open(EVENT_LOG_DIR "/00000001.log", FILE_APPEND);
+    CHECK(file);
+    for (int i = 0; i < 10; i++) {
+        measurementEvent(99).printTo(file);
+    }
+    file.close();
+
+    EventLog log;
+    CHECK(log.begin(SD));
+    appendEvents(log, 3, 5);
+    CHECK_EQUAL(drainLog(log, 0, 4), 8);
+    CHECK(!log.hasPending());
+}
+
+TEST(short_write_on_a_full_card_is_reported) {
+    clearTestCard();
+    EventLog log;
+    CHECK(log.begin(SD));
+    appendEvents(log, 0, 5);
+
+    // room for a few events of the next ten, the commit marker does not fit
+    SD.setCapacity(SD.usedBytes() + 100);
+    Event events[10];
+    for (int i = 0; i < 10; i++) {
+        events[i] = measurementEvent(5 + i);
+    }
+    CHECK(!log.append(events, 10));
+    CHECK(!log.append(events, 10));
+
+    // the caller still has them and appends them again once there is room
+    SD.setCapacity(0);
+    CHECK(log.append(events, 10));
+    appendEvents(log, 15, 3);
+    CHECK_EQUAL(drainLog(log, 0, 4), 18);
+    CHECK(!log.hasPending());
+}
+
+TEST(text_segments_are_still_read) {
+    clearTestCard();
+    SD.mkdir(EVENT_LOG_DIR);
+    File file = SD.open(EVENT_LOG_DIR "/00000001.log", FILE_WRITE);
+    CHECK(file);
+    for (int i = 0; i < 3; i++) {
+        measurementEvent(i).printTo(file);
+    }
+    file.print(EVENT_LOG_COMMIT_MARKER "\n");
+    // a malformed line is skipped, the rest of the commit is read
+    file.print("not an event\n");
+    measurementEvent(3).printTo(file);
+    file.print(EVENT_LOG_COMMIT_MARKER "\n");
+    file.close();
+
+    EventLog log;
+    CHECK(log.begin(SD));
+    appendEvents(log, 4, 2);
+    CHECK_EQUAL(drainLog(log, 0), 6);
+}
+
+TEST(segments_roll_over_and_are_deleted_once_read) {
+    clearTestCard();
+    EventLog log;
+    CHECK(log.begin(SD));
+
+    int appended = 0;
+    while (!segmentExists(4)) {
+        appendEvents(log, appended, TEST_BATCH);
+        appended += TEST_BATCH;
+        CHECK(appended < 100000);
+    }
+    CHECK(segmentExists(1) && segmentExists(2) && segmentExists(3));
+
+    File first = SD.open(EVENT_LOG_DIR "/00000001.log");
+    CHECK(first.size() >= EVENT_LOG_SEGMENT_SIZE);
+    CHECK(first.size() < EVENT_LOG_SEGMENT_SIZE + EVENT_LINE_MAX_LENGTH * TEST_BATCH);
+    first.close();
+
+    CHECK_EQUAL(drainLog(log, 0), appended);
+    CHECK(!segmentExists(1) && !segmentExists(2) && !segmentExists(3));
+    CHECK(segmentExists(4));
+    CHECK_EQUAL(log.getCursor().segment, 4u);
+}
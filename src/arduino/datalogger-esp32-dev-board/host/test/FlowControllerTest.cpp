@@ -0,0 +1,220 @@
+/*
+* The watermarks of the flow controller on their own, then the upload path of the
+* sketch through a server outage: the connection manager against the mock API
+* server and the event log on the test card, measuring the events held in RAM,
+* the heap, the writes to the card and how late the records arrive.
+*/
+
+#include <Arduino.h>
+#include <SD.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "ConnectionEventManager.h"
+#include "EventLog.h"
+#include "FlowController.h"
+#include "Instrumentation.h"
+
+#define TEST_SAMPLE_PERIOD 10000    // ms between sampled events, as the sensors run
+#define TEST_UPLOAD_PERIOD 2500     // ms between upload steps, as uploadFrequency
+#define TEST_OUTAGE_MS (30 * 60000UL)
+
+TEST(watermarks_decide_spill_and_refill) {
+    FlowController flow;
+    CHECK_EQUAL(flow.toSpill(FLOW_HIGH_WATERMARK - 1), (size_t)0);
+    CHECK_EQUAL(flow.toSpill(FLOW_HIGH_WATERMARK), (size_t)(FLOW_HIGH_WATERMARK - FLOW_LOW_WATERMARK));
+    CHECK_EQUAL(flow.toRefill(FLOW_LOW_WATERMARK, true), (size_t)FLOW_MAX_BATCH);
+    CHECK_EQUAL(flow.toRefill(FLOW_LOW_WATERMARK + 1, true), (size_t)0);
+    CHECK_EQUAL(flow.toRefill(0, false), (size_t)0);
+
+    // a failed send spills everything from the low watermark and stops the refill
+    flow.recordSend(3, 0, 100);
+    CHECK(flow.uplinkDegraded());
+    CHECK_EQUAL(flow.toSpill(FLOW_LOW_WATERMARK), (size_t)FLOW_LOW_WATERMARK);
+    CHECK_EQUAL(flow.toSpill(FLOW_LOW_WATERMARK - 1), (size_t)0);
+    CHECK_EQUAL(flow.toRefill(0, true), (size_t)0);
+    flow.recordSend(3, 3, 100);
+    CHECK(!flow.uplinkDegraded());
+}
+
+TEST(batch_fits_the_time_budget) {
+    FlowController flow;
+    // 100 ms per event sent and 100 ms per event read is 20 events in 4 s, capped
+    flow.recordSend(1, 1, 100);
+    flow.recordSdAccess(1, 100);
+    CHECK_EQUAL(flow.batchSize(), (size_t)FLOW_MAX_BATCH);
+    // 1 s per event sent and read, 4 of them
+    for (int i = 0; i < 20; i++) {
+        flow.recordSend(1, 1, 500);
+        flow.recordSdAccess(1, 500);
+    }
+    CHECK_EQUAL(flow.batchSize(), (size_t)(FLOW_TIME_BUDGET_MS / 1000));
+    // slower than the budget still sends one
+    flow.recordSend(1, 1, 60000);
+    CHECK_EQUAL(flow.batchSize(), (size_t)1);
+}
+
+struct OutageRun {
+    unsigned long sampled;
+    unsigned long delivered;        // records the server took
+    size_t ramPeak;                 // most events pending in RAM between upload steps
+    size_t heapPeak;                // B over the heap in use at the start
+    unsigned long sdWrites;         // write calls that reached the card
+    unsigned long spilled;          // events appended to the log
+    unsigned long drops;
+    uint64_t maxDelayMs;            // longest a record took from sampling to the server
+};
+
+/*
+* A step of uploadTask in the sketch: the sampled event, the pending ones, the
+* spill above the watermark and a refill from the log below it.
+*/
+static void uploadStep(ConnectionEventManager& manager, FlowController& flow, EventLog& log,
+                       const Event* sampled, int count) {
+    if (count > 0) {
+        unsigned long start = millis();
+        size_t sent = manager.sendNewEvents(sampled, count);
+        flow.recordSend(manager.getLastAttemptedCount(), sent, millis() - start);
+    }
+    unsigned long start = millis();
+    size_t sent = manager.sendMemAllocatedData();
+    flow.recordSend(manager.getLastAttemptedCount(), sent, millis() - start);
+
+    size_t toSpill = flow.toSpill(manager.measurementEvents.size());
+    if (toSpill > 0) {
+        start = millis();
+        size_t spilled = manager.spillExcessEvents(toSpill);
+        if (spilled > 0) {
+            flow.recordSdAccess(spilled, millis() - start);
+        }
+    }
+
+    size_t batch = flow.toRefill(manager.measurementEvents.size(), log.hasPending());
+    if (batch == 0 || !manager.uplinkReady()) {
+        return;
+    }
+    Event loaded[FLOW_MAX_BATCH];
+    EventLogCursor next;
+    start = millis();
+    int loadedCount = log.peek(loaded, min(batch, (size_t)FLOW_MAX_BATCH), next);
+    flow.recordSdAccess(loadedCount, millis() - start);
+    if (loadedCount > 0) {
+        start = millis();
+        bool allSent = manager.updateFromLoadedEvents(loaded, loadedCount);
+        flow.recordSend(manager.getLastAttemptedCount(), manager.getLastSentCount(), millis() - start);
+        if (!allSent && !log.append(loaded, loadedCount)) {
+            return;
+        }
+    }
+    log.advance(next);
+}
+
+static void connect(ConnectionEventManager& manager) {
+    host::config().serverHandler = nullptr;
+    host::config().serverStatus = CREATED_STATUS;
+    host::config().serverOutageCount = 0;
+    while (!manager.isConnected()) {
+        long wait = manager.resume(millis());
+        delay(wait > 0 ? min(wait, 100L) : 1);
+    }
+}
+
+/*
+* Samples an event every TEST_SAMPLE_PERIOD for duration, with the server gone for
+* TEST_OUTAGE_MS from the start, then runs on until the backlog is sent.
+*/
+static OutageRun runOutage(unsigned long duration) {
+    ConnectionEventManager manager;
+    FlowController flow;
+    EventLog log;
+    CHECK(log.begin(SD));
+    manager.setSpillLog(&log);
+    connect(manager);
+
+    host::Config& config = host::config();
+    host::Stats& stats = host::stats();
+    config.serverOutages[0].start = millis();
+    config.serverOutages[0].end = millis() + TEST_OUTAGE_MS;
+    config.serverOutageCount = 1;
+    instrumentation().reset();
+    stats.maxDeliveryDelayMs = 0;
+    unsigned long deliveredBefore = stats.deliveredRecords;
+    unsigned long writesBefore = SD.writeCount();
+    host::resetHeapPeak();
+    size_t heapBefore = host::heap().inUse;
+
+    OutageRun run = {};
+    unsigned long end = millis() + duration;
+    unsigned long nextSample = millis();
+    // once sampling stops, up to the longest breaker backoff for the backlog to go
+    unsigned long drainEnd = end + BREAKER_MAX_BACKOFF + 10 * 60000UL;
+    while (millis() < drainEnd && (millis() < end || log.hasPending() || !manager.measurementEvents.empty())) {
+        int count = 0;
+        Event event;
+        if (millis() < end && millis() >= nextSample) {
+            uint32_t epoch = config.startEpoch + millis() / 1000;
+            MeasurementRecord record = makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP,
+                                                             20.0f + run.sampled % 10, epoch);
+            event = Event(OK_STATUS, &record, 1);
+            count = 1;
+            run.sampled++;
+            nextSample += TEST_SAMPLE_PERIOD;
+        }
+        uploadStep(manager, flow, log, &event, count);
+        run.ramPeak = max(run.ramPeak, manager.measurementEvents.size());
+        delay(TEST_UPLOAD_PERIOD);
+    }
+    config.serverOutageCount = 0;
+
+    run.delivered = stats.deliveredRecords - deliveredBefore;
+    run.heapPeak = host::heap().peak - heapBefore;
+    run.sdWrites = SD.writeCount() - writesBefore;
+    run.spilled = instrumentation().counter(COUNTER_SPILLS);
+    run.drops = instrumentation().counter(COUNTER_DROPS);
+    run.maxDelayMs = stats.maxDeliveryDelayMs;
+    return run;
+}
+
+TEST(outage_is_spilled_in_batches_and_drained_after) {
+    clearTestCard();
+    OutageRun run = runOutage(2 * TEST_OUTAGE_MS);
+    fprintf(stderr, "        %lu sampled, %lu spilled in %lu writes, %d events peak in RAM, %d B heap peak,"
+            " %.1f min longest delay\n", run.sampled, run.spilled, run.sdWrites, (int)run.ramPeak,
+            (int)run.heapPeak, run.maxDelayMs / 60000.0);
+
+    // everything arrives, nothing waits in RAM above the ring
+    CHECK(run.sampled >= 2 * TEST_OUTAGE_MS / TEST_SAMPLE_PERIOD);
+    CHECK_EQUAL(run.delivered, run.sampled);
+    CHECK_EQUAL(run.drops, 0ul);
+    CHECK(run.ramPeak <= (size_t)(MAX_MEASUREMENTS + MAX_EXCESS_EVENTS));
+    // the events are kept in place, only the requests and the log reads allocate
+    CHECK(run.heapPeak <= 1024);
+
+    // the events of the outage go to the card, and those sampled until the breaker
+    // lets a probe through: every event is a write, each append adds its commit
+    // marker and each drain step the cursor
+    unsigned long outageEvents = TEST_OUTAGE_MS / TEST_SAMPLE_PERIOD;
+    CHECK(run.spilled >= outageEvents - FLOW_HIGH_WATERMARK);
+    CHECK(run.spilled <= (TEST_OUTAGE_MS + BREAKER_MAX_BACKOFF) / TEST_SAMPLE_PERIOD);
+    CHECK(run.sdWrites <= 3 * run.spilled);
+
+    // the oldest record waits for the outage and the breaker to let a probe through
+    CHECK(run.maxDelayMs >= TEST_OUTAGE_MS);
+    CHECK(run.maxDelayMs <= TEST_OUTAGE_MS + BREAKER_MAX_BACKOFF + 5 * 60000UL);
+}
+
+TEST(full_card_keeps_the_events_in_ram_and_counts_the_drops) {
+    clearTestCard();
+    // a card that takes nothing more than the empty log
+    EventLog log;
+    CHECK(log.begin(SD));
+    SD.setCapacity(SD.usedBytes() + 1);
+    OutageRun run = runOutage(TEST_OUTAGE_MS);
+
+    // spilling failed every time, the ring kept the newest and counted the rest
+    CHECK_EQUAL(run.spilled, 0ul);
+    CHECK(run.drops > 0);
+    CHECK(run.delivered > 0);
+    CHECK_EQUAL(run.delivered + run.drops, run.sampled);
+    CHECK(run.ramPeak <= (size_t)(MAX_MEASUREMENTS + MAX_EXCESS_EVENTS));
+    SD.setCapacity(0);
+}
@@ -0,0 +1,160 @@
+/*
+* The gzip encoder against zlib: whatever it writes must inflate back to the
+* input with a matching crc and length, however the input is split.
+*/
+
+#include <zlib.h>
+#include "Test.h"
+#include "GzipEncoder.h"
+#include "JsonEncoder.h"
+#include "MeasurementCatalog.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define TEST_INPUT 65536
+#define TEST_OUTPUT (TEST_INPUT + TEST_INPUT / 2)
+
+static char input[TEST_INPUT];
+static char compressed[TEST_OUTPUT];
+static char inflated[TEST_INPUT + 1];
+static GzipEncoder encoder;
+
+// Compresses the input in pieces of chunk bytes, 0 for all at once
+static size_t compress(const char* data, size_t length, size_t chunk = 0) {
+    BufferSink sink(compressed, sizeof(compressed));
+    encoder.begin(sink);
+    GzipSink<BufferSink> gzip(encoder, sink);
+    for (size_t done = 0; done < length;) {
+        size_t piece = (chunk == 0) ? length - done : min(chunk, length - done);
+        gzip.write(data + done, piece);
+        done += piece;
+    }
+    encoder.finish(sink);
+    CHECK(!sink.overflow());
+    return sink.length();
+}
+
+/*
+* Inflates a whole gzip member with zlib, which checks the header, the crc32 and
+* the size in the trailer.
+* @return inflated length, or -1 if zlib rejected the stream
+*/
+static long inflateGzip(const char* data, size_t length) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+        return -1;
+    }
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = (uInt)length;
+    stream.next_out = (Bytef*)inflated;
+    stream.avail_out = sizeof(inflated);
+    int result = inflate(&stream, Z_FINISH);
+    long inflatedLength = (long)stream.total_out;
+    bool whole = stream.avail_in == 0;
+    inflateEnd(&stream);
+    return (result == Z_STREAM_END && whole) ? inflatedLength : -1;
+}
+
+static bool roundTrips(const char* data, size_t length, size_t chunk = 0) {
+    size_t compressedLength = compress(data, length, chunk);
+    long inflatedLength = inflateGzip(compressed, compressedLength);
+    return inflatedLength == (long)length && memcmp(inflated, data, length) == 0;
+}
+
+// The body of a batch as the API client writes it
+static size_t measurementBody(char* out, size_t capacity, int events) {
+    BufferSink sink(out, capacity);
+    const MeasurementDictionary& dictionary = measurementDictionary();
+    sink.write("[", 1);
+    for (int i = 0; i < events; i++) {
+        for (int r = 0; r < 4; r++) {
+            MeasurementRecord record = makeMeasurementRecord(r, DEFAULT_CROP, 20.0f + (i * 7 + r * 3) % 50 * 0.37f,
+                                                             TEST_EPOCH + i * 60);
+            if (i + r > 0) {
+                sink.write(", ", 2);
+            }
+            encodeMeasurement(sink, record, dictionary);
+        }
+    }
+    sink.write("]", 1);
+    return sink.length();
+}
+
+static uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+TEST(empty_input_is_a_valid_member) {
+    size_t length = compress("", 0);
+    CHECK_EQUAL(inflateGzip(compressed, length), 0l);
+}
+
+TEST(short_text_round_trips) {
+    const char* text = "{\"variable\": 1}";
+    CHECK(roundTrips(text, strlen(text)));
+    const char* repeated = "abcabcabcabcabcabcabcabcabcabc";
+    CHECK(roundTrips(repeated, strlen(repeated)));
+}
+
+TEST(measurement_body_round_trips_and_shrinks) {
+    size_t length = measurementBody(input, sizeof(input), 30);
+    CHECK(roundTrips(input, length));
+    size_t compressedLength = compress(input, length);
+    // the uiids, keys and timestamps repeat within the window
+    CHECK(compressedLength * 3 < length);
+    fprintf(stderr, "        30 events: %zu B of JSON, %zu B gzip (%.1f%%)\n", length, compressedLength,
+            100.0 * compressedLength / length);
+}
+
+TEST(output_does_not_depend_on_how_the_input_is_split) {
+    size_t length = measurementBody(input, sizeof(input), 100);
+    size_t whole = compress(input, length);
+    static char reference[TEST_OUTPUT];
+    memcpy(reference, compressed, whole);
+
+    const size_t chunks[] = {1, 2, 7, 64, GZIP_WINDOW_SIZE - 1, GZIP_WINDOW_SIZE, GZIP_WINDOW_SIZE + 3, 5000};
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        CHECK_EQUAL(compress(input, length, chunks[i]), whole);
+        CHECK(memcmp(compressed, reference, whole) == 0);
+        CHECK(roundTrips(input, length, chunks[i]));
+    }
+
+    // a counting pass gives the length of the real one, as the Content-Length does
+    CountingSink counter;
+    encoder.begin(counter);
+    encoder.write(counter, input, length);
+    encoder.finish(counter);
+    CHECK_EQUAL(counter.count, whole);
+}
+
+TEST(matches_at_every_length_and_distance) {
+    // long runs give the longest matches, repeats at growing distances every distance code
+    size_t length = 0;
+    for (size_t run = 1; run <= 600 && length + run < TEST_INPUT / 2; run += 37) {
+        memset(input + length, 'a' + run % 26, run);
+        length += run;
+    }
+    for (size_t distance = 1; distance < GZIP_WINDOW_SIZE && length + 2 * distance + 8 < TEST_INPUT; distance *= 2) {
+        for (size_t i = 0; i < distance; i++) {
+            input[length + i] = (char)('A' + (i * 13 + distance) % 58);
+        }
+        memcpy(input + length + distance, input + length, distance);
+        length += 2 * distance;
+    }
+    CHECK(roundTrips(input, length));
+    CHECK(roundTrips(input, length, 3));
+}
+
+TEST(incompressible_bytes_round_trip) {
+    uint32_t state = 2463534242UL;
+    for (size_t i = 0; i < TEST_INPUT; i++) {
+        input[i] = (char)(nextRandom(state) & 0xFF);
+    }
+    // far more than the window, every byte value, literals above 143 take 9 bits
+    CHECK(roundTrips(input, TEST_INPUT));
+    size_t compressedLength = compress(input, TEST_INPUT);
+    CHECK(compressedLength <= TEST_INPUT * 9 / 8 + 32);
+}
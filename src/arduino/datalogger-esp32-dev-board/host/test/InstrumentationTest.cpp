@@ -0,0 +1,226 @@
+/*
+* The latency histograms and counters: bucket boundaries, percentiles, resets,
+* and stage timers driven by the simulated clock of the host runtime. Last a
+* thread standing for the acquisition core records while this one resets and
+* reads, as the uplink task does; it only touches the Instrumentation.
+*/
+
+#include <pthread.h>
+#include <atomic>
+#include <Arduino.h>
+#include "Test.h"
+#include "Instrumentation.h"
+
+#define STRESS_WINDOWS 2000000
+#define STRESS_SAMPLE_US 100        // every sample of the recording thread
+
+// The bucket a single duration lands in
+static int bucketOf(uint32_t us) {
+    LatencyHistogram histogram;
+    histogram.record(us);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (histogram.bucketCount(i) == 1) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+TEST(buckets_split_at_the_powers_of_two) {
+    CHECK_EQUAL(bucketOf(0), 0);
+    CHECK_EQUAL(bucketOf(1), 0);
+    CHECK_EQUAL(bucketOf(2), 1);
+    CHECK_EQUAL(bucketOf(3), 1);
+    // bucket i holds 2^i up to 2^(i+1) - 1
+    for (int i = 2; i < HISTOGRAM_BUCKETS - 1; i++) {
+        CHECK_EQUAL(bucketOf(1UL << i), i);
+        CHECK_EQUAL(bucketOf((2UL << i) - 1), i);
+        CHECK_EQUAL(bucketOf((1UL << i) - 1), i - 1);
+    }
+    // the last one takes the rest
+    CHECK_EQUAL(bucketOf(1UL << (HISTOGRAM_BUCKETS - 1)), HISTOGRAM_BUCKETS - 1);
+    CHECK_EQUAL(bucketOf(UINT32_MAX), HISTOGRAM_BUCKETS - 1);
+}
+
+TEST(percentiles_are_bucket_bounds_capped_at_the_maximum) {
+    LatencyHistogram histogram;
+    CHECK_EQUAL(histogram.percentileUs(50), 0u);
+    for (uint32_t us = 1; us <= 100; us++) {
+        histogram.record(us);
+    }
+    CHECK_EQUAL(histogram.count(), 100u);
+    CHECK_EQUAL(histogram.meanUs(), 50u);
+    CHECK_EQUAL(histogram.maxUs(), 100u);
+    // the 50th sample is 50, in the bucket up to 63
+    CHECK_EQUAL(histogram.percentileUs(50), 63u);
+    // the 95th is in the bucket up to 127, which is past the largest sample
+    CHECK_EQUAL(histogram.percentileUs(95), 100u);
+    CHECK_EQUAL(histogram.percentileUs(1), 1u);
+    CHECK_EQUAL(histogram.percentileUs(100), 100u);
+
+    // the last bucket has no bound of its own
+    histogram.record(UINT32_MAX);
+    CHECK_EQUAL(histogram.percentileUs(100), (uint32_t)UINT32_MAX);
+}
+
+TEST(histogram_reset_forgets_everything) {
+    LatencyHistogram histogram;
+    histogram.record(10);
+    histogram.record(100000);
+    histogram.reset();
+    CHECK_EQUAL(histogram.count(), 0u);
+    CHECK_EQUAL(histogram.maxUs(), 0u);
+    CHECK_EQUAL(histogram.meanUs(), 0u);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        CHECK_EQUAL(histogram.bucketCount(i), 0u);
+    }
+}
+
+TEST(counters_count_and_reset) {
+    Instrumentation metrics;
+    metrics.count(COUNTER_DROPS);
+    metrics.count(COUNTER_DROPS, 4);
+    metrics.count(COUNTER_SPILLS, 2);
+    // out of range is ignored
+    metrics.count(-1);
+    metrics.count(NUMBER_OF_COUNTERS);
+    metrics.record(NUMBER_OF_STAGES, 5);
+    CHECK_EQUAL(metrics.counter(COUNTER_DROPS), 5u);
+    CHECK_EQUAL(metrics.counter(COUNTER_SPILLS), 2u);
+    CHECK_EQUAL(metrics.counter(COUNTER_GIVEN_UP), 0u);
+
+    metrics.record(STAGE_SD_STORE, 300);
+    metrics.reset();
+    for (int i = 0; i < NUMBER_OF_COUNTERS; i++) {
+        CHECK_EQUAL(metrics.counter(i), 0u);
+    }
+    CHECK_EQUAL(metrics.stage(STAGE_SD_STORE).count(), 0u);
+}
+
+TEST(stage_timer_measures_the_scope_on_the_simulated_clock) {
+    Instrumentation& metrics = instrumentation();
+    metrics.reset();
+    metrics.setClock(nullptr);
+    {
+        // nothing is timed until the clock is set
+        INSTRUMENT_STAGE(STAGE_SD_STORE);
+        delayMicroseconds(300);
+    }
+    CHECK_EQUAL(metrics.stage(STAGE_SD_STORE).count(), 0u);
+
+    metrics.setClock(micros);
+    for (int i = 0; i < 10; i++) {
+        INSTRUMENT_STAGE(STAGE_SD_STORE);
+        delayMicroseconds(300);
+    }
+    for (int i = 0; i < 3; i++) {
+        INSTRUMENT_STAGE(STAGE_SD_STORE);
+        delay(5);
+    }
+    const LatencyHistogram& store = metrics.stage(STAGE_SD_STORE);
+    CHECK_EQUAL(store.count(), 13u);
+    // 300 us is between 256 and 511, 5 ms between 4096 and 8191
+    CHECK_EQUAL(store.bucketCount(8), 10u);
+    CHECK_EQUAL(store.bucketCount(12), 3u);
+    CHECK_EQUAL(store.maxUs(), 5000u);
+    CHECK_EQUAL(store.percentileUs(50), 511u);
+    CHECK_EQUAL(store.percentileUs(95), 5000u);
+
+    // a nested stage is counted in both
+    {
+        INSTRUMENT_STAGE(STAGE_HTTP_SEND);
+        delay(2);
+        {
+            INSTRUMENT_STAGE(STAGE_JSON_BUILD);
+            delayMicroseconds(100);
+        }
+    }
+    CHECK_EQUAL(metrics.stage(STAGE_JSON_BUILD).maxUs(), 100u);
+    CHECK_EQUAL(metrics.stage(STAGE_HTTP_SEND).maxUs(), 2100u);
+
+    INSTRUMENT_COUNT(COUNTER_SENSOR_ERRORS, 2);
+    CHECK_EQUAL(metrics.counter(COUNTER_SENSOR_ERRORS), 2u);
+    metrics.setClock(nullptr);
+    metrics.reset();
+}
+
+TEST(json_summary_lists_the_stages_that_ran) {
+    Instrumentation metrics;
+    metrics.record(STAGE_DHT_READ, 3000);
+    metrics.record(STAGE_DHT_READ, 5000);
+    metrics.count(COUNTER_SEND_RETRIES, 7);
+    char text[512];
+    BufferSink sink(text, sizeof(text) - 1);
+    metrics.writeJson(sink, 60000);
+    text[sink.length()] = '\0';
+    CHECK(!sink.overflow());
+    // longer than CHECK_EQUAL prints
+    CHECK(strcmp(text,
+        "{\"telemetry\": {\"uptime_ms\": 60000, \"stages\": {\"dht_read\": {\"n\": 2, \"mean_us\": 4000,"
+        " \"p50_us\": 4095, \"p95_us\": 5000, \"max_us\": 5000}}, \"counters\": {\"send_retries\": 7,"
+        " \"given_up\": 0, \"drops\": 0, \"spills\": 0, \"sensor_errors\": 0}}}") == 0);
+}
+
+struct Recording {
+    Instrumentation* metrics;
+    std::atomic<bool> done;
+    std::atomic<unsigned long> samples;
+    std::atomic<unsigned long> torn;        // samples after which the writer saw its histogram torn
+};
+
+// Whether the histogram is one the writer could have left between two samples
+static bool consistent(const LatencyHistogram& h) {
+    uint32_t bucketed = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        bucketed += h.bucketCount(i);
+    }
+    if (h.count() == 0) {
+        return bucketed == 0 && h.maxUs() == 0;
+    }
+    return bucketed == h.count() && h.maxUs() == STRESS_SAMPLE_US && h.meanUs() == STRESS_SAMPLE_US;
+}
+
+// The acquisition task: records, then reads back what it holds between two samples
+static void* recordUntilDone(void* argument) {
+    Recording& recording = *static_cast<Recording*>(argument);
+    while (!recording.done.load()) {
+        recording.metrics->record(STAGE_DHT_READ, STRESS_SAMPLE_US);
+        recording.samples++;
+        if (!consistent(recording.metrics->stage(STAGE_DHT_READ))) {
+            recording.torn++;
+        }
+    }
+    return nullptr;
+}
+
+TEST(reset_and_reads_from_another_task_leave_the_writer_consistent) {
+    Instrumentation metrics;
+    Recording recording;
+    recording.metrics = &metrics;
+    recording.done = false;
+    recording.samples = 0;
+    recording.torn = 0;
+    pthread_t writer;
+    CHECK_EQUAL(pthread_create(&writer, nullptr, recordUntilDone, &recording), 0);
+
+    // the uplink task dumps and resets, for windows until the writer took as many
+    // samples so the two overlap; its copies may be off by the sample in flight
+    unsigned long windows = 0;
+    unsigned long dumped = 0;
+    for (; windows < STRESS_WINDOWS || recording.samples < STRESS_WINDOWS; windows++) {
+        dumped += metrics.stage(STAGE_DHT_READ).count();
+        metrics.reset();
+    }
+    recording.done = true;
+    pthread_join(writer, nullptr);
+
+    // no reset ever landed in the middle of a sample
+    CHECK_EQUAL(recording.torn.load(), 0ul);
+    // a flagged stage reads as empty until its writer clears it with the next sample
+    metrics.reset();
+    CHECK_EQUAL(metrics.stage(STAGE_DHT_READ).count(), 0u);
+    metrics.record(STAGE_DHT_READ, STRESS_SAMPLE_US);
+    CHECK_EQUAL(metrics.stage(STAGE_DHT_READ).count(), 1u);
+    fprintf(stderr, "        %lu windows over %lu samples, %lu of them dumped\n", windows,
+            recording.samples.load(), dumped);
+}
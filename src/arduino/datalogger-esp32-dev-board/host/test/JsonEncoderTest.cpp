@@ -0,0 +1,160 @@
+/*
+* The streaming JSON encoder of the measurement payloads.
+*/
+
+#include <Arduino.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "JsonEncoder.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+
+static const char* const testVariables[] = {"\"t\"", "\"h\"", "\"vpd\"", "\"dew\"", "\"lux\"", "\"dli\""};
+static const char* const testCrops[] = {"\"crop\""};
+static const MeasurementDictionary testDictionary = {testVariables, NUMBER_OF_VARIABLES, testCrops, NUMBER_OF_CROPS,
+                                                     "-05:00"};
+
+// Encodes into a null terminated buffer
+template <size_t Size>
+static size_t encode(char (&text)[Size], const MeasurementRecord* records, int count,
+                     const MeasurementDictionary& dictionary = testDictionary) {
+    BufferSink sink(text, Size - 1);
+    size_t written = encodeMeasurements(sink, records, count, dictionary);
+    text[sink.length()] = '\0';
+    return written;
+}
+
+template <size_t Size>
+static const char* value(char (&text)[Size], float v) {
+    BufferSink sink(text, Size - 1);
+    json_encoder::writeValue(sink, v);
+    text[sink.length()] = '\0';
+    return text;
+}
+
+TEST(encodes_the_api_array) {
+    const MeasurementRecord records[] = {
+        makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 23.45f, TEST_EPOCH),
+        makeMeasurementRecord(HUMIDITY_VARIABLE, DEFAULT_CROP, 61.2f, TEST_EPOCH + 1)};
+    char text[256];
+    encode(text, records, 2);
+    CHECK_EQUAL(text, "[{\"variable\": \"t\", \"value\": 23.45, \"crop\": \"crop\", \"datetime\": "
+                      "\"2024-06-01T12:00:00 -05:00\"}, {\"variable\": \"h\", \"value\": 61.20, \"crop\": \"crop\", "
+                      "\"datetime\": \"2024-06-01T12:00:01 -05:00\"}]");
+}
+
+TEST(encodes_an_empty_array) {
+    char text[8];
+    CHECK_EQUAL(encode(text, nullptr, 0), (size_t)2);
+    CHECK_EQUAL(text, "[]");
+}
+
+TEST(length_is_known_before_encoding) {
+    MeasurementRecord records[MAX_RECORDS_PER_EVENT];
+    for (int i = 0; i < MAX_RECORDS_PER_EVENT; i++) {
+        records[i] = makeMeasurementRecord(i, DEFAULT_CROP, -1234.567f * i, TEST_EPOCH + i * 3600);
+    }
+    char text[512];
+    for (int n = 0; n <= MAX_RECORDS_PER_EVENT; n++) {
+        size_t written = encode(text, records, n);
+        CHECK_EQUAL(measurementsJsonLength(records, n, testDictionary), written);
+        CHECK_EQUAL(strlen(text), written);
+    }
+}
+
+TEST(omits_the_offset_without_a_time_zone) {
+    const MeasurementRecord record = makeMeasurementRecord(LUX_VARIABLE, DEFAULT_CROP, 1200.0f, TEST_EPOCH);
+    MeasurementDictionary utc = testDictionary;
+    utc.tz = "";
+    char text[128];
+    encode(text, &record, 1, utc);
+    CHECK(strstr(text, "\"datetime\": \"2024-06-01T12:00:00\"}") != nullptr);
+}
+
+TEST(unknown_ids_map_to_the_last_entry) {
+    const MeasurementRecord record = makeMeasurementRecord(200, 7, 1.0f, TEST_EPOCH);
+    char text[128];
+    encode(text, &record, 1);
+    CHECK(strstr(text, "\"variable\": \"dli\"") != nullptr);
+    CHECK(strstr(text, "\"crop\": \"crop\"") != nullptr);
+}
+
+TEST(values_have_two_decimals) {
+    char text[32];
+    CHECK_EQUAL(value(text, 0.0f), "0.00");
+    CHECK_EQUAL(value(text, 1.005f), "1.00");
+    CHECK_EQUAL(value(text, 2.678f), "2.68");
+    CHECK_EQUAL(value(text, -0.004f), "0.00");
+    CHECK_EQUAL(value(text, -12.5f), "-12.50");
+    CHECK_EQUAL(value(text, 100000.0f), "100000.00");
+    CHECK_EQUAL(value(text, NAN), "null");
+    CHECK_EQUAL(value(text, INFINITY), "null");
+}
+
+TEST(integers_cover_their_whole_range) {
+    char text[32];
+    BufferSink sink(text, sizeof(text) - 1);
+    json_encoder::writeSigned(sink, INT64_MIN);
+    text[sink.length()] = '\0';
+    CHECK_EQUAL(text, "-9223372036854775808");
+
+    BufferSink padded(text, sizeof(text) - 1);
+    json_encoder::writeUnsigned(padded, 7, 3);
+    json_encoder::writeUnsigned(padded, UINT64_MAX);
+    text[padded.length()] = '\0';
+    CHECK_EQUAL(text, "00718446744073709551615");
+}
+
+TEST(buffer_sink_stops_at_its_capacity) {
+    const MeasurementRecord record = makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 23.45f, TEST_EPOCH);
+    char text[33];
+    memset(text, '#', sizeof(text));
+    BufferSink sink(text, 16);
+    size_t written = encodeMeasurements(sink, &record, 1, testDictionary);
+    CHECK(sink.overflow());
+    CHECK_EQUAL(sink.length(), (size_t)16);
+    CHECK(written > 16);
+    CHECK_EQUAL(text[16], '#');
+}
+
+TEST(encoding_does_not_allocate) {
+    MeasurementRecord records[MAX_RECORDS_PER_EVENT];
+    for (int i = 0; i < MAX_RECORDS_PER_EVENT; i++) {
+        records[i] = makeMeasurementRecord(i, DEFAULT_CROP, 10.0f + i, TEST_EPOCH);
+    }
+    char text[512];
+    host::HeapUsage before = host::heap();
+    encode(text, records, MAX_RECORDS_PER_EVENT);
+    measurementsJsonLength(records, MAX_RECORDS_PER_EVENT, testDictionary);
+    CHECK_EQUAL(host::heap().allocations, before.allocations);
+}
+
+// Counts the writes that reach the output, to see the buffering
+struct CountingOutput {
+    size_t writes = 0;
+    size_t bytes = 0;
+
+    size_t write(const uint8_t* data, size_t length) {
+        (void)data;
+        writes++;
+        bytes += length;
+        return length;
+    }
+};
+
+TEST(print_sink_writes_in_chunks) {
+    MeasurementRecord records[MAX_RECORDS_PER_EVENT];
+    for (int i = 0; i < MAX_RECORDS_PER_EVENT; i++) {
+        records[i] = makeMeasurementRecord(i, DEFAULT_CROP, 10.0f + i, TEST_EPOCH);
+    }
+    CountingOutput output;
+    size_t length;
+    {
+        PrintSink<CountingOutput, 64> sink(output);
+        length = encodeMeasurements(sink, records, MAX_RECORDS_PER_EVENT, testDictionary);
+        CHECK_EQUAL(output.bytes % 64, (size_t)0);
+    }
+    // the rest goes out when the sink is destroyed
+    CHECK_EQUAL(output.bytes, length);
+    CHECK_EQUAL(output.writes, (length + 63) / 64);
+}
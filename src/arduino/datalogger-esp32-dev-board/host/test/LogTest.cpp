@@ -0,0 +1,126 @@
+/*
+* The logger: lines formatted from the captured arguments, and the deferred ring
+* when the log task falls behind, which drops lines and says how many.
+*/
+
+#include <string.h>
+#include "Test.h"
+#include "Log.h"
+
+#define CAPTURED_LINES 64
+
+static char lines[CAPTURED_LINES][LOG_LINE_LENGTH];
+static int lineCount = 0;
+static unsigned long now = 0;
+
+static unsigned long testClock() {
+    return now;
+}
+
+static void captureLine(const char* text, size_t length) {
+    if (lineCount < CAPTURED_LINES) {
+        memcpy(lines[lineCount], text, length);
+        lines[lineCount][length] = '\0';
+    }
+    lineCount++;
+}
+
+static void reset(Logger& log, bool deferred) {
+    lineCount = 0;
+    now = 1000;
+    log.begin(testClock, captureLine);
+    log.setDeferred(deferred);
+}
+
+TEST(direct_lines_are_written_by_the_caller) {
+    Logger log;
+    reset(log, false);
+    char name[] = "sensor";
+    log.log(LOG_LEVEL_INFO, "SENSORS", "%s read %d values, %.1f C", name, 3, 21.5);
+    CHECK_EQUAL(lineCount, 1);
+    CHECK_EQUAL(lines[0], "I (1000) SENSORS: sensor read 3 values, 21.5 C\n");
+    CHECK_EQUAL(log.drain(), (size_t)0);
+}
+
+TEST(deferred_lines_wait_for_the_drain) {
+    Logger log;
+    reset(log, true);
+    char name[] = "sensor";
+    log.log(LOG_LEVEL_WARN, "SENSORS", "%s is gone", name);
+    // the string was copied, the buffer may change before the drain
+    strcpy(name, "other");
+    CHECK_EQUAL(lineCount, 0);
+    CHECK_EQUAL(log.drain(), (size_t)1);
+    CHECK_EQUAL(lineCount, 1);
+    CHECK_EQUAL(lines[0], "W (1000) SENSORS: sensor is gone\n");
+}
+
+TEST(full_ring_drops_lines_and_counts_them) {
+    Logger log;
+    reset(log, true);
+    for (int i = 0; i < LOG_RING_CAPACITY + 5; i++) {
+        now = 1000 + i;
+        log.log(LOG_LEVEL_INFO, "SYSTEM", "line %d", i);
+    }
+    CHECK_EQUAL(log.dropped(), 5u);
+    CHECK_EQUAL(lineCount, 0);
+
+    // the count comes first, then the lines that fit, oldest first
+    now = 2000;
+    CHECK_EQUAL(log.drain(), (size_t)LOG_RING_CAPACITY);
+    CHECK_EQUAL(lineCount, LOG_RING_CAPACITY + 1);
+    CHECK_EQUAL(lines[0], "W (2000) LOG: 5 lines dropped\n");
+    int inOrder = 0;
+    for (int i = 0; i < LOG_RING_CAPACITY; i++) {
+        char expected[LOG_LINE_LENGTH];
+        snprintf(expected, sizeof(expected), "I (%d) SYSTEM: line %d\n", 1000 + i, i);
+        inOrder += strcmp(lines[i + 1], expected) == 0 ? 1 : 0;
+    }
+    CHECK_EQUAL(inOrder, LOG_RING_CAPACITY);
+    CHECK_EQUAL(log.dropped(), 0u);
+
+    // nothing is left, and the count is not written again
+    CHECK_EQUAL(log.drain(), (size_t)0);
+    CHECK_EQUAL(lineCount, LOG_RING_CAPACITY + 1);
+}
+
+TEST(ring_keeps_working_after_it_wrapped) {
+    Logger log;
+    reset(log, true);
+    // many times around, a few lines at a time
+    int next = 0;
+    int written = 0;
+    for (int round = 0; round < 10 * LOG_RING_CAPACITY; round++) {
+        log.log(LOG_LEVEL_INFO, "SYSTEM", "line %d", next++);
+        if (round % 3 == 2) {
+            written += (int)log.drain(3);
+        }
+    }
+    written += (int)log.drain();
+    CHECK_EQUAL(log.dropped(), 0u);
+    CHECK_EQUAL(written, next);
+    CHECK_EQUAL(lineCount, next);
+
+    // and drops again once full, counting from zero
+    lineCount = 0;
+    for (int i = 0; i < LOG_RING_CAPACITY + 1; i++) {
+        log.log(LOG_LEVEL_INFO, "SYSTEM", "line %d", i);
+    }
+    CHECK_EQUAL(log.dropped(), 1u);
+    CHECK_EQUAL(log.drain(), (size_t)LOG_RING_CAPACITY);
+    CHECK_EQUAL(lines[0], "W (1000) LOG: 1 lines dropped\n");
+    CHECK_EQUAL(lines[1], "I (1000) SYSTEM: line 0\n");
+}
+
+TEST(no_writer_keeps_the_deferred_lines) {
+    Logger log;
+    reset(log, true);
+    log.begin(testClock, nullptr);
+    log.log(LOG_LEVEL_ERROR, "STORAGE", "Failed to open %s", "/events");
+    CHECK_EQUAL(log.drain(), (size_t)0);
+
+    // written once there is somewhere to write them
+    log.begin(testClock, captureLine);
+    CHECK_EQUAL(log.drain(), (size_t)1);
+    CHECK_EQUAL(lines[0], "E (1000) STORAGE: Failed to open /events\n");
+}
@@ -0,0 +1,95 @@
+/*
+* The fixed layout measurement record and the measurement events that carry it.
+*/
+
+#include <Arduino.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "Event.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+
+static Event dhtEvent() {
+    const MeasurementRecord records[] = {
+        makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 23.45f, TEST_EPOCH),
+        makeMeasurementRecord(HUMIDITY_VARIABLE, DEFAULT_CROP, 61.2f, TEST_EPOCH),
+        makeMeasurementRecord(VPD_VARIABLE, DEFAULT_CROP, 1.12f, TEST_EPOCH),
+        makeMeasurementRecord(DEWPOINT_VARIABLE, DEFAULT_CROP, 15.67f, TEST_EPOCH)};
+    return Event(OK_STATUS, records, 4);
+}
+
+TEST(record_is_a_16_byte_pod) {
+    CHECK_EQUAL(sizeof(MeasurementRecord), (size_t)16);
+    CHECK(std::is_trivially_copyable<MeasurementRecord>::value);
+    CHECK(std::is_standard_layout<MeasurementRecord>::value);
+}
+
+TEST(make_record_fills_every_field) {
+    MeasurementRecord record = makeMeasurementRecord(LUX_VARIABLE, DEFAULT_CROP, 1234.5f, TEST_EPOCH);
+    CHECK_EQUAL(record.variableId, (uint8_t)LUX_VARIABLE);
+    CHECK_EQUAL(record.cropId, (uint8_t)DEFAULT_CROP);
+    CHECK_EQUAL(record.value, 1234.5f);
+    CHECK_EQUAL(record.epoch, (uint32_t)TEST_EPOCH);
+    CHECK_EQUAL(record.status, (int16_t)0);
+    CHECK_EQUAL(record.timesSent, (uint8_t)0);
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQUAL(record.reserved[i], (uint8_t)0);
+    }
+}
+
+TEST(records_compare_by_value) {
+    MeasurementRecord a = makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, 20.0f, TEST_EPOCH);
+    MeasurementRecord b = a;
+    CHECK(a == b);
+    b.timesSent = 1;
+    CHECK(a != b);
+    b = a;
+    b.value = 20.01f;
+    CHECK(a != b);
+}
+
+TEST(measurement_event_keeps_its_records) {
+    Event event = dhtEvent();
+    CHECK_EQUAL(event.getType(), MEASUREMENT_EVENT);
+    CHECK_EQUAL(event.getRecordCount(), 4);
+    CHECK_EQUAL(event.getRecords()[1].variableId, (uint8_t)HUMIDITY_VARIABLE);
+    CHECK_EQUAL(event.getRecords()[3].value, 15.67f);
+    CHECK_EQUAL(event.getData().length(), 0u);
+}
+
+TEST(measurement_event_truncates_extra_records) {
+    MeasurementRecord records[MAX_RECORDS_PER_EVENT + 2];
+    for (int i = 0; i < MAX_RECORDS_PER_EVENT + 2; i++) {
+        records[i] = makeMeasurementRecord(TEMPERATURE_VARIABLE, DEFAULT_CROP, (float)i, TEST_EPOCH + i);
+    }
+    Event event(OK_STATUS, records, MAX_RECORDS_PER_EVENT + 2);
+    CHECK_EQUAL(event.getRecordCount(), MAX_RECORDS_PER_EVENT);
+    CHECK_EQUAL(event.getRecords()[MAX_RECORDS_PER_EVENT - 1].epoch, (uint32_t)(TEST_EPOCH + MAX_RECORDS_PER_EVENT - 1));
+}
+
+TEST(copying_measurement_events_does_not_allocate) {
+    Event source = dhtEvent();
+    Event copies[8];
+
+    host::HeapUsage before = host::heap();
+    for (int i = 0; i < 8; i++) {
+        copies[i] = source;
+    }
+    Event constructed(copies[7]);
+    host::HeapUsage after = host::heap();
+
+    CHECK_EQUAL(after.allocations, before.allocations);
+    CHECK(constructed == source);
+}
+
+TEST(measurement_event_round_trips_through_its_line) {
+    Event event = dhtEvent();
+    event.timesSent = 3;
+    Event parsed(event.toString());
+    CHECK(parsed == event);
+    CHECK_EQUAL(parsed.timesSent, 3);
+    CHECK_EQUAL(parsed.getRecordCount(), 4);
+    for (int i = 0; i < 4; i++) {
+        CHECK(parsed.getRecords()[i] == event.getRecords()[i]);
+    }
+}
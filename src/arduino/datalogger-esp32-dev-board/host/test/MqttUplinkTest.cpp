@@ -0,0 +1,186 @@
+/*
+* The MQTT uplink against the mock broker of the host runtime: pipelined QoS 1
+* publishes, a broker that goes away or stops answering, and the time a drain
+* takes compared with the HTTP client on the same round trip.
+*/
+
+#include <Arduino.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "MqttUplink.h"
+#include "ApiClient.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+#define TEST_EVENTS UPLINK_MAX_EVENTS
+#define TEST_RECORDS 4
+#define TEST_ROUND_TRIP 150     // ms, the default of the host runtime
+
+static void connectWifi() {
+    host::config().requestMs = TEST_ROUND_TRIP;
+    host::config().serverHandler = nullptr;
+    host::config().serverStatus = CREATED_STATUS;
+    host::config().serverOutageCount = 0;
+    WiFi.begin("test", "test");
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(100);
+    }
+}
+
+static void fillEvents(Event* events) {
+    for (int i = 0; i < TEST_EVENTS; i++) {
+        MeasurementRecord records[TEST_RECORDS];
+        for (int r = 0; r < TEST_RECORDS; r++) {
+            records[r] = makeMeasurementRecord(r, DEFAULT_CROP, 20.0f + i, TEST_EPOCH + i * 60);
+        }
+        events[i] = Event(OK_STATUS, records, TEST_RECORDS);
+    }
+}
+
+static int countDelivered(const int* results, int n) {
+    int delivered = 0;
+    for (int i = 0; i < n; i++) {
+        delivered += (results[i] == OK_STATUS || results[i] == CREATED_STATUS) ? 1 : 0;
+    }
+    return delivered;
+}
+
+// Starts a server outage now, for the given ms
+static void serverDownFor(unsigned long duration) {
+    host::Config& config = host::config();
+    config.serverOutages[0].start = millis();
+    config.serverOutages[0].end = millis() + duration;
+    config.serverOutageCount = 1;
+}
+
+TEST(publishes_are_pipelined_within_the_window) {
+    connectWifi();
+    WiFiClient socket;
+    MqttUplink uplink(socket);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    host::Stats before = host::stats();
+    unsigned long start = millis();
+    int* results = uplink.sendEvents(events, TEST_EVENTS);
+    unsigned long elapsed = millis() - start;
+
+    host::Stats& stats = host::stats();
+    CHECK_EQUAL(countDelivered(results, TEST_EVENTS), TEST_EVENTS);
+    CHECK_EQUAL(uplink.getAckedCount(), (unsigned long)TEST_EVENTS);
+    CHECK_EQUAL(stats.publishes - before.publishes, (unsigned long)TEST_EVENTS);
+    CHECK_EQUAL(stats.deliveredRecords - before.deliveredRecords, (unsigned long)(TEST_EVENTS * TEST_RECORDS));
+    CHECK_EQUAL(stats.brokerConnections - before.brokerConnections, 1ul);
+    CHECK(stats.maxInflight <= (unsigned long)MQTT_MAX_INFLIGHT);
+    CHECK_EQUAL(stats.maxInflight, (unsigned long)MQTT_MAX_INFLIGHT);
+
+    // the CONNACK and one round trip per window of publishes
+    int windows = (TEST_EVENTS + MQTT_MAX_INFLIGHT - 1) / MQTT_MAX_INFLIGHT;
+    CHECK(elapsed >= (unsigned long)(1 + windows) * TEST_ROUND_TRIP);
+    CHECK(elapsed <= (unsigned long)(1 + windows) * (TEST_ROUND_TRIP + 2) + 30);
+
+    // the session is kept for the next call
+    start = millis();
+    results = uplink.sendEvents(events, TEST_EVENTS);
+    CHECK_EQUAL(countDelivered(results, TEST_EVENTS), TEST_EVENTS);
+    CHECK_EQUAL(stats.brokerConnections - before.brokerConnections, 1ul);
+    CHECK(millis() - start <= (unsigned long)windows * (TEST_ROUND_TRIP + 2));
+}
+
+TEST(events_stay_pending_while_the_broker_is_down) {
+    connectWifi();
+    WiFiClient socket;
+    MqttUplink uplink(socket);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    serverDownFor(60000);
+    host::Stats before = host::stats();
+    int* results = uplink.sendEvents(events, 5);
+    CHECK_EQUAL(countDelivered(results, 5), 0);
+    for (int i = 0; i < 5; i++) {
+        CHECK_EQUAL(results[i], SERVICE_UNAVAILABLE_STATUS);
+    }
+    CHECK_EQUAL(host::stats().deliveredRecords, before.deliveredRecords);
+
+    // and go once it is back
+    delay(60000);
+    results = uplink.sendEvents(events, 5);
+    CHECK_EQUAL(countDelivered(results, 5), 5);
+    host::config().serverOutageCount = 0;
+}
+
+TEST(broker_lost_mid_session_is_reconnected) {
+    connectWifi();
+    WiFiClient socket;
+    MqttUplink uplink(socket);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    CHECK_EQUAL(countDelivered(uplink.sendEvents(events, 3), 3), 3);
+    serverDownFor(1000);
+    delay(500);
+    CHECK(!socket.connected());
+    delay(1000);
+
+    host::Stats before = host::stats();
+    CHECK_EQUAL(countDelivered(uplink.sendEvents(events, 3), 3), 3);
+    CHECK_EQUAL(host::stats().brokerConnections - before.brokerConnections, 1ul);
+    host::config().serverOutageCount = 0;
+}
+
+TEST(half_open_session_times_out_and_is_replaced) {
+    connectWifi();
+    WiFiClient socket;
+    MqttUplink uplink(socket);
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    CHECK_EQUAL(countDelivered(uplink.sendEvents(events, 3), 3), 3);
+    host::dropConnections();
+
+    // the publishes leave but no PUBACK comes back
+    unsigned long start = millis();
+    int* results = uplink.sendEvents(events, 3);
+    CHECK_EQUAL(countDelivered(results, 3), 0);
+    CHECK(millis() - start >= (unsigned long)MQTT_ACK_TIMEOUT);
+
+    host::Stats before = host::stats();
+    results = uplink.sendEvents(events, 3);
+    CHECK_EQUAL(countDelivered(results, 3), 3);
+    CHECK_EQUAL(host::stats().brokerConnections - before.brokerConnections, 1ul);
+}
+
+TEST(qos1_drain_against_http_on_the_same_round_trip) {
+    connectWifi();
+    Event events[TEST_EVENTS];
+    fillEvents(events);
+
+    WiFiClient socket;
+    MqttUplink uplink(socket);
+    uplink.sendEvents(events, 1);
+    unsigned long start = millis();
+    CHECK_EQUAL(countDelivered(uplink.sendEvents(events, TEST_EVENTS), TEST_EVENTS), TEST_EVENTS);
+    unsigned long mqttMs = millis() - start;
+
+    WiFiClient client;
+    ApiClient batched(client);
+    batched.sendEvents(events, 1);
+    start = millis();
+    CHECK_EQUAL(countDelivered(batched.sendEvents(events, TEST_EVENTS), TEST_EVENTS), TEST_EVENTS);
+    unsigned long batchedMs = millis() - start;
+
+    ApiClient single(client);
+    single.setBatchingEnabled(false);
+    single.sendEvents(events, 1);
+    start = millis();
+    CHECK_EQUAL(countDelivered(single.sendEvents(events, TEST_EVENTS), TEST_EVENTS), TEST_EVENTS);
+    unsigned long singleMs = millis() - start;
+
+    // pipelining takes a round trip per window, one request per event takes one per event
+    CHECK(mqttMs < singleMs);
+    CHECK(singleMs >= (unsigned long)TEST_EVENTS * TEST_ROUND_TRIP);
+    fprintf(stderr, "        %d events: mqtt qos1 %lu ms (%.0f events/s), http batched %lu ms (%.0f events/s),"
+            " http single %lu ms (%.0f events/s)\n", TEST_EVENTS,
+            mqttMs, TEST_EVENTS * 1000.0 / mqttMs, batchedMs, TEST_EVENTS * 1000.0 / batchedMs,
+            singleMs, TEST_EVENTS * 1000.0 / singleMs);
+}
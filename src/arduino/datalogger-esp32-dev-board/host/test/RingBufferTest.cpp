@@ -0,0 +1,178 @@
+/*
+* The ring buffer of the pending events: order across the wrap, the overflow
+* policies and compaction without copies.
+*/
+
+#include "Test.h"
+#include "RingBuffer.h"
+
+// Counts how it is copied and moved, -1 is an empty slot
+struct Tracked {
+    static int copies;
+    static int moves;
+    int value;
+
+    Tracked() : value(-1) {}
+    Tracked(int v) : value(v) {}
+    Tracked(const Tracked& other) : value(other.value) { copies++; }
+    Tracked(Tracked&& other) : value(other.value) { moves++; }
+    Tracked& operator=(const Tracked& other) {
+        value = other.value;
+        copies++;
+        return *this;
+    }
+    Tracked& operator=(Tracked&& other) {
+        value = other.value;
+        moves++;
+        return *this;
+    }
+};
+
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+
+template <size_t Capacity>
+static void pushRange(RingBuffer<Tracked, Capacity>& ring, int from, int to) {
+    for (int i = from; i < to; i++) {
+        ring.push(Tracked(i));
+    }
+}
+
+TEST(keeps_the_order_across_the_wrap) {
+    RingBuffer<Tracked, 4> ring;
+    int next = 0;
+    int expected = 0;
+    Tracked item;
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < 1 + round % 3 && !ring.full(); i++) {
+            CHECK(ring.push(Tracked(next++)));
+        }
+        for (size_t i = 0; i < ring.size(); i++) {
+            CHECK_EQUAL(ring[i].value, expected + (int)i);
+        }
+        for (int i = 0; i < 1 + round % 2 && ring.pop(item); i++) {
+            CHECK_EQUAL(item.value, expected++);
+        }
+    }
+    CHECK_EQUAL(ring.dropped(), 0ul);
+}
+
+TEST(drop_oldest_makes_room) {
+    RingBuffer<Tracked, 4> ring(OVERFLOW_DROP_OLDEST);
+    pushRange(ring, 0, 6);
+    CHECK(ring.full());
+    CHECK_EQUAL(ring.dropped(), 2ul);
+    for (size_t i = 0; i < 4; i++) {
+        CHECK_EQUAL(ring[i].value, 2 + (int)i);
+    }
+}
+
+TEST(drop_newest_refuses_the_item) {
+    RingBuffer<Tracked, 4> ring(OVERFLOW_DROP_NEWEST);
+    pushRange(ring, 0, 4);
+    CHECK(!ring.push(Tracked(4)));
+    CHECK(!ring.push(Tracked(5)));
+    CHECK_EQUAL(ring.dropped(), 2ul);
+    for (size_t i = 0; i < 4; i++) {
+        CHECK_EQUAL(ring[i].value, (int)i);
+    }
+}
+
+TEST(spill_leaves_the_room_to_the_owner) {
+    RingBuffer<Tracked, 4> ring(OVERFLOW_SPILL);
+    pushRange(ring, 0, 4);
+    CHECK(!ring.push(Tracked(4)));
+    // refused but not lost: the owner moves the oldest items out and pushes again
+    CHECK_EQUAL(ring.dropped(), 0ul);
+    Tracked spilled[2];
+    CHECK(ring.pop(spilled[0]));
+    CHECK(ring.pop(spilled[1]));
+    CHECK(ring.push(Tracked(4)));
+    CHECK_EQUAL(spilled[0].value, 0);
+    CHECK_EQUAL(ring[0].value, 2);
+    CHECK_EQUAL(ring[2].value, 4);
+
+    ring.setPolicy(OVERFLOW_DROP_OLDEST);
+    pushRange(ring, 5, 7);
+    CHECK_EQUAL(ring.policy(), OVERFLOW_DROP_OLDEST);
+    CHECK_EQUAL(ring.dropped(), 1ul);
+    CHECK_EQUAL(ring[0].value, 3);
+}
+
+TEST(peek_hands_out_contiguous_runs) {
+    RingBuffer<Tracked, 4> ring;
+    pushRange(ring, 0, 4);
+    ring.discard(3);
+    pushRange(ring, 4, 6);
+    // slots: [4][5][-][3], the oldest is at the end of the array
+
+    Tracked* first;
+    CHECK_EQUAL(ring.peek(first, 10), (size_t)1);
+    CHECK_EQUAL(first[0].value, 3);
+    CHECK_EQUAL(ring.peek(first, 10, 1), (size_t)2);
+    CHECK_EQUAL(first[0].value, 4);
+    CHECK_EQUAL(first[1].value, 5);
+    CHECK_EQUAL(ring.peek(first, 1, 1), (size_t)1);
+    CHECK_EQUAL(ring.peek(first, 10, 3), (size_t)0);
+    CHECK(first == nullptr);
+    CHECK_EQUAL(ring.size(), (size_t)3);
+}
+
+TEST(discard_resets_the_slots) {
+    RingBuffer<Tracked, 4> ring;
+    pushRange(ring, 0, 3);
+    ring.discard(10);
+    CHECK(ring.empty());
+    for (size_t i = 0; i < 4; i++) {
+        CHECK_EQUAL(ring[i].value, -1);
+    }
+    CHECK_EQUAL(ring.dropped(), 0ul);
+}
+
+TEST(retain_compacts_without_copies) {
+    RingBuffer<Tracked, 8> ring;
+    pushRange(ring, 0, 8);
+    ring.discard(3);
+    pushRange(ring, 8, 11);
+    // wrapped: 3..10 with the head in the middle of the array
+
+    Tracked::copies = 0;
+    Tracked::moves = 0;
+    size_t removed = ring.retain([](Tracked& item, size_t) { return item.value % 3 != 0; });
+    CHECK_EQUAL(removed, (size_t)3);
+    CHECK_EQUAL(Tracked::copies, 0);
+    // each kept item moves once at most, each freed slot is reset once
+    CHECK(Tracked::moves <= 5 + 3);
+
+    const int kept[] = {4, 5, 7, 8, 10};
+    CHECK_EQUAL(ring.size(), (size_t)5);
+    for (size_t i = 0; i < 5; i++) {
+        CHECK_EQUAL(ring[i].value, kept[i]);
+    }
+    for (size_t i = 5; i < 8; i++) {
+        CHECK_EQUAL(ring[i].value, -1);
+    }
+
+    // what is left still wraps correctly
+    pushRange(ring, 11, 14);
+    CHECK(ring.full());
+    Tracked item;
+    CHECK(ring.pop(item));
+    CHECK_EQUAL(item.value, 4);
+    CHECK_EQUAL(ring[6].value, 13);
+}
+
+TEST(retain_all_and_none) {
+    RingBuffer<Tracked, 4> ring;
+    pushRange(ring, 0, 4);
+    Tracked::copies = 0;
+    Tracked::moves = 0;
+    CHECK_EQUAL(ring.retain([](Tracked&, size_t) { return true; }), (size_t)0);
+    CHECK_EQUAL(Tracked::copies + Tracked::moves, 0);
+
+    CHECK_EQUAL(ring.retain([](Tracked&, size_t position) { return position == 3; }), (size_t)3);
+    CHECK_EQUAL(ring[0].value, 3);
+    CHECK_EQUAL(ring.retain([](Tracked&, size_t) { return false; }), (size_t)1);
+    CHECK(ring.empty());
+    CHECK_EQUAL(ring.dropped(), 0ul);
+}
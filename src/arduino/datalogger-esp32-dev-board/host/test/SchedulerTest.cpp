@@ -0,0 +1,297 @@
+/*
+* The cooperative scheduler driven by a clock of its own, so every deadline,
+* jitter and overrun is exact.
+*/
+
+#include <limits.h>
+#include "Test.h"
+#include "Scheduler.h"
+
+static unsigned long now = 0;
+static uint32_t freeHeap = 100000;
+static int* runOrder = nullptr;     // where the next job that runs writes its id
+
+static unsigned long testClock() {
+    return now;
+}
+
+static uint32_t testHeap() {
+    return freeHeap;
+}
+
+// Counts its runs and takes as long as it is told, in ms of the test clock
+struct Job {
+    int runs = 0;
+    unsigned long duration = 0;
+    unsigned long lastRun = 0;
+    int id = 0;
+    uint32_t leak = 0;
+
+    static void run(void* context) {
+        Job* job = (Job*)context;
+        job->runs++;
+        job->lastRun = now;
+        if (runOrder != nullptr) {
+            *runOrder++ = job->id;
+        }
+        now += job->duration;
+        freeHeap -= job->leak;
+    }
+};
+
+// Waits for a sensor in steps, as the sampling state machines do
+struct Steps : public ResumableTask {
+    int step = 0;
+    int steps = 3;
+    unsigned long wait = 250;
+    unsigned long resumedAt[8] = {};
+
+    long resume(unsigned long time) override {
+        resumedAt[step] = time;
+        return ++step < steps ? (long)wait : TASK_FINISHED;
+    }
+};
+
+// Always has more to do, as a task polling a busy peripheral
+struct Spinner : public ResumableTask {
+    int runs = 0;
+
+    long resume(unsigned long time) override {
+        (void)time;
+        runs++;
+        return 0;
+    }
+};
+
+// Runs the scheduler up to duration ms from now included, sleeping what tick() asks plus a lateness
+static void runFor(Scheduler& scheduler, unsigned long duration, unsigned long lateness = 0) {
+    unsigned long end = now + duration;
+    while ((long)(now - end) <= 0) {
+        unsigned long wait = scheduler.tick();
+        now += (wait > 0 ? wait : 1) + lateness;
+    }
+}
+
+TEST(periodic_task_runs_on_its_deadlines) {
+    now = 1000;
+    Scheduler scheduler(testClock);
+    Job job;
+    int id = scheduler.every(100, Job::run, &job, "job", 50);
+
+    CHECK_EQUAL(scheduler.tick(), 50ul);
+    CHECK_EQUAL(job.runs, 0);
+    now += 50;
+    CHECK_EQUAL(scheduler.tick(), 100ul);
+    CHECK_EQUAL(job.runs, 1);
+
+    runFor(scheduler, 1000);
+    CHECK_EQUAL(job.runs, 11);
+    CHECK_EQUAL(job.lastRun, 2050ul);
+    const TaskStats* stats = scheduler.stats(id);
+    CHECK_EQUAL(stats->runs, 11ul);
+    CHECK_EQUAL(stats->maxJitter, 0ul);
+    CHECK_EQUAL(stats->overruns, 0ul);
+    CHECK_EQUAL(stats->name, "job");
+}
+
+TEST(wait_is_capped_when_nothing_is_due) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    CHECK_EQUAL(scheduler.tick(), (unsigned long)SCHEDULER_MAX_WAIT);
+    Job job;
+    scheduler.after(5 * SCHEDULER_MAX_WAIT, Job::run, &job, "later");
+    CHECK_EQUAL(scheduler.tick(), (unsigned long)SCHEDULER_MAX_WAIT);
+}
+
+TEST(due_tasks_run_earliest_deadline_first) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    int order[4];
+    Job a, b, c;
+    a.id = 1;
+    b.id = 2;
+    c.id = 3;
+    scheduler.after(30, Job::run, &a, "a");
+    scheduler.after(10, Job::run, &b, "b");
+    scheduler.after(20, Job::run, &c, "c");
+
+    now = 40;
+    runOrder = order;
+    scheduler.tick();
+    runOrder = nullptr;
+    CHECK_EQUAL(order[0], 2);
+    CHECK_EQUAL(order[1], 3);
+    CHECK_EQUAL(order[2], 1);
+}
+
+TEST(late_runs_report_jitter_and_keep_the_period) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    Job job;
+    int id = scheduler.every(100, Job::run, &job, "job");
+
+    // every wake up is 7 ms late
+    runFor(scheduler, 1000, 7);
+    const TaskStats* stats = scheduler.stats(id);
+    CHECK_EQUAL(stats->maxJitter, 7ul);
+    CHECK(stats->runs >= 9);
+    CHECK_EQUAL(stats->totalJitter, 7 * stats->runs - 7);
+    // the deadlines stay on the 100 ms grid
+    CHECK_EQUAL(job.lastRun % 100, 7ul);
+    CHECK_EQUAL(stats->overruns, 0ul);
+}
+
+TEST(overruns_skip_the_missed_runs) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    Job job;
+    job.duration = 250;
+    int id = scheduler.every(100, Job::run, &job, "slow");
+
+    runFor(scheduler, 1000);
+    const TaskStats* stats = scheduler.stats(id);
+    // runs at 0, 300, 600, 900: each ends past two deadlines that are dropped
+    CHECK_EQUAL(stats->runs, 4ul);
+    CHECK_EQUAL(stats->overruns, 4ul);
+    CHECK_EQUAL(stats->maxDuration, 250ul);
+    CHECK_EQUAL(stats->maxJitter, 0ul);
+    CHECK_EQUAL(job.lastRun, 900ul);
+}
+
+TEST(always_due_task_cannot_starve_the_others) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    Spinner busy;
+    Job other;
+    scheduler.start(busy, "busy");
+    scheduler.every(10, Job::run, &other, "other");
+
+    for (int i = 0; i < 10; i++) {
+        CHECK_EQUAL(scheduler.tick(), 0ul);
+        now += 10;
+    }
+    CHECK_EQUAL(busy.runs, 10);
+    CHECK_EQUAL(other.runs, 10);
+}
+
+TEST(one_shot_task_runs_once) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    Job job;
+    int id = scheduler.after(200, Job::run, &job, "once");
+    CHECK(scheduler.isActive(id));
+    runFor(scheduler, 1000);
+    CHECK_EQUAL(job.runs, 1);
+    CHECK_EQUAL(job.lastRun, 200ul);
+    CHECK(!scheduler.isActive(id));
+    CHECK(scheduler.stats(id) == nullptr);
+}
+
+TEST(resumable_task_waits_what_it_asks) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    Steps steps;
+    int id = scheduler.start(steps, "steps", 100);
+
+    runFor(scheduler, 2000);
+    CHECK_EQUAL(steps.step, 3);
+    CHECK_EQUAL(steps.resumedAt[0], 100ul);
+    CHECK_EQUAL(steps.resumedAt[1], 350ul);
+    CHECK_EQUAL(steps.resumedAt[2], 600ul);
+    CHECK(!scheduler.isActive(id));
+}
+
+TEST(cancelled_tasks_free_their_slot) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    Job jobs[SCHEDULER_MAX_TASKS + 1];
+    for (int i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        CHECK(scheduler.every(100, Job::run, &jobs[i], "job") >= 0);
+    }
+    CHECK_EQUAL(scheduler.every(100, Job::run, &jobs[SCHEDULER_MAX_TASKS], "extra"), -1);
+
+    scheduler.cancel(3);
+    CHECK_EQUAL(scheduler.every(100, Job::run, &jobs[SCHEDULER_MAX_TASKS], "extra"), 3);
+    runFor(scheduler, 450);
+    CHECK_EQUAL(jobs[3].runs, 0);
+    CHECK_EQUAL(jobs[SCHEDULER_MAX_TASKS].runs, 5);
+}
+
+static Scheduler* selfCancelling = nullptr;
+static int selfCancellingId = -1;
+
+static void cancelSelf(void* context) {
+    (*(int*)context)++;
+    selfCancelling->cancel(selfCancellingId);
+}
+
+TEST(task_can_cancel_itself) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    int runs = 0;
+    selfCancelling = &scheduler;
+    selfCancellingId = scheduler.every(100, cancelSelf, &runs, "self");
+    runFor(scheduler, 1000);
+    CHECK_EQUAL(runs, 1);
+    CHECK(!scheduler.isActive(selfCancellingId));
+}
+
+TEST(deadlines_survive_the_clock_wrapping) {
+    now = ULONG_MAX - 250;
+    Scheduler scheduler(testClock);
+    Job job;
+    int id = scheduler.every(100, Job::run, &job, "wrap");
+    runFor(scheduler, 1000);
+    CHECK_EQUAL(job.runs, 11);
+    CHECK_EQUAL(scheduler.stats(id)->maxJitter, 0ul);
+    CHECK_EQUAL(scheduler.stats(id)->overruns, 0ul);
+}
+
+TEST(heap_probe_counts_what_each_run_keeps) {
+    now = 0;
+    freeHeap = 100000;
+    Scheduler scheduler(testClock);
+    scheduler.setHeapProbe(testHeap);
+    Job leaking, clean;
+    leaking.leak = 32;
+    int leakingId = scheduler.every(100, Job::run, &leaking, "leaking");
+    int cleanId = scheduler.every(100, Job::run, &clean, "clean", 50);
+
+    runFor(scheduler, 1000);
+    CHECK_EQUAL(scheduler.stats(leakingId)->lastHeapDelta, 32l);
+    CHECK_EQUAL(scheduler.stats(leakingId)->netHeapDelta, 32l * leaking.runs);
+    CHECK_EQUAL(scheduler.stats(cleanId)->netHeapDelta, 0l);
+    CHECK_EQUAL(scheduler.stats(cleanId)->maxHeapDelta, 0l);
+}
+
+TEST(random_lateness_is_reported_as_jitter) {
+    now = 0;
+    Scheduler scheduler(testClock);
+    Job fast, slow, sampling;
+    sampling.duration = 3;
+    int fastId = scheduler.every(50, Job::run, &fast, "fast");
+    int slowId = scheduler.every(1000, Job::run, &slow, "slow", 500);
+    int samplingId = scheduler.every(300, Job::run, &sampling, "sampling", 10);
+
+    // an hour of wake ups up to 15 ms late
+    uint32_t random = 12345;
+    unsigned long end = now + 3600000UL;
+    while (now < end) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        unsigned long wait = scheduler.tick();
+        now += (wait > 0 ? wait : 1) + random % 16;
+    }
+
+    const unsigned long periods[] = {50, 1000, 300};
+    const int ids[] = {fastId, slowId, samplingId};
+    for (int i = 0; i < 3; i++) {
+        const TaskStats* stats = scheduler.stats(ids[i]);
+        // another task may run first, for at most its duration
+        CHECK(stats->maxJitter <= 15 + sampling.duration);
+        CHECK_EQUAL(stats->overruns, 0ul);
+        CHECK(stats->runs + 1 >= 3600000UL / periods[i]);
+        CHECK(stats->runs <= 3600000UL / periods[i] + 1);
+    }
+}
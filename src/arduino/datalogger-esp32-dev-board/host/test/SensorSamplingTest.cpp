@@ -0,0 +1,227 @@
+/*
+* Sampling several sensors at once: mock drivers with their own settle time and
+* read latency behind the Adapter interface, then the real adapters on the
+* simulated DHT and BH1750.
+*/
+
+#include <Arduino.h>
+#include "HostRuntime.h"
+#include "Test.h"
+#include "SensorAdapters.h"
+#include "SensorsMicroService.h"
+
+#define TEST_EPOCH 1717243200   // 2024-06-01T12:00:00
+
+/*
+* A sensor that needs settleMs between readings and blocks for readMs while it
+* is read, as a driver waiting on the bus does.
+*/
+class MockSensor : public Adapter {
+public:
+    MockSensor(uint8_t variable, int readings, unsigned long settleMs, unsigned long readMs)
+        : variable_(variable), readings_(readings), settleMs_(settleMs), readMs_(readMs), failing_(false),
+          taken_(0), nextReadingAt_(0), doneAt_(0) {}
+
+    Event specificRequest(Event timeEvent) override {
+        return sampleBlocking(timeEvent);
+    }
+
+    void startSampling(const Event& timeEvent, unsigned long now) override {
+        timeEvent_ = timeEvent;
+        result_ = Event();
+        taken_ = 0;
+        nextReadingAt_ = now;
+    }
+
+    long pollSampling(unsigned long now) override {
+        if ((long)(now - nextReadingAt_) < 0) {
+            return nextReadingAt_ - now;
+        }
+        delay(readMs_);
+        if (++taken_ < readings_) {
+            nextReadingAt_ = now + settleMs_;
+            return settleMs_;
+        }
+        doneAt_ = millis();
+        if (failing_) {
+            result_ = Event(MEASUREMENT_EVENT, INTERNAL_SERVER_ERROR, "", "Mock sensor not found");
+        } else {
+            MeasurementRecord record = makeMeasurementRecord(variable_, DEFAULT_CROP, 1.0f, timeEvent_.getEpoch());
+            result_ = Event(OK_STATUS, &record, 1);
+        }
+        return SAMPLING_DONE;
+    }
+
+    // Time a round takes when this sensor is sampled alone
+    unsigned long aloneMs() const {
+        return (readings_ - 1) * settleMs_ + readings_ * readMs_;
+    }
+
+    void setFailing(bool failing) { failing_ = failing; }
+    unsigned long doneAt() const { return doneAt_; }
+
+private:
+    uint8_t variable_;
+    int readings_;
+    unsigned long settleMs_;
+    unsigned long readMs_;
+    bool failing_;
+    int taken_;
+    unsigned long nextReadingAt_;
+    unsigned long doneAt_;
+};
+
+// Counts what the microservice publishes
+struct Published {
+    int spans = 0;
+    int records = 0;
+    bool seen[NUMBER_OF_VARIABLES] = {};
+
+    void onRecords(const RecordSpan& span) {
+        spans++;
+        for (size_t i = 0; i < span.size; i++) {
+            records++;
+            if (span.data[i].variableId < NUMBER_OF_VARIABLES) {
+                seen[span.data[i].variableId] = true;
+            }
+        }
+    }
+};
+
+static Event timeEvent() {
+    Event event(TIME_EVENT, OK_STATUS, "", "");
+    event.setEpoch(TEST_EPOCH);
+    return event;
+}
+
+TEST(round_takes_as_long_as_the_slowest_sensor) {
+    // a DHT, a light sensor and a slow bus sensor
+    MockSensor humidity(HUMIDITY_VARIABLE, 5, 2100, 25);
+    MockSensor light(LUX_VARIABLE, 5, 250, 120);
+    MockSensor soil(TEMPERATURE_VARIABLE, 3, 1000, 0);
+    SensorsMicroService service;
+    service.AddSensor(&humidity);
+    service.AddSensor(&light);
+    service.AddSensor(&soil);
+    service.onTime(timeEvent());
+
+    unsigned long sequential = humidity.aloneMs() + light.aloneMs() + soil.aloneMs();
+    unsigned long start = millis();
+    service.main();
+    unsigned long round = millis() - start;
+
+    // the reads of the others may push the slowest one back, the settle times overlap
+    unsigned long otherReads = 5 * 120;
+    CHECK(round >= humidity.aloneMs());
+    CHECK(round <= humidity.aloneMs() + otherReads);
+    CHECK(light.doneAt() < humidity.doneAt());
+    CHECK(soil.doneAt() < humidity.doneAt());
+    fprintf(stderr, "        round %lu ms, sampled one after the other %lu ms\n", round, sequential);
+}
+
+TEST(every_finished_sensor_is_published) {
+    MockSensor humidity(HUMIDITY_VARIABLE, 2, 100, 5);
+    MockSensor light(LUX_VARIABLE, 3, 50, 5);
+    SensorsMicroService service;
+    service.AddSensor(&humidity);
+    service.AddSensor(&light);
+    service.onTime(timeEvent());
+    Published published;
+    CHECK((service.measurementChannel.subscribe<Published, &Published::onRecords>(&published)));
+
+    service.notify();
+    CHECK_EQUAL(published.spans, 2);
+    CHECK(published.seen[HUMIDITY_VARIABLE] && published.seen[LUX_VARIABLE]);
+
+    // the stored events are handed out once
+    service.publish();
+    CHECK_EQUAL(published.spans, 2);
+}
+
+TEST(a_failing_sensor_does_not_hold_the_others) {
+    MockSensor broken(HUMIDITY_VARIABLE, 1, 0, 30);
+    broken.setFailing(true);
+    MockSensor light(LUX_VARIABLE, 4, 200, 10);
+    SensorsMicroService service;
+    service.AddSensor(&broken);
+    service.AddSensor(&light);
+    service.onTime(timeEvent());
+    Published published;
+    CHECK((service.measurementChannel.subscribe<Published, &Published::onRecords>(&published)));
+
+    unsigned long start = millis();
+    service.notify();
+    CHECK(millis() - start <= light.aloneMs() + 30);
+    CHECK_EQUAL(published.spans, 1);
+    CHECK(published.seen[LUX_VARIABLE]);
+    CHECK(!published.seen[HUMIDITY_VARIABLE]);
+}
+
+// Stands for the uploads and the SD drain that share the loop with sampling
+static int uploads = 0;
+
+static void upload(void* context) {
+    (void)context;
+    uploads++;
+}
+
+TEST(other_tasks_run_while_sensors_settle) {
+    MockSensor humidity(HUMIDITY_VARIABLE, 5, 2100, 25);
+    MockSensor light(LUX_VARIABLE, 5, 250, 60);
+    SensorsMicroService service;
+    service.AddSensor(&humidity);
+    service.AddSensor(&light);
+    service.onTime(timeEvent());
+    service.setSamplingInterval(10000);
+    Published published;
+    CHECK((service.measurementChannel.subscribe<Published, &Published::onRecords>(&published)));
+
+    Scheduler scheduler(millis);
+    int sampling = scheduler.start(service, "sampling");
+    uploads = 0;
+    int uploading = scheduler.every(100, upload, nullptr, "upload");
+
+    unsigned long end = millis() + 60000;
+    while ((long)(millis() - end) < 0) {
+        delay(scheduler.tick());
+    }
+
+    // the uploads kept their period through six rounds, late by the reads of one poll at most
+    CHECK_EQUAL(published.spans, 6 * 2);
+    CHECK_EQUAL(uploads, 600);
+    CHECK(scheduler.stats(uploading)->maxJitter <= 60 + 25);
+    CHECK_EQUAL(scheduler.stats(uploading)->overruns, 0ul);
+    CHECK(scheduler.stats(sampling)->maxDuration <= 60 + 25);
+}
+
+TEST(real_adapters_sample_together) {
+    DHTAdapter dht;
+    LuxAndDLIAdapter light(60);
+    SensorsMicroService service;
+    service.AddSensor(&dht);
+    service.AddSensor(&light);
+    service.onTime(timeEvent());
+    Published published;
+    CHECK((service.measurementChannel.subscribe<Published, &Published::onRecords>(&published)));
+
+    host::Stats& stats = host::stats();
+    unsigned long temperatureReads = stats.temperatureReads;
+    unsigned long lightReads = stats.lightReads;
+    unsigned long start = millis();
+    service.notify();
+    unsigned long round = millis() - start;
+
+    // five DHT readings 2.1 s apart, the light readings fit in between
+    CHECK_EQUAL(round, (unsigned long)(MAX_RETRIES - 1) * 2100);
+    CHECK_EQUAL(stats.temperatureReads - temperatureReads, (unsigned long)MAX_RETRIES);
+    CHECK_EQUAL(stats.lightReads - lightReads, (unsigned long)MAX_RETRIES);
+    CHECK_EQUAL(published.records, 6);
+    CHECK(published.seen[TEMPERATURE_VARIABLE] && published.seen[DEWPOINT_VARIABLE]);
+    CHECK(published.seen[LUX_VARIABLE] && published.seen[DLI_VARIABLE]);
+
+    // the same adapters one after the other
+    start = millis();
+    dht.sampleBlocking(timeEvent());
+    light.sampleBlocking(timeEvent());
+    CHECK_EQUAL(millis() - start, (unsigned long)(MAX_RETRIES - 1) * (2100 + 250));
+}
@@ -0,0 +1,171 @@
+/*
+* The single producer single consumer queue, alone and between two threads
+* standing for the two cores. The host runtime is single threaded, so the
+* threads here only touch the queue and their own state.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include "Test.h"
+#include "SpscQueue.h"
+#include "MeasurementQueue.h"
+
+#define STRESS_ITEMS 2000000UL
+
+TEST(holds_one_less_than_its_capacity) {
+    SpscQueue<int, 8> queue;
+    CHECK_EQUAL(queue.capacity(), (size_t)7);
+    CHECK(queue.empty());
+    for (int i = 0; i < 7; i++) {
+        CHECK(queue.push(i));
+    }
+    CHECK(!queue.push(7));
+    CHECK_EQUAL(queue.size(), (size_t)7);
+    CHECK_EQUAL(queue.freeSpace(), (size_t)0);
+
+    int item = -1;
+    CHECK(queue.peek(item));
+    CHECK_EQUAL(item, 0);
+    CHECK_EQUAL(queue.size(), (size_t)7);
+    for (int i = 0; i < 7; i++) {
+        CHECK(queue.pop(item));
+        CHECK_EQUAL(item, i);
+    }
+    CHECK(!queue.pop(item));
+    CHECK(!queue.peek(item));
+}
+
+TEST(keeps_the_order_across_the_wrap) {
+    SpscQueue<int, 4> queue;
+    int next = 0;
+    int expected = 0;
+    int item;
+    // pushes and pops in uneven steps so the indexes wrap at every offset
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < 1 + round % 3 && queue.push(next); i++) {
+            next++;
+        }
+        for (int i = 0; i < 1 + round % 2 && queue.pop(item); i++) {
+            CHECK_EQUAL(item, expected++);
+        }
+        CHECK_EQUAL(queue.size(), (size_t)(next - expected));
+    }
+}
+
+// What a producer core pushes: a sequence number and a check of it, so an item
+// read before it was completely written shows up
+struct Sample {
+    unsigned long sequence;
+    unsigned long check;
+};
+
+static unsigned long checkOf(unsigned long sequence) {
+    return sequence * 2654435761UL ^ 0x5bd1e995UL;
+}
+
+struct StressRun {
+    SpscQueue<Sample, 64> queue;
+    unsigned long fullSpins;
+    unsigned long emptySpins;
+    unsigned long received;
+    unsigned long outOfOrder;
+    unsigned long torn;
+};
+
+static void* produce(void* context) {
+    StressRun* run = (StressRun*)context;
+    for (unsigned long i = 0; i < STRESS_ITEMS; i++) {
+        Sample sample = {i, checkOf(i)};
+        while (!run->queue.push(sample)) {
+            run->fullSpins++;
+            sched_yield();
+        }
+    }
+    return nullptr;
+}
+
+static void* consume(void* context) {
+    StressRun* run = (StressRun*)context;
+    unsigned long expected = 0;
+    while (expected < STRESS_ITEMS) {
+        Sample sample;
+        if (!run->queue.pop(sample)) {
+            run->emptySpins++;
+            sched_yield();
+            continue;
+        }
+        if (sample.sequence != expected) {
+            run->outOfOrder++;
+        }
+        if (sample.check != checkOf(sample.sequence)) {
+            run->torn++;
+        }
+        expected = sample.sequence + 1;
+        run->received++;
+    }
+    return nullptr;
+}
+
+TEST(two_threads_lose_and_reorder_nothing) {
+    static StressRun run;
+    pthread_t producer;
+    pthread_t consumer;
+    CHECK_EQUAL(pthread_create(&consumer, nullptr, consume, &run), 0);
+    CHECK_EQUAL(pthread_create(&producer, nullptr, produce, &run), 0);
+    pthread_join(producer, nullptr);
+    pthread_join(consumer, nullptr);
+
+    CHECK_EQUAL(run.received, STRESS_ITEMS);
+    CHECK_EQUAL(run.outOfOrder, 0ul);
+    CHECK_EQUAL(run.torn, 0ul);
+    CHECK(run.queue.empty());
+    fprintf(stderr, "        %lu items, producer found it full %lu times, consumer found it empty %lu times\n",
+            run.received, run.fullSpins, run.emptySpins);
+}
+
+// The measurement queue between acquisition and upload, with its own record type
+struct RecordRun {
+    MeasurementQueue queue;
+    unsigned long received;
+    unsigned long wrong;
+};
+
+static void* produceRecords(void* context) {
+    RecordRun* run = (RecordRun*)context;
+    for (uint32_t i = 0; i < STRESS_ITEMS / 4; i++) {
+        MeasurementRecord record = makeMeasurementRecord(i % NUMBER_OF_VARIABLES, DEFAULT_CROP, (float)(i % 1000), i);
+        while (!run->queue.push(record)) {
+            sched_yield();
+        }
+    }
+    return nullptr;
+}
+
+static void* consumeRecords(void* context) {
+    RecordRun* run = (RecordRun*)context;
+    while (run->received < STRESS_ITEMS / 4) {
+        MeasurementRecord record;
+        if (!run->queue.pop(record)) {
+            sched_yield();
+            continue;
+        }
+        uint32_t i = (uint32_t)run->received++;
+        if (record != makeMeasurementRecord(i % NUMBER_OF_VARIABLES, DEFAULT_CROP, (float)(i % 1000), i)) {
+            run->wrong++;
+        }
+    }
+    return nullptr;
+}
+
+TEST(measurement_queue_between_two_threads) {
+    static RecordRun run;
+    pthread_t producer;
+    pthread_t consumer;
+    CHECK_EQUAL(pthread_create(&consumer, nullptr, consumeRecords, &run), 0);
+    CHECK_EQUAL(pthread_create(&producer, nullptr, produceRecords, &run), 0);
+    pthread_join(producer, nullptr);
+    pthread_join(consumer, nullptr);
+
+    CHECK_EQUAL(run.received, STRESS_ITEMS / 4);
+    CHECK_EQUAL(run.wrong, 0ul);
+}
@@ -0,0 +1,123 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+
+/*
+* Unit tests of the host build. Every file in test/ is its own executable that
+* ctest runs; a test is a function registered with TEST and stops at the first
+* CHECK that fails:
+*
+*   TEST(ring_buffer_wraps) {
+*       CHECK(ring.push(event));
+*       CHECK_EQUAL(ring.size(), 1u);
+*   }
+*
+* The runner in TestMain.cpp sets up the host runtime the way the benchmarks do
+* (simulated time that never runs out) and takes an optional name filter.
+*/
+
+typedef void (*TestFunction)();
+
+struct TestCase {
+    const char* name;
+    TestFunction function;
+    TestCase* next;
+};
+
+// Thrown by a failed CHECK, caught by the runner
+struct TestFailure {};
+
+void registerTest(TestCase* test);
+void testFailed(const char* file, int line, const char* expression, const char* detail);
+
+// Empties the simulated SD card (test-sd-<executable>/), lifts its capacity and mounts it again
+void clearTestCard();
+
+struct TestRegistrar {
+    TestRegistrar(TestCase* test) { registerTest(test); }
+};
+
+#define TEST(name)                                                          \
+    static void name();                                                     \
+    static TestCase name##_case = {#name, name, nullptr};                   \
+    static TestRegistrar name##_registrar(&name##_case);                    \
+    static void name()
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            testFailed(__FILE__, __LINE__, #condition, nullptr);            \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQUAL(actual, expected) checkEqual((actual), (expected), #actual " == " #expected, __FILE__, __LINE__)
+
+#define CHECK_NEAR(actual, expected, tolerance)                             \
+    checkNear((double)(actual), (double)(expected), (double)(tolerance), #actual " ~ " #expected, __FILE__, __LINE__)
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+describe(char* text, size_t size, T value) {
+    snprintf(text, size, "%lld", (long long)value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+describe(char* text, size_t size, T value) {
+    snprintf(text, size, "%llu", (unsigned long long)value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type describe(char* text, size_t size, T value) {
+    snprintf(text, size, "%.9g", (double)value);
+}
+
+inline void describe(char* text, size_t size, const char* value) {
+    snprintf(text, size, "\"%s\"", value != nullptr ? value : "(null)");
+}
+
+inline void describe(char* text, size_t size, char* value) {
+    describe(text, size, (const char*)value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_enum<T>::value>::type describe(char* text, size_t size, T value) {
+    snprintf(text, size, "%lld", (long long)value);
+}
+
+inline bool equal(const char* a, const char* b) {
+    return a != nullptr && b != nullptr ? strcmp(a, b) == 0 : a == b;
+}
+
+template <typename A, typename B>
+bool equal(const A& a, const B& b) {
+    return a == b;
+}
+
+template <typename A, typename B>
+void checkEqual(const A& actual, const B& expected, const char* expression, const char* file, int line) {
+    if (!equal(actual, expected)) {
+        char a[64];
+        char e[64];
+        char detail[160];
+        describe(a, sizeof(a), actual);
+        describe(e, sizeof(e), expected);
+        snprintf(detail, sizeof(detail), "got %s, expected %s", a, e);
+        testFailed(file, line, expression, detail);
+    }
+}
+
+inline void checkNear(double actual, double expected, double tolerance, const char* expression, const char* file,
+                      int line) {
+    double difference = actual > expected ? actual - expected : expected - actual;
+    if (!(difference <= tolerance)) {
+        char detail[160];
+        snprintf(detail, sizeof(detail), "got %.9g, expected %.9g within %g", actual, expected, tolerance);
+        testFailed(file, line, expression, detail);
+    }
+}
+
+#endif // HOST_TEST_H
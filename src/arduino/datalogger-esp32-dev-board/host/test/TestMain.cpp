@@ -0,0 +1,73 @@
+/*
+* Runs the tests of one test executable, all of them or those whose name holds
+* the text given as the only argument. Exits with 1 if any test failed.
+*/
+
+#include <stdint.h>
+#include <ftw.h>
+#include "HostRuntime.h"
+#include "SD.h"
+#include "Test.h"
+
+static TestCase* firstTest = nullptr;
+static TestCase* lastTest = nullptr;
+
+void registerTest(TestCase* test) {
+    // kept in the order of the file, tests read better failing top to bottom
+    if (lastTest == nullptr) {
+        firstTest = test;
+    } else {
+        lastTest->next = test;
+    }
+    lastTest = test;
+}
+
+void testFailed(const char* file, int line, const char* expression, const char* detail) {
+    const char* base = strrchr(file, '/');
+    fprintf(stderr, "  %s:%d: CHECK(%s) failed%s%s\n", base != nullptr ? base + 1 : file, line, expression,
+            detail != nullptr ? ": " : "", detail != nullptr ? detail : "");
+    throw TestFailure();
+}
+
+static int removeEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+void clearTestCard() {
+    nftw(host::config().sdRoot, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    SD.setCapacity(0);
+    SD.begin();
+}
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+
+    // the tests never run out of simulated time, each one starts where the last stopped
+    host::Config& config = host::config();
+    config.durationMs = UINT64_MAX;
+    // a card per executable, ctest runs them in parallel from the same directory
+    const char* name = strrchr(argv[0], '/');
+    snprintf(config.sdRoot, sizeof(config.sdRoot), "test-sd-%s", name != nullptr ? name + 1 : argv[0]);
+    host::begin();
+
+    int run = 0;
+    int failed = 0;
+    for (TestCase* test = firstTest; test != nullptr; test = test->next) {
+        if (filter != nullptr && strstr(test->name, filter) == nullptr) {
+            continue;
+        }
+        run++;
+        try {
+            test->function();
+            fprintf(stderr, "ok      %s\n", test->name);
+        } catch (const TestFailure&) {
+            fprintf(stderr, "FAILED  %s\n", test->name);
+            failed++;
+        }
+    }
+    fprintf(stderr, "%d tests, %d failed\n", run, failed);
+    return failed > 0 || run == 0 ? 1 : 0;
+}
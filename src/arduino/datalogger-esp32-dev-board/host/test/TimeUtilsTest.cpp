@@ -0,0 +1,127 @@
+/*
+* The civil date conversions at the leap days, the 2038 boundary of a signed
+* 32 bit time_t and the end of the unsigned epoch, and every day in between
+* against the C library, whose time_t is 64 bits on the host.
+*/
+
+#include <time.h>
+#include <string.h>
+#include "Test.h"
+#include "TimeUtils.h"
+
+#define SIGNED_EPOCH_MAX 2147483647UL   // 2038-01-19T03:14:07, where a signed 32 bit time_t ends
+
+static bool parses(const char* text, uint32_t& epoch) {
+    return parseIsoTimestamp(text, strlen(text), epoch);
+}
+
+static bool formatsAs(uint32_t epoch, const char* expected) {
+    char text[ISO_TIMESTAMP_BUFFER];
+    formatIsoTimestamp(epoch, text);
+    if (strcmp(text, expected) != 0) {
+        fprintf(stderr, "  %lu formats as %s, expected %s\n", (unsigned long)epoch, text, expected);
+        return false;
+    }
+    return true;
+}
+
+// Formats the epoch and parses it back
+static bool roundTrips(uint32_t epoch) {
+    char text[ISO_TIMESTAMP_BUFFER];
+    formatIsoTimestamp(epoch, text);
+    uint32_t parsed = 0;
+    return parses(text, parsed) && parsed == epoch && epochFromCivil(civilFromEpoch(epoch)) == epoch;
+}
+
+TEST(leap_years_follow_the_gregorian_rules) {
+    CHECK(isLeapYear(2024));
+    CHECK(!isLeapYear(2023));
+    CHECK(isLeapYear(2000));
+    CHECK(!isLeapYear(2100));
+    CHECK(!isLeapYear(1900));
+    CHECK_EQUAL((int)daysInMonth(2024, 2), 29);
+    CHECK_EQUAL((int)daysInMonth(2100, 2), 28);
+    CHECK_EQUAL((int)daysInMonth(2000, 2), 29);
+    CHECK_EQUAL((int)daysInMonth(2023, 12), 31);
+}
+
+TEST(leap_days_are_crossed_both_ways) {
+    uint32_t epoch = 0;
+    CHECK(parses("2024-02-29T23:59:59", epoch));
+    CHECK(formatsAs(epoch, "2024-02-29T23:59:59"));
+    CHECK(formatsAs(epoch + 1, "2024-03-01T00:00:00"));
+    CHECK(parses("2024-02-28T12:00:00", epoch));
+    CHECK(formatsAs(epoch + SECONDS_PER_DAY, "2024-02-29T12:00:00"));
+
+    // 2000 is a leap year by the 400 rule, 2100 is not by the 100 rule
+    CHECK(parses("2000-02-28T00:00:00", epoch));
+    CHECK(formatsAs(epoch + SECONDS_PER_DAY, "2000-02-29T00:00:00"));
+    CHECK(parses("2100-02-28T00:00:00", epoch));
+    CHECK(formatsAs(epoch + SECONDS_PER_DAY, "2100-03-01T00:00:00"));
+
+    // the year ends a day later in a leap year
+    CHECK(parses("2024-12-31T00:00:00", epoch));
+    CHECK_EQUAL(dayNumber(epoch) - (uint32_t)daysFromCivil(2024, 1, 1), 365ul);
+    CHECK(parses("2023-12-31T00:00:00", epoch));
+    CHECK_EQUAL(dayNumber(epoch) - (uint32_t)daysFromCivil(2023, 1, 1), 364ul);
+}
+
+TEST(days_not_in_the_month_are_rejected) {
+    uint32_t epoch = 0;
+    CHECK(!parses("2023-02-29T00:00:00", epoch));
+    CHECK(!parses("2100-02-29T00:00:00", epoch));
+    CHECK(!parses("2024-02-30T00:00:00", epoch));
+    CHECK(!parses("2024-04-31T00:00:00", epoch));
+    CHECK(parses("2000-02-29T00:00:00", epoch));
+    CHECK(parses("2024-01-31T00:00:00", epoch));
+}
+
+TEST(signed_32_bit_boundary_of_2038_is_crossed) {
+    CHECK(formatsAs(SIGNED_EPOCH_MAX, "2038-01-19T03:14:07"));
+    CHECK(formatsAs(SIGNED_EPOCH_MAX + 1, "2038-01-19T03:14:08"));
+    CHECK(roundTrips(SIGNED_EPOCH_MAX));
+    CHECK(roundTrips(SIGNED_EPOCH_MAX + 1));
+
+    uint32_t epoch = 0;
+    CHECK(parses("2038-01-19T03:14:08", epoch));
+    CHECK_EQUAL(epoch, (uint32_t)(SIGNED_EPOCH_MAX + 1));
+    CHECK(parses("2038-01-20T00:00:00", epoch));
+    CHECK_EQUAL(dayNumber(epoch), dayNumber(SIGNED_EPOCH_MAX) + 1);
+}
+
+TEST(unsigned_epoch_ends_in_2106) {
+    CHECK(formatsAs(0, "1970-01-01T00:00:00"));
+    CHECK(formatsAs(UINT32_MAX, "2106-02-07T06:28:15"));
+    CHECK(roundTrips(UINT32_MAX));
+
+    uint32_t epoch = 0;
+    CHECK(parses("2106-02-07T06:28:15", epoch));
+    CHECK_EQUAL(epoch, (uint32_t)UINT32_MAX);
+    CHECK(!parses("2106-02-07T06:28:16", epoch));
+    CHECK(!parses("2107-01-01T00:00:00", epoch));
+    CHECK(!parses("1969-12-31T23:59:59", epoch));
+}
+
+TEST(every_day_matches_the_c_library) {
+    // noon, and the last second of each day, from 1970 to the end of the epoch
+    int mismatches = 0;
+    for (uint32_t day = 0; day <= dayNumber(UINT32_MAX); day++) {
+        const uint32_t seconds[2] = {12 * 3600, SECONDS_PER_DAY - 1};
+        for (int i = 0; i < 2; i++) {
+            uint64_t epoch64 = (uint64_t)day * SECONDS_PER_DAY + seconds[i];
+            if (epoch64 > UINT32_MAX) {
+                continue;
+            }
+            uint32_t epoch = (uint32_t)epoch64;
+            time_t time = (time_t)epoch;
+            struct tm expected;
+            gmtime_r(&time, &expected);
+            CivilTime civil = civilFromEpoch(epoch);
+            bool same = civil.year == expected.tm_year + 1900 && civil.month == expected.tm_mon + 1 &&
+                        civil.day == expected.tm_mday && civil.hour == expected.tm_hour &&
+                        civil.minute == expected.tm_min && civil.second == expected.tm_sec;
+            mismatches += (same && roundTrips(epoch)) ? 0 : 1;
+        }
+    }
+    CHECK_EQUAL(mismatches, 0);
+}
@@ -10,17 +10,53 @@
 #endif
 
 
-#include "EventManager.h"
 #include "TimeEventManager.h"
+#include "ClockService.h"
+#include "Ds3231Clock.h"
+#include "NtpClock.h"
 #include "ConnectionEventManager.h"
 
 #include "CustomUtils.h"
+#include "EventLog.h"
 #include "secrets.h"
 #include "SensorAdapters.h"
 #include "SensorsMicroService.h"
+#include "Scheduler.h"
+#include "MeasurementQueue.h"
+#include "FlowController.h"
+#include "Instrumentation.h"
+#include "Log.h"
 
 //SD card
 bool sdCardInitialized = false;
+EventLog sdEventLog;
+
+// acquisition runs on the loop task (core 1) and the uplink on its own task next to
+// the WiFi stack (core 0), set DUAL_CORE to 0 to run both on the loop task
+#ifndef DUAL_CORE
+#define DUAL_CORE 1
+#endif
+#define UPLINK_CORE 0
+#define UPLINK_STACK_SIZE 16384
+#define UPLINK_PRIORITY 1
+
+// the log lines are written to the serial port by a task of their own, so printing
+// never holds up the acquisition or the uplink. It runs one above the idle task, at
+// the priority of the loop task: at the idle priority it only ran when the idle task
+// yielded, and an acquisition that kept the core busy starved it until the ring
+// overflowed. Next to the loop task it gets the core when the acquisition waits, and
+// when both are ready they share it a tick at a time; writing blocks on the UART
+// driver's queue instead of spinning, so the acquisition loses at most that tick.
+#define LOG_CORE 1
+#define LOG_STACK_SIZE 4096
+#define LOG_PRIORITY (tskIDLE_PRIORITY + 1)
+#define LOG_DRAIN_INTERVAL 50                    //ms
+
+// measurements go from the acquisition side to the uplink side only through this queue
+MeasurementQueue measurementQueue;
+
+// decides when events move between RAM and the SD card, used by the uplink only
+FlowController flowController;
 
 //time in seconds
 #define timeEventManagerFrequency 5              //5 seconds
@@ -28,17 +64,40 @@ bool sdCardInitialized = false;
 #define connectionEventManagerFrequency 41*1    //10 minutes
 #define sdStoreFrequency 60*2                    //11 minutes
 #define sdLoadFrequency 60*1                     //12 minutes
+#define uploadFrequency 2500                     //ms
+#define statsFrequency 60000                     //ms
 #define LED 2
 
-void updateEventManager(EventManager &eventManager, unsigned long &previousEventMillis, unsigned long &currentMillis, unsigned long eventFrequency);
-void sendPendingAndStoreExcessEvents(ConnectionEventManager &connectioneventmanager, TimeEventManager &timeeventmanager);
+// the stage timings and counters are uploaded as an event this often, in ms; 0 keeps
+// them on the serial port only, the server has to accept the telemetry payload first
+#ifndef TELEMETRY_INTERVAL
+#define TELEMETRY_INTERVAL 0
+#endif
+#define TELEMETRY_JSON_LENGTH 1024
+
+void uploadTask(void* connectionEventManager);
+void statsTask(void* scheduler);
+void instrumentationTask(void* unused);
+void logTask(void* unused);
+void logDrainTask(void* unused);
+void writeLogToSerial(const char* text, size_t length);
+void telemetryTask(void* connectionEventManager);
+void uplinkTask(void* scheduler);
+void sendPendingAndStoreExcessEvents(ConnectionEventManager &connectioneventmanager);
 void loadAndSendEvents(ConnectionEventManager &connectionEventManager, bool fromNewestToOldest = true);
+bool loadAndSendLegacyEvents(ConnectionEventManager &connectionEventManager, bool fromNewestToOldest);
 
 void setup() {
 
   //initialize the serial port, the i2c bus, the spi bus
   Serial.begin(9600);
   delay(250);
+  // the stages are timed from here on, the SD card scan below included
+  instrumentation().setClock(micros);
+  logger().begin(millis, writeLogToSerial);
+#if DUAL_CORE
+  xTaskCreatePinnedToCore(logTask, "log", LOG_STACK_SIZE, nullptr, LOG_PRIORITY, nullptr, LOG_CORE);
+#endif
   Wire.begin();
   delay(250);
   SPI.begin(SCK, MISO, MOSI, CS);
@@ -52,10 +111,11 @@ void setup() {
 
   // start the SD card
   if(!SD.begin()){
-      Serial.println("Card Mount Failed");
+      LOG_ERROR(STORAGE, "Card Mount Failed");
   }else{
-      Serial.println("Card Mount Success");
+      LOG_INFO(STORAGE, "Card Mount Success");
       sdCardInitialized = true;
+      sdEventLog.begin(SD);
   }
 
   showAditionalSDCardInfo(SD);
@@ -64,7 +124,16 @@ void setup() {
 void loop() {
 
   delay(100);
-  TimeEventManager timeEventManager = TimeEventManager(timeEventManagerFrequency);
+  // the RTC is read at start and then hourly, the time in between is kept by millis()
+  Ds3231Clock rtc;
+  NtpClock ntpClock;
+  ClockService clockService(rtc, millis);
+  if (!clockService.begin()) {
+    LOG_ERROR(SYSTEM, "RTC read failed, the clock starts unset");
+  }
+  clockService.setReference(&ntpClock);
+
+  TimeEventManager timeEventManager(clockService, timeEventManagerFrequency);
   ConnectionEventManager connectionEventManager;
   SensorsMicroService sensorsMicroService = SensorsMicroService();
   DHTAdapter dhtAdapter = DHTAdapter();
@@ -73,99 +142,226 @@ void loop() {
   sensorsMicroService.AddSensor(&dhtAdapter);
   sensorsMicroService.AddSensor(&luxAndDLIAdapter);
 
-  timeEventManager.subscribe(&sensorsMicroService);
-  sensorsMicroService.subscribe(&connectionEventManager);
+  MeasurementQueueWriter measurementQueueWriter(measurementQueue);
+  connectionEventManager.setSpillLog(&sdEventLog);
+
+  timeEventManager.timeChannel.subscribe<SensorsMicroService, &SensorsMicroService::onTime>(&sensorsMicroService);
+  sensorsMicroService.measurementChannel.subscribe<MeasurementQueueWriter, &MeasurementQueueWriter::onRecords>(&measurementQueueWriter);
+  // SNTP is started once the link is up
+  connectionEventManager.linkChannel.subscribe<NtpClock, &NtpClock::onLink>(&ntpClock);
   delay(100);
   logMemoryUsage();
-  connectionEventManager.main();
-  logMemoryUsage();
 
-  unsigned long previousTimeEventMillis = 0;
-  unsigned long previousConnectionEventMillis = 0;
-  unsigned long previousSensorsMicroServiceMillis = 0;
-  unsigned long sdStoreMillis = 0;
-  unsigned long sdLoadMillis = 0;
-  unsigned long currentMillis = millis();
+  // every manager runs from a scheduler, earliest deadline first, instead of
+  // being polled in a loop that sleeps between passes
+  // the stats of every task show the heap its runs keep, it stays flat when nothing leaks
+  Scheduler acquisition(millis);
+  acquisition.setHeapProbe(freeHeapBytes);
+  // the clock owns the I2C bus together with the sensors, so it runs on the same task
+  acquisition.start(clockService, "clock");
+  acquisition.every(timeEventManagerFrequency * 1000UL, TimeEventManager::notifyTask, &timeEventManager, "time");
+  // the sensors are sampled concurrently, the task is resumed whenever one needs a reading
+  sensorsMicroService.setSamplingInterval(sensorsMicroServiceFrequency * 1000UL);
+  acquisition.start(sensorsMicroService, "sensors");
+  acquisition.every(statsFrequency, statsTask, &acquisition, "acquisition stats");
+#if !DUAL_CORE
+  // without the log task the lines are written between the other tasks
+  acquisition.every(LOG_DRAIN_INTERVAL, logDrainTask, nullptr, "log");
+#endif
+
+  Scheduler uplink(millis);
+  uplink.setHeapProbe(freeHeapBytes);
+  // the WiFi link is brought up and watched a step at a time, sends wait for it
+  uplink.start(connectionEventManager, "connection");
+  uplink.every(uploadFrequency, uploadTask, &connectionEventManager, "upload");
+  uplink.every(statsFrequency, statsTask, &uplink, "uplink stats");
+  uplink.every(statsFrequency, instrumentationTask, nullptr, "instrumentation");
+#if TELEMETRY_INTERVAL > 0
+  uplink.every(TELEMETRY_INTERVAL, telemetryTask, &connectionEventManager, "telemetry");
+#endif
 
+#if DUAL_CORE
+  // loop never returns, so the objects above outlive the uplink task
+  xTaskCreatePinnedToCore(uplinkTask, "uplink", UPLINK_STACK_SIZE, &uplink, UPLINK_PRIORITY, nullptr, UPLINK_CORE);
+
+  while (true) {
+    // sleep until the next deadline, the idle task keeps the watchdog fed
+    delay(acquisition.tick());
+  }
+#else
   while (true) {
-    currentMillis = millis();
-    
-    //update the time
-    updateEventManager(timeEventManager, previousTimeEventMillis, currentMillis, timeEventManagerFrequency);
-    
-    //update the connection - this tries to connect to the wifi and check if the connection
-    //is still alive
-    updateEventManager(connectionEventManager, previousConnectionEventMillis, currentMillis, connectionEventManagerFrequency);
-
-    //update the time
-    updateEventManager(timeEventManager, previousTimeEventMillis, currentMillis, timeEventManagerFrequency);
-
-    //update the measurements from sensors - this tries to get the measurements from
-    //the sensors and notify the subscribers
-    updateEventManager(sensorsMicroService, previousSensorsMicroServiceMillis, currentMillis, sensorsMicroServiceFrequency);
-
-    //update the time
-    updateEventManager(timeEventManager, previousTimeEventMillis, currentMillis, timeEventManagerFrequency);
-
-    //send pending events and store excess events
-    sendPendingAndStoreExcessEvents(connectionEventManager, timeEventManager);
-
-    //load and send events from the SD card
-    loadAndSendEvents(connectionEventManager);
-
-    //show memory usage
-    logMemoryUsage();
-    delay(2500);
+    unsigned long acquisitionWait = acquisition.tick();
+    delay(min(acquisitionWait, uplink.tick()));
   }
+#endif
+
+}
+
+void uplinkTask(void* scheduler) {
+  Scheduler &uplink = *static_cast<Scheduler*>(scheduler);
+  while (true) {
+    delay(uplink.tick());
+  }
+}
+
+/*
+* Sends the sampled and pending events, stores the excess ones and drains a batch from the SD card.
+*/
+void uploadTask(void* connectionEventManager) {
+  ConnectionEventManager &manager = *static_cast<ConnectionEventManager*>(connectionEventManager);
+
+  //hand the sampled measurements to the connection manager
+  Event sampledEvents[MAX_MEASUREMENTS];
+  int sampled = drainMeasurementQueue(measurementQueue, sampledEvents, MAX_MEASUREMENTS);
+  if (sampled > 0) {
+    unsigned long start = millis();
+    size_t sent = manager.sendNewEvents(sampledEvents, sampled);
+    flowController.recordSend(manager.getLastAttemptedCount(), sent, millis() - start);
+  }
+
+  //send pending events and store excess events
+  sendPendingAndStoreExcessEvents(manager);
+
+  //load and send events from the SD card
+  loadAndSendEvents(manager);
+}
+
+void statsTask(void* scheduler) {
+  logMemoryUsage();
+  static_cast<Scheduler*>(scheduler)->logStats();
+}
 
+void writeLogToSerial(const char* text, size_t length) {
+  Serial.write((const uint8_t*)text, length);
+}
+
+void logTask(void* unused) {
+  (void)unused;
+  while (true) {
+    if (logger().drain() == 0) {
+      delay(LOG_DRAIN_INTERVAL);
+    }
+  }
 }
 
+void logDrainTask(void* unused) {
+  (void)unused;
+  logger().drain();
+}
 
+void instrumentationTask(void* unused) {
+  (void)unused;
+  LOG_INFO(SYSTEM, "Stage timings:");
+  instrumentation().logSummary();
+}
 
 /*
-* Update the event manager
+* Sends the stage timings and counters since the last telemetry event, as an event
+* carrying the JSON as its data. It goes through the connection manager, so it is
+* kept and retried like a measurement when the link is down.
 */
-void updateEventManager(EventManager &eventManager,
-                        unsigned long &previousEventMillis,
-                        unsigned long &currentMillis,
-                        unsigned long eventFrequency) {
-  if (currentMillis - previousEventMillis >= eventFrequency * 1000) {
-    eventManager.notify();
-    previousEventMillis = currentMillis;
+void telemetryTask(void* connectionEventManager) {
+  ConnectionEventManager &manager = *static_cast<ConnectionEventManager*>(connectionEventManager);
+
+  char json[TELEMETRY_JSON_LENGTH + 1];
+  BufferSink sink(json, TELEMETRY_JSON_LENGTH);
+  instrumentation().writeJson(sink, millis());
+  if (sink.overflow()) {
+    LOG_WARN(SYSTEM, "Telemetry does not fit its buffer, not sent");
+    return;
   }
-  currentMillis = millis();
+  json[sink.length()] = '\0';
+
+  Event telemetry(MEASUREMENT_EVENT, OK_STATUS, "", String(json));
+  manager.sendNewEvents(&telemetry, 1);
+  // only flags the stages, the acquisition task clears its own at its next sample
+  instrumentation().reset();
 }
 
-void sendPendingAndStoreExcessEvents(ConnectionEventManager &connectionEventManager, 
-                                     TimeEventManager &timeEventManager){
-  
-  String epoch = String(abs(timeEventManager.getEpoch()));
-  String fileName = "/" + epoch + ".txt";
+void sendPendingAndStoreExcessEvents(ConnectionEventManager &connectionEventManager){
 
   // try to send any pending events
-  connectionEventManager.sendMemAllocatedData();
-
-  // store excess pending events in the SD card
-  Event excessEvents[MAX_EVENTS_PER_FILE];
-  bool availableData = connectionEventManager.returnExcessEvents(excessEvents, MAX_EVENTS_PER_FILE);
-  if (availableData) {
-    storeEvents(SD, excessEvents, MAX_EVENTS_PER_FILE, fileName.c_str());
+  unsigned long start = millis();
+  size_t sent = connectionEventManager.sendMemAllocatedData();
+  flowController.recordSend(connectionEventManager.getLastAttemptedCount(), sent, millis() - start);
+
+  // append the events above the watermark to the SD card log, in one append or two
+  // when the buffer wrapped around; they stay in RAM if the append fails
+  size_t toSpill = flowController.toSpill(connectionEventManager.measurementEvents.size());
+  if (toSpill == 0) {
+    return;
+  }
+  start = millis();
+  size_t spilled = connectionEventManager.spillExcessEvents(toSpill);
+  if (spilled > 0) {
+    flowController.recordSdAccess(spilled, millis() - start);
   }
 }
 
+/*
+* Sends a batch of events from the SD card once the events in RAM are below the low
+* watermark. Files left by older firmware are drained first, then the log. Events the
+* server acknowledged are consumed by advancing the log cursor, the ones that failed
+* are appended again at the end of the log.
+*/
 void loadAndSendEvents(ConnectionEventManager &connectionEventManager, 
                        bool fromNewestToOldest) {
+  bool backlogPending = sdEventLog.hasPending() || hasBacklogFiles();
+  size_t batch = flowController.toRefill(connectionEventManager.measurementEvents.size(), backlogPending);
+  // nothing is read from the card while the uplink is paused
+  if (batch == 0 || !connectionEventManager.uplinkReady()) {
+    return;
+  }
+  if (loadAndSendLegacyEvents(connectionEventManager, fromNewestToOldest)) {
+    return;
+  }
+
+  Event loadedEvents[FLOW_MAX_BATCH];
+  EventLogCursor next;
+  unsigned long start = millis();
+  int loaded = sdEventLog.peek(loadedEvents, min(batch, (size_t)FLOW_MAX_BATCH), next);
+  flowController.recordSdAccess(loaded, millis() - start);
+
+  if (loaded > 0) {
+    start = millis();
+    // the events that were sent or given up are replaced with empty ones, the
+    // ones the server rejected count it in timesSent
+    bool allSent = connectionEventManager.updateFromLoadedEvents(loadedEvents, loaded);
+    flowController.recordSend(connectionEventManager.getLastAttemptedCount(),
+                              connectionEventManager.getLastSentCount(), millis() - start);
+
+    if (!allSent) {
+      if (!sdEventLog.append(loadedEvents, loaded)) {
+        // keep the cursor where it is so the batch is read again
+        return;
+      }
+    }
+  }
+  sdEventLog.advance(next);
+}
+
+/*
+* Sends a batch from the one-file-per-batch backlog written by older firmware.
+* @return true if a legacy file was found
+*/
+bool loadAndSendLegacyEvents(ConnectionEventManager &connectionEventManager,
+                             bool fromNewestToOldest) {
+  char filename[20];
+  if (!findFileByDate(SD, "/", filename, sizeof(filename), fromNewestToOldest)) {
+    return false;
+  }
+
   Event loadedEvents[MAX_EVENTS_PER_FILE];
-  String filename = "/" + findFileByDate(SD, "/", fromNewestToOldest);
-  bool loadedData = loadEvents(SD, loadedEvents, MAX_EVENTS_PER_FILE, filename.c_str());
+  bool loadedData = loadEvents(SD, loadedEvents, MAX_EVENTS_PER_FILE, filename);
 
   if (loadedData) {
     bool allSent = connectionEventManager.updateFromLoadedEvents(loadedEvents, MAX_EVENTS_PER_FILE);
     //if all events were sent, delete the file, otherwise store the remaining events
     if (allSent) {
-      deleteFile(SD, filename.c_str());
+      deleteFile(SD, filename);
     }else{
-      storeEvents(SD, loadedEvents, MAX_EVENTS_PER_FILE, filename.c_str());
+      storeEvents(SD, loadedEvents, MAX_EVENTS_PER_FILE, filename);
     }
   }
+  return true;
 }
\ No newline at end of file